@@ -0,0 +1,813 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Asynchronous web server
+ *
+ * HTTP/1.1 server for files in the static/ and dynamic/ folders of the
+ * document root. Connections are multiplexed with epoll(7) and use
+ * non-blocking sockets. Persistent (keep-alive) connections and pipelined
+ * requests are supported.
+ *
+ * Static files are sent with sendfile(2). By default, dynamic files are
+ * moved from the file to a per-connection pipe and then from the pipe to
+ * the socket with splice(2). In both cases file data is never copied to
+ * user space, but reading cold files blocks the event loop.
+ *
+ * Alternatively (-d option), dynamic files are read in a per-connection
+ * buffer asynchronously, with io_uring or Linux AIO (see aws_io.c), and
+ * then sent from it. The event loop keeps serving other connections while
+ * reads are in flight.
+ *
+ * Several event loops (threads) may be started, each with its own epoll
+ * instance; they share the listening socket.
+ *
+ * Open files, with their response headers, are kept in a cache shared by
+ * the event loops (see aws_cache.c). Loop 0 also handles the cache
+ * invalidation events and signals: SIGUSR1 logs cache statistics, SIGINT
+ * and SIGTERM log them and stop the server.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/signalfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "utils/utils.h"
+#include "utils/log/log.h"
+#include "utils/sock/sock_util.h"
+#include "utils/sock/w_epoll.h"
+
+#include "aws.h"
+
+enum io_result {
+	IO_DONE,
+	IO_AGAIN,
+	IO_PENDING,	/* waiting for an asynchronous read */
+	IO_ERROR
+};
+
+/* event loop: a thread with its own epoll instance */
+struct aws_loop {
+	pthread_t tid;
+	int id;
+	int epollfd;
+	struct aws_io io;
+};
+
+/* server socket file descriptor */
+static int listenfd;
+
+/* signals handled by loop 0 */
+static int sigfd;
+
+static struct aws_cache cache;
+
+/* epoll data for the other file descriptors, connections use their handler */
+#define LISTENER	((void *) &listenfd)
+#define SIGNALS		((void *) &sigfd)
+#define CACHE		((void *) &cache)
+
+static const char *document_root = AWS_DOCUMENT_ROOT;
+
+static unsigned int cache_entries = AWS_CACHE_ENTRIES;
+
+static enum aws_io_backend dynamic_backend = AWS_IO_SPLICE;
+
+static struct aws_loop loops[AWS_MAX_LOOPS];
+
+/*
+ * Initialize connection structure on given socket.
+ */
+
+static struct connection *connection_create(struct aws_loop *loop, int sockfd)
+{
+	struct connection *conn = malloc(sizeof(*conn));
+
+	DIE(conn == NULL, "malloc");
+
+	conn->sockfd = sockfd;
+	conn->loop = loop;
+	conn->events = 0;
+	conn->recv_len = 0;
+	conn->send_data = conn->send_buffer;
+	conn->send_len = 0;
+	conn->send_pos = 0;
+	conn->res_type = RESOURCE_TYPE_NONE;
+	conn->file = NULL;
+	conn->pipefd[0] = -1;
+	conn->pipefd[1] = -1;
+	conn->pipe_len = 0;
+	conn->io_buf = NULL;
+	conn->io_len = 0;
+	conn->io_pos = 0;
+	conn->io_pending = false;
+	conn->keep_alive = false;
+	conn->state = STATE_RECEIVING_DATA;
+
+	return conn;
+}
+
+/*
+ * Release the file sent on the connection, if any.
+ */
+
+static void connection_put_file(struct connection *conn)
+{
+	if (conn->file) {
+		aws_cache_put(&cache, conn->file);
+		conn->file = NULL;
+	}
+}
+
+static void connection_free(struct connection *conn)
+{
+	connection_put_file(conn);
+	free(conn->io_buf);
+	free(conn);
+}
+
+/*
+ * Remove connection handler. If a read is in flight, the handler (and its
+ * buffer and file) is freed when the read completes.
+ */
+
+static void connection_remove(struct connection *conn)
+{
+	int rc;
+
+	rc = w_epoll_remove_ptr(conn->loop->epollfd, conn->sockfd, conn);
+	DIE(rc < 0, "w_epoll_remove_ptr");
+
+	if (conn->pipefd[0] >= 0) {
+		close(conn->pipefd[0]);
+		close(conn->pipefd[1]);
+	}
+	close(conn->sockfd);
+
+	conn->state = STATE_CONNECTION_CLOSED;
+	if (conn->io_pending)
+		return;
+
+	connection_free(conn);
+}
+
+/*
+ * Only watch the given epoll events on the connection socket. Avoid the
+ * system call if they are already watched.
+ */
+
+static void connection_watch(struct connection *conn, unsigned int events)
+{
+	int rc;
+
+	if (conn->events == events)
+		return;
+
+	if (events == EPOLLIN)
+		rc = w_epoll_update_ptr_in(conn->loop->epollfd, conn->sockfd, conn);
+	else if (events == EPOLLOUT)
+		rc = w_epoll_update_ptr_out(conn->loop->epollfd, conn->sockfd, conn);
+	else
+		rc = w_epoll_update_ptr_none(conn->loop->epollfd, conn->sockfd, conn);
+	DIE(rc < 0, "w_epoll_update_ptr");
+
+	conn->events = events;
+}
+
+/*
+ * Accept all pending connection requests on the server socket.
+ */
+
+static void handle_new_connection(struct aws_loop *loop)
+{
+	struct sockaddr_in addr;
+	socklen_t addrlen;
+	struct connection *conn;
+	int sockfd;
+	int one = 1;
+	int rc;
+
+	while (1) {
+		addrlen = sizeof(addr);
+		sockfd = accept4(listenfd, (SSA *) &addr, &addrlen, SOCK_NONBLOCK);
+		if (sockfd < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			/* e.g. the client gave up before we accepted it */
+			ERR(errno != ECONNABORTED && errno != EINTR, "accept4");
+			if (errno == EMFILE || errno == ENFILE)
+				return;
+			continue;
+		}
+
+		log_debug("Loop %d accepted connection from %s:%d", loop->id,
+			inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+
+		rc = setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		ERR(rc < 0, "setsockopt");
+
+		conn = connection_create(loop, sockfd);
+
+		rc = w_epoll_add_ptr_in(loop->epollfd, sockfd, conn);
+		DIE(rc < 0, "w_epoll_add_ptr_in");
+		conn->events = EPOLLIN;
+	}
+}
+
+/*
+ * Fill the send buffer with the response header.
+ */
+
+static void connection_prepare_header(struct connection *conn, int code,
+		const char *reason, size_t content_length)
+{
+	conn->send_data = conn->send_buffer;
+	conn->send_len = http_format_header(conn->send_buffer,
+		sizeof(conn->send_buffer), code, reason, content_length,
+		conn->keep_alive);
+	conn->send_pos = 0;
+}
+
+/*
+ * Map request path to a resource type. Only files in the static/ and
+ * dynamic/ folders are served.
+ */
+
+static enum resource_type get_resource_type(const char *path)
+{
+	if (path[0] != '/' || strstr(path, "..") != NULL)
+		return RESOURCE_TYPE_NONE;
+
+	if (strncmp(path + 1, AWS_REL_STATIC_FOLDER,
+			strlen(AWS_REL_STATIC_FOLDER)) == 0)
+		return RESOURCE_TYPE_STATIC;
+	if (strncmp(path + 1, AWS_REL_DYNAMIC_FOLDER,
+			strlen(AWS_REL_DYNAMIC_FOLDER)) == 0)
+		return RESOURCE_TYPE_DYNAMIC;
+
+	return RESOURCE_TYPE_NONE;
+}
+
+/*
+ * Get the requested file from the cache and point the response header to
+ * its pre-rendered one. Return 0 on success or -1 if it can't be served.
+ */
+
+static int connection_open_file(struct connection *conn, const char *path)
+{
+	bool direct;
+
+	/* Linux AIO is only asynchronous for direct I/O. */
+	direct = (conn->res_type == RESOURCE_TYPE_DYNAMIC &&
+		conn->loop->io.backend == AWS_IO_AIO);
+
+	conn->file = aws_cache_get(&cache, path, direct);
+	if (conn->file == NULL)
+		return -1;
+
+	conn->send_data = conn->file->header[conn->keep_alive];
+	conn->send_len = conn->file->header_len[conn->keep_alive];
+	conn->send_pos = 0;
+
+	conn->file_size = conn->file->size;
+	conn->file_pos = 0;
+	conn->file_sent = 0;
+	conn->io_len = 0;
+	conn->io_pos = 0;
+
+	return 0;
+}
+
+/*
+ * Parse the next request in the receive buffer and prepare its response.
+ * Return false if no complete request is available.
+ */
+
+static bool connection_start_request(struct connection *conn)
+{
+	struct http_request req;
+	ssize_t len;
+
+	len = http_parse_request(conn->recv_buffer, conn->recv_len, &req);
+	if (len == 0 && conn->recv_len < sizeof(conn->recv_buffer))
+		return false;
+
+	if (len <= 0) {
+		log_error("Bad request on socket %d", conn->sockfd);
+		conn->keep_alive = false;
+		conn->res_type = RESOURCE_TYPE_NONE;
+		connection_prepare_header(conn, 400, "Bad Request", 0);
+		conn->recv_len = 0;
+		conn->state = STATE_SENDING_HEADER;
+		return true;
+	}
+
+	/* Keep pipelined requests for later. */
+	conn->recv_len -= len;
+	memmove(conn->recv_buffer, conn->recv_buffer + len, conn->recv_len);
+
+	log_debug("%s %s HTTP/1.%d", req.method, req.path, req.minor_version);
+
+	conn->keep_alive = req.keep_alive;
+	conn->res_type = get_resource_type(req.path);
+
+	if (strcmp(req.method, "GET") != 0 ||
+			conn->res_type == RESOURCE_TYPE_NONE ||
+			connection_open_file(conn, req.path) < 0) {
+		conn->res_type = RESOURCE_TYPE_NONE;
+		connection_prepare_header(conn, 404, "Not Found", 0);
+	}
+
+	conn->state = STATE_SENDING_HEADER;
+
+	return true;
+}
+
+/*
+ * Send (what is left of) the response header. Cork it with the body,
+ * if any.
+ */
+
+static enum io_result send_header(struct connection *conn)
+{
+	int flags = MSG_NOSIGNAL;
+	ssize_t n;
+
+	if (conn->res_type != RESOURCE_TYPE_NONE && conn->file_size > 0)
+		flags |= MSG_MORE;
+
+	while (conn->send_pos < conn->send_len) {
+		n = send(conn->sockfd, conn->send_data + conn->send_pos,
+			conn->send_len - conn->send_pos, flags);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return IO_AGAIN;
+			return IO_ERROR;
+		}
+		conn->send_pos += n;
+	}
+
+	return IO_DONE;
+}
+
+/*
+ * Send static file with sendfile(2).
+ */
+
+static enum io_result send_file_static(struct connection *conn)
+{
+	ssize_t n;
+
+	while (conn->file_sent < conn->file_size) {
+		n = sendfile(conn->sockfd, conn->file->fd, &conn->file_pos,
+			conn->file_size - conn->file_sent);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return IO_AGAIN;
+			return IO_ERROR;
+		}
+		if (n == 0)		/* file was truncated */
+			return IO_ERROR;
+		conn->file_sent += n;
+	}
+
+	return IO_DONE;
+}
+
+/*
+ * Send dynamic file with splice(2): file -> pipe -> socket.
+ */
+
+static enum io_result send_file_dynamic(struct connection *conn)
+{
+	size_t len;
+	ssize_t n;
+	int rc;
+
+	if (conn->pipefd[0] < 0) {
+		rc = pipe2(conn->pipefd, O_NONBLOCK);
+		if (rc < 0) {
+			log_error("pipe2: %s", strerror(errno));
+			return IO_ERROR;
+		}
+	}
+
+	while (conn->file_sent < conn->file_size) {
+		if (conn->pipe_len == 0) {
+			len = conn->file_size - conn->file_pos;
+			if (len > AWS_PIPE_CHUNK)
+				len = AWS_PIPE_CHUNK;
+			n = splice(conn->file->fd, &conn->file_pos, conn->pipefd[1], NULL,
+				len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n <= 0)
+				return IO_ERROR;
+			conn->pipe_len = n;
+		}
+
+		n = splice(conn->pipefd[0], NULL, conn->sockfd, NULL,
+			conn->pipe_len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK |
+			(conn->file_pos < (off_t) conn->file_size ? SPLICE_F_MORE : 0));
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return IO_AGAIN;
+			return IO_ERROR;
+		}
+		conn->pipe_len -= n;
+		conn->file_sent += n;
+	}
+
+	return IO_DONE;
+}
+
+/*
+ * Account for a chunk of n bytes read into the connection buffer. Reads are
+ * full size, for O_DIRECT: only send up to file_size, which went out in the
+ * Content-Length header, even if the file grew since.
+ */
+
+static void file_chunk_read(struct connection *conn, size_t n)
+{
+	conn->io_pos = 0;
+	conn->io_len = n;
+	if (conn->io_len > conn->file_size - conn->file_sent)
+		conn->io_len = conn->file_size - conn->file_sent;
+	conn->file_pos += n;
+}
+
+/*
+ * Send dynamic file through the connection buffer: read a chunk (blocking
+ * or asynchronously), send it, repeat.
+ */
+
+static enum io_result send_file_buffered(struct connection *conn)
+{
+	struct aws_io *io = &conn->loop->io;
+	ssize_t n;
+	int rc;
+
+	if (conn->io_pending)
+		return IO_PENDING;
+
+	if (conn->io_buf == NULL) {
+		rc = posix_memalign((void **) &conn->io_buf, AWS_IO_ALIGN,
+			AWS_IO_CHUNK);
+		if (rc != 0) {
+			conn->io_buf = NULL;
+			return IO_ERROR;
+		}
+	}
+
+	while (conn->file_sent < conn->file_size) {
+		if (conn->io_pos < conn->io_len) {
+			n = send(conn->sockfd, conn->io_buf + conn->io_pos,
+				conn->io_len - conn->io_pos, MSG_NOSIGNAL |
+				(conn->file_pos < (off_t) conn->file_size ? MSG_MORE : 0));
+			if (n < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					return IO_AGAIN;
+				return IO_ERROR;
+			}
+			conn->io_pos += n;
+			conn->file_sent += n;
+			continue;
+		}
+
+		/* Buffer drained, read the next (aligned, full size) chunk. */
+		conn->io_pos = 0;
+		conn->io_len = 0;
+		if (io->backend != AWS_IO_READ &&
+				aws_io_read(io, &conn->io_req, conn->file->fd, conn->io_buf,
+					AWS_IO_CHUNK, conn->file_pos, conn) == 0) {
+			conn->io_pending = true;
+			return IO_PENDING;
+		}
+
+		n = pread(conn->file->fd, conn->io_buf, AWS_IO_CHUNK, conn->file_pos);
+		if (n <= 0)
+			return IO_ERROR;
+		file_chunk_read(conn, n);
+	}
+
+	return IO_DONE;
+}
+
+/*
+ * Drive the connection state machine as far as possible without blocking:
+ * parse requests, send responses. Watch for input when waiting for a new
+ * request and for output when the socket buffer is full.
+ */
+
+static void connection_run(struct connection *conn)
+{
+	enum io_result res = IO_DONE;
+
+	while (1) {
+		switch (conn->state) {
+		case STATE_RECEIVING_DATA:
+			if (!connection_start_request(conn)) {
+				connection_watch(conn, EPOLLIN);
+				return;
+			}
+			continue;
+
+		case STATE_SENDING_HEADER:
+			res = send_header(conn);
+			if (res != IO_DONE)
+				break;
+			if (conn->res_type == RESOURCE_TYPE_STATIC)
+				conn->state = STATE_SENDING_STATIC;
+			else if (conn->res_type == RESOURCE_TYPE_DYNAMIC)
+				conn->state = STATE_SENDING_DYNAMIC;
+			else
+				conn->state = STATE_RESPONSE_SENT;
+			continue;
+
+		case STATE_SENDING_STATIC:
+			res = send_file_static(conn);
+			if (res == IO_DONE)
+				conn->state = STATE_RESPONSE_SENT;
+			break;
+
+		case STATE_SENDING_DYNAMIC:
+			if (conn->loop->io.backend == AWS_IO_SPLICE)
+				res = send_file_dynamic(conn);
+			else
+				res = send_file_buffered(conn);
+			if (res == IO_DONE)
+				conn->state = STATE_RESPONSE_SENT;
+			break;
+
+		case STATE_RESPONSE_SENT:
+			connection_put_file(conn);
+			if (!conn->keep_alive) {
+				connection_remove(conn);
+				return;
+			}
+			conn->state = STATE_RECEIVING_DATA;
+			continue;
+
+		default:
+			return;
+		}
+
+		if (res == IO_AGAIN) {
+			connection_watch(conn, EPOLLOUT);
+			return;
+		}
+		if (res == IO_PENDING) {
+			connection_watch(conn, 0);
+			return;
+		}
+		if (res == IO_ERROR) {
+			log_debug("Error sending response on socket %d", conn->sockfd);
+			connection_remove(conn);
+			return;
+		}
+	}
+}
+
+/*
+ * Receive data on socket and process the requests it completes.
+ */
+
+static void handle_input(struct connection *conn)
+{
+	ssize_t n;
+
+	n = recv(conn->sockfd, conn->recv_buffer + conn->recv_len,
+		sizeof(conn->recv_buffer) - conn->recv_len, 0);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
+	if (n <= 0) {			/* error or connection closed */
+		log_debug("Connection closed on socket %d", conn->sockfd);
+		connection_remove(conn);
+		return;
+	}
+
+	conn->recv_len += n;
+	connection_run(conn);
+}
+
+/*
+ * An asynchronous read of a dynamic file finished: send the chunk.
+ */
+
+static void handle_read_completion(void *data, ssize_t res)
+{
+	struct connection *conn = data;
+
+	conn->io_pending = false;
+
+	if (conn->state == STATE_CONNECTION_CLOSED) {
+		connection_free(conn);
+		return;
+	}
+
+	if (res <= 0) {
+		log_error("Asynchronous read on socket %d: %s", conn->sockfd,
+			res < 0 ? strerror(-res) : "unexpected end of file");
+		connection_remove(conn);
+		return;
+	}
+
+	file_chunk_read(conn, res);
+
+	connection_run(conn);
+}
+
+/*
+ * Handle a signal delivered on the signal file descriptor.
+ */
+
+static void handle_signal(void)
+{
+	struct signalfd_siginfo si;
+	ssize_t n;
+
+	n = read(sigfd, &si, sizeof(si));
+	if (n != sizeof(si))
+		return;
+
+	aws_cache_log_stats(&cache);
+
+	if (si.ssi_signo != SIGUSR1)
+		exit(EXIT_SUCCESS);
+}
+
+static void *loop_run(void *arg)
+{
+	struct aws_loop *loop = arg;
+	struct epoll_event rev[AWS_MAX_EVENTS];
+	int rc;
+
+	/* server main loop */
+	while (1) {
+		/* wait for events */
+		rc = w_epoll_wait(loop->epollfd, rev, AWS_MAX_EVENTS,
+			EPOLL_TIMEOUT_INFINITE);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		DIE(rc < 0, "w_epoll_wait");
+
+		for (int i = 0; i < rc; i++) {
+			struct connection *conn = rev[i].data.ptr;
+
+			if (conn == LISTENER) {
+				handle_new_connection(loop);
+				continue;
+			}
+			if ((void *) conn == CACHE) {
+				aws_cache_handle_events(&cache);
+				continue;
+			}
+			if ((void *) conn == SIGNALS) {
+				handle_signal();
+				continue;
+			}
+			if ((void *) conn == &loop->io) {
+				aws_io_reap(&loop->io, handle_read_completion);
+				continue;
+			}
+
+			/*
+			 * Errors and hang-ups are reported even with no events
+			 * watched, as while a read is in flight: stop now,
+			 * the connection is freed when the read completes.
+			 */
+			if (conn->io_pending &&
+					(rev[i].events & (EPOLLERR | EPOLLHUP))) {
+				log_debug("Connection closed on socket %d",
+					conn->sockfd);
+				connection_remove(conn);
+				continue;
+			}
+
+			if (rev[i].events & EPOLLIN)
+				handle_input(conn);
+			else if (rev[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+				connection_run(conn);
+		}
+	}
+
+	return NULL;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-p port] [-r document_root] [-t loops]\n"
+		"\t[-c cache_entries] [-d splice|read|aio|uring] [-v]\n", argv0);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned short port = AWS_LISTEN_PORT;
+	int num_loops = 1;
+	sigset_t mask;
+	int opt;
+	int rc;
+
+	log_set_level(LOG_INFO);
+
+	while ((opt = getopt(argc, argv, "p:r:t:c:d:v")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'r':
+			document_root = optarg;
+			break;
+		case 't':
+			num_loops = atoi(optarg);
+			if (num_loops < 1 || num_loops > AWS_MAX_LOOPS)
+				usage(argv[0]);
+			break;
+		case 'c':
+			cache_entries = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			if (aws_io_backend_parse(optarg, &dynamic_backend) < 0)
+				usage(argv[0]);
+			break;
+		case 'v':
+			log_set_level(LOG_TRACE);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	/* Peers closing connections early must not kill the server. */
+	signal(SIGPIPE, SIG_IGN);
+
+	/* Block signals in all loops, loop 0 reads them from sigfd. */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR1);
+	rc = pthread_sigmask(SIG_BLOCK, &mask, NULL);
+	DIE(rc != 0, "pthread_sigmask");
+	sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	DIE(sigfd < 0, "signalfd");
+
+	aws_cache_init(&cache, document_root, cache_entries);
+
+	/* create server socket */
+	listenfd = tcp_create_listener(port, AWS_LISTEN_BACKLOG);
+	DIE(listenfd < 0, "tcp_create_listener");
+
+	rc = fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+	DIE(rc < 0, "fcntl");
+
+	for (int i = 0; i < num_loops; i++) {
+		loops[i].id = i;
+
+		/* init multiplexing */
+		loops[i].epollfd = w_epoll_create();
+		DIE(loops[i].epollfd < 0, "w_epoll_create");
+
+		rc = w_epoll_add_ptr_in_exclusive(loops[i].epollfd, listenfd,
+			LISTENER);
+		DIE(rc < 0, "w_epoll_add_ptr_in_exclusive");
+
+		/* asynchronous reads, completions are signaled on an eventfd */
+		aws_io_init(&loops[i].io, dynamic_backend);
+		if (loops[i].io.efd >= 0) {
+			rc = w_epoll_add_ptr_in(loops[i].epollfd, loops[i].io.efd,
+				&loops[i].io);
+			DIE(rc < 0, "w_epoll_add_ptr_in");
+		}
+	}
+
+	rc = w_epoll_add_ptr_in(loops[0].epollfd, sigfd, SIGNALS);
+	DIE(rc < 0, "w_epoll_add_ptr_in");
+	if (cache.inotify_fd >= 0) {
+		rc = w_epoll_add_ptr_in(loops[0].epollfd, cache.inotify_fd, CACHE);
+		DIE(rc < 0, "w_epoll_add_ptr_in");
+	}
+
+	log_info("Server waiting for connections on port %d (%d event loops, "
+		"dynamic files: %s, cache: %u entries)", port, num_loops,
+		aws_io_backend_name(loops[0].io.backend), cache.max_entries);
+
+	for (int i = 1; i < num_loops; i++) {
+		rc = pthread_create(&loops[i].tid, NULL, loop_run, &loops[i]);
+		DIE(rc != 0, "pthread_create");
+	}
+	loop_run(&loops[0]);
+
+	return 0;
+}
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef AWS_H_
+#define AWS_H_		1
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "http.h"
+#include "aws_io.h"
+#include "aws_cache.h"
+
+#define AWS_LISTEN_PORT		8888
+#define AWS_DOCUMENT_ROOT	"./"
+#define AWS_REL_STATIC_FOLDER	"static/"
+#define AWS_REL_DYNAMIC_FOLDER	"dynamic/"
+#define AWS_LISTEN_BACKLOG	1024
+#define AWS_MAX_EVENTS		64
+#define AWS_MAX_LOOPS		64
+#define AWS_CACHE_ENTRIES	1024	/* default size of the open file cache */
+
+/* largest chunk moved from the file to the pipe for dynamic files */
+#define AWS_PIPE_CHUNK		(64 * 1024)
+
+/* buffer for dynamic files read with read / AIO / io_uring */
+#define AWS_IO_CHUNK		(128 * 1024)
+#define AWS_IO_ALIGN		4096	/* O_DIRECT buffer alignment */
+
+enum resource_type {
+	RESOURCE_TYPE_NONE,
+	RESOURCE_TYPE_STATIC,
+	RESOURCE_TYPE_DYNAMIC
+};
+
+enum connection_state {
+	STATE_RECEIVING_DATA,
+	STATE_SENDING_HEADER,
+	STATE_SENDING_STATIC,
+	STATE_SENDING_DYNAMIC,
+	STATE_RESPONSE_SENT,
+	STATE_CONNECTION_CLOSED
+};
+
+struct aws_loop;
+
+/* structure acting as a connection handler */
+struct connection {
+	int sockfd;
+	struct aws_loop *loop;
+	unsigned int events;		/* epoll events currently watched */
+
+	/* received data; may hold several (pipelined) requests */
+	char recv_buffer[BUFSIZ];
+	size_t recv_len;
+
+	/* response header: send_buffer or pre-rendered by the cache */
+	char send_buffer[BUFSIZ];
+	const char *send_data;
+	size_t send_len;
+	size_t send_pos;
+
+	/* response body */
+	enum resource_type res_type;
+	struct aws_file *file;		/* reference from the file cache */
+	off_t file_pos;			/* next offset read from the file */
+	size_t file_size;
+	size_t file_sent;
+
+	/* pipe used to splice() dynamic files to the socket */
+	int pipefd[2];
+	size_t pipe_len;
+
+	/* buffer used to read dynamic files with the other backends */
+	char *io_buf;
+	size_t io_len;
+	size_t io_pos;
+	bool io_pending;		/* asynchronous read in flight */
+	struct aws_io_req io_req;
+
+	bool keep_alive;
+	enum connection_state state;
+};
+
+#endif /* AWS_H_ */
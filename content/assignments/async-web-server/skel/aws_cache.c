@@ -0,0 +1,431 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Open file cache for the web server
+ *
+ * Served files are kept open in an LRU cache shared by the event loops,
+ * together with their size and pre-rendered response headers. Requests for
+ * hot files skip open(2), fstat(2) and header formatting.
+ *
+ * The directories of cached files are watched with inotify(7): files that
+ * are modified, replaced or removed are dropped from the cache. Connections
+ * that are sending a dropped file hold a reference to it and finish the
+ * response from the old file descriptor.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "utils/utils.h"
+#include "utils/log/log.h"
+
+#include "aws_cache.h"
+
+/* anything that may change the contents or the identity of a file */
+#define AWS_CACHE_DIR_EVENTS	(IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | \
+		IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+		IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+static struct aws_file **bucket(struct aws_cache *cache, const char *path,
+		bool direct)
+{
+	uint64_t h = 14695981039346656037ULL;	/* FNV-1a */
+
+	for (; *path != '\0'; path++) {
+		h ^= (unsigned char) *path;
+		h *= 1099511628211ULL;
+	}
+	h ^= direct;
+
+	return &cache->buckets[h & (cache->num_buckets - 1)];
+}
+
+static struct aws_file *lookup(struct aws_cache *cache, const char *path,
+		bool direct)
+{
+	struct aws_file *file;
+
+	for (file = *bucket(cache, path, direct); file; file = file->hash_next)
+		if (file->direct == direct && strcmp(file->path, path) == 0)
+			return file;
+
+	return NULL;
+}
+
+static void lru_unlink(struct aws_cache *cache, struct aws_file *file)
+{
+	if (file->lru_prev)
+		file->lru_prev->lru_next = file->lru_next;
+	else
+		cache->lru_head = file->lru_next;
+	if (file->lru_next)
+		file->lru_next->lru_prev = file->lru_prev;
+	else
+		cache->lru_tail = file->lru_prev;
+}
+
+static void lru_push_front(struct aws_cache *cache, struct aws_file *file)
+{
+	file->lru_prev = NULL;
+	file->lru_next = cache->lru_head;
+	if (cache->lru_head)
+		cache->lru_head->lru_prev = file;
+	else
+		cache->lru_tail = file;
+	cache->lru_head = file;
+}
+
+static void file_free(struct aws_file *file)
+{
+	close(file->fd);
+	free(file);
+}
+
+/*
+ * Drop file from the cache, with the cache lock held.
+ */
+
+static void cache_remove(struct aws_cache *cache, struct aws_file *file)
+{
+	struct aws_file **p = bucket(cache, file->path, file->direct);
+
+	while (*p != file)
+		p = &(*p)->hash_next;
+	*p = file->hash_next;
+	lru_unlink(cache, file);
+
+	file->cached = false;
+	cache->num_entries--;
+	if (--file->refs == 0)
+		file_free(file);
+}
+
+static void invalidate_path(struct aws_cache *cache, const char *prefix,
+		const char *name)
+{
+	char path[HTTP_MAX_PATH];
+	struct aws_file *file;
+	int rc;
+
+	rc = snprintf(path, sizeof(path), "%s%s", prefix, name);
+	if (rc < 0 || (size_t) rc >= sizeof(path))
+		return;
+
+	for (int direct = 0; direct <= 1; direct++) {
+		file = lookup(cache, path, direct);
+		if (file == NULL)
+			continue;
+		log_debug("Cache: %s changed", path);
+		cache_remove(cache, file);
+		cache->invalidations++;
+	}
+}
+
+static void invalidate_all(struct aws_cache *cache)
+{
+	while (cache->lru_head) {
+		cache_remove(cache, cache->lru_head);
+		cache->invalidations++;
+	}
+}
+
+/*
+ * Watch the directory holding path, with the cache lock held. Return -1 if
+ * it can't be watched: files in it must not be cached.
+ */
+
+static int watch_dir(struct aws_cache *cache, const char *path)
+{
+	char dirname[PATH_MAX];
+	size_t len = strrchr(path, '/') - path + 1;
+	int free_slot = -1;
+	int wd;
+	int rc;
+
+	for (int i = 0; i < AWS_CACHE_MAX_DIRS; i++) {
+		if (cache->dirs[i].wd < 0) {
+			if (free_slot < 0)
+				free_slot = i;
+			continue;
+		}
+		if (strncmp(cache->dirs[i].prefix, path, len) == 0 &&
+				cache->dirs[i].prefix[len] == '\0')
+			return 0;
+	}
+	if (free_slot < 0)
+		return -1;
+
+	rc = snprintf(dirname, sizeof(dirname), "%s%.*s",
+		cache->document_root, (int) len, path);
+	if (rc < 0 || (size_t) rc >= sizeof(dirname))
+		return -1;
+
+	wd = inotify_add_watch(cache->inotify_fd, dirname, AWS_CACHE_DIR_EVENTS);
+	if (wd < 0) {
+		log_debug("Cache: can't watch %s: %s", dirname, strerror(errno));
+		return -1;
+	}
+
+	cache->dirs[free_slot].wd = wd;
+	memcpy(cache->dirs[free_slot].prefix, path, len);
+	cache->dirs[free_slot].prefix[len] = '\0';
+
+	return 0;
+}
+
+/*
+ * Open the file for the request path and render its response headers.
+ * Return NULL if it can't be served.
+ */
+
+static struct aws_file *file_open(struct aws_cache *cache, const char *path,
+		bool direct)
+{
+	char filename[PATH_MAX];
+	struct aws_file *file;
+	struct stat st;
+	int rc;
+
+	rc = snprintf(filename, sizeof(filename), "%s%s",
+		cache->document_root, path);
+	if (rc < 0 || (size_t) rc >= sizeof(filename))
+		return NULL;
+
+	file = malloc(sizeof(*file));
+	DIE(file == NULL, "malloc");
+
+	/*
+	 * Linux AIO is only asynchronous for direct I/O; fall back to
+	 * buffered reads on file systems that don't support it.
+	 */
+	file->fd = -1;
+	if (direct)
+		file->fd = open(filename, O_RDONLY | O_DIRECT);
+	if (file->fd < 0)
+		file->fd = open(filename, O_RDONLY);
+	if (file->fd < 0)
+		goto free_file;
+
+	rc = fstat(file->fd, &st);
+	if (rc < 0 || !S_ISREG(st.st_mode))
+		goto close_file;
+
+	snprintf(file->path, sizeof(file->path), "%s", path);
+	file->direct = direct;
+	file->size = st.st_size;
+	for (int keep_alive = 0; keep_alive <= 1; keep_alive++)
+		file->header_len[keep_alive] = http_format_header(
+			file->header[keep_alive], AWS_CACHE_HEADER_SIZE,
+			200, "OK", file->size, keep_alive);
+
+	file->refs = 1;
+	file->cached = false;
+	file->hash_next = NULL;
+	file->lru_prev = NULL;
+	file->lru_next = NULL;
+
+	return file;
+
+close_file:
+	close(file->fd);
+free_file:
+	free(file);
+	return NULL;
+}
+
+/*
+ * Set up the cache for files under document_root. With max_entries set to
+ * 0, files are opened for every request and closed after it.
+ */
+
+void aws_cache_init(struct aws_cache *cache, const char *document_root,
+		unsigned int max_entries)
+{
+	size_t len;
+
+	memset(cache, 0, sizeof(*cache));
+	pthread_mutex_init(&cache->lock, NULL);
+
+	/* Request paths start with '/': "/srv/www/" and "/srv/www" both work. */
+	cache->document_root = strdup(document_root);
+	DIE(cache->document_root == NULL, "strdup");
+	len = strlen(cache->document_root);
+	while (len > 0 && cache->document_root[len - 1] == '/')
+		cache->document_root[--len] = '\0';
+
+	cache->inotify_fd = -1;
+	for (int i = 0; i < AWS_CACHE_MAX_DIRS; i++)
+		cache->dirs[i].wd = -1;
+
+	if (max_entries == 0)
+		return;
+
+	cache->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (cache->inotify_fd < 0) {
+		/* Without invalidation, cached files would go stale. */
+		log_warn("inotify not available (%s), file cache disabled",
+			strerror(errno));
+		return;
+	}
+
+	cache->max_entries = max_entries;
+	cache->num_buckets = 1;
+	while (cache->num_buckets < max_entries)
+		cache->num_buckets <<= 1;
+	cache->buckets = calloc(cache->num_buckets, sizeof(*cache->buckets));
+	DIE(cache->buckets == NULL, "calloc");
+}
+
+/*
+ * Get a reference to the open file for the request path; release it with
+ * aws_cache_put(). direct asks for O_DIRECT. Return NULL if the file can't
+ * be served.
+ */
+
+struct aws_file *aws_cache_get(struct aws_cache *cache, const char *path,
+		bool direct)
+{
+	struct aws_file *file, *victim;
+	unsigned long generation;
+	int rc;
+
+	if (cache->max_entries == 0)
+		return file_open(cache, path, direct);
+
+	pthread_mutex_lock(&cache->lock);
+	file = lookup(cache, path, direct);
+	if (file) {
+		lru_unlink(cache, file);
+		lru_push_front(cache, file);
+		file->refs++;
+		cache->hits++;
+		pthread_mutex_unlock(&cache->lock);
+		return file;
+	}
+	cache->misses++;
+	rc = watch_dir(cache, path);
+	generation = cache->generation;
+	pthread_mutex_unlock(&cache->lock);
+
+	/* Don't hold the lock while opening: it may block on disk. */
+	file = file_open(cache, path, direct);
+	if (file == NULL || rc < 0)
+		return file;
+
+	pthread_mutex_lock(&cache->lock);
+	/*
+	 * Don't cache the file if there were changes in the meantime: they
+	 * may have been made to it after it was opened. Another loop may
+	 * also have cached it already.
+	 */
+	if (cache->generation != generation || lookup(cache, path, direct)) {
+		pthread_mutex_unlock(&cache->lock);
+		return file;
+	}
+
+	file->refs++;
+	file->cached = true;
+	file->hash_next = *bucket(cache, path, direct);
+	*bucket(cache, path, direct) = file;
+	lru_push_front(cache, file);
+	cache->num_entries++;
+
+	if (cache->num_entries > cache->max_entries) {
+		victim = cache->lru_tail;
+		cache_remove(cache, victim);
+		cache->evictions++;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return file;
+}
+
+/*
+ * Release a reference obtained with aws_cache_get().
+ */
+
+void aws_cache_put(struct aws_cache *cache, struct aws_file *file)
+{
+	bool last;
+
+	if (cache->max_entries == 0) {
+		file_free(file);
+		return;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	last = (--file->refs == 0);
+	pthread_mutex_unlock(&cache->lock);
+
+	if (last)
+		file_free(file);
+}
+
+/*
+ * Called when the inotify file descriptor is readable: drop changed files.
+ */
+
+void aws_cache_handle_events(struct aws_cache *cache)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	ssize_t len;
+
+	pthread_mutex_lock(&cache->lock);
+	while (1) {
+		len = read(cache->inotify_fd, buf, sizeof(buf));
+		if (len < 0) {
+			ERR(errno != EAGAIN, "read inotify");
+			break;
+		}
+
+		for (char *p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *) p;
+			cache->generation++;
+
+			if (ev->mask & IN_Q_OVERFLOW) {
+				log_warn("Cache: inotify queue overflow");
+				invalidate_all(cache);
+				continue;
+			}
+
+			for (int i = 0; i < AWS_CACHE_MAX_DIRS; i++) {
+				if (cache->dirs[i].wd != ev->wd)
+					continue;
+				if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+					/* Paths in the directory now mean other files. */
+					invalidate_all(cache);
+					inotify_rm_watch(cache->inotify_fd, ev->wd);
+					cache->dirs[i].wd = -1;
+				} else if (ev->len > 0) {
+					invalidate_path(cache, cache->dirs[i].prefix,
+						ev->name);
+				}
+			}
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void aws_cache_log_stats(struct aws_cache *cache)
+{
+	unsigned long lookups;
+
+	pthread_mutex_lock(&cache->lock);
+	lookups = cache->hits + cache->misses;
+	log_info("Cache: %u/%u entries, %lu hits, %lu misses (hit ratio %.1f%%), "
+		"%lu invalidations, %lu evictions", cache->num_entries,
+		cache->max_entries, cache->hits, cache->misses,
+		lookups ? 100.0 * cache->hits / lookups : 0.0,
+		cache->invalidations, cache->evictions);
+	pthread_mutex_unlock(&cache->lock);
+}
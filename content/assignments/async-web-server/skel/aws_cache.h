@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef AWS_CACHE_H_
+#define AWS_CACHE_H_	1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "http.h"
+
+#define AWS_CACHE_HEADER_SIZE	256
+#define AWS_CACHE_MAX_DIRS	64
+
+/* open file, with its size and pre-rendered 200 OK response headers */
+struct aws_file {
+	char path[HTTP_MAX_PATH];	/* request path */
+	bool direct;			/* opened with O_DIRECT */
+	int fd;
+	size_t size;
+
+	/* response header, indexed by keep_alive */
+	char header[2][AWS_CACHE_HEADER_SIZE];
+	size_t header_len[2];
+
+	/* references: connections sending the file, plus one if cached */
+	unsigned int refs;
+	bool cached;
+	struct aws_file *hash_next;
+	struct aws_file *lru_prev, *lru_next;
+};
+
+/* directory watched for changes to cached files */
+struct aws_cache_dir {
+	int wd;				/* -1 if the slot is free */
+	char prefix[HTTP_MAX_PATH];	/* request path of the directory */
+};
+
+/* LRU cache of open files, shared by the event loops */
+struct aws_cache {
+	pthread_mutex_t lock;
+	char *document_root;		/* without trailing '/' */
+	unsigned int max_entries;	/* 0: caching disabled */
+	unsigned int num_entries;
+
+	struct aws_file **buckets;
+	size_t num_buckets;		/* power of 2 */
+	struct aws_file *lru_head;	/* most recently used */
+	struct aws_file *lru_tail;
+
+	/* Files are invalidated when inotify reports changes. */
+	int inotify_fd;
+	struct aws_cache_dir dirs[AWS_CACHE_MAX_DIRS];
+	unsigned long generation;	/* incremented on invalidation */
+
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long invalidations;
+	unsigned long evictions;
+};
+
+void aws_cache_init(struct aws_cache *cache, const char *document_root,
+		unsigned int max_entries);
+struct aws_file *aws_cache_get(struct aws_cache *cache, const char *path,
+		bool direct);
+void aws_cache_put(struct aws_cache *cache, struct aws_file *file);
+void aws_cache_handle_events(struct aws_cache *cache);
+void aws_cache_log_stats(struct aws_cache *cache);
+
+#endif /* AWS_CACHE_H_ */
@@ -0,0 +1,320 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Asynchronous file reads for the web server event loops
+ *
+ * Reads are submitted either to an io_uring instance or to a Linux AIO
+ * context. Both signal completions on an eventfd, which the event loop
+ * watches with epoll alongside its sockets. System calls are issued
+ * directly, without liburing or libaio.
+ *
+ * aws_io_init() falls back from io_uring to Linux AIO and from Linux AIO to
+ * blocking reads if the kernel (or the container runtime) does not allow
+ * them.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+
+#include "utils/utils.h"
+#include "utils/log/log.h"
+
+#include "aws_io.h"
+
+/* maximum number of reads in flight per event loop */
+#define AWS_IO_QUEUE_DEPTH	256
+
+static const char *backend_names[] = {
+	[AWS_IO_SPLICE] = "splice",
+	[AWS_IO_READ] = "read",
+	[AWS_IO_AIO] = "aio",
+	[AWS_IO_URING] = "uring",
+};
+
+const char *aws_io_backend_name(enum aws_io_backend backend)
+{
+	return backend_names[backend];
+}
+
+int aws_io_backend_parse(const char *name, enum aws_io_backend *backend)
+{
+	for (size_t i = 0; i < sizeof(backend_names) / sizeof(backend_names[0]); i++) {
+		if (strcmp(name, backend_names[i]) == 0) {
+			*backend = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * io_uring
+ */
+
+static int uring_init(struct aws_io *io)
+{
+	struct io_uring_params p;
+	size_t sq_size, cq_size;
+	void *sq_ptr, *cq_ptr, *sqes;
+	int rc;
+
+	memset(&p, 0, sizeof(p));
+	io->ring_fd = syscall(__NR_io_uring_setup, AWS_IO_QUEUE_DEPTH, &p);
+	if (io->ring_fd < 0)
+		return -1;
+
+	sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq_size > sq_size)
+			sq_size = cq_size;
+		cq_size = sq_size;
+	}
+
+	sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, io->ring_fd, IORING_OFF_SQ_RING);
+	if (sq_ptr == MAP_FAILED)
+		goto close_ring;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq_ptr = sq_ptr;
+	} else {
+		cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, io->ring_fd, IORING_OFF_CQ_RING);
+		if (cq_ptr == MAP_FAILED)
+			goto close_ring;
+	}
+
+	sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		io->ring_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		goto close_ring;
+
+	io->sq_head = (unsigned int *) ((char *) sq_ptr + p.sq_off.head);
+	io->sq_tail = (unsigned int *) ((char *) sq_ptr + p.sq_off.tail);
+	io->sq_mask = (unsigned int *) ((char *) sq_ptr + p.sq_off.ring_mask);
+	io->sq_array = (unsigned int *) ((char *) sq_ptr + p.sq_off.array);
+	io->cq_head = (unsigned int *) ((char *) cq_ptr + p.cq_off.head);
+	io->cq_tail = (unsigned int *) ((char *) cq_ptr + p.cq_off.tail);
+	io->cq_mask = (unsigned int *) ((char *) cq_ptr + p.cq_off.ring_mask);
+	io->cqes = (struct io_uring_cqe *) ((char *) cq_ptr + p.cq_off.cqes);
+	io->sqes = sqes;
+
+	rc = syscall(__NR_io_uring_register, io->ring_fd,
+		IORING_REGISTER_EVENTFD, &io->efd, 1);
+	if (rc < 0)
+		goto close_ring;
+
+	return 0;
+
+close_ring:
+	/* Mappings go away with the process; this only happens at startup. */
+	close(io->ring_fd);
+	return -1;
+}
+
+static int uring_read(struct aws_io *io, struct aws_io_req *req, int fd,
+		off_t offset)
+{
+	unsigned int tail, index;
+	struct io_uring_sqe *sqe;
+	int rc;
+
+	tail = *io->sq_tail;
+	if (tail - atomic_load_explicit((_Atomic unsigned int *) io->sq_head,
+				memory_order_acquire) > *io->sq_mask)
+		return -1;
+
+	index = tail & *io->sq_mask;
+	sqe = &io->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long) &req->iov;
+	sqe->len = 1;
+	sqe->off = offset;
+	sqe->user_data = (unsigned long) req;
+	io->sq_array[index] = index;
+
+	atomic_store_explicit((_Atomic unsigned int *) io->sq_tail, tail + 1,
+		memory_order_release);
+
+	/*
+	 * The kernel consumes entries in order and this is the only one
+	 * queued: unless it was submitted, it is still ours to take back.
+	 */
+	rc = syscall(__NR_io_uring_enter, io->ring_fd, 1, 0, 0, NULL, 0);
+	if (rc != 1) {
+		/* Take the entry back, the caller falls back to pread(2). */
+		atomic_store_explicit((_Atomic unsigned int *) io->sq_tail, tail,
+			memory_order_release);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void uring_reap(struct aws_io *io, aws_io_complete_fn complete)
+{
+	unsigned int head, tail;
+	struct io_uring_cqe *cqe;
+	struct aws_io_req *req;
+
+	head = *io->cq_head;
+	tail = atomic_load_explicit((_Atomic unsigned int *) io->cq_tail,
+		memory_order_acquire);
+
+	while (head != tail) {
+		cqe = &io->cqes[head & *io->cq_mask];
+		req = (struct aws_io_req *) (unsigned long) cqe->user_data;
+		head++;
+		atomic_store_explicit((_Atomic unsigned int *) io->cq_head, head,
+			memory_order_release);
+
+		io->inflight--;
+		complete(req->data, cqe->res);
+	}
+}
+
+/*
+ * Linux AIO
+ */
+
+static int aio_init(struct aws_io *io)
+{
+	io->aio_ctx = 0;
+
+	return syscall(__NR_io_setup, AWS_IO_QUEUE_DEPTH, &io->aio_ctx);
+}
+
+static int aio_read(struct aws_io *io, struct aws_io_req *req, int fd,
+		off_t offset)
+{
+	struct iocb *iocbp = &req->iocb;
+
+	memset(&req->iocb, 0, sizeof(req->iocb));
+	req->iocb.aio_data = (unsigned long) req;
+	req->iocb.aio_lio_opcode = IOCB_CMD_PREAD;
+	req->iocb.aio_fildes = fd;
+	req->iocb.aio_buf = (unsigned long) req->iov.iov_base;
+	req->iocb.aio_nbytes = req->iov.iov_len;
+	req->iocb.aio_offset = offset;
+	req->iocb.aio_flags = IOCB_FLAG_RESFD;
+	req->iocb.aio_resfd = io->efd;
+
+	return syscall(__NR_io_submit, io->aio_ctx, 1, &iocbp) == 1 ? 0 : -1;
+}
+
+static void aio_reap(struct aws_io *io, aws_io_complete_fn complete)
+{
+	struct io_event events[64];
+	struct timespec zero = { 0, 0 };
+	struct aws_io_req *req;
+	int n;
+
+	do {
+		n = syscall(__NR_io_getevents, io->aio_ctx, 0, 64, events, &zero);
+		for (int i = 0; i < n; i++) {
+			req = (struct aws_io_req *) (unsigned long) events[i].data;
+			io->inflight--;
+			complete(req->data, events[i].res);
+		}
+	} while (n == 64);
+}
+
+/*
+ * Set up the requested backend, falling back to simpler ones if it is not
+ * available. Return the backend actually used.
+ */
+
+enum aws_io_backend aws_io_init(struct aws_io *io, enum aws_io_backend backend)
+{
+	memset(io, 0, sizeof(*io));
+	io->efd = -1;
+	io->ring_fd = -1;
+	io->backend = backend;
+
+	if (backend != AWS_IO_URING && backend != AWS_IO_AIO)
+		return backend;
+
+	io->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	DIE(io->efd < 0, "eventfd");
+
+	if (io->backend == AWS_IO_URING && uring_init(io) < 0) {
+		log_warn("io_uring not available (%s), using Linux AIO",
+			strerror(errno));
+		io->backend = AWS_IO_AIO;
+	}
+	if (io->backend == AWS_IO_AIO && aio_init(io) < 0) {
+		log_warn("Linux AIO not available (%s), using blocking reads",
+			strerror(errno));
+		io->backend = AWS_IO_READ;
+		close(io->efd);
+		io->efd = -1;
+	}
+
+	return io->backend;
+}
+
+/*
+ * Submit an asynchronous read of len bytes at offset in fd into buf. data
+ * is passed to the completion function. Return -1 if the read can't be
+ * submitted (e.g. the queue is full); the caller should then read
+ * synchronously.
+ */
+
+int aws_io_read(struct aws_io *io, struct aws_io_req *req, int fd,
+		void *buf, size_t len, off_t offset, void *data)
+{
+	int rc;
+
+	if (io->inflight == AWS_IO_QUEUE_DEPTH)
+		return -1;
+
+	req->iov.iov_base = buf;
+	req->iov.iov_len = len;
+	req->data = data;
+
+	if (io->backend == AWS_IO_URING)
+		rc = uring_read(io, req, fd, offset);
+	else if (io->backend == AWS_IO_AIO)
+		rc = aio_read(io, req, fd, offset);
+	else
+		rc = -1;
+
+	if (rc == 0)
+		io->inflight++;
+
+	return rc;
+}
+
+/*
+ * Called when the eventfd is readable: run the completion function for all
+ * finished reads.
+ */
+
+void aws_io_reap(struct aws_io *io, aws_io_complete_fn complete)
+{
+	uint64_t count;
+
+	/* Reset the eventfd counter before looking for completions. */
+	if (read(io->efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		ERR(1, "read eventfd");
+
+	if (io->backend == AWS_IO_URING)
+		uring_reap(io, complete);
+	else
+		aio_reap(io, complete);
+}
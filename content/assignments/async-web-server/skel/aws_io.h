@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef AWS_IO_H_
+#define AWS_IO_H_	1
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <linux/aio_abi.h>
+
+/* how dynamic files are read */
+enum aws_io_backend {
+	AWS_IO_SPLICE,		/* splice(2) file -> pipe -> socket */
+	AWS_IO_READ,		/* blocking pread(2) in the event loop */
+	AWS_IO_AIO,		/* Linux AIO: io_submit(2) + eventfd */
+	AWS_IO_URING		/* io_uring, completions signaled on an eventfd */
+};
+
+/* asynchronous read request; must stay valid until completion */
+struct aws_io_req {
+	struct iovec iov;
+	struct iocb iocb;
+	void *data;
+};
+
+/* per event loop asynchronous I/O context */
+struct aws_io {
+	enum aws_io_backend backend;
+	int efd;			/* eventfd signaled on completion */
+	unsigned int inflight;
+
+	/* Linux AIO */
+	aio_context_t aio_ctx;
+
+	/* io_uring */
+	int ring_fd;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+};
+
+typedef void (*aws_io_complete_fn)(void *data, ssize_t res);
+
+const char *aws_io_backend_name(enum aws_io_backend backend);
+int aws_io_backend_parse(const char *name, enum aws_io_backend *backend);
+enum aws_io_backend aws_io_init(struct aws_io *io, enum aws_io_backend backend);
+int aws_io_read(struct aws_io *io, struct aws_io_req *req, int fd,
+		void *buf, size_t len, off_t offset, void *data);
+void aws_io_reap(struct aws_io *io, aws_io_complete_fn complete);
+
+#endif /* AWS_IO_H_ */
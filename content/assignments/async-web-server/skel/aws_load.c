@@ -0,0 +1,396 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Load generator for the asynchronous web server
+ *
+ * Opens a number of persistent connections to the server, spread over
+ * several threads, each multiplexing its connections with epoll(7). The
+ * given paths are spread over the connections (connection i requests path
+ * i % number_of_paths), to run mixed workloads. Every connection sends
+ * batches of pipelined GET requests and reads the responses. At the end,
+ * print requests per second, body throughput (MB/s) and average latency,
+ * overall and per path.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "utils/utils.h"
+#include "utils/log/log.h"
+#include "utils/sock/sock_util.h"
+#include "utils/sock/w_epoll.h"
+
+#include "aws.h"
+
+#define LOAD_MAX_THREADS	64
+#define LOAD_MAX_PATHS		16
+#define LOAD_MAX_PIPELINE	64
+#define LOAD_RECV_SIZE		(256 * 1024)
+#define LOAD_HEADER_SIZE	4096
+
+/* client side of a connection */
+struct load_conn {
+	int sockfd;
+	unsigned int path;
+	double batch_start;
+
+	/* batch of pipelined requests */
+	char req[LOAD_MAX_PIPELINE * (HTTP_MAX_PATH + 64)];
+	size_t req_len;
+	size_t req_sent;
+	unsigned int outstanding;
+
+	/* response being received */
+	char hdr[LOAD_HEADER_SIZE];
+	size_t hdr_len;
+	bool in_body;
+	size_t body_left;
+};
+
+struct load_thread {
+	pthread_t tid;
+	int epollfd;
+	unsigned int num_conns;
+	struct load_conn *conns;
+	char *recv_buf;
+
+	/* statistics */
+	unsigned long requests[LOAD_MAX_PATHS];
+	unsigned long bytes[LOAD_MAX_PATHS];
+	double latency[LOAD_MAX_PATHS];
+	unsigned long errors;
+	unsigned long reconnects;
+};
+
+static const char *server_host = "127.0.0.1";
+static unsigned short server_port = AWS_LISTEN_PORT;
+static unsigned int pipeline = 1;
+static const char *paths[LOAD_MAX_PATHS];
+static unsigned int num_paths;
+static double deadline;
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void conn_open(struct load_thread *t, struct load_conn *c)
+{
+	int one = 1;
+	int rc;
+
+	c->sockfd = tcp_connect_to_server(server_host, server_port);
+
+	rc = setsockopt(c->sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	DIE(rc < 0, "setsockopt");
+	rc = fcntl(c->sockfd, F_SETFL, fcntl(c->sockfd, F_GETFL) | O_NONBLOCK);
+	DIE(rc < 0, "fcntl");
+
+	c->req_len = 0;
+	c->req_sent = 0;
+	c->outstanding = 0;
+	c->hdr_len = 0;
+	c->in_body = false;
+
+	rc = w_epoll_add_ptr_out(t->epollfd, c->sockfd, c);
+	DIE(rc < 0, "w_epoll_add_ptr_out");
+}
+
+static void conn_reopen(struct load_thread *t, struct load_conn *c)
+{
+	w_epoll_remove_ptr(t->epollfd, c->sockfd, c);
+	close(c->sockfd);
+	t->reconnects++;
+	conn_open(t, c);
+}
+
+/*
+ * Send (the rest of) the current batch of requests. Build a new batch if
+ * all previous responses were received.
+ */
+
+static void conn_send(struct load_thread *t, struct load_conn *c)
+{
+	ssize_t n;
+	int rc;
+
+	if (c->req_len == 0) {
+		for (unsigned int i = 0; i < pipeline; i++)
+			c->req_len += sprintf(c->req + c->req_len,
+				"GET %s HTTP/1.1\r\nHost: %s\r\n\r\n",
+				paths[c->path], server_host);
+		c->req_sent = 0;
+		c->outstanding = pipeline;
+		c->batch_start = now_sec();
+	}
+
+	while (c->req_sent < c->req_len) {
+		n = send(c->sockfd, c->req + c->req_sent,
+			c->req_len - c->req_sent, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			t->errors++;
+			conn_reopen(t, c);
+			return;
+		}
+		c->req_sent += n;
+	}
+
+	/* Whole batch sent, wait for the responses. */
+	rc = w_epoll_update_ptr_in(t->epollfd, c->sockfd, c);
+	DIE(rc < 0, "w_epoll_update_ptr_in");
+}
+
+/*
+ * Parse the response header in c->hdr. Return the header length or 0 if
+ * it is incomplete.
+ */
+
+static size_t parse_header(struct load_thread *t, struct load_conn *c)
+{
+	char *end, *p;
+	size_t len;
+
+	end = memmem(c->hdr, c->hdr_len, "\r\n\r\n", 4);
+	if (end == NULL)
+		return 0;
+	len = end + 4 - c->hdr;
+	*end = '\0';
+
+	if (strncmp(c->hdr, "HTTP/1.1 200", 12) != 0)
+		t->errors++;
+
+	c->body_left = 0;
+	for (p = c->hdr; p != NULL; p = strstr(p, "\r\n")) {
+		if (*p == '\r')
+			p += 2;
+		if (strncasecmp(p, "Content-Length:", 15) == 0)
+			c->body_left = strtoul(p + 15, NULL, 10);
+	}
+
+	return len;
+}
+
+/*
+ * Consume received bytes: response headers and bodies.
+ */
+
+static void conn_consume(struct load_thread *t, struct load_conn *c,
+		const char *buf, size_t len)
+{
+	size_t n, hlen, used;
+
+	while (len > 0) {
+		if (!c->in_body) {
+			n = sizeof(c->hdr) - 1 - c->hdr_len;
+			if (n > len)
+				n = len;
+			memcpy(c->hdr + c->hdr_len, buf, n);
+			c->hdr_len += n;
+
+			hlen = parse_header(t, c);
+			if (hlen == 0) {
+				DIE(c->hdr_len == sizeof(c->hdr) - 1, "response header");
+				return;
+			}
+
+			/* Bytes past the header belong to the body. */
+			used = n - (c->hdr_len - hlen);
+			buf += used;
+			len -= used;
+			c->hdr_len = 0;
+			c->in_body = true;
+		}
+
+		n = (c->body_left < len) ? c->body_left : len;
+		c->body_left -= n;
+		t->bytes[c->path] += n;
+		buf += n;
+		len -= n;
+
+		if (c->body_left == 0) {
+			c->in_body = false;
+			t->requests[c->path]++;
+			t->latency[c->path] += now_sec() - c->batch_start;
+			c->outstanding--;
+		}
+	}
+}
+
+static void conn_recv(struct load_thread *t, struct load_conn *c)
+{
+	ssize_t n;
+	int rc;
+
+	while (c->outstanding > 0) {
+		n = recv(c->sockfd, t->recv_buf, LOAD_RECV_SIZE, 0);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (n <= 0) {
+			/* server closed the connection */
+			if (n < 0)
+				t->errors++;
+			conn_reopen(t, c);
+			return;
+		}
+		conn_consume(t, c, t->recv_buf, n);
+	}
+
+	/* All responses received, send the next batch. */
+	c->req_len = 0;
+	rc = w_epoll_update_ptr_out(t->epollfd, c->sockfd, c);
+	DIE(rc < 0, "w_epoll_update_ptr_out");
+}
+
+static void *thread_run(void *arg)
+{
+	struct load_thread *t = arg;
+	struct epoll_event rev[64];
+	int rc;
+
+	while (now_sec() < deadline) {
+		rc = w_epoll_wait(t->epollfd, rev, 64, 100);
+		DIE(rc < 0 && errno != EINTR, "w_epoll_wait");
+
+		for (int i = 0; i < rc; i++) {
+			struct load_conn *c = rev[i].data.ptr;
+
+			if (c->outstanding > 0 && c->req_sent == c->req_len)
+				conn_recv(t, c);
+			else
+				conn_send(t, c);
+		}
+	}
+
+	return NULL;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-H host] [-p port] [-c connections] [-t threads]\n"
+		"\t[-d seconds] [-P pipeline] path [path ...]\n", argv0);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct load_thread threads[LOAD_MAX_THREADS];
+	unsigned int num_conns = 16, num_threads = 1, duration = 10;
+	unsigned long requests[LOAD_MAX_PATHS] = { 0 };
+	unsigned long bytes[LOAD_MAX_PATHS] = { 0 };
+	double latency[LOAD_MAX_PATHS] = { 0 };
+	unsigned long total_requests = 0, total_bytes = 0;
+	unsigned long errors = 0, reconnects = 0;
+	double start, elapsed, total_latency = 0;
+	int opt;
+	int rc;
+
+	while ((opt = getopt(argc, argv, "H:p:c:t:d:P:")) != -1) {
+		switch (opt) {
+		case 'H':
+			server_host = optarg;
+			break;
+		case 'p':
+			server_port = atoi(optarg);
+			break;
+		case 'c':
+			num_conns = atoi(optarg);
+			break;
+		case 't':
+			num_threads = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'P':
+			pipeline = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	for (; optind < argc && num_paths < LOAD_MAX_PATHS; optind++)
+		paths[num_paths++] = argv[optind];
+
+	if (num_paths == 0 || num_threads < 1 || num_threads > LOAD_MAX_THREADS ||
+			num_conns < num_threads || pipeline < 1 ||
+			pipeline > LOAD_MAX_PIPELINE || duration < 1)
+		usage(argv[0]);
+
+	signal(SIGPIPE, SIG_IGN);
+
+	for (unsigned int i = 0; i < num_threads; i++) {
+		struct load_thread *t = &threads[i];
+
+		memset(t, 0, sizeof(*t));
+		t->num_conns = num_conns / num_threads +
+			(i < num_conns % num_threads);
+		t->conns = calloc(t->num_conns, sizeof(*t->conns));
+		DIE(t->conns == NULL, "calloc");
+		t->recv_buf = malloc(LOAD_RECV_SIZE);
+		DIE(t->recv_buf == NULL, "malloc");
+		t->epollfd = w_epoll_create();
+		DIE(t->epollfd < 0, "w_epoll_create");
+
+		for (unsigned int j = 0; j < t->num_conns; j++) {
+			t->conns[j].path = (i + j * num_threads) % num_paths;
+			conn_open(t, &t->conns[j]);
+		}
+	}
+
+	start = now_sec();
+	deadline = start + duration;
+
+	for (unsigned int i = 0; i < num_threads; i++) {
+		rc = pthread_create(&threads[i].tid, NULL, thread_run, &threads[i]);
+		DIE(rc != 0, "pthread_create");
+	}
+	for (unsigned int i = 0; i < num_threads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		for (unsigned int p = 0; p < num_paths; p++) {
+			requests[p] += threads[i].requests[p];
+			bytes[p] += threads[i].bytes[p];
+			latency[p] += threads[i].latency[p];
+		}
+		errors += threads[i].errors;
+		reconnects += threads[i].reconnects;
+	}
+	elapsed = now_sec() - start;
+
+	printf("%u connections, %u threads, pipeline %u, %.1f s\n",
+		num_conns, num_threads, pipeline, elapsed);
+	printf("%-32s %12s %10s %12s\n", "path", "requests/s", "MB/s",
+		"latency_ms");
+	for (unsigned int p = 0; p < num_paths; p++) {
+		printf("%-32s %12.0f %10.1f %12.3f\n", paths[p],
+			requests[p] / elapsed, bytes[p] / elapsed / (1024 * 1024),
+			requests[p] ? latency[p] / requests[p] * 1000 : 0);
+		total_requests += requests[p];
+		total_bytes += bytes[p];
+		total_latency += latency[p];
+	}
+	printf("%-32s %12.0f %10.1f %12.3f\n", "total",
+		total_requests / elapsed, total_bytes / elapsed / (1024 * 1024),
+		total_requests ? total_latency / total_requests * 1000 : 0);
+	printf("errors: %lu, reconnects: %lu\n", errors, reconnects);
+
+	return 0;
+}
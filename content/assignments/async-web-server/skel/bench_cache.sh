@@ -0,0 +1,34 @@
+#!/bin/bash
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Compare the server with and without the open file cache on hot, small
+# files: with the cache, requests skip open(), fstat() and formatting the
+# response header. Run "make files" first.
+
+PORT=${PORT:-8889}
+DURATION=${DURATION:-10}
+CONNS=${CONNS:-32}
+PIPELINE=${PIPELINE:-4}
+
+if ! test -f static/small.dat -a -f dynamic/small.dat; then
+    echo "Missing small files, run \"make files\" first." 1>&2
+    exit 1
+fi
+
+for entries in 0 1024; do
+    echo "=== cache entries: $entries"
+
+    ./aws -p "$PORT" -c "$entries" 2> aws_cache.log &
+    pid=$!
+    sleep 0.5
+
+    ./aws_load -p "$PORT" -d "$DURATION" -c "$CONNS" -P "$PIPELINE" \
+        /static/small.dat /dynamic/small.dat
+
+    # The server logs cache statistics when it is stopped.
+    kill -INT "$pid"
+    wait "$pid" 2> /dev/null
+    grep "Cache:" aws_cache.log
+done
+
+rm -f aws_cache.log
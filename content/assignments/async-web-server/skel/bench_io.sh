@@ -0,0 +1,50 @@
+#!/bin/bash
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Compare the ways of reading dynamic files (blocking splice and read,
+# Linux AIO, io_uring) under a mixed workload: some connections download
+# a large dynamic file, the others request a small, cached static file.
+#
+# The page cache is dropped before each run (requires root), so the large
+# file is read from disk. Run "make files" first.
+
+PORT=${PORT:-8889}
+DURATION=${DURATION:-10}
+LARGE_CONNS=${LARGE_CONNS:-4}
+SMALL_CONNS=${SMALL_CONNS:-28}
+LARGE=${LARGE:-/dynamic/large.dat}
+SMALL=${SMALL:-/static/small.dat}
+
+if ! test -f ".$LARGE" -a -f ".$SMALL"; then
+    echo "Missing .$LARGE or .$SMALL, run \"make files\" first." 1>&2
+    exit 1
+fi
+
+# Connection i requests path i % 8: 1 in 8 connections gets the large file.
+paths=()
+for i in $(seq 0 7); do
+    if test "$i" -lt $((8 * LARGE_CONNS / (LARGE_CONNS + SMALL_CONNS))); then
+        paths+=("$LARGE")
+    else
+        paths+=("$SMALL")
+    fi
+done
+
+for backend in splice read aio uring; do
+    echo "=== $backend"
+
+    sync
+    if ! echo 3 2> /dev/null > /proc/sys/vm/drop_caches; then
+        echo "(can't drop the page cache, large file may be cached)"
+    fi
+
+    ./aws -p "$PORT" -d "$backend" 2> /dev/null &
+    pid=$!
+    sleep 0.5
+
+    ./aws_load -p "$PORT" -d "$DURATION" -c $((LARGE_CONNS + SMALL_CONNS)) \
+        "${paths[@]}"
+
+    kill "$pid"
+    wait "$pid" 2> /dev/null
+done
@@ -0,0 +1,114 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Minimal HTTP/1.x request parser and response header formatting
+ *
+ * Only the request line and the Connection header are interpreted. Other
+ * headers and request bodies are ignored.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "http.h"
+
+#define HTTP_HEADER_END		"\r\n\r\n"
+
+/*
+ * Look for value (case insensitive) in the comma-separated list of the
+ * header line [p, end).
+ */
+
+static bool header_has_token(const char *p, const char *end,
+		const char *value)
+{
+	size_t len = strlen(value);
+
+	for (; p + len <= end; p++)
+		if (strncasecmp(p, value, len) == 0)
+			return true;
+
+	return false;
+}
+
+/*
+ * Parse the first request in buf. Return the size of the request (request
+ * line and headers), 0 if the request is incomplete or -1 if it is
+ * malformed.
+ */
+
+ssize_t http_parse_request(const char *buf, size_t len,
+		struct http_request *req)
+{
+	const char *end, *p, *line_end, *sp1, *sp2, *q;
+	size_t n;
+
+	end = memmem(buf, len, HTTP_HEADER_END, strlen(HTTP_HEADER_END));
+	if (end == NULL)
+		return 0;
+	end += strlen(HTTP_HEADER_END);
+
+	/* request line: METHOD SP PATH SP HTTP/1.x CRLF */
+	line_end = memchr(buf, '\r', end - buf);
+	sp1 = memchr(buf, ' ', line_end - buf);
+	if (sp1 == NULL)
+		return -1;
+	sp2 = memchr(sp1 + 1, ' ', line_end - sp1 - 1);
+	if (sp2 == NULL)
+		return -1;
+
+	n = sp1 - buf;
+	if (n == 0 || n >= sizeof(req->method))
+		return -1;
+	memcpy(req->method, buf, n);
+	req->method[n] = '\0';
+
+	q = memchr(sp1 + 1, '?', sp2 - sp1 - 1);
+	n = (q ? q : sp2) - (sp1 + 1);
+	if (n == 0 || n >= sizeof(req->path))
+		return -1;
+	memcpy(req->path, sp1 + 1, n);
+	req->path[n] = '\0';
+
+	if (line_end - sp2 - 1 != 8 || strncmp(sp2 + 1, "HTTP/1.", 7) != 0 ||
+			!isdigit((unsigned char) sp2[8]))
+		return -1;
+	req->minor_version = sp2[8] - '0';
+
+	/* HTTP/1.1 connections are persistent by default, 1.0 ones are not. */
+	req->keep_alive = (req->minor_version >= 1);
+
+	for (p = line_end + 2; p < end - 2; p = line_end + 2) {
+		line_end = memchr(p, '\r', end - p);
+		if (line_end - p > 11 && strncasecmp(p, "Connection:", 11) == 0) {
+			if (header_has_token(p + 11, line_end, "close"))
+				req->keep_alive = false;
+			else if (header_has_token(p + 11, line_end, "keep-alive"))
+				req->keep_alive = true;
+		}
+	}
+
+	return end - buf;
+}
+
+/*
+ * Format the header of a response with a body of content_length bytes.
+ * Return its length, as snprintf().
+ */
+
+int http_format_header(char *buf, size_t size, int code, const char *reason,
+		size_t content_length, bool keep_alive)
+{
+	return snprintf(buf, size,
+		"HTTP/1.1 %d %s\r\n"
+		"Server: aws\r\n"
+		"Content-Length: %zu\r\n"
+		"Content-Type: application/octet-stream\r\n"
+		"Connection: %s\r\n"
+		"\r\n",
+		code, reason, content_length,
+		keep_alive ? "keep-alive" : "close");
+}
@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef HTTP_H_
+#define HTTP_H_		1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define HTTP_MAX_PATH		1024
+
+struct http_request {
+	char method[8];
+	char path[HTTP_MAX_PATH];	/* query string removed */
+	int minor_version;		/* HTTP/1.x */
+	bool keep_alive;
+};
+
+ssize_t http_parse_request(const char *buf, size_t len,
+		struct http_request *req);
+int http_format_header(char *buf, size_t size, int code, const char *reason,
+		size_t content_length, bool keep_alive);
+
+#endif /* HTTP_H_ */
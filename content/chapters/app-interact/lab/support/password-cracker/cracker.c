@@ -0,0 +1,274 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <openssl/sha.h>
+
+#include "../utils/utils.h"
+#include "cracker.h"
+
+int cracker_job_init(struct cracker_job *job, const char *charset,
+		unsigned int len, const unsigned char *hash, uint64_t chunk_size,
+		int scalar)
+{
+	size_t charset_len = strlen(charset);
+	uint64_t keyspace = 1;
+	unsigned int i;
+
+	if (charset_len == 0 || charset_len >= sizeof(job->charset))
+		return -1;
+	for (i = 0; i < charset_len; i++)
+		if (strchr(charset + i + 1, charset[i]) != NULL)
+			return -1;
+	if (len == 0 || len > CRACKER_MAX_LEN || chunk_size == 0)
+		return -1;
+	for (i = 0; i < len; i++) {
+		if (keyspace > UINT64_MAX / charset_len)
+			return -1;
+		keyspace *= charset_len;
+	}
+
+	memset(job, 0, sizeof(*job));
+	memcpy(job->charset, charset, charset_len);
+	job->charset_len = charset_len;
+	job->len = len;
+	memcpy(job->hash, hash, SHA512_MB_DIGEST_LEN);
+	job->keyspace = keyspace;
+	job->chunk_size = chunk_size;
+	job->scalar = scalar;
+	atomic_init(&job->next_chunk, 0);
+	atomic_init(&job->found, 0);
+
+	return 0;
+}
+
+/*
+ * Candidates are numbers written in base charset_len, the last character
+ * being the least significant digit.
+ */
+
+static void candidate_from_index(const struct cracker_job *job, uint64_t idx,
+		unsigned int *digits, char *word)
+{
+	int p;
+
+	for (p = job->len - 1; p >= 0; p--) {
+		digits[p] = idx % job->charset_len;
+		word[p] = job->charset[digits[p]];
+		idx /= job->charset_len;
+	}
+}
+
+static void candidate_next(const struct cracker_job *job, unsigned int *digits,
+		char *word)
+{
+	int p = job->len - 1;
+
+	while (p >= 0 && ++digits[p] == job->charset_len) {
+		digits[p] = 0;
+		word[p] = job->charset[0];
+		p--;
+	}
+	if (p >= 0)
+		word[p] = job->charset[digits[p]];
+}
+
+static void report_found(struct cracker_job *job, const char *word)
+{
+	int expected = 0;
+
+	/* Should there be collisions, keep the first one reported. */
+	if (atomic_compare_exchange_strong(&job->found, &expected, -1)) {
+		memcpy(job->password, word, job->len);
+		job->password[job->len] = '\0';
+		atomic_store(&job->found, 1);
+	}
+}
+
+static uint64_t search_scalar(struct cracker_job *job, uint64_t start,
+		uint64_t end)
+{
+	unsigned int digits[CRACKER_MAX_LEN];
+	unsigned char hash[SHA512_MB_DIGEST_LEN];
+	char word[CRACKER_MAX_LEN];
+	uint64_t i;
+
+	candidate_from_index(job, start, digits, word);
+	for (i = start; i < end; i++) {
+		SHA512((unsigned char *) word, job->len, hash);
+		if (memcmp(hash, job->hash, sizeof(hash)) == 0) {
+			report_found(job, word);
+			return i + 1 - start;
+		}
+		candidate_next(job, digits, word);
+	}
+
+	return i - start;
+}
+
+static uint64_t search_mb(struct cracker_job *job, uint64_t start,
+		uint64_t end)
+{
+	unsigned int digits[CRACKER_MAX_LEN];
+	unsigned char hash[SHA512_MB_LANES][SHA512_MB_DIGEST_LEN];
+	char word[SHA512_MB_LANES][CRACKER_MAX_LEN];
+	const unsigned char *msg[SHA512_MB_LANES];
+	unsigned int l, n;
+	uint64_t i;
+
+	for (l = 0; l < SHA512_MB_LANES; l++)
+		msg[l] = (unsigned char *) word[l];
+
+	candidate_from_index(job, start, digits, word[0]);
+	for (i = start; i < end; i += n) {
+		n = end - i < SHA512_MB_LANES ? end - i : SHA512_MB_LANES;
+
+		/* Fill the lanes left over at the end of the chunk too. */
+		for (l = 1; l < SHA512_MB_LANES; l++) {
+			memcpy(word[l], word[l - 1], job->len);
+			candidate_next(job, digits, word[l]);
+		}
+
+		sha512_mb(msg, job->len, hash);
+		for (l = 0; l < n; l++) {
+			if (memcmp(hash[l], job->hash, SHA512_MB_DIGEST_LEN) == 0) {
+				report_found(job, word[l]);
+				return i + l + 1 - start;
+			}
+		}
+
+		memcpy(word[0], word[SHA512_MB_LANES - 1], job->len);
+		candidate_next(job, digits, word[0]);
+	}
+
+	return i - start;
+}
+
+uint64_t cracker_work(struct cracker_job *job)
+{
+	uint64_t hashes = 0;
+	uint64_t chunk, start, end;
+
+	while (!atomic_load_explicit(&job->found, memory_order_relaxed)) {
+		chunk = atomic_fetch_add_explicit(&job->next_chunk, 1,
+				memory_order_relaxed);
+		if (chunk >= (job->keyspace + job->chunk_size - 1) /
+				job->chunk_size)
+			break;
+
+		start = chunk * job->chunk_size;
+		end = start + job->chunk_size;
+		if (end > job->keyspace)
+			end = job->keyspace;
+
+		if (job->scalar)
+			hashes += search_scalar(job, start, end);
+		else
+			hashes += search_mb(job, start, end);
+	}
+
+	return hashes;
+}
+
+struct worker {
+	pthread_t tid;
+	struct cracker_job *job;
+	uint64_t hashes;
+};
+
+static void *worker_thread(void *arg)
+{
+	struct worker *w = arg;
+
+	w->hashes = cracker_work(w->job);
+
+	return NULL;
+}
+
+int cracker_run_threads(struct cracker_job *job, unsigned int num_workers,
+		uint64_t *hashes)
+{
+	struct worker *workers;
+	unsigned int i;
+	int ret;
+
+	workers = calloc(num_workers, sizeof(*workers));
+	DIE(workers == NULL, "calloc");
+
+	for (i = 0; i < num_workers; i++) {
+		workers[i].job = job;
+		ret = pthread_create(&workers[i].tid, NULL, worker_thread,
+				&workers[i]);
+		DIE(ret, "pthread_create");
+	}
+
+	for (i = 0; i < num_workers; i++) {
+		ret = pthread_join(workers[i].tid, NULL);
+		DIE(ret, "pthread_join");
+		hashes[i] = workers[i].hashes;
+	}
+
+	free(workers);
+
+	return atomic_load(&job->found) == 1;
+}
+
+/*
+ * The job descriptor and the hash counters of the workers, shared with the
+ * worker processes.
+ */
+
+struct shared_job {
+	struct cracker_job job;
+	uint64_t hashes[];
+};
+
+int cracker_run_processes(struct cracker_job *job, unsigned int num_workers,
+		uint64_t *hashes)
+{
+	struct shared_job *shared;
+	size_t size;
+	unsigned int i;
+	pid_t pid;
+	int status;
+	int ret;
+
+	size = sizeof(*shared) + num_workers * sizeof(shared->hashes[0]);
+	shared = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	DIE(shared == MAP_FAILED, "mmap");
+	memcpy(&shared->job, job, sizeof(*job));
+
+	/* Flush buffered output, or every child would print it again. */
+	fflush(NULL);
+
+	for (i = 0; i < num_workers; i++) {
+		pid = fork();
+		DIE(pid < 0, "fork");
+
+		if (pid == 0) {
+			shared->hashes[i] = cracker_work(&shared->job);
+			_exit(EXIT_SUCCESS);
+		}
+	}
+
+	for (i = 0; i < num_workers; i++) {
+		pid = wait(&status);
+		DIE(pid < 0, "wait");
+		DIE(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS,
+			"worker process");
+	}
+
+	memcpy(job, &shared->job, sizeof(*job));
+	memcpy(hashes, shared->hashes, num_workers * sizeof(hashes[0]));
+	ret = munmap(shared, size);
+	DIE(ret < 0, "munmap");
+
+	return atomic_load(&job->found) == 1;
+}
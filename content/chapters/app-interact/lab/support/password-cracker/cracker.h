@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Brute-force engine: find the password of a given length, made of the
+ * characters of a given charset, whose SHA-512 hash is known.
+ *
+ * The keyspace (all charset_len ^ len candidates, in lexicographic order) is
+ * split into chunks of consecutive candidates. Workers take the next chunk
+ * from a shared atomic counter until the keyspace is exhausted, so a worker
+ * that gets ahead simply takes more chunks. The first worker to find the
+ * password raises a flag that the others check after each chunk.
+ *
+ * struct cracker_job holds no pointers: cracker_run_processes() shares it
+ * with its worker processes through a shared memory mapping.
+ */
+
+#ifndef CRACKER_H_
+#define CRACKER_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "sha512_mb.h"
+
+#define CRACKER_MAX_LEN		32
+#define CRACKER_CHUNK_SIZE	4096	/* default, in candidates */
+
+struct cracker_job {
+	/* set by cracker_job_init(), read-only afterwards */
+	char charset[256];
+	unsigned int charset_len;
+	unsigned int len;
+	unsigned char hash[SHA512_MB_DIGEST_LEN];
+	uint64_t keyspace;
+	uint64_t chunk_size;
+	int scalar;			/* hash with OpenSSL, one at a time */
+
+	/* shared by the workers */
+	atomic_uint_fast64_t next_chunk;
+	atomic_int found;
+	char password[CRACKER_MAX_LEN + 1];
+};
+
+/*
+ * Return -1 if the charset is empty or has duplicates, if len is 0 or
+ * larger than CRACKER_MAX_LEN, or if the keyspace does not fit in 64 bits.
+ */
+int cracker_job_init(struct cracker_job *job, const char *charset,
+		unsigned int len, const unsigned char *hash, uint64_t chunk_size,
+		int scalar);
+
+/*
+ * Take and search chunks until the keyspace is exhausted or the password is
+ * found, by this or any other worker. Return the number of hashes computed.
+ */
+uint64_t cracker_work(struct cracker_job *job);
+
+/*
+ * Search with num_workers threads. Store the hashes computed by each one in
+ * hashes[]. Return 1 if the password was found (in job->password), 0 if not.
+ */
+int cracker_run_threads(struct cracker_job *job, unsigned int num_workers,
+		uint64_t *hashes);
+
+/*
+ * Same as cracker_run_threads(), with num_workers child processes.
+ */
+int cracker_run_processes(struct cracker_job *job, unsigned int num_workers,
+		uint64_t *hashes);
+
+#endif
@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Password cracker built on the engine in cracker.c: as many workers
+ * (threads, or processes with -m) as online CPUs take chunks of the keyspace
+ * from a shared counter, stop as soon as one of them finds the password, and
+ * hash several candidates per call with the multi-buffer SHA-512 in
+ * sha512_mb.c.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <openssl/sha.h>
+
+#include "../utils/utils.h"
+#include "cracker.h"
+
+#define PASSWORD_LEN 4
+#define PASSWORD_HASH "\x59\xa5\xab\xc2\xa9\x9b\x95\xbe"		\
+	"\x73\xc3\x1e\xa2\x72\xab\x0f\x2f"				\
+	"\x2f\xe4\x2f\xec\x30\x36\x71\x55"				\
+	"\xcb\x73\xf6\xf6\xce\xf1\xf4\xe6"				\
+	"\xee\x37\xf5\x86\xcb\xd0\x2c\xc7"				\
+	"\x38\xa8\x7a\x5d\x6a\xdd\x3b\xa3"				\
+	"\x1d\xbe\xaf\x39\xec\x77\xca\xd9"				\
+	"\x10\x83\x7c\x94\xc6\x58\x37\xfb"
+#define CHARSET "abcdefghijklmnopqrstuvwxyz"
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * CPU time, user and system, of this process or of its waited-for children.
+ */
+
+static double cpu_time(int who)
+{
+	struct rusage ru;
+	int ret;
+
+	ret = getrusage(who, &ru);
+	DIE(ret < 0, "getrusage");
+
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+		ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static int parse_hash(const char *hex, unsigned char *hash)
+{
+	unsigned int i, v;
+
+	if (strlen(hex) != 2 * SHA512_DIGEST_LENGTH)
+		return -1;
+	for (i = 0; i < SHA512_DIGEST_LENGTH; i++) {
+		if (sscanf(hex + 2 * i, "%2x", &v) != 1)
+			return -1;
+		hash[i] = v;
+	}
+
+	return 0;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-t workers] [-m] [-c charset] [-l length] "
+		"[-H sha512_hex | -p password] [-k chunk_size] [-s]\n"
+		"  -m: use worker processes instead of threads\n"
+		"  -p: search for the given password (benchmark)\n"
+		"  -s: hash with OpenSSL, one candidate at a time\n", argv0);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned char hash[SHA512_DIGEST_LENGTH];
+	const char *charset = CHARSET;
+	unsigned int len = PASSWORD_LEN;
+	uint64_t chunk_size = CRACKER_CHUNK_SIZE;
+	long num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	struct cracker_job job;
+	uint64_t *hashes, total = 0;
+	double start, elapsed;
+	double cpu_start, cpu;
+	int processes = 0;
+	int scalar = 0;
+	int found;
+	int opt;
+	int ret;
+
+	memcpy(hash, PASSWORD_HASH, sizeof(hash));
+
+	while ((opt = getopt(argc, argv, "t:mc:l:H:p:k:s")) != -1) {
+		switch (opt) {
+		case 't':
+			num_workers = atol(optarg);
+			break;
+		case 'm':
+			processes = 1;
+			break;
+		case 'c':
+			charset = optarg;
+			break;
+		case 'l':
+			len = atoi(optarg);
+			break;
+		case 'H':
+			if (parse_hash(optarg, hash) < 0)
+				usage(argv[0]);
+			break;
+		case 'p':
+			len = strlen(optarg);
+			SHA512((unsigned char *) optarg, len, hash);
+			break;
+		case 'k':
+			chunk_size = strtoull(optarg, NULL, 10);
+			break;
+		case 's':
+			scalar = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (num_workers < 1)
+		usage(argv[0]);
+
+	ret = cracker_job_init(&job, charset, len, hash, chunk_size, scalar);
+	if (ret < 0) {
+		log_error("Invalid charset, length or chunk size");
+		usage(argv[0]);
+	}
+
+	hashes = calloc(num_workers, sizeof(*hashes));
+	DIE(hashes == NULL, "calloc");
+
+	/* Worker processes are only accounted for once waited for. */
+	cpu_start = cpu_time(processes ? RUSAGE_CHILDREN : RUSAGE_SELF);
+	start = now();
+	if (processes)
+		found = cracker_run_processes(&job, num_workers, hashes);
+	else
+		found = cracker_run_threads(&job, num_workers, hashes);
+	elapsed = now() - start;
+	cpu = cpu_time(processes ? RUSAGE_CHILDREN : RUSAGE_SELF) - cpu_start;
+
+	if (found)
+		printf("found %s\n", job.password);
+	else
+		printf("not found\n");
+
+	for (long i = 0; i < num_workers; i++) {
+		printf("worker %ld: %lu hashes\n", i, hashes[i]);
+		total += hashes[i];
+	}
+	printf("%lu hashes in %.3f s: %.0f hashes/s, %.0f hashes/s per worker (%s)\n",
+		total, elapsed, total / elapsed, total / elapsed / num_workers,
+		scalar ? "OpenSSL" : "multi-buffer");
+	printf("%ld %s: wall time %.3f s, CPU time %.3f s\n", num_workers,
+		processes ? "processes" : "threads", elapsed, cpu);
+
+	free(hashes);
+
+	return 0;
+}
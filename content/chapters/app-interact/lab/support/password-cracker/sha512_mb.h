@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Multi-buffer SHA-512: hash SHA512_MB_LANES messages with one call, one
+ * message per SIMD lane.
+ *
+ * Only short messages (one SHA-512 block, at most SHA512_MB_MAX_LEN bytes)
+ * of the same length are supported, which is all a brute-force search needs.
+ */
+
+#ifndef SHA512_MB_H_
+#define SHA512_MB_H_
+
+#include <stddef.h>
+
+#define SHA512_MB_LANES		8
+#define SHA512_MB_MAX_LEN	111
+#define SHA512_MB_DIGEST_LEN	64
+
+/*
+ * Hash msg[0] ... msg[SHA512_MB_LANES - 1], each len bytes long, into
+ * digest[0] ... digest[SHA512_MB_LANES - 1].
+ *
+ * The best instruction set the CPU supports (AVX-512, AVX2, or plain SSE2)
+ * is picked when the program is loaded.
+ */
+void sha512_mb(const unsigned char *const msg[SHA512_MB_LANES], size_t len,
+		unsigned char digest[SHA512_MB_LANES][SHA512_MB_DIGEST_LEN]);
+
+#endif
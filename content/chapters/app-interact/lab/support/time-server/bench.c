@@ -0,0 +1,293 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Benchmark for the event-driven time server (server -e).
+ *
+ * For each number of clients (1, 10, 100, 1000 and 10000 by default), open
+ * the connections, then have each client keep a number of requests in
+ * flight (pipelining) for a few seconds. A single thread drives all clients
+ * with epoll(7). Print the replies received per second.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "../utils/utils.h"
+#include "utils/sock/w_epoll.h"
+
+#include "time_proto.h"
+
+#define MAX_EVENTS		256
+#define MAX_DEPTH		256
+
+struct client {
+	int sockfd;
+	int connected;
+	uint32_t next_id;		/* of the next request */
+	uint32_t expected_id;		/* of the next reply */
+
+	/* requests not sent yet */
+	struct time_request out[MAX_DEPTH];
+	size_t out_len;			/* bytes */
+
+	/* partial reply */
+	char in[sizeof(struct time_reply)];
+	size_t in_len;
+};
+
+static struct sockaddr_in server_addr;
+static unsigned int depth = 16;
+static int epollfd;
+static unsigned long replies;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void queue_requests(struct client *c, unsigned int count)
+{
+	struct time_request *req;
+
+	for (unsigned int i = 0; i < count; i++) {
+		req = (struct time_request *) ((char *) c->out + c->out_len);
+		req->size = htonl(TIME_REQUEST_PAYLOAD);
+		req->id = htonl(c->next_id++);
+		c->out_len += sizeof(*req);
+	}
+}
+
+static int client_send(struct client *c)
+{
+	ssize_t n;
+
+	if (c->out_len == 0)
+		return 0;
+
+	n = send(c->sockfd, c->out, c->out_len, MSG_NOSIGNAL);
+	if (n < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+	memmove(c->out, (char *) c->out + n, c->out_len - n);
+	c->out_len -= n;
+
+	return 0;
+}
+
+/*
+ * Check the replies received and send as many new requests.
+ */
+
+static int client_recv(struct client *c)
+{
+	char buf[MAX_DEPTH * sizeof(struct time_reply)];
+	struct time_reply reply;
+	unsigned int count = 0;
+	size_t off = 0, len;
+	ssize_t n;
+
+	memcpy(buf, c->in, c->in_len);
+	n = recv(c->sockfd, buf + c->in_len, sizeof(buf) - c->in_len, 0);
+	if (n == 0)
+		return -1;
+	if (n < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+	len = c->in_len + n;
+
+	while (len - off >= sizeof(reply)) {
+		memcpy(&reply, buf + off, sizeof(reply));
+		if (ntohl(reply.size) != TIME_REPLY_PAYLOAD ||
+				ntohl(reply.id) != c->expected_id) {
+			log_error("Unexpected reply");
+			return -1;
+		}
+		c->expected_id++;
+		off += sizeof(reply);
+		count++;
+	}
+	c->in_len = len - off;
+	memcpy(c->in, buf + off, c->in_len);
+
+	replies += count;
+	queue_requests(c, count);
+
+	return client_send(c);
+}
+
+static int client_open(struct client *c)
+{
+	int one = 1;
+
+	memset(c, 0, sizeof(*c));
+	c->sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (c->sockfd < 0)
+		return -1;
+	setsockopt(c->sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if (connect(c->sockfd, (struct sockaddr *) &server_addr,
+			sizeof(server_addr)) < 0 && errno != EINPROGRESS) {
+		close(c->sockfd);
+		return -1;
+	}
+
+	/* Writable once connected. */
+	return w_epoll_add_ptr_inout(epollfd, c->sockfd, c);
+}
+
+static void client_event(struct client *c, unsigned int events)
+{
+	socklen_t len = sizeof(int);
+	int err = 0;
+
+	if (!c->connected) {
+		getsockopt(c->sockfd, SOL_SOCKET, SO_ERROR, &err, &len);
+		DIE(err != 0, "connect");
+		c->connected = 1;
+		queue_requests(c, depth);
+	}
+
+	if (events & EPOLLOUT)
+		DIE(client_send(c) < 0, "send");
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		DIE(client_recv(c) < 0, "Connection closed by server");
+
+	/* Only watch output while requests are left to send. */
+	if (c->out_len > 0)
+		w_epoll_update_ptr_inout(epollfd, c->sockfd, c);
+	else if (events & EPOLLOUT)
+		w_epoll_update_ptr_in(epollfd, c->sockfd, c);
+}
+
+/*
+ * Run num_clients clients for duration seconds. Return replies per second.
+ */
+
+static double run(unsigned int num_clients, double duration)
+{
+	struct epoll_event rev[MAX_EVENTS];
+	struct client *clients;
+	double start, end;
+	unsigned int connected = 0;
+	int n;
+
+	clients = calloc(num_clients, sizeof(*clients));
+	DIE(clients == NULL, "calloc");
+	epollfd = w_epoll_create();
+	DIE(epollfd < 0, "w_epoll_create");
+
+	for (unsigned int i = 0; i < num_clients; i++)
+		DIE(client_open(&clients[i]) < 0, "connect");
+
+	/* Count from when all clients are connected. */
+	start = 0;
+	end = 0;
+	while (start == 0 || now() < end) {
+		n = w_epoll_wait(epollfd, rev, MAX_EVENTS, 100);
+		if (n < 0 && errno == EINTR)
+			continue;
+		DIE(n < 0, "epoll_wait");
+
+		for (int i = 0; i < n; i++) {
+			struct client *c = rev[i].data.ptr;
+
+			if (!c->connected)
+				connected++;
+			client_event(c, rev[i].events);
+		}
+
+		if (start == 0 && connected == num_clients) {
+			start = now();
+			end = start + duration;
+			replies = 0;
+		}
+	}
+
+	for (unsigned int i = 0; i < num_clients; i++)
+		close(clients[i].sockfd);
+	close(epollfd);
+	free(clients);
+
+	return replies / (now() - start);
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-H ip] [-p port] [-c clients[,clients...]] "
+		"[-P depth] [-d seconds]\n", argv0);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	char default_clients[] = "1,10,100,1000,10000";
+	char *clients_list = default_clients;
+	const char *ip = "127.0.0.1";
+	unsigned short port = 2000;
+	double duration = 3;
+	struct rlimit rlim;
+	double rate;
+	char *tok;
+	int opt;
+	int ret;
+
+	while ((opt = getopt(argc, argv, "H:p:c:P:d:")) != -1) {
+		switch (opt) {
+		case 'H':
+			ip = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'c':
+			clients_list = optarg;
+			break;
+		case 'P':
+			depth = atoi(optarg);
+			if (depth < 1 || depth > MAX_DEPTH)
+				usage(argv[0]);
+			break;
+		case 'd':
+			duration = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, ip, &server_addr.sin_addr) != 1)
+		usage(argv[0]);
+
+	ret = getrlimit(RLIMIT_NOFILE, &rlim);
+	DIE(ret < 0, "getrlimit");
+	rlim.rlim_cur = rlim.rlim_max;
+	ret = setrlimit(RLIMIT_NOFILE, &rlim);
+	DIE(ret < 0, "setrlimit");
+
+	printf("%10s %8s %14s\n", "clients", "depth", "requests/s");
+	for (tok = strtok(clients_list, ","); tok != NULL;
+			tok = strtok(NULL, ",")) {
+		rate = run(atoi(tok), duration);
+		printf("%10d %8u %14.0f\n", atoi(tok), depth, rate);
+		fflush(stdout);
+	}
+
+	return 0;
+}
@@ -0,0 +1,295 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Event-driven mode of the time server: a single thread serves all clients
+ * with epoll(7), using the framed protocol in time_proto.h.
+ *
+ * Connections stay open. All complete requests received are answered at
+ * once: their replies (each one a single block, size and payload) are queued
+ * and sent with one writev(2). The time is read once per wakeup, not once
+ * per request.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "../utils/utils.h"
+#include "utils/sock/w_epoll.h"
+#include "utils/metrics/metrics.h"
+
+#include "time_proto.h"
+#include "epoll_server.h"
+
+#define MAX_EVENTS		64
+
+/* requests read at a time, replies queued per connection */
+#define CONN_IN_SIZE		(128 * sizeof(struct time_request))
+#define CONN_OUT_REPLIES	256
+
+struct conn {
+	int sockfd;
+	unsigned int events;		/* watched */
+
+	/* received data, starting with a request */
+	char in[CONN_IN_SIZE];
+	size_t in_len;
+
+	/* replies to send, in a ring */
+	struct time_reply out[CONN_OUT_REPLIES];
+	unsigned int out_head;
+	unsigned int out_count;
+	size_t out_sent;		/* bytes of the head reply */
+};
+
+/* marks the listening socket in epoll events */
+static int listenfd;
+#define LISTENER		((void *) &listenfd)
+
+static int epollfd;
+
+/* current time, in network byte order, read once per wakeup */
+static uint64_t cached_time;
+
+static void conn_close(struct conn *c)
+{
+	w_epoll_remove_ptr(epollfd, c->sockfd, c);
+	close(c->sockfd);
+	free(c);
+	metrics_count(metrics, METRICS_CLOSED, 1);
+}
+
+/*
+ * Stop reading requests while the reply queue is full: the client gets no
+ * more replies than it reads.
+ */
+
+static int conn_update_events(struct conn *c)
+{
+	unsigned int events = 0;
+	int ret = 0;
+
+	if (c->out_count < CONN_OUT_REPLIES)
+		events |= EPOLLIN;
+	if (c->out_count > 0)
+		events |= EPOLLOUT;
+
+	if (events == c->events)
+		return 0;
+
+	if (events == (EPOLLIN | EPOLLOUT))
+		ret = w_epoll_update_ptr_inout(epollfd, c->sockfd, c);
+	else if (events == EPOLLIN)
+		ret = w_epoll_update_ptr_in(epollfd, c->sockfd, c);
+	else
+		ret = w_epoll_update_ptr_out(epollfd, c->sockfd, c);
+	c->events = events;
+
+	return ret;
+}
+
+/*
+ * Queue replies to the complete requests received, while there is room.
+ * Return -1 on a malformed request.
+ */
+
+static int conn_parse(struct conn *c)
+{
+	struct time_request req;
+	struct time_reply *reply;
+	size_t off = 0;
+
+	while (c->in_len - off >= sizeof(req) &&
+			c->out_count < CONN_OUT_REPLIES) {
+		memcpy(&req, c->in + off, sizeof(req));
+		if (ntohl(req.size) != TIME_REQUEST_PAYLOAD)
+			return -1;
+		off += sizeof(req);
+
+		reply = &c->out[(c->out_head + c->out_count) % CONN_OUT_REPLIES];
+		reply->size = htonl(TIME_REPLY_PAYLOAD);
+		reply->id = req.id;
+		reply->time = cached_time;
+		c->out_count++;
+	}
+
+	memmove(c->in, c->in + off, c->in_len - off);
+	c->in_len -= off;
+	metrics_count(metrics, METRICS_REQUESTS, off / sizeof(req));
+
+	return 0;
+}
+
+/*
+ * Send the queued replies with one writev(): the ring is at most two
+ * contiguous parts.
+ */
+
+static int conn_send(struct conn *c)
+{
+	struct iovec iov[2];
+	unsigned int first, iovcnt = 1;
+	ssize_t n;
+
+	first = CONN_OUT_REPLIES - c->out_head;
+	if (first > c->out_count)
+		first = c->out_count;
+
+	iov[0].iov_base = (char *) &c->out[c->out_head] + c->out_sent;
+	iov[0].iov_len = first * sizeof(struct time_reply) - c->out_sent;
+	if (first < c->out_count) {
+		iov[1].iov_base = &c->out[0];
+		iov[1].iov_len = (c->out_count - first) *
+			sizeof(struct time_reply);
+		iovcnt = 2;
+	}
+
+	n = writev(c->sockfd, iov, iovcnt);
+	if (n < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+	metrics_count(metrics, METRICS_BYTES_OUT, n);
+
+	n += c->out_sent;
+	c->out_head = (c->out_head + n / sizeof(struct time_reply)) %
+		CONN_OUT_REPLIES;
+	c->out_count -= n / sizeof(struct time_reply);
+	c->out_sent = n % sizeof(struct time_reply);
+
+	return 0;
+}
+
+static void conn_handle(struct conn *c, unsigned int events)
+{
+	uint64_t start;
+	ssize_t n;
+
+	if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+			c->in_len < CONN_IN_SIZE) {
+		start = metrics_start(metrics);
+		n = recv(c->sockfd, c->in + c->in_len, CONN_IN_SIZE - c->in_len, 0);
+		metrics_record_since(metrics, METRICS_READ, start);
+		if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+			goto close;
+		if (n > 0) {
+			c->in_len += n;
+			metrics_count(metrics, METRICS_BYTES_IN, n);
+		}
+	}
+
+	/* Also parse requests left over while the reply queue was full. */
+	if (conn_parse(c) < 0) {
+		log_error("Malformed request, closing connection");
+		metrics_count(metrics, METRICS_ERRORS, 1);
+		goto close;
+	}
+
+	if (c->out_count > 0) {
+		start = metrics_start(metrics);
+		if (conn_send(c) < 0)
+			goto close;
+		metrics_record_since(metrics, METRICS_SEND, start);
+	}
+
+	if (conn_update_events(c) < 0)
+		goto close;
+
+	return;
+
+close:
+	conn_close(c);
+}
+
+static void accept_clients(void)
+{
+	struct conn *c;
+	uint64_t start;
+	int sockfd;
+	int one = 1;
+	int ret;
+
+	while (1) {
+		sockfd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK);
+		if (sockfd < 0) {
+			if (errno == ECONNABORTED || errno == EINTR)
+				continue;
+			ERR(errno != EAGAIN && errno != EWOULDBLOCK, "accept4");
+			return;
+		}
+		start = metrics_start(metrics);
+
+		/* Replies are small: send them right away. */
+		setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		c = malloc(sizeof(*c));
+		if (c == NULL) {
+			ERR(1, "malloc");
+			close(sockfd);
+			continue;
+		}
+		c->sockfd = sockfd;
+		c->events = EPOLLIN;
+		c->in_len = 0;
+		c->out_head = 0;
+		c->out_count = 0;
+		c->out_sent = 0;
+
+		ret = w_epoll_add_ptr_in(epollfd, sockfd, c);
+		if (ret < 0) {
+			ERR(1, "w_epoll_add_ptr_in");
+			close(sockfd);
+			free(c);
+			continue;
+		}
+
+		metrics_count(metrics, METRICS_ACCEPTED, 1);
+		metrics_record_since(metrics, METRICS_ACCEPT, start);
+	}
+}
+
+void run_epoll_server(int sockfd)
+{
+	struct epoll_event rev[MAX_EVENTS];
+	struct timespec ts;
+	int ret;
+	int n;
+
+	listenfd = sockfd;
+	ret = fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+	DIE(ret < 0, "fcntl");
+
+	epollfd = w_epoll_create();
+	DIE(epollfd < 0, "w_epoll_create");
+	ret = w_epoll_add_ptr_in(epollfd, listenfd, LISTENER);
+	DIE(ret < 0, "w_epoll_add_ptr_in");
+
+	while (1) {
+		n = w_epoll_wait(epollfd, rev, MAX_EVENTS, -1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		DIE(n < 0, "epoll_wait");
+
+		/* The time has a one second resolution: a coarse clock will do. */
+		clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+		cached_time = htobe64(ts.tv_sec);
+
+		for (int i = 0; i < n; i++) {
+			if (rev[i].data.ptr == LISTENER)
+				accept_clients();
+			else
+				conn_handle(rev[i].data.ptr, rev[i].events);
+		}
+	}
+}
@@ -0,0 +1,13 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef EPOLL_SERVER_H_
+#define EPOLL_SERVER_H_
+
+struct metrics;
+
+/* NULL unless a metrics port is given */
+extern struct metrics *metrics;
+
+void run_epoll_server(int listenfd);
+
+#endif
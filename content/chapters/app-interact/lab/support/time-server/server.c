@@ -6,15 +6,22 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/resource.h>
 
 #include "../utils/utils.h"
+#include "utils/metrics/metrics.h"
+
+#include "epoll_server.h"
 
 #define BIND_ADDR "0.0.0.0"
 #define PORT 2000
 
-int create_socket(char *addr, short port)
+struct metrics *metrics;
+
+int create_socket(char *addr, short port, int backlog)
 {
 	int sockfd;
 	struct sockaddr_in srv_addr;
@@ -37,7 +44,7 @@ int create_socket(char *addr, short port)
 	ret = bind(sockfd, (struct sockaddr *)&srv_addr, sizeof(srv_addr));
 	DIE(ret < 0, "bind");
 
-	ret = listen(sockfd, 10);
+	ret = listen(sockfd, backlog);
 	DIE(ret < 0, "listen");
 
 	return sockfd;
@@ -79,29 +86,80 @@ int handle_client(int sockfd)
 	ret = xsend(sockfd, &current_time, sizeof(current_time), 0);
 	DIE(ret < 0, "send");
 
+	metrics_count(metrics, METRICS_REQUESTS, 1);
+	metrics_count(metrics, METRICS_BYTES_OUT,
+		sizeof(size) + sizeof(current_time));
+
 	return 1;
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+	struct rlimit rlim;
+	int event_mode = 0;
+	int metrics_port = 0;
 	int sockfd;
+	int ret;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "em:")) != -1) {
+		switch (opt) {
+		case 'e':
+			event_mode = 1;
+			break;
+		case 'm':
+			metrics_port = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-e] [-m metrics_port]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (metrics_port > 0) {
+		metrics = metrics_create(1);
+		DIE(metrics == NULL, "metrics_create");
+		ret = metrics_serve(metrics, metrics_port);
+		DIE(ret < 0, "metrics_serve");
+	}
+
+	if (event_mode) {
+		/* A file descriptor per client. */
+		ret = getrlimit(RLIMIT_NOFILE, &rlim);
+		DIE(ret < 0, "getrlimit");
+		rlim.rlim_cur = rlim.rlim_max;
+		ret = setrlimit(RLIMIT_NOFILE, &rlim);
+		DIE(ret < 0, "setrlimit");
+
+		sockfd = create_socket(BIND_ADDR, PORT, SOMAXCONN);
+		DIE(sockfd < 0, "Failed to create socket\n");
+		run_epoll_server(sockfd);
+	}
 
-	sockfd = create_socket(BIND_ADDR, PORT);
+	sockfd = create_socket(BIND_ADDR, PORT, 10);
 	DIE(sockfd < 0, "Failed to create socket\n");
 
 	while (1) {
 		struct sockaddr_in cl_addr;
 		int cl_sockfd;
 		socklen_t addr_len = sizeof(cl_addr);
+		uint64_t accepted, start;
 
 		cl_sockfd = accept(sockfd, (struct sockaddr *)&cl_addr, &addr_len);
 		DIE(cl_sockfd < 0, "accept");
+		accepted = metrics_start(metrics);
+		metrics_count(metrics, METRICS_ACCEPTED, 1);
 
 		printf("Got connection from %s:%d\n", inet_ntoa(cl_addr.sin_addr), ntohs(cl_addr.sin_port));
+		metrics_record_since(metrics, METRICS_ACCEPT, accepted);
 
+		start = metrics_start(metrics);
 		handle_client(cl_sockfd);
+		metrics_record_since(metrics, METRICS_SEND, start);
 
 		close(cl_sockfd);
+		metrics_count(metrics, METRICS_CLOSED, 1);
+		metrics_record_since(metrics, METRICS_CONNECTION, accepted);
 	}
 
 	return 0;
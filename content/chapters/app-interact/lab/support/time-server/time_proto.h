@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Protocol of the event-driven time server (server -e).
+ *
+ * Like the replies of the classic server, every message is a frame: the
+ * payload size (32 bits, big endian), then the payload. A client keeps the
+ * connection open and may send several requests without waiting for the
+ * replies (pipelining); replies come in the order of the requests.
+ *
+ * request payload:	id (32 bits)
+ * reply payload:	id of the request (32 bits), time (64 bits, big endian)
+ *
+ * Ids are opaque to the server; they let clients check the replies.
+ */
+
+#ifndef TIME_PROTO_H_
+#define TIME_PROTO_H_
+
+#include <stdint.h>
+
+struct time_request {
+	uint32_t size;		/* htonl(sizeof(id)) */
+	uint32_t id;
+} __attribute__((packed));
+
+struct time_reply {
+	uint32_t size;		/* htonl(sizeof(id) + sizeof(time)) */
+	uint32_t id;
+	uint64_t time;
+} __attribute__((packed));
+
+#define TIME_REQUEST_PAYLOAD	(sizeof(struct time_request) - sizeof(uint32_t))
+#define TIME_REPLY_PAYLOAD	(sizeof(struct time_reply) - sizeof(uint32_t))
+
+#endif
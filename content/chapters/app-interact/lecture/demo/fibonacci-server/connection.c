@@ -14,10 +14,13 @@
 
 #include "utils/log/log.h"
 #include "utils/sock/sock_util.h"
+#include "utils/metrics/metrics.h"
 #include "utils/utils.h"
 
 #include "connection.h"
 
+struct metrics *server_metrics;
+
 /*
  * Compute Fibonacci number.
  */
@@ -68,7 +71,8 @@ error:
 }
 
 /*
- * Send data to socket. Handle possible errors.
+ * Send data to socket. send() may send only part of the data: call it
+ * until everything is sent. Handle possible errors.
  *
  * Return number of bytes sent, -1 at error.
  */
@@ -76,6 +80,7 @@ error:
 static int send_data(int sockfd, char *buffer, size_t len)
 {
 	ssize_t bytes_sent;
+	size_t total = 0;
 	char abuffer[64];
 	int rc;
 
@@ -85,20 +90,24 @@ static int send_data(int sockfd, char *buffer, size_t len)
 		goto error;
 	}
 
-	bytes_sent = send(sockfd, buffer, len, 0);
-	if (bytes_sent < 0) {		/* error in communication */
-		log_error("Error in communication to %s", abuffer);
-		goto error;
-	}
-	if (bytes_sent == 0) {		/* connection closed */
-		log_info("Connection closed to %s", abuffer);
-		goto error;
+	while (total < len) {
+		bytes_sent = send(sockfd, buffer + total, len - total,
+			MSG_NOSIGNAL);
+		if (bytes_sent < 0) {		/* error in communication */
+			log_error("Error in communication to %s", abuffer);
+			goto error;
+		}
+		if (bytes_sent == 0) {		/* connection closed */
+			log_info("Connection closed to %s", abuffer);
+			goto error;
+		}
+		total += bytes_sent;
 	}
 
 	log_debug("Sent message to %s", abuffer);
 	log_debug("--%s--", buffer);
 
-	return bytes_sent;
+	return total;
 
 error:
 	return -1;
@@ -123,24 +132,30 @@ int accept_connection(int listenfd)
 
 	log_info("Accepted connection from %s:%d",
 		inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+	metrics_count(server_metrics, METRICS_ACCEPTED, 1);
 
 	return sockfd;
 }
 
 /*
- * Handle a new connection.
+ * Serve a connection accepted at accepted_ns (metrics_now_ns()).
  */
 
-void handle_connection(int connectfd)
+static void serve_connection(int connectfd, uint64_t accepted_ns)
 {
 	char buffer[BUFSIZ];
 	ssize_t bytes;
 	unsigned long num;
+	uint64_t start;
 
 	/* Read data. */
+	start = metrics_start(server_metrics);
 	bytes = receive_data(connectfd, buffer, BUFSIZ);
+	metrics_record_since(server_metrics, METRICS_READ, start);
 	if (bytes < 0)
 		goto end;
+	metrics_count(server_metrics, METRICS_REQUESTS, 1);
+	metrics_count(server_metrics, METRICS_BYTES_IN, bytes);
 
 	num = (unsigned int) strtoul(buffer, NULL, 10);
 	if (errno == ERANGE) {
@@ -153,13 +168,42 @@ void handle_connection(int connectfd)
 		goto send;
 	}
 
+	start = metrics_start(server_metrics);
 	num = fibonacci(num);
+	metrics_record_since(server_metrics, METRICS_COMPUTE, start);
 	snprintf(buffer, BUFSIZ, "%lu", num);
 
 send:
 	/* Send data. Fall through, irrespective of result. */
-	send_data(connectfd, buffer, strlen(buffer));
+	start = metrics_start(server_metrics);
+	bytes = send_data(connectfd, buffer, strlen(buffer));
+	metrics_record_since(server_metrics, METRICS_SEND, start);
+	if (bytes < 0)
+		metrics_count(server_metrics, METRICS_ERRORS, 1);
+	else
+		metrics_count(server_metrics, METRICS_BYTES_OUT, bytes);
 
 end:
 	close(connectfd);
+	metrics_count(server_metrics, METRICS_CLOSED, 1);
+	metrics_record_since(server_metrics, METRICS_CONNECTION, accepted_ns);
+}
+
+/*
+ * Handle a new connection.
+ */
+
+void handle_connection(int connectfd)
+{
+	serve_connection(connectfd, metrics_start(server_metrics));
+}
+
+/*
+ * Handle a connection that waited for a worker since accepted_ns.
+ */
+
+void handle_connection_queued(int connectfd, uint64_t accepted_ns)
+{
+	metrics_record_since(server_metrics, METRICS_QUEUE, accepted_ns);
+	serve_connection(connectfd, accepted_ns);
 }
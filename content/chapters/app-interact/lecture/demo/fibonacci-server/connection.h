@@ -3,7 +3,15 @@
 #ifndef CONNECTION_H_
 #define CONNECTION_H_	1
 
+#include <stdint.h>
+
+struct metrics;
+
+/* metrics of the server, NULL if they are not collected */
+extern struct metrics *server_metrics;
+
 int accept_connection(int listenfd);
 void handle_connection(int connectfd);
+void handle_connection_queued(int connectfd, uint64_t accepted_ns);
 
 #endif /* CONNECTION_H_ */
@@ -12,6 +12,7 @@
 #include "utils/utils.h"
 #include "utils/log/log.h"
 #include "utils/sock/sock_util.h"
+#include "utils/metrics/metrics.h"
 
 #include "./task.h"
 #include "./connection.h"
@@ -25,7 +26,7 @@ static void handle(void)
 		struct task *t;
 
 		t = get_task(ts);
-		handle_connection(t->fd);
+		handle_connection_queued(t->fd, t->accepted_ns);
 	}
 }
 
@@ -71,25 +72,30 @@ static void run_server(int port)
 	while (1) {
 		struct task *t;
 		int connectfd;	/* client communication socket */
+		uint64_t accepted_ns;
 
 		connectfd = accept_connection(listenfd);
 		DIE(connectfd < 0, "accept_connection");
+		accepted_ns = metrics_start(server_metrics);
 
 		/* Create task and it to task list. */
 		t = create_task(connectfd);
 		DIE(t == NULL, "create_task");
+		t->accepted_ns = accepted_ns;
 
+		/* Blocks while the task set is full. */
 		put_task(ts, t);
+		metrics_record_since(server_metrics, METRICS_ACCEPT, accepted_ns);
 	}
 }
 
 int main(int argc, char **argv)
 {
-	int port;
+	int port, metrics_port = 0;
 	long num_cores;
 
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s port\n", argv[0]);
+	if (argc != 2 && argc != 3) {
+		fprintf(stderr, "Usage: %s port [metrics_port]\n", argv[0]);
 		exit(EXIT_FAILURE);
 	}
 
@@ -101,14 +107,35 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
+	if (argc == 3) {
+		metrics_port = (int) strtol(argv[2], NULL, 10);
+		DIE(errno == ERANGE, "strtol");
+	}
+
 	/* Create task set. */
 	ts = create_task_set(MAX_CAPACITY, 1);
 	DIE(ts == NULL, "create_task_set");
 
 	num_cores = get_nprocs();
+
+	/*
+	 * Metrics are in a shared mapping: create them before the workers,
+	 * with a slot for each worker and one for this process.
+	 */
+	if (metrics_port > 0) {
+		server_metrics = metrics_create(num_cores + 1);
+		DIE(server_metrics == NULL, "metrics_create");
+	}
+
 	log_info("Creating pool of %ld processes\n", num_cores);
 	create_process_pool(num_cores);
 
+	if (metrics_port > 0) {
+		DIE(metrics_serve(server_metrics, metrics_port) < 0,
+			"metrics_serve");
+		log_info("Serving metrics on port %d", metrics_port);
+	}
+
 	log_info("Starting server on port %d", port);
 	run_server(port);
 
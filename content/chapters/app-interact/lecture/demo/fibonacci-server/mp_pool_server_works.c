@@ -12,10 +12,12 @@
 #include "utils/utils.h"
 #include "utils/log/log.h"
 #include "utils/sock/sock_util.h"
+#include "utils/metrics/metrics.h"
 
 #include "./connection.h"
 
 int listenfd;
+static int metrics_port;
 
 static void handle(void)
 {
@@ -64,6 +66,13 @@ static void create_process_pool(size_t num_processes, int port)
 		}
 	}
 
+	/* Serve the metrics of all processes from the parent. */
+	if (server_metrics != NULL) {
+		DIE(metrics_serve(server_metrics, metrics_port) < 0,
+			"metrics_serve");
+		log_info("Serving metrics on port %d", metrics_port);
+	}
+
 	/* Parent process itself does the handling. */
 	handle();
 }
@@ -73,8 +82,8 @@ int main(int argc, char **argv)
 	int port;
 	long num_cores;
 
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s port\n", argv[0]);
+	if (argc != 2 && argc != 3) {
+		fprintf(stderr, "Usage: %s port [metrics_port]\n", argv[0]);
 		exit(EXIT_FAILURE);
 	}
 
@@ -87,6 +96,15 @@ int main(int argc, char **argv)
 	}
 
 	num_cores = get_nprocs() - 1;
+
+	/* shared by the processes: a slot for each of them */
+	if (argc == 3) {
+		metrics_port = (int) strtol(argv[2], NULL, 10);
+		DIE(errno == ERANGE, "strtol");
+		server_metrics = metrics_create(num_cores + 1);
+		DIE(server_metrics == NULL, "metrics_create");
+	}
+
 	log_info("Creating pool of %ld processes\n", num_cores);
 	create_process_pool(num_cores, port);
 
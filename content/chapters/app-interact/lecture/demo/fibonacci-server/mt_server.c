@@ -15,14 +15,24 @@
 #include "utils/utils.h"
 #include "utils/log/log.h"
 #include "utils/sock/sock_util.h"
+#include "utils/metrics/metrics.h"
 
 #include "./connection.h"
 
+/* metrics slots, reused by new threads when others exit */
+#define METRICS_SLOTS	64
+
+struct thread_arg {
+	int connectfd;
+	uint64_t accepted_ns;
+};
+
 static void *thread_handle(void *arg)
 {
-	int connectfd = (int) ((long) arg);
+	struct thread_arg targ = *(struct thread_arg *) arg;
 
-	handle_connection(connectfd);
+	free(arg);
+	handle_connection_queued(targ.connectfd, targ.accepted_ns);
 
 	return NULL;
 }
@@ -32,16 +42,29 @@ static void handle_in_new_thread(int connectfd)
 	int rc;
 	pthread_t tid;
 	pthread_attr_t attr;
+	struct thread_arg *targ;
+	uint64_t accepted_ns = metrics_start(server_metrics);
+
+	targ = malloc(sizeof(*targ));
+	if (targ == NULL) {
+		ERR(1, "malloc");
+		close(connectfd);
+		return;
+	}
+	targ->connectfd = connectfd;
+	targ->accepted_ns = accepted_ns;
 
 	pthread_attr_init(&attr);
 	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 
-	rc = pthread_create(&tid, &attr, thread_handle, (void *) (long) connectfd);
+	rc = pthread_create(&tid, &attr, thread_handle, targ);
 	if (rc != 0) {
 		ERR(rc != 0, "pthread_create");
+		free(targ);
 		close(connectfd);
 		goto end;
 	}
+	metrics_record_since(server_metrics, METRICS_ACCEPT, accepted_ns);
 
 	log_info("Created thread with ID %lu to handle connection.", tid);
 
@@ -67,10 +90,10 @@ static void run_server(int port)
 
 int main(int argc, char **argv)
 {
-	int port;
+	int port, metrics_port = 0;
 
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s port\n", argv[0]);
+	if (argc != 2 && argc != 3) {
+		fprintf(stderr, "Usage: %s port [metrics_port]\n", argv[0]);
 		exit(EXIT_FAILURE);
 	}
 
@@ -82,6 +105,19 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
+	if (argc == 3) {
+		metrics_port = (int) strtol(argv[2], NULL, 10);
+		DIE(errno == ERANGE, "strtol");
+	}
+
+	if (metrics_port > 0) {
+		server_metrics = metrics_create(METRICS_SLOTS);
+		DIE(server_metrics == NULL, "metrics_create");
+		DIE(metrics_serve(server_metrics, metrics_port) < 0,
+			"metrics_serve");
+		log_info("Serving metrics on port %d", metrics_port);
+	}
+
 	log_info("Starting server on port %d", port);
 	run_server(port);
 
@@ -19,6 +19,7 @@ struct task *create_task(int fd)
 		return NULL;
 
 	t->fd = fd;
+	t->accepted_ns = 0;
 
 	return t;
 }
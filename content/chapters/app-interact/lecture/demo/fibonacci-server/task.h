@@ -4,11 +4,13 @@
 #define TASK_H_		1
 
 #include <semaphore.h>
+#include <stdint.h>
 
 #define MAX_CAPACITY	100
 
 struct task {
 	int fd;
+	uint64_t accepted_ns;	/* for queueing time metrics */
 };
 
 struct task_set {
@@ -38,13 +38,60 @@
 
 /* Github link: https://github.com/AlexanderAgd/CLIST */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
 #include "clist.h"
 
+#define CLIST_SEG_SHIFT  4    /* CLIST_SEGMENTED: first segment holds 16 items, each next one twice more */
+#define CLIST_SEGMENTS   27   /* Segments needed for INT_MAX items */
+#define CLIST_STRIPES    16   /* CLIST_CONCURRENT: seqlocks guarding replace, chosen by index */
+#define CLIST_CHUNK_MIN  5    /* CLIST_CHUNKED: chunks hold 32 items at first */
+#define CLIST_CHUNK_MAX  18   /* Chunks stop growing once there is room for INT_MAX items */
+
+typedef struct
+{
+  unsigned seq;       /* Odd while an item of this stripe is replaced */
+} __attribute__((aligned(64))) CList_stripe_;
+
+typedef struct
+{
+  pthread_rwlock_t lock;      /* Shared for add, replace, at, searches; exclusive for the rest */
+  pthread_mutex_t grow_lock;  /* Taken by add to append a segment, in segmented mode */
+  pthread_mutex_t index_lock; /* Taken to use the hash index with the lock held shared */
+  uint64_t slots;             /* Slots handed out to add << 32 | adds still writing their item */
+  CList_stripe_ stripes[CLIST_STRIPES];
+} CList_sync_;
+
+typedef struct
+{
+  char *data;         /* Ring of 1 << chunk_shift items */
+  int head;           /* Position of the first item of the chunk in data */
+} CList_chunk_;
+
+typedef struct
+{
+  uint32_t hash;      /* Hash of the indexed bytes of the item */
+  int next;           /* Next item in the same bucket, -1 at the end */
+} CList_node_;
+
+typedef struct
+{
+  size_t shift;       /* Indexed bytes of the items, as given to firstMatch */
+  size_t size;
+  int string;
+  int stale;          /* Items moved by insert or remove, rebuilt by the next search */
+  int num_buckets;    /* Power of two, heads of the chains of nodes */
+  int *buckets;
+  int alloc_nodes;    /* nodes[n] describes item n */
+  CList_node_ *nodes;
+} CList_hash_;
+
 typedef struct
 {
   int count;          /* Number of items in the list. */
@@ -52,12 +99,591 @@ typedef struct
   int lastSearchPos;  /* Position of last search - firstMatch or LastMatch */
   size_t item_size;   /* Size of each item in bytes. */
   void *items;        /* Pointer to the list */
+  int mode;           /* CLIST_CONCURRENT, CLIST_SEGMENTED */
+  int num_segments;   /* Segments allocated in segmented mode, instead of items */
+  void *segments[CLIST_SEGMENTS];
+  int chunk_shift;    /* Chunked mode: item n is item n & mask of chunk n >> chunk_shift */
+  int num_chunks;     /* All the chunks before the one holding item count - 1 are full */
+  CList_chunk_ *chunks;
+  CList_sync_ *sync;  /* NULL unless concurrent */
+  CList_hash_ *hash;  /* NULL unless hashIndex was called */
 } CList_priv_;  
 
+/* Count is written by concurrent add() calls while other threads read it */
+static inline int CList_count_(CList_priv_ *p)
+{
+  return __atomic_load_n(&p->count, __ATOMIC_ACQUIRE);
+}
+
+static inline void CList_setSearchPos_(CList_priv_ *p, int n)
+{
+  __atomic_store_n(&p->lastSearchPos, n, __ATOMIC_RELAXED);
+}
+
+/* Index of the first item of segment k */
+static inline size_t CList_segStart_(int k)
+{
+  return ((size_t) 1 << (k + CLIST_SEG_SHIFT)) - ((size_t) 1 << CLIST_SEG_SHIFT);
+}
+
+static inline int CList_segOf_(int n)
+{
+  return 31 - __builtin_clz(((unsigned) n >> CLIST_SEG_SHIFT) + 1);
+}
+
+static inline char *CList_item_(CList_priv_ *p, int n)
+{
+  if (p->mode & CLIST_CHUNKED)
+  {
+    CList_chunk_ *ch = &p->chunks[n >> p->chunk_shift];
+    int mask = (1 << p->chunk_shift) - 1;
+    return ch->data + (size_t) ((ch->head + n) & mask) * p->item_size;
+  }
+
+  if (!(p->mode & CLIST_SEGMENTED))
+    return (char*) p->items + (size_t) n * p->item_size;
+
+  int k = CList_segOf_(n);
+  return (char*) p->segments[k] + (n - CList_segStart_(k)) * p->item_size;
+}
+
+static inline int CList_min_(int a, size_t b, size_t c)
+{
+  size_t m = b < c ? b : c;
+  return (size_t) a < m ? a : (int) m;
+}
+
+/* Returns item n and sets len to the number of items stored after it without a gap, up to count */
+static inline char *CList_span_(CList_priv_ *p, int n, int count, int *len)
+{
+  if (p->mode & CLIST_CHUNKED)
+  {
+    int size = 1 << p->chunk_shift;
+    int pos = (p->chunks[n >> p->chunk_shift].head + n) & (size - 1);
+    int end = ((n >> p->chunk_shift) + 1) << p->chunk_shift;
+
+    /* Up to the end of the chunk or of its ring */
+    *len = CList_min_(count - n, end - n, size - pos);
+    return CList_item_(p, n);
+  }
+
+  if (!(p->mode & CLIST_SEGMENTED))
+  {
+    *len = count - n;
+    return (char*) p->items + (size_t) n * p->item_size;
+  }
+
+  int k = CList_segOf_(n);
+  size_t end = CList_segStart_(k + 1);
+  *len = (end < (size_t) count ? (int) end : count) - n;
+  return (char*) p->segments[k] + (n - CList_segStart_(k)) * p->item_size;
+}
+
+/* Move count items from index src to index dst, the ranges may overlap */
+static void CList_move_(CList_priv_ *p, int dst, int src, int count)
+{
+  size_t step = p->item_size;
+  int chunk;
+
+  if (!(p->mode & CLIST_SEGMENTED))
+  {
+    char *data = (char*) p->items;
+    memmove(data + dst * step, data + src * step, count * step);
+  }
+  else if (dst < src)
+  {
+    /* From the front, as many items at once as both segments hold */
+    while (count > 0)
+    {
+      chunk = CList_min_(count, CList_segStart_(CList_segOf_(src) + 1) - src,
+                         CList_segStart_(CList_segOf_(dst) + 1) - dst);
+      memmove(CList_item_(p, dst), CList_item_(p, src), chunk * step);
+      src += chunk;
+      dst += chunk;
+      count -= chunk;
+    }
+  }
+  else if (dst > src)
+  {
+    /* From the back */
+    while (count > 0)
+    {
+      int src_end = src + count, dst_end = dst + count;
+      chunk = CList_min_(count, src_end - CList_segStart_(CList_segOf_(src_end - 1)),
+                         dst_end - CList_segStart_(CList_segOf_(dst_end - 1)));
+      memmove(CList_item_(p, dst_end - chunk), CList_item_(p, src_end - chunk), chunk * step);
+      count -= chunk;
+    }
+  }
+}
+
+/* Segments are added or freed at the end, the items never move */
+static int CList_ReallocSegments_(CList_priv_ *p, int n)
+{
+  while (p->alloc_size < n)
+  {
+    int k = p->num_segments;
+    if (k == CLIST_SEGMENTS)
+    {
+      fprintf(stderr, "CList: ERROR! Can not reallocate to '%i' items\n", n);
+      return 0;
+    }
+
+    void *ptr = malloc(p->item_size * ((size_t) 1 << (k + CLIST_SEG_SHIFT)));
+    if (ptr == NULL)
+    {
+      fprintf(stderr, "CList: ERROR! Can not reallocate memory!\n");
+      return 0;
+    }
+    p->segments[k] = ptr;
+    p->num_segments++;
+    /* Concurrent add() checks alloc_size before using the new segment */
+    __atomic_store_n(&p->alloc_size, (int) CList_segStart_(k + 1), __ATOMIC_RELEASE);
+  }
+
+  while (p->num_segments > 1 && (int) CList_segStart_(p->num_segments - 1) >= n)
+  {
+    int k = --p->num_segments;
+    free(p->segments[k]);
+    p->segments[k] = NULL;
+    p->alloc_size = CList_segStart_(k);
+  }
+
+  return 1;
+}
+
+/*** CLIST_CHUNKED: insert and remove move O(sqrt(count)) items ***/
+
+/* Move count items of a chunk from position src to dst, counted from its head */
+static void CList_ringMove_(CList_priv_ *p, CList_chunk_ *ch, int dst, int src, int count)
+{
+  int size = 1 << p->chunk_shift, mask = size - 1;
+  size_t step = p->item_size;
+  int chunk, s, d;
+
+  if (dst < src)
+  {
+    while (count > 0)
+    {
+      s = (ch->head + src) & mask;
+      d = (ch->head + dst) & mask;
+      chunk = CList_min_(count, size - s, size - d);
+      memmove(ch->data + d * step, ch->data + s * step, chunk * step);
+      src += chunk;
+      dst += chunk;
+      count -= chunk;
+    }
+  }
+  else if (dst > src)
+  {
+    while (count > 0)
+    {
+      s = ((ch->head + src + count - 1) & mask) + 1;
+      d = ((ch->head + dst + count - 1) & mask) + 1;
+      chunk = CList_min_(count, s, d);
+      memmove(ch->data + (d - chunk) * step, ch->data + (s - chunk) * step, chunk * step);
+      count -= chunk;
+    }
+  }
+}
+
+/* Make room for item n, there is a free slot after item count - 1 */
+static void CList_chunkInsert_(CList_priv_ *p, int n)
+{
+  int mask = (1 << p->chunk_shift) - 1;
+  int c = n >> p->chunk_shift, last = p->count >> p->chunk_shift;
+  size_t step = p->item_size;
+  CList_chunk_ *ch, *prev;
+  int k;
+
+  /* Each chunk after c takes the last item of the one before it */
+  for (k = last; k > c; k--)
+  {
+    ch = &p->chunks[k];
+    prev = &p->chunks[k - 1];
+    ch->head = (ch->head - 1) & mask;
+    memcpy(ch->data + ch->head * step, prev->data + ((prev->head + mask) & mask) * step, step);
+  }
+
+  /* Chunk c has len items and a free slot at each end of the ring, shift the shorter side */
+  int i = n & mask;
+  int len = c == last ? p->count & mask : mask;
+  ch = &p->chunks[c];
+  if (i < len - i)
+  {
+    CList_ringMove_(p, ch, -1, 0, i);
+    ch->head = (ch->head - 1) & mask;
+  }
+  else
+    CList_ringMove_(p, ch, i + 1, i, len - i);
+}
+
+/* Close the gap left by item n, before count is decreased */
+static void CList_chunkRemove_(CList_priv_ *p, int n)
+{
+  int mask = (1 << p->chunk_shift) - 1;
+  int c = n >> p->chunk_shift, last = (p->count - 1) >> p->chunk_shift;
+  size_t step = p->item_size;
+  CList_chunk_ *ch, *prev;
+  int k;
+
+  int i = n & mask;
+  int len = c == last ? p->count - (c << p->chunk_shift) : mask + 1;
+  ch = &p->chunks[c];
+  if (i < len - 1 - i)
+  {
+    CList_ringMove_(p, ch, 1, 0, i);
+    ch->head = (ch->head + 1) & mask;
+  }
+  else
+    CList_ringMove_(p, ch, i, i + 1, len - 1 - i);
+
+  /* Each chunk after c gives its first item to the one before it */
+  for (k = c + 1; k <= last; k++)
+  {
+    ch = &p->chunks[k];
+    prev = &p->chunks[k - 1];
+    memcpy(prev->data + ((prev->head + mask) & mask) * step, ch->data + ch->head * step, step);
+    ch->head = (ch->head + 1) & mask;
+  }
+}
+
+static void CList_freeChunks_(CList_chunk_ *chunks, int num)
+{
+  while (num > 0)
+    free(chunks[--num].data);
+  free(chunks);
+}
+
+/* Copy the items to chunks of 1 << shift items, the hash index stays valid */
+static int CList_rechunk_(CList_priv_ *p, int shift)
+{
+  int num = (p->count >> shift) + 1;
+  size_t step = p->item_size;
+  CList_chunk_ *chunks = calloc(num, sizeof(CList_chunk_));
+  int n, len;
+
+  if (chunks == NULL)
+    goto fail;
+  for (n = 0; n < num; n++)
+    if ((chunks[n].data = malloc(step << shift)) == NULL)
+      goto fail;
+
+  /* An old chunk fits in a new one, a span never crosses two */
+  for (n = 0; n < p->count; n += len)
+  {
+    char *src = CList_span_(p, n, p->count, &len);
+    memcpy(chunks[n >> shift].data + (size_t) (n & ((1 << shift) - 1)) * step, src, len * step);
+  }
+
+  CList_freeChunks_(p->chunks, p->num_chunks);
+  p->chunks = chunks;
+  p->num_chunks = num;
+  p->chunk_shift = shift;
+  p->alloc_size = num << shift;
+  return 1;
+
+fail:
+  if (chunks)
+    CList_freeChunks_(chunks, num);
+  fprintf(stderr, "CList: ERROR! Can not reallocate memory!\n");
+  return 0;
+}
+
+/*
+ * Chunks are added or freed at the end. Moving an item between two chunks costs about as
+ * much as shifting 16 items within one, so chunks grow to keep 16 times fewer of them than
+ * the items each one holds: count <= size^2 / 16.
+ */
+static int CList_ReallocChunks_(CList_priv_ *p, int n)
+{
+  int shift = p->chunk_shift;
+  while (shift < CLIST_CHUNK_MAX && ((size_t) 1 << (2 * shift - 4)) < (size_t) n)
+    shift++;
+  if (shift != p->chunk_shift && CList_rechunk_(p, shift) == 0)
+    return 0;
+
+  int num = (int) (((size_t) n + (1 << shift) - 1) >> shift);
+  if (num == 0)
+    num = 1;
+
+  while (p->num_chunks > num)
+    free(p->chunks[--p->num_chunks].data);
+
+  CList_chunk_ *chunks = realloc(p->chunks, num * sizeof(CList_chunk_));
+  if (chunks == NULL)
+  {
+    fprintf(stderr, "CList: ERROR! Can not reallocate memory!\n");
+    return 0;
+  }
+  p->chunks = chunks;
+
+  while (p->num_chunks < num)
+  {
+    CList_chunk_ *ch = &p->chunks[p->num_chunks];
+    if ((ch->data = malloc(p->item_size << shift)) == NULL)
+    {
+      fprintf(stderr, "CList: ERROR! Can not reallocate memory!\n");
+      p->alloc_size = p->num_chunks << shift;
+      return 0;
+    }
+    ch->head = 0;
+    p->num_chunks++;
+  }
+
+  p->alloc_size = num << shift;
+  return 1;
+}
+
+/*** Hash index for firstMatch and lastMatch ***/
+
+static inline int CList_compare_(const char *data, const void *o, size_t size, int string)
+{
+  return string ? strncmp(data, o, size) : memcmp(data, o, size);
+}
+
+#define CLIST_UNLINKED  (-2)  /* next of a node whose item is not in the index */
+#define CLIST_NO_INDEX  (-2)  /* The search can't use the index */
+
+static void CList_hashLock_(CList_priv_ *p)
+{
+  if (p->sync)
+    pthread_mutex_lock(&p->sync->index_lock);
+}
+
+static void CList_hashUnlock_(CList_priv_ *p)
+{
+  if (p->sync)
+    pthread_mutex_unlock(&p->sync->index_lock);
+}
+
+/* FNV-1a, strings end at the null byte like for strncmp */
+static uint32_t CList_hashKey_(const void *key, size_t size, int string)
+{
+  const unsigned char *c = key;
+  uint32_t hash = 2166136261u;
+  size_t i;
+
+  for (i = 0; i < size && !(string && c[i] == '\0'); i++)
+    hash = (hash ^ c[i]) * 16777619u;
+
+  return hash;
+}
+
+static uint32_t CList_hashItem_(CList_priv_ *p, int n)
+{
+  CList_hash_ *h = p->hash;
+  return CList_hashKey_(CList_item_(p, n) + h->shift, h->size, h->string);
+}
+
+static void CList_hashLink_(CList_hash_ *h, int n, uint32_t hash)
+{
+  int b = hash & (h->num_buckets - 1);
+  h->nodes[n].hash = hash;
+  h->nodes[n].next = h->buckets[b];
+  h->buckets[b] = n;
+}
+
+static void CList_hashUnlink_(CList_hash_ *h, int n)
+{
+  if (n >= h->alloc_nodes || h->nodes[n].next == CLIST_UNLINKED)
+    return;
+
+  int *link = &h->buckets[h->nodes[n].hash & (h->num_buckets - 1)];
+  while (*link != n)
+    link = &h->nodes[*link].next;
+  *link = h->nodes[n].next;
+  h->nodes[n].next = CLIST_UNLINKED;
+}
+
+/* Make room for node n, with one bucket per node */
+static int CList_hashReserve_(CList_hash_ *h, int n)
+{
+  int alloc = h->alloc_nodes ? h->alloc_nodes : 16;
+  int i;
+
+  if (n < h->alloc_nodes)
+    return 1;
+  while (alloc <= n)
+    alloc *= 2;
+
+  CList_node_ *nodes = realloc(h->nodes, alloc * sizeof(CList_node_));
+  int *buckets = malloc(alloc * sizeof(int));
+  if (nodes != NULL)
+    h->nodes = nodes;
+  if (nodes == NULL || buckets == NULL)
+  {
+    fprintf(stderr, "CList: ERROR! Can not allocate hash index!\n");
+    free(buckets);
+    return 0;
+  }
+
+  for (i = h->alloc_nodes; i < alloc; i++)
+    nodes[i].next = CLIST_UNLINKED;
+  h->alloc_nodes = alloc;
+
+  free(h->buckets);
+  h->buckets = buckets;
+  h->num_buckets = alloc;
+  memset(buckets, 0xff, alloc * sizeof(int));  /* All -1 */
+  for (i = 0; i < alloc; i++)
+  {
+    if (nodes[i].next != CLIST_UNLINKED)
+      CList_hashLink_(h, i, nodes[i].hash);
+  }
+
+  return 1;
+}
+
+static int CList_hashRebuild_(CList_priv_ *p)
+{
+  CList_hash_ *h = p->hash;
+  int i;
+
+  for (i = 0; i < h->alloc_nodes; i++)
+    h->nodes[i].next = CLIST_UNLINKED;
+  if (h->buckets)
+    memset(h->buckets, 0xff, h->num_buckets * sizeof(int));
+
+  if (p->count > 0 && CList_hashReserve_(h, p->count - 1) == 0)
+  {
+    h->stale = 1;
+    return 0;
+  }
+
+  for (i = 0; i < p->count; i++)
+    CList_hashLink_(h, i, CList_hashItem_(p, i));
+  h->stale = 0;
+  return 1;
+}
+
+/* Item n was stored at the end of the list */
+static void CList_hashAdd_(CList_priv_ *p, int n)
+{
+  CList_hash_ *h = p->hash;
+  if (h == NULL)
+    return;
+
+  CList_hashLock_(p);
+  if (!h->stale)
+  {
+    if (CList_hashReserve_(h, n))
+      CList_hashLink_(h, n, CList_hashItem_(p, n));
+    else
+      h->stale = 1;
+  }
+  CList_hashUnlock_(p);
+}
+
+/* Item n got a new value */
+static void CList_hashUpdate_(CList_priv_ *p, int n)
+{
+  CList_hash_ *h = p->hash;
+  if (h == NULL)
+    return;
+
+  CList_hashLock_(p);
+  if (!h->stale)
+  {
+    CList_hashUnlink_(h, n);
+    if (CList_hashReserve_(h, n))
+      CList_hashLink_(h, n, CList_hashItem_(p, n));
+    else
+      h->stale = 1;
+  }
+  CList_hashUnlock_(p);
+}
+
+/* Item n, the last one, is removed */
+static void CList_hashRemove_(CList_priv_ *p, int n)
+{
+  CList_hash_ *h = p->hash;
+  if (h == NULL)
+    return;
+
+  CList_hashLock_(p);
+  if (!h->stale)
+    CList_hashUnlink_(h, n);
+  CList_hashUnlock_(p);
+}
+
+/*
+ * Items moved: updating the positions would cost as much as a rebuild, which
+ * is left to the next search so that a run of inserts or removes pays once
+ */
+static void CList_hashInvalidate_(CList_priv_ *p)
+{
+  if (p->hash == NULL)
+    return;
+
+  CList_hashLock_(p);
+  p->hash->stale = 1;
+  CList_hashUnlock_(p);
+}
+
+/* Returns the index of the first or last match, -1 or CLIST_NO_INDEX */
+static int CList_hashFind_(CList_priv_ *p, const void *o, size_t shift, size_t size,
+                           int string, int last)
+{
+  CList_hash_ *h = p->hash;
+  if (h == NULL || h->shift != shift || h->size != size || h->string != string)
+    return CLIST_NO_INDEX;
+
+  CList_hashLock_(p);
+  /* With CLIST_CONCURRENT, only a search holding the lock exclusively rebuilds */
+  if (h->stale && (p->sync || CList_hashRebuild_(p) == 0))
+  {
+    CList_hashUnlock_(p);
+    return CLIST_NO_INDEX;
+  }
+
+  uint32_t hash = CList_hashKey_(o, size, string);
+  int count = CList_count_(p), best = -1, j;
+
+  for (j = h->num_buckets ? h->buckets[hash & (h->num_buckets - 1)] : -1; j >= 0;
+       j = h->nodes[j].next)
+  {
+    /* Items still being added are not counted yet */
+    if (h->nodes[j].hash == hash && j < count && (best < 0 || (last ? j > best : j < best)) &&
+        CList_compare_(CList_item_(p, j) + shift, o, size, string) == 0)
+      best = j;
+  }
+  CList_hashUnlock_(p);
+
+  return best;
+}
+
+int CList_hashIndex_(CList *l, size_t shift, size_t size, int string)
+{
+  CList_priv_ *p = (CList_priv_*) l->priv;
+
+  if (shift + size > p->item_size)
+  {
+    fprintf(stderr, "CList: ERROR! Wrong ranges for hashIndex - "
+                "shift '%zu', size '%zu', item_size '%zu'\n", shift, size, p->item_size);
+    assert(shift + size <= p->item_size);
+    return 0;
+  }
+
+  if (shift == 0 && size == 0)
+    size = p->item_size;
+
+  if (p->hash == NULL && (p->hash = calloc(1, sizeof(CList_hash_))) == NULL)
+  {
+    fprintf(stderr, "CList: ERROR! Can not allocate hash index!\n");
+    return 0;
+  }
+
+  p->hash->shift = shift;
+  p->hash->size = size;
+  p->hash->string = string;
+  return CList_hashRebuild_(p);
+}
+
 int CList_Realloc_(CList *l, int n)
 {
   CList_priv_ *p = (CList_priv_*) l->priv;
-  if (n < p->count)
+  if (n < CList_count_(p))
   {
     fprintf(stderr, "CList: ERROR! Can not realloc to '%i' size - count is '%i'\n", n, p->count);
     assert(n >= p->count);
@@ -67,6 +693,11 @@ int CList_Realloc_(CList *l, int n)
   if (n == 0 && p->alloc_size == 0)
     n = 2;
 
+  if (p->mode & CLIST_SEGMENTED)
+    return CList_ReallocSegments_(p, n);
+  if (p->mode & CLIST_CHUNKED)
+    return CList_ReallocChunks_(p, n);
+
   void *ptr = realloc(p->items, p->item_size * n);
   if (ptr == NULL)
   {
@@ -85,10 +716,10 @@ void *CList_Add_(CList *l, void *o)
         CList_Realloc_(l, p->alloc_size * 2) == 0)
     return NULL;
   
-  char *data = (char*) p->items;
-  data = data + p->count * p->item_size;
+  char *data = CList_item_(p, p->count);
   memcpy(data, o, p->item_size);
   p->count++;
+  CList_hashAdd_(p, p->count - 1);
   return data;
 }
 
@@ -107,28 +738,35 @@ void *CList_Insert_(CList *l, void *o, int n)
         CList_Realloc_(l, p->alloc_size * 2) == 0)
     return NULL;
 
-  size_t step = p->item_size;
-  char *data = (char*) p->items + n * step;
-  memmove(data + step, data, (p->count - n) * step);
-  memcpy(data, o, step);
+  if (p->mode & CLIST_CHUNKED)
+    CList_chunkInsert_(p, n);
+  else
+    CList_move_(p, n + 1, n, p->count - n);
+  char *data = CList_item_(p, n);
+  memcpy(data, o, p->item_size);
   p->count++;
+  if (n == p->count - 1)
+    CList_hashAdd_(p, n);
+  else
+    CList_hashInvalidate_(p);
   return data;
 }
 
 void *CList_Replace_(CList *l, void *o, int n)
 {
   CList_priv_ *p = (CList_priv_*) l->priv;
-  if (n < 0 || n >= p->count)
+  int count = CList_count_(p);
+  if (n < 0 || n >= count)
   {
     fprintf(stderr, "CList: ERROR! Replace position outside range - %d; n - %d.\n", 
-                        p->count, n);
-    assert(n >= 0 && n < p->count);
+                        count, n);
+    assert(n >= 0 && n < count);
     return NULL;
   }
 
-  char *data = (char*) p->items;
-  data = data + n * p->item_size;
+  char *data = CList_item_(p, n);
   memcpy(data, o, p->item_size);
+  CList_hashUpdate_(p, n);
   return data;
 }
 
@@ -143,9 +781,14 @@ void CList_Remove_(CList *l, int n)
     return;
   }
 
-  size_t step = p->item_size;
-  char *data = (char*)p->items + n * step;
-  memmove(data, data + step, (p->count - n - 1) * step);
+  if (n == p->count - 1)
+    CList_hashRemove_(p, n);
+  else
+    CList_hashInvalidate_(p);
+  if (p->mode & CLIST_CHUNKED)
+    CList_chunkRemove_(p, n);
+  else
+    CList_move_(p, n, n + 1, p->count - n - 1);
   p->count--;
 
   if (p->alloc_size > 3 * p->count && p->alloc_size >= 4) /* Dont hold much memory */
@@ -155,117 +798,122 @@ void CList_Remove_(CList *l, int n)
 void *CList_At_(CList *l, int n)
 {
   CList_priv_ *p = (CList_priv_*) l->priv;
-  if (n < 0 || n >= p->count)
+  int count = CList_count_(p);
+  if (n < 0 || n >= count)
   {
     fprintf(stderr, "CList: ERROR! Get position outside range - %d; n - %d.\n", 
-                      p->count, n);
-    assert(n >= 0 && n < p->count);
+                      count, n);
+    assert(n >= 0 && n < count);
     return NULL;
   }
 
-  char *data = (char*) p->items;
-  data = data + n * p->item_size;
-  return data;
+  return CList_item_(p, n);
 }
 
-void *CList_firstMatch_(CList *l, const void *o, size_t shift, size_t size, int string)
+/* Index of the first match from item n up, or -1 */
+static int CList_findNext_(CList_priv_ *p, const void *o, size_t shift, size_t size,
+                           int string, int n)
 {
-  CList_priv_ *p = (CList_priv_*) l->priv;    
-  char *data = (char*) p->items;
+  int count = CList_count_(p);
   size_t step = p->item_size;
-  p->lastSearchPos = -1;  
+  int len;
 
-  if (shift + size > p->item_size)
+  while (n < count)
   {
-    fprintf(stderr, "CList: ERROR! Wrong ranges for firstMatch - "
-                "shift '%zu', size '%zu', item_size '%zu'\n", shift, size, p->item_size);
-    assert(shift + size <= p->item_size);
-    return NULL;    
+    char *data = CList_span_(p, n, count, &len) + shift;
+    for (; len > 0; len--, n++, data += step)
+    {
+      if (CList_compare_(data, o, size, string) == 0)
+        return n;
+    }
   }
 
-  if (shift == 0 && size == 0)
-    size = p->item_size;
-
-  size_t i = shift;
-  size_t end = p->count * step;
-  int index = 0;
+  return -1;
+}
 
-  if (string)
+/* Index of the last match from item n down, or -1 */
+static int CList_findPrev_(CList_priv_ *p, const void *o, size_t shift, size_t size,
+                           int string, int n)
+{
+  for (; n >= 0; n--)
   {
-    for (; i < end; i += step, index++)
-    {
-      if (strncmp(data + i, o, size) == 0)
-      {
-        p->lastSearchPos = index;  
-        return (data + i - shift);
-      }
-    }
+    if (CList_compare_(CList_item_(p, n) + shift, o, size, string) == 0)
+      return n;
   }
-  else
+
+  return -1;
+}
+
+static CList_stripe_ *CList_stripe_of_(CList_priv_ *p, int n)
+{
+  return &p->sync->stripes[(unsigned) n % CLIST_STRIPES];
+}
+
+/* Whether item n still matches, compared while no replace() runs on its stripe */
+static int CList_matchStable_(CList_priv_ *p, int n, const void *o, size_t shift,
+                              size_t size, int string)
+{
+  CList_stripe_ *s = CList_stripe_of_(p, n);
+  unsigned seq;
+  int match;
+
+  do
   {
-    for (; i < end; i += step, index++)
-    {
-      if (memcmp(data + i, o, size) == 0)
-      {
-        p->lastSearchPos = index;
-        return (data + i - shift);
-      }
-    }
-  }
+    while ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1)
+      sched_yield();
+    match = CList_compare_(CList_item_(p, n) + shift, o, size, string) == 0;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq);
 
-  return NULL;
+  return match;
 }
 
-void *CList_lastMatch_(struct CList *l, const void *o, size_t shift, size_t size, int string)
+static void *CList_search_(CList *l, const void *o, size_t shift, size_t size, int string,
+                           int last)
 {
   CList_priv_ *p = (CList_priv_*) l->priv;    
-  char *data = (char*) p->items;
-  size_t step = p->item_size;
-  p->lastSearchPos = -1;
+  CList_setSearchPos_(p, -1);
 
   if (shift + size > p->item_size)
   {
-    fprintf(stderr, "CList: ERROR! Wrong ranges for lastMatch - "
-                "shift '%zu', size '%zu', item_size '%zu'\n", shift, size, p->item_size);
-     assert(shift + size <= p->item_size);
-    return NULL;
+    fprintf(stderr, "CList: ERROR! Wrong ranges for %s - "
+                "shift '%zu', size '%zu', item_size '%zu'\n",
+                last ? "lastMatch" : "firstMatch", shift, size, p->item_size);
+    assert(shift + size <= p->item_size);
+    return NULL;    
   }
 
   if (shift == 0 && size == 0)
     size = p->item_size;
 
-  int index = p->count - 1;
-  long i = index * step + shift;
-  if (string)
-  {  
-    for (; i >= 0; i -= step, index--)
-    {
-      if (strncmp(data + i, o, size) == 0)
-      {
-        p->lastSearchPos = index;
-        return (data + i - shift);
-      }
-    }
-  }  
-  else
-  {  
-    for (; i >= 0; i -= step, index--)
-    {
-      if (memcmp(data + i, o, size) == 0)
-      {
-        p->lastSearchPos = index;
-        return (data + i - shift);
-      }
-    }
-  }
+  int index = CList_hashFind_(p, o, shift, size, string, last);
+  if (index == CLIST_NO_INDEX)
+    index = last ? CList_findPrev_(p, o, shift, size, string, CList_count_(p) - 1)
+                 : CList_findNext_(p, o, shift, size, string, 0);
+
+  /* A concurrent replace() may have been writing the item while it was compared */
+  while (index >= 0 && p->sync && !CList_matchStable_(p, index, o, shift, size, string))
+    index = last ? CList_findPrev_(p, o, shift, size, string, index - 1)
+                 : CList_findNext_(p, o, shift, size, string, index + 1);
+
+  CList_setSearchPos_(p, index);
+  return index < 0 ? NULL : CList_item_(p, index);
+}
 
-  return NULL;  
+void *CList_firstMatch_(CList *l, const void *o, size_t shift, size_t size, int string)
+{
+  return CList_search_(l, o, shift, size, string, 0);
+}
+
+void *CList_lastMatch_(struct CList *l, const void *o, size_t shift, size_t size, int string)
+{
+  return CList_search_(l, o, shift, size, string, 1);
 }
 
 int CList_index_(CList *l)
 {
   CList_priv_ *p = (CList_priv_*) l->priv;
-  return p->lastSearchPos;
+  return __atomic_load_n(&p->lastSearchPos, __ATOMIC_RELAXED);
 }
 
 int CList_swap_(CList *l, int a, int b)
@@ -282,29 +930,31 @@ int CList_swap_(CList *l, int a, int b)
 
   if (a == b) return 1; /* ? Good ? :D */
 
-  char *data = (char*) p->items;
   size_t step = p->item_size;
 
   if (p->count == p->alloc_size && 
         CList_Realloc_(l, p->alloc_size + 1) == 0)
     return 0;
 
-  memcpy(data + p->count * step, data + a * step, step);
-  memcpy(data + a * step, data + b * step, step);
-  memcpy(data + b * step, data + p->count * step, step);
+  char *tmp = CList_item_(p, p->count);
+  memcpy(tmp, CList_item_(p, a), step);
+  memcpy(CList_item_(p, a), CList_item_(p, b), step);
+  memcpy(CList_item_(p, b), tmp, step);
+  CList_hashUpdate_(p, a);
+  CList_hashUpdate_(p, b);
   return 1;
 }
 
 int CList_Count_(CList *l)
 {
   CList_priv_ *p = (CList_priv_*) l->priv;
-  return p->count;
+  return CList_count_(p);
 }
 
 int CList_AllocSize_(CList *l)
 {
   CList_priv_ *p = (CList_priv_*) l->priv;
-  return p->alloc_size;
+  return __atomic_load_n(&p->alloc_size, __ATOMIC_RELAXED);
 }
 
 size_t CList_ItemSize_(CList *l)
@@ -318,14 +968,42 @@ void CList_Clear_(CList *l)
   CList_priv_ *p = (CList_priv_*) l->priv;
   free(p->items);
   p->items = NULL;
+  while (p->num_segments > 0)
+  {
+    p->num_segments--;
+    free(p->segments[p->num_segments]);
+    p->segments[p->num_segments] = NULL;
+  }
+  CList_freeChunks_(p->chunks, p->num_chunks);
+  p->chunks = NULL;
+  p->num_chunks = 0;
+  p->chunk_shift = CLIST_CHUNK_MIN;
   p->alloc_size = 0;
   p->count = 0;
+  if (p->hash)
+  {
+    free(p->hash->nodes);
+    free(p->hash->buckets);
+    p->hash->nodes = NULL;
+    p->hash->buckets = NULL;
+    p->hash->alloc_nodes = 0;
+    p->hash->num_buckets = 0;
+    p->hash->stale = 0;
+  }
 }
 
 void CList_Free_(CList *l)
 {
   CList_priv_ *p = (CList_priv_*) l->priv;
-  free(p->items);
+  CList_Clear_(l);
+  free(p->hash);
+  if (p->sync)
+  {
+    pthread_rwlock_destroy(&p->sync->lock);
+    pthread_mutex_destroy(&p->sync->grow_lock);
+    pthread_mutex_destroy(&p->sync->index_lock);
+    free(p->sync);
+  }
   free(p);
   free(l);
   l = NULL;
@@ -366,11 +1044,10 @@ void CList_print_(CList *l, size_t shift, int n, const char *type)
     }  
 
     n = (n > p->count) ? p->count : n;
-    char *data = (char*) p->items + shift;
-    size_t step = p->item_size;
     int i = 0;
     for (; i < n; i++)
     {
+      char *data = CList_item_(p, i) + shift;
       switch (tp)
       {
         case 0: printf("%p  ", data); break;
@@ -384,27 +1061,289 @@ void CList_print_(CList *l, size_t shift, int n, const char *type)
         case 8: printf("%s\n", data); break;
         default: return;
       }  
-
-      data += step;
     }
     printf("\n\n");
   }
 }
 
-CList *CList_init(size_t objSize)
+/*** CLIST_CONCURRENT: the functions above, synchronized ***/
+
+static void CList_wait_(int *spins)
+{
+  if (++*spins < 64)
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  }
+  else
+    sched_yield();
+}
+
+/* Make room for slot, called with the lock held shared */
+static int CList_Grow_(CList *l, int slot)
+{
+  CList_priv_ *p = (CList_priv_*) l->priv;
+  CList_sync_ *s = p->sync;
+  int ok = 1;
+
+  if (p->mode & CLIST_SEGMENTED)
+  {
+    /* A new segment doesn't move the items, readers can go on */
+    pthread_mutex_lock(&s->grow_lock);
+    if (slot >= p->alloc_size)
+      ok = CList_Realloc_(l, p->alloc_size * 2);
+    pthread_mutex_unlock(&s->grow_lock);
+    return ok;
+  }
+
+  /* realloc() may move the items: wait for all the readers to leave */
+  pthread_rwlock_unlock(&s->lock);
+  pthread_rwlock_wrlock(&s->lock);
+  if ((int) (s->slots >> 32) >= p->alloc_size)
+    ok = CList_Realloc_(l, p->alloc_size * 2);
+  pthread_rwlock_unlock(&s->lock);
+  pthread_rwlock_rdlock(&s->lock);
+  return ok;
+}
+
+static void *CList_AddSync_(CList *l, void *o)
+{
+  CList_priv_ *p = (CList_priv_*) l->priv;
+  CList_sync_ *s = p->sync;
+  uint64_t slots;
+  int slot, count;
+
+  /* Reserve a slot, the lock is only taken exclusively to reallocate */
+  pthread_rwlock_rdlock(&s->lock);
+  slots = __atomic_load_n(&s->slots, __ATOMIC_RELAXED);
+  for (;;)
+  {
+    slot = slots >> 32;
+    if (slot >= __atomic_load_n(&p->alloc_size, __ATOMIC_ACQUIRE))
+    {
+      if (CList_Grow_(l, slot) == 0)
+      {
+        pthread_rwlock_unlock(&s->lock);
+        return NULL;
+      }
+      slots = __atomic_load_n(&s->slots, __ATOMIC_RELAXED);
+    }
+    else if (__atomic_compare_exchange_n(&s->slots, &slots, slots + ((uint64_t) 1 << 32) + 1,
+                                         1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      break;
+  }
+
+  char *data = CList_item_(p, slot);
+  memcpy(data, o, p->item_size);
+  CList_hashAdd_(p, slot);
+
+  /*
+   * count only covers written items: the last add to finish writing publishes
+   * all the reserved slots. Nobody waits for a slower (or preempted) add.
+   */
+  slots = __atomic_sub_fetch(&s->slots, 1, __ATOMIC_ACQ_REL);
+  if ((uint32_t) slots == 0)
+  {
+    count = __atomic_load_n(&p->count, __ATOMIC_RELAXED);
+    while (count < (int) (slots >> 32) &&
+           !__atomic_compare_exchange_n(&p->count, &count, (int) (slots >> 32), 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+  }
+
+  pthread_rwlock_unlock(&s->lock);
+  return data;
+}
+
+static void *CList_ReplaceSync_(CList *l, void *o, int n)
+{
+  CList_priv_ *p = (CList_priv_*) l->priv;
+  CList_stripe_ *s = CList_stripe_of_(p, n);
+  unsigned seq;
+  int spins = 0;
+
+  pthread_rwlock_rdlock(&p->sync->lock);
+
+  /* Searches retry while seq is odd or has changed */
+  for (;;)
+  {
+    seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+    if (!(seq & 1) && __atomic_compare_exchange_n(&s->seq, &seq, seq + 1, 0,
+                                                  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      break;
+    CList_wait_(&spins);
+  }
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  void *data = CList_Replace_(l, o, n);
+
+  __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+  pthread_rwlock_unlock(&p->sync->lock);
+  return data;
+}
+
+/* The functions that move items or change count run alone */
+static void CList_lock_(CList *l)
+{
+  CList_priv_ *p = (CList_priv_*) l->priv;
+  pthread_rwlock_wrlock(&p->sync->lock);
+}
+
+static void CList_unlock_(CList *l)
+{
+  CList_priv_ *p = (CList_priv_*) l->priv;
+  p->sync->slots = (uint64_t) p->count << 32;
+  pthread_rwlock_unlock(&p->sync->lock);
+}
+
+/* Called with the lock held shared: a stale index is rebuilt with the lock held exclusively */
+static void CList_hashRefresh_(CList *l)
+{
+  CList_priv_ *p = (CList_priv_*) l->priv;
+  if (p->hash == NULL)
+    return;
+
+  CList_hashLock_(p);
+  int stale = p->hash->stale;
+  CList_hashUnlock_(p);
+  if (!stale)
+    return;
+
+  pthread_rwlock_unlock(&p->sync->lock);
+  CList_lock_(l);
+  if (p->hash->stale)
+    CList_hashRebuild_(p);
+  CList_unlock_(l);
+  pthread_rwlock_rdlock(&p->sync->lock);
+}
+
+static void *CList_AtSync_(CList *l, int n)
+{
+  CList_priv_ *p = (CList_priv_*) l->priv;
+  pthread_rwlock_rdlock(&p->sync->lock);
+  void *data = CList_At_(l, n);
+  pthread_rwlock_unlock(&p->sync->lock);
+  return data;
+}
+
+static void *CList_firstMatchSync_(CList *l, const void *o, size_t shift, size_t size, int string)
+{
+  CList_priv_ *p = (CList_priv_*) l->priv;
+  pthread_rwlock_rdlock(&p->sync->lock);
+  CList_hashRefresh_(l);
+  void *data = CList_search_(l, o, shift, size, string, 0);
+  pthread_rwlock_unlock(&p->sync->lock);
+  return data;
+}
+
+static void *CList_lastMatchSync_(CList *l, const void *o, size_t shift, size_t size, int string)
+{
+  CList_priv_ *p = (CList_priv_*) l->priv;
+  pthread_rwlock_rdlock(&p->sync->lock);
+  CList_hashRefresh_(l);
+  void *data = CList_search_(l, o, shift, size, string, 1);
+  pthread_rwlock_unlock(&p->sync->lock);
+  return data;
+}
+
+static void CList_printSync_(CList *l, size_t shift, int n, const char *type)
+{
+  CList_priv_ *p = (CList_priv_*) l->priv;
+  pthread_rwlock_rdlock(&p->sync->lock);
+  CList_print_(l, shift, n, type);
+  pthread_rwlock_unlock(&p->sync->lock);
+}
+
+static void *CList_InsertSync_(CList *l, void *o, int n)
+{
+  CList_lock_(l);
+  void *data = CList_Insert_(l, o, n);
+  CList_unlock_(l);
+  return data;
+}
+
+static void CList_RemoveSync_(CList *l, int n)
+{
+  CList_lock_(l);
+  CList_Remove_(l, n);
+  CList_unlock_(l);
+}
+
+static int CList_ReallocSync_(CList *l, int n)
+{
+  CList_lock_(l);
+  int ok = CList_Realloc_(l, n);
+  CList_unlock_(l);
+  return ok;
+}
+
+static int CList_swapSync_(CList *l, int a, int b)
+{
+  CList_lock_(l);
+  int ok = CList_swap_(l, a, b);
+  CList_unlock_(l);
+  return ok;
+}
+
+static int CList_hashIndexSync_(CList *l, size_t shift, size_t size, int string)
+{
+  CList_lock_(l);
+  int ok = CList_hashIndex_(l, shift, size, string);
+  CList_unlock_(l);
+  return ok;
+}
+
+static void CList_ClearSync_(CList *l)
+{
+  CList_lock_(l);
+  CList_Clear_(l);
+  CList_unlock_(l);
+}
+
+static CList_sync_ *CList_syncNew_(void)
+{
+  CList_sync_ *s = aligned_alloc(__alignof__(CList_sync_), sizeof(CList_sync_));
+  pthread_rwlockattr_t attr;
+
+  if (s == NULL)
+    return NULL;
+  memset(s, 0, sizeof(*s));
+
+  /* A steady stream of add() calls must not starve a realloc() */
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  pthread_rwlock_init(&s->lock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+  pthread_mutex_init(&s->grow_lock, NULL);
+  pthread_mutex_init(&s->index_lock, NULL);
+
+  return s;
+}
+
+CList *CList_initMode(size_t objSize, int mode)
 {
   CList *lst = malloc(sizeof(CList));
-  CList_priv_ *p = malloc(sizeof(CList_priv_));
+  CList_priv_ *p = calloc(1, sizeof(CList_priv_));
   if (!lst || !p)
   {
     fprintf(stderr, "CList: ERROR! Can not allocate CList!\n");
     return NULL;
   }
+  if ((mode & CLIST_SEGMENTED) && (mode & CLIST_CHUNKED))
+  {
+    fprintf(stderr, "CList: ERROR! CLIST_SEGMENTED and CLIST_CHUNKED can not be combined!\n");
+    free(p);
+    free(lst);
+    return NULL;
+  }
   p->count = 0;
   p->alloc_size = 0;
   p->lastSearchPos = -1;
   p->item_size = objSize;
   p->items = NULL;
+  p->mode = mode;
+  p->chunk_shift = CLIST_CHUNK_MIN;
   lst->add = &CList_Add_;
   lst->insert = &CList_Insert_;
   lst->replace = &CList_Replace_;
@@ -415,6 +1354,7 @@ CList *CList_init(size_t objSize)
   lst->firstMatch = &CList_firstMatch_;
   lst->lastMatch = &CList_lastMatch_;
   lst->index = &CList_index_;
+  lst->hashIndex = &CList_hashIndex_;
   lst->swap = &CList_swap_;
   lst->allocSize = &CList_AllocSize_;
   lst->itemSize = &CList_ItemSize_;
@@ -422,6 +1362,32 @@ CList *CList_init(size_t objSize)
   lst->clear = &CList_Clear_;
   lst->free = &CList_Free_;
   lst->priv = p;
+
+  if (mode & CLIST_CONCURRENT)
+  {
+    if ((p->sync = CList_syncNew_()) == NULL)
+    {
+      fprintf(stderr, "CList: ERROR! Can not allocate CList!\n");
+      return NULL;
+    }
+    lst->add = &CList_AddSync_;
+    lst->insert = &CList_InsertSync_;
+    lst->replace = &CList_ReplaceSync_;
+    lst->remove = &CList_RemoveSync_;
+    lst->at = &CList_AtSync_;
+    lst->realloc = &CList_ReallocSync_;
+    lst->firstMatch = &CList_firstMatchSync_;
+    lst->lastMatch = &CList_lastMatchSync_;
+    lst->hashIndex = &CList_hashIndexSync_;
+    lst->swap = &CList_swapSync_;
+    lst->print = &CList_printSync_;
+    lst->clear = &CList_ClearSync_;
+  }
+
   return lst;
 }
 
+CList *CList_init(size_t objSize)
+{
+  return CList_initMode(objSize, 0);
+}
@@ -60,6 +60,8 @@ typedef struct CList
   void * (* lastMatch)   (struct CList *l, const void *o, size_t shift, size_t size, int string);
                                                                 /* Returns object with last match of string or byte compare */
   int    (* index)       (struct CList *l);                     /* Get index of previos search match */
+  int    (* hashIndex)   (struct CList *l, size_t shift, size_t size, int string);
+                                                                /* Index items for firstMatch and lastMatch */
   int    (* swap)        (struct CList *l, int a, int b);       /* Swap, replace two items with index a b */
   int    (* allocSize)   (struct CList *l);                     /* Get allocated size in items */
   size_t (* itemSize)    (struct CList *l);                     /* Get item size in bytes */
@@ -71,6 +73,12 @@ typedef struct CList
 
 CList *CList_init(size_t objSize); /* Set list object size in bytes */
 
+#define CLIST_CONCURRENT  1  /* Thread safe: all functions except free may run concurrently */
+#define CLIST_SEGMENTED   2  /* Items never move in memory when the list grows */
+#define CLIST_CHUNKED     4  /* Insert and remove take O(sqrt(count)) instead of O(count) */
+
+CList *CList_initMode(size_t objSize, int mode); /* CList_init with a combination of the modes above */
+
 /*  void *add(struct CList *l, void *o);
         Returns pointer to added object; Returns NULL if failed.
 
@@ -96,11 +104,35 @@ CList *CList_init(size_t objSize); /* Set list object size in bytes */
 
     int index(struct CList *l);
         Returns index of last search firstMatch or lastMatch. Returns -1 if search failed.
+
+    int hashIndex(struct CList *l, size_t shift, size_t size, int string);
+        Keeps a hash table of the items by the bytes firstMatch and lastMatch compare with
+        the same shift, size and string arguments, so these searches take O(1) expected time
+        instead of scanning the list. The table follows add, replace, swap and inserts or
+        removes at the end of the list; after an insert or remove elsewhere it is rebuilt by
+        the next search. Calling it again indexes another range instead. Return 1 when
+        success. Returns 0 if failed, searches then scan the list.
     
     void print(struct CList *l, size_t shift, int n, const char *type);
         Prints data of "int n" list items with offset "size_t shift" and type "const char *type".
         Supported types: char, short, int, long, uintptr_t, size_t, double, string.
         If type is NULL just pointers data will be printed. 
+
+    CList *CList_initMode(size_t objSize, int mode);
+        CLIST_CONCURRENT: readers (at, firstMatch, lastMatch, count) share a reader-writer lock,
+        add reserves its slot atomically and only takes the lock exclusively to reallocate,
+        its item is counted once all the add calls running at the same time have stored theirs,
+        replace is guarded by seqlocks so that searches never match a half-written item.
+        insert, remove, swap, realloc and clear run alone. index returns the result of the
+        last search made by any thread.
+        CLIST_SEGMENTED: items are stored in segments of growing size instead of one array,
+        so growing the list never moves them and pointers returned by add and at stay valid
+        until an insert, remove or swap.
+        CLIST_CHUNKED: items are stored in chunks of equal size, each one a ring buffer, and
+        all the chunks but the last are full. at stays O(1); insert and remove shift the items
+        on the shorter side within one chunk, then move a single item between each following
+        pair of chunks. Chunks grow with the list, 4 * sqrt(count) items each, so both take
+        O(sqrt(count)). Can not be combined with CLIST_SEGMENTED.
 */
 
 #ifdef __cplusplus
@@ -64,6 +64,174 @@ size_t diff_usec(struct timeval start, struct timeval end)
   return (1000000 * (end.tv_sec - start.tv_sec) + end.tv_usec - start.tv_usec);
 }
 
+void performance_test(int mode, const char *name, int n)
+{
+  CList *lst = CList_initMode(sizeof(int), mode);
+  size_t time;
+  int i = 0;
+  struct timeval start;
+  struct timeval end;
+
+  printf("%s list:\n", name);
+
+  gettimeofday(&start, NULL);
+  for(i=0; i < n; i++)
+    lst->add(lst, &i);
+  gettimeofday(&end, NULL);
+  time = diff_usec(start, end);
+  printf("Add of %i int takes  -  %zu microseconds\n", n, time);
+
+  gettimeofday(&start, NULL);
+  for(i=0; i < n; i++)
+    lst->remove(lst, 0);
+  gettimeofday(&end, NULL);
+  time = diff_usec(start, end);
+  printf("Remove from position '0' of %i int takes  -  %zu microseconds\n", n, time);
+
+  gettimeofday(&start, NULL);
+  for(i=0; i < n; i++)
+    lst->insert(lst, &i, 0);
+  gettimeofday(&end, NULL);
+  time = diff_usec(start, end);
+  printf("Insert to position '0' of %i int takes  -  %zu microseconds\n", n, time);
+
+  gettimeofday(&start, NULL);
+  for(i=0; i < n; i++)
+    lst->remove(lst, lst->count(lst) - 1);
+  gettimeofday(&end, NULL);
+  time = diff_usec(start, end);
+  printf("Remove from last position of %i int takes  -  %zu microseconds\n", n, time);
+
+  gettimeofday(&start, NULL);
+  for(i=0; i < n; i++)
+    lst->insert(lst, &i, lst->count(lst));
+  gettimeofday(&end, NULL);
+  time = diff_usec(start, end);
+  printf("Insert to last position of %i int takes  -  %zu microseconds\n", n, time);
+
+  gettimeofday(&start, NULL);
+  for(i=0; i < n; i++)
+    lst->replace(lst, &n, i);
+  gettimeofday(&end, NULL);
+  time = diff_usec(start, end);
+  printf("Replace of %i int takes  -  %zu microseconds\n", n, time);
+
+  for(i=0; i < n; i++)
+    lst->replace(lst, &i, i);
+
+  if (n <= 10000) /* Each search scans the list */
+  {
+    gettimeofday(&start, NULL);
+    for(i=0; i < n; i++)
+      lst->firstMatch(lst, &i, 0, sizeof(int), 0);
+    gettimeofday(&end, NULL);
+    time = diff_usec(start, end);
+    printf("Search of %i int takes  -  %zu microseconds\n", n, time);
+  }
+
+  gettimeofday(&start, NULL);
+  lst->hashIndex(lst, 0, sizeof(int), 0);
+  for(i=0; i < n; i++)
+    lst->firstMatch(lst, &i, 0, sizeof(int), 0);
+  gettimeofday(&end, NULL);
+  time = diff_usec(start, end);
+  printf("Search of %i int with hashIndex takes  -  %zu microseconds\n", n, time);
+
+  printf("\n");
+  lst->free(lst);
+}
+
+int same_items(CList *lst, CList *ref)
+{
+  int i = 0;
+
+  if (lst->count(lst) != ref->count(ref))
+    return 0;
+
+  for(i=0; i < ref->count(ref); i++)
+    if (*(int*)lst->at(lst, i) != *(int*)ref->at(ref, i))
+      return 0;
+
+  return 1;
+}
+
+/* Apply the same random operations to a list in mode and to a plain list */
+
+int consistency_test(int mode, const char *name, int n)
+{
+  CList *lst = CList_initMode(sizeof(int), mode);
+  CList *ref = CList_init(sizeof(int));
+  int i = 0;
+  int j = 0;
+  int k = 0;
+  int v = 0;
+  int op = 0;
+  int count = 0;
+  int ok = 1;
+
+  srand(mode);
+
+  for(k=0; k < n && ok; k++)
+  {
+    op = rand() % 10;
+    count = ref->count(ref);
+    v = rand() % 1000;
+
+    if (op < 4 || count == 0)
+    {
+      lst->add(lst, &v);
+      ref->add(ref, &v);
+    }
+    else if (op < 6)
+    {
+      i = rand() % (count + 1);
+      lst->insert(lst, &v, i);
+      ref->insert(ref, &v, i);
+    }
+    else if (op < 8)
+    {
+      i = rand() % count;
+      lst->remove(lst, i);
+      ref->remove(ref, i);
+    }
+    else if (op < 9)
+    {
+      i = rand() % count;
+      lst->replace(lst, &v, i);
+      ref->replace(ref, &v, i);
+    }
+    else
+    {
+      i = rand() % count;
+      j = rand() % count;
+      lst->swap(lst, i, j);
+      ref->swap(ref, i, j);
+
+      lst->firstMatch(lst, &v, 0, 0, 0);
+      ref->firstMatch(ref, &v, 0, 0, 0);
+      ok = ok && lst->index(lst) == ref->index(ref);
+
+      lst->lastMatch(lst, &v, 0, 0, 0);
+      ref->lastMatch(ref, &v, 0, 0, 0);
+      ok = ok && lst->index(lst) == ref->index(ref);
+    }
+
+    ok = ok && lst->count(lst) == ref->count(ref);
+    if (k % 10000 == 0)
+      ok = ok && same_items(lst, ref);
+  }
+  ok = ok && same_items(lst, ref);
+
+  if (ok)
+    printf("%s list matches plain list after %i operations, %i items\n", name, n, ref->count(ref));
+  else
+    printf("%s list differs from plain list after %i operations\n", name, k);
+
+  lst->free(lst);
+  ref->free(ref);
+  return ok;
+}
+
 int main(void)
 {
   void *obj = NULL;
@@ -292,63 +460,25 @@ int main(void)
   free(sm3);
   lst->free(lst);
 
-  /******************************************************* PERFOMANCE TEST */
+  /******************************************************* CONSISTENCY TEST */
 
-  n = sizeof(int);
-  lst = CList_init(n);
+  n = 200000;
+  if (!consistency_test(CLIST_CONCURRENT, "Concurrent", n) ||
+      !consistency_test(CLIST_SEGMENTED, "Segmented", n) ||
+      !consistency_test(CLIST_CONCURRENT | CLIST_SEGMENTED, "Concurrent segmented", n) ||
+      !consistency_test(CLIST_CHUNKED, "Chunked", n) ||
+      !consistency_test(CLIST_CONCURRENT | CLIST_CHUNKED, "Concurrent chunked", n))
+    return 1;
+  printf("\n");
 
-  size_t time;
-  i = 0;
-  n = 10000;
-  struct timeval start;
-  struct timeval end;
+  /******************************************************* PERFOMANCE TEST */
 
   printf("PERFOMANCE TEST - 1 second contains 1000000 microseconds\n\n");
 
-  gettimeofday(&start, NULL);
-  for(i=0; i < n; i++)
-    lst->add(lst, &i);
-  gettimeofday(&end, NULL);
-  time = diff_usec(start, end);
-  printf("Add of %i int takes  -  %zu microseconds\n", n, time);
-
-  gettimeofday(&start, NULL);
-  for(i=0; i < n; i++)
-    lst->remove(lst, 0);
-  gettimeofday(&end, NULL);
-  time = diff_usec(start, end);
-  printf("Remove from position '0' of %i int takes  -  %zu microseconds\n", n, time);
-
-  gettimeofday(&start, NULL);
-  for(i=0; i < n; i++)
-    lst->insert(lst, &i, 0);
-  gettimeofday(&end, NULL);
-  time = diff_usec(start, end);
-  printf("Insert to position '0' of %i int takes  -  %zu microseconds\n", n, time);
-
-  gettimeofday(&start, NULL);
-  for(i=0; i < n; i++)
-    lst->remove(lst, lst->count(lst) - 1);
-  gettimeofday(&end, NULL);
-  time = diff_usec(start, end);
-  printf("Remove from last position of %i int takes  -  %zu microseconds\n", n, time);
-
-  gettimeofday(&start, NULL);
-  for(i=0; i < n; i++)
-    lst->insert(lst, &i, lst->count(lst));
-  gettimeofday(&end, NULL);
-  time = diff_usec(start, end);
-  printf("Insert to last position of %i int takes  -  %zu microseconds\n", n, time);
-
-  gettimeofday(&start, NULL);
-  for(i=0; i < n; i++)
-    lst->replace(lst, &n, i);
-  gettimeofday(&end, NULL);
-  time = diff_usec(start, end);
-  printf("Replace of %i int takes  -  %zu microseconds\n", n, time);
-
-  printf("\n");
-  lst->free(lst);
+  performance_test(0, "Plain", 10000);
+  performance_test(0, "Plain", 100000);
+  performance_test(CLIST_SEGMENTED, "Segmented", 100000);
+  performance_test(CLIST_CHUNKED, "Chunked", 100000);
 
   return 0;
 
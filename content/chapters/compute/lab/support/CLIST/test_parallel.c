@@ -10,28 +10,43 @@
 
 #include "clist.h"
 
-#define NUM_ELEMS	100000000
+#define NUM_ELEMS	10000000
+#define MAX_THREADS	64
 #define INT_SIZE	sizeof(int)
 
+/*
+ * Removing the first element moves all the others, unless the list is
+ * chunked, so the tests that remove elements use fewer of them.
+ */
+#define REMOVE_RATIO	100
+
+static int num_elems = NUM_ELEMS;
+static int mode;
+
 static size_t diff_usec(struct timeval start, struct timeval end)
-{ 
+{
 	return (1000000 * (end.tv_sec - start.tv_sec) + end.tv_usec -
 		start.tv_usec);
 }
 
+/* Each thread works on elements first, first + step, first + 2 * step... */
 typedef struct {
 	CList *l;
-	int *elems;
-	size_t n;
+	int first;
+	int step;
+	int n;
+	long sum;
 } list_args_t;
 
 static void *add_to_list(void *arg)
 {
 	list_args_t *args = (list_args_t *)arg;
-	size_t i;
+	int i, elem;
 
-	for (i = 0; i < args->n; ++i)
-		args->l->add(args->l, args->elems + i);
+	for (i = 0; i < args->n; ++i) {
+		elem = args->first + i * args->step;
+		args->l->add(args->l, &elem);
+	}
 
 	return NULL;
 }
@@ -39,78 +54,98 @@ static void *add_to_list(void *arg)
 static void *remove_from_list(void *arg)
 {
 	list_args_t *args = (list_args_t *)arg;
-	size_t i;
+	int i;
 
+	/* Always remove the first element. */
 	for (i = 0; i < args->n; ++i)
-		args->l->remove(args->l, args->elems[i]);
+		args->l->remove(args->l, 0);
 
 	return NULL;
 }
 
-static void *replace_even_from_list(void *arg)
+static void *add_remove_list(void *arg)
 {
 	list_args_t *args = (list_args_t *)arg;
-	size_t i;
+	int i, elem;
 
-	for (i = 0; i < args->n; ++i)
-		args->l->replace(args->l, args->elems + i, 2 * i);
+	for (i = 0; i < args->n; ++i) {
+		elem = args->first + i * args->step;
+		args->l->add(args->l, &elem);
+		args->l->remove(args->l, 0);
+	}
 
 	return NULL;
 }
 
-static void *replace_odd_from_list(void *arg)
+static void *replace_in_list(void *arg)
 {
 	list_args_t *args = (list_args_t *)arg;
-	size_t i;
+	int i, idx, elem;
 
-	for (i = 0; i < args->n; ++i)
-		args->l->replace(args->l, args->elems + i, 2 * i + 1);
+	for (i = 0; i < args->n; ++i) {
+		idx = args->first + i * args->step;
+		elem = -idx;
+		args->l->replace(args->l, &elem, idx);
+	}
 
 	return NULL;
 }
 
-static void *replace_same_from_list(void *arg)
+static void *replace_first_in_list(void *arg)
 {
 	list_args_t *args = (list_args_t *)arg;
-	size_t i;
+	int i, elem;
 
-	for (i = 0; i < args->n; ++i)
-		args->l->replace(args->l, args->elems + i, 0);
+	for (i = 0; i < args->n; ++i) {
+		elem = -(args->first + i * args->step);
+		args->l->replace(args->l, &elem, 0);
+	}
 
 	return NULL;
 }
 
-static int init_even_elem(size_t idx)
+static void *read_list(void *arg)
 {
-	return idx * 2; 
+	list_args_t *args = (list_args_t *)arg;
+	int i;
+
+	args->sum = 0;
+	for (i = 0; i < args->n; ++i)
+		args->sum += *(int *)args->l->at(args->l, args->first + i * args->step);
+
+	return NULL;
 }
 
-static int init_odd_elem(size_t idx)
+/* Elements of n handled by thread i of num_threads. */
+static int share(int n, int i, int num_threads)
 {
-	return idx * 2 + 1; 
+	return n / num_threads + (i < n % num_threads);
 }
 
-static int init_remove_elem(size_t idx)
+static void create_args(list_args_t *args, CList *l, int n, int num_threads)
 {
-	(void)idx;
-	return 0;
+	int i;
+
+	for (i = 0; i < num_threads; ++i) {
+		args[i].l = l;
+		args[i].first = i;
+		args[i].step = num_threads;
+		args[i].n = share(n, i, num_threads);
+	}
 }
 
-static void create_args(list_args_t *args, CList *l, int (*init_elem)(size_t))
+static CList *create_list(int n)
 {
-	size_t i;
+	CList *l = CList_initMode(INT_SIZE, mode);
+	list_args_t args;
 
-	args->n = NUM_ELEMS / 2;
-	args->l = l;
-
-	args->elems = malloc(args->n * INT_SIZE);
-	if (!args->elems) {
-		perror("malloc");
+	if (!l)
 		exit(EXIT_FAILURE);
-	}
 
-	for (i = 0; i < args->n; ++i)
-		args->elems[i] = init_elem(i);
+	create_args(&args, l, n, 1);
+	add_to_list(&args);
+
+	return l;
 }
 
 static pthread_t spawn_thread(void *(*func)(void *), list_args_t *args)
@@ -118,170 +153,238 @@ static pthread_t spawn_thread(void *(*func)(void *), list_args_t *args)
 	pthread_t tid;
 	int rc = pthread_create(&tid, NULL, func, args);
 
-	if (rc < 0) {
-		perror("pthread_create");
+	if (rc != 0) {
+		fprintf(stderr, "pthread_create: %s\n", strerror(rc));
 		exit(EXIT_FAILURE);
 	}
 
 	return tid;
 }
 
-static void test_parallel_add_add(void)
+/* Thread i runs funcs[i], returns the time until all of them finish. */
+static size_t run_threads(void *(**funcs)(void *), list_args_t *args,
+		int num_threads)
 {
-	int i;
-	pthread_t tid1, tid2;
-	list_args_t args1, args2;
+	pthread_t tids[MAX_THREADS];
 	struct timeval start, end;
-	CList *l = CList_init(INT_SIZE);
-
-	create_args(&args1, l, init_even_elem);
-	create_args(&args2, l, init_odd_elem);
+	int i;
 
 	gettimeofday(&start, NULL);
-	tid1 = spawn_thread(add_to_list, &args2);
-	tid2 = spawn_thread(add_to_list, &args2);
-
-	pthread_join(tid1, NULL);
-	pthread_join(tid2, NULL);
+	for (i = 0; i < num_threads; ++i)
+		tids[i] = spawn_thread(funcs[i], &args[i]);
+	for (i = 0; i < num_threads; ++i)
+		pthread_join(tids[i], NULL);
 	gettimeofday(&end, NULL);
 
-	assert(l->count(l) == NUM_ELEMS);
-	for (i = 0; i < NUM_ELEMS; ++i)
-		assert(l->firstMatch(l, &i, INT_SIZE, INT_SIZE, 0));
-
-	printf("Add of %i `int`s on 2 threads takes  -  %zu microseconds\n",
-		NUM_ELEMS, diff_usec(start, end));
+	return diff_usec(start, end);
 }
 
-static void test_parallel_add_remove(void)
+static size_t run_same(void *(*func)(void *), list_args_t *args,
+		int num_threads)
 {
-	pthread_t tid1, tid2;
-	list_args_t args1, args2;
-	struct timeval start, end;
-	CList *l = CList_init(INT_SIZE);
+	void *(*funcs[MAX_THREADS])(void *);
+	int i;
 
-	create_args(&args1, l, init_even_elem);
-	create_args(&args2, l, init_remove_elem);
+	for (i = 0; i < num_threads; ++i)
+		funcs[i] = func;
 
-	gettimeofday(&start, NULL);
-	tid1 = spawn_thread(add_to_list, &args2);
-	tid2 = spawn_thread(remove_from_list, &args1);
+	return run_threads(funcs, args, num_threads);
+}
 
-	pthread_join(tid1, NULL);
-	pthread_join(tid2, NULL);
-	gettimeofday(&end, NULL);
+static size_t test_parallel_add_add(int num_threads)
+{
+	list_args_t args[MAX_THREADS];
+	CList *l = CList_initMode(INT_SIZE, mode);
+	size_t usec;
+	int i;
+
+	create_args(args, l, num_elems, num_threads);
+	usec = run_same(add_to_list, args, num_threads);
 
-	printf("Add and Remove of %i `int`s on 2 threads takes  -  %zu microseconds\n",
-		NUM_ELEMS / 2, diff_usec(start, end));
+	/* Without the index, each search would scan the list. */
+	assert(l->count(l) == num_elems);
+	assert(l->hashIndex(l, 0, INT_SIZE, 0));
+	for (i = 0; i < num_elems; ++i)
+		assert(l->firstMatch(l, &i, 0, INT_SIZE, 0));
+
+	l->free(l);
+	return usec;
 }
 
-static void test_parallel_remove_remove(void)
+static size_t test_parallel_add_remove(int num_threads)
 {
-	pthread_t tid1, tid2;
-	list_args_t args1, args2;
-	struct timeval start, end;
-	CList *l = CList_init(INT_SIZE);
+	void *(*funcs[MAX_THREADS])(void *);
+	list_args_t args[MAX_THREADS];
+	int n = num_elems / REMOVE_RATIO;
+	CList *l = create_list(n);
+	int adders = (num_threads + 1) / 2;
+	int removers = num_threads - adders;
+	size_t usec;
+	int i;
 
-	create_args(&args1, l, init_even_elem);
-	add_to_list(&args1);
-	create_args(&args2, l, init_odd_elem);
-	add_to_list(&args2);
+	/* Half the threads add n elements, the others remove n. */
+	if (removers == 0) {
+		create_args(args, l, n, 1);
+		funcs[0] = add_remove_list;
+	} else {
+		create_args(args, l, n, adders);
+		create_args(args + adders, l, n, removers);
+		for (i = 0; i < num_threads; ++i)
+			funcs[i] = i < adders ? add_to_list : remove_from_list;
+	}
+	usec = run_threads(funcs, args, num_threads);
 
-	/* Always remove the first element. */
-	memset(args1.elems, 0, args1.n * INT_SIZE);
-	memset(args2.elems, 0, args2.n * INT_SIZE);
+	assert(l->count(l) == n);
 
-	gettimeofday(&start, NULL);
-	tid1 = spawn_thread(remove_from_list, &args1);
-	tid2 = spawn_thread(remove_from_list, &args2);
+	l->free(l);
+	return usec;
+}
 
-	pthread_join(tid1, NULL);
-	pthread_join(tid2, NULL);
-	gettimeofday(&end, NULL);
+static size_t test_parallel_remove_remove(int num_threads)
+{
+	list_args_t args[MAX_THREADS];
+	int n = num_elems / REMOVE_RATIO;
+	CList *l = create_list(n);
+	size_t usec;
+
+	create_args(args, l, n, num_threads);
+	usec = run_same(remove_from_list, args, num_threads);
 
 	assert(l->count(l) == 0);
 
-	printf("Remove of %i `int`s on 2 threads takes  -  %zu microseconds\n",
-		NUM_ELEMS, diff_usec(start, end));
+	l->free(l);
+	return usec;
 }
 
-static void test_parallel_replace_replace_different(void)
+static size_t test_parallel_replace_replace_different(int num_threads)
 {
-	size_t i;
+	list_args_t args[MAX_THREADS];
+	CList *l = create_list(num_elems);
+	size_t usec;
 	int j;
-	pthread_t tid1, tid2;
-	list_args_t args1, args2;
-	struct timeval start, end;
-	CList *l = CList_init(INT_SIZE);
-
-	create_args(&args1, l, init_even_elem);
-	add_to_list(&args1);
-	create_args(&args2, l, init_odd_elem);
-	add_to_list(&args2);
-
-	for (i = 0; i < args1.n; ++i) {
-		args1.elems[i] = -args1.elems[i];
-		args2.elems[i] = -args2.elems[i];
-	}
 
-	gettimeofday(&start, NULL);
-	tid1 = spawn_thread(replace_even_from_list, &args1);
-	tid2 = spawn_thread(replace_odd_from_list, &args2);
-
-	pthread_join(tid1, NULL);
-	pthread_join(tid2, NULL);
-	gettimeofday(&end, NULL);
+	create_args(args, l, num_elems, num_threads);
+	usec = run_same(replace_in_list, args, num_threads);
 
-	assert(l->count(l) == NUM_ELEMS);
-	for (j = 0; j < NUM_ELEMS; ++j)
+	assert(l->count(l) == num_elems);
+	for (j = 0; j < num_elems; ++j)
 		assert(*(int *) l->at(l, j) == -j);
 
-	printf("Replacing %i `int`s on 2 threads takes  -  %zu microseconds\n",
-		NUM_ELEMS, diff_usec(start, end));
+	l->free(l);
+	return usec;
 }
 
-static void test_parallel_replace_replace_same(void)
+static size_t test_parallel_replace_replace_same(int num_threads)
 {
-	size_t i;
-	int first_elem;
-	pthread_t tid1, tid2;
-	list_args_t args1, args2;
-	struct timeval start, end;
-	CList *l = CList_init(INT_SIZE);
+	list_args_t args[MAX_THREADS];
+	CList *l = create_list(num_elems);
+	int first_elem, last, i;
+	size_t usec;
 
-	create_args(&args1, l, init_even_elem);
-	add_to_list(&args1);
-	create_args(&args2, l, init_odd_elem);
-	add_to_list(&args2);
+	create_args(args, l, num_elems, num_threads);
+	usec = run_same(replace_first_in_list, args, num_threads);
 
-	for (i = 0; i < args1.n; ++i) {
-		args1.elems[i] = -args1.elems[i];
-		args2.elems[i] = -args2.elems[i];
+	/* The last value written by one of the threads. */
+	assert(l->count(l) == num_elems);
+	first_elem = *(int *) l->at(l, 0);
+	for (i = 0; i < num_threads; ++i) {
+		last = -(args[i].first + (args[i].n - 1) * args[i].step);
+		if (first_elem == last)
+			break;
 	}
+	assert(i < num_threads);
 
-	gettimeofday(&start, NULL);
-	tid1 = spawn_thread(replace_same_from_list, &args1);
-	tid2 = spawn_thread(replace_same_from_list, &args2);
+	l->free(l);
+	return usec;
+}
 
-	pthread_join(tid1, NULL);
-	pthread_join(tid2, NULL);
-	gettimeofday(&end, NULL);
+static size_t test_parallel_read_read(int num_threads)
+{
+	list_args_t args[MAX_THREADS];
+	CList *l = create_list(num_elems);
+	long sum = 0;
+	size_t usec;
+	int i;
 
-	assert(l->count(l) == NUM_ELEMS);
-	first_elem = *(int *) l->at(l, 0);
-	assert(first_elem == -NUM_ELEMS || first_elem == -NUM_ELEMS + 1);
+	create_args(args, l, num_elems, num_threads);
+	usec = run_same(read_list, args, num_threads);
+
+	for (i = 0; i < num_threads; ++i)
+		sum += args[i].sum;
+	assert(sum == (long)num_elems * (num_elems - 1) / 2);
+
+	l->free(l);
+	return usec;
+}
 
-	printf("Replacing the first element %i timess on 2 threads takes  -  %zu microseconds\n",
-		NUM_ELEMS, diff_usec(start, end));
+static const struct {
+	const char *name;
+	size_t (*run)(int num_threads);
+} tests[] = {
+	{ "add",		test_parallel_add_add },
+	{ "add+remove",		test_parallel_add_remove },
+	{ "remove",		test_parallel_remove_remove },
+	{ "replace",		test_parallel_replace_replace_different },
+	{ "replace_same",	test_parallel_replace_replace_same },
+	{ "at",			test_parallel_read_read },
+};
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [-m plain|concurrent|segmented|chunked] [-t max_threads] [-n elements]\n",
+		argv0);
+	exit(EXIT_FAILURE);
 }
 
-int main(void)
+int main(int argc, char *argv[])
 {
-	test_parallel_add_add();
-	test_parallel_add_remove();
-	test_parallel_remove_remove();
-	test_parallel_replace_replace_different();
-	test_parallel_replace_replace_same();
+	int max_threads = 2, num_threads, opt;
+	size_t i;
+
+	while ((opt = getopt(argc, argv, "m:t:n:")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (strcmp(optarg, "plain") == 0)
+				mode = 0;
+			else if (strcmp(optarg, "concurrent") == 0)
+				mode = CLIST_CONCURRENT;
+			else if (strcmp(optarg, "segmented") == 0)
+				mode = CLIST_CONCURRENT | CLIST_SEGMENTED;
+			else if (strcmp(optarg, "chunked") == 0)
+				mode = CLIST_CONCURRENT | CLIST_CHUNKED;
+			else
+				usage(argv[0]);
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'n':
+			num_elems = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (max_threads < 1 || max_threads > MAX_THREADS ||
+	    num_elems < REMOVE_RATIO)
+		usage(argv[0]);
+
+	printf("%d `int`s, %d for the tests that remove; time in microseconds\n",
+		num_elems, num_elems / REMOVE_RATIO);
+	printf("%-14s", "threads");
+	for (num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+		printf(" %10d", num_threads);
+	printf("\n");
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+		printf("%-14s", tests[i].name);
+		for (num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+			fflush(stdout);
+			printf(" %10zu", tests[i].run(num_threads));
+		}
+		printf("\n");
+	}
 
 	return 0;
 }
@@ -0,0 +1,175 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Benchmark libult with 1, 2, 4, ... carriers (kernel threads):
+ *
+ *  - spawn: create, run and join many empty threads. Every thread costs
+ *    a context switch to start it and the scheduler's switches are counted,
+ *    so this gives the context switches per second.
+ *  - cpu: run CPU-bound threads and compare the time with the time on
+ *    one carrier (speedup).
+ *
+ * The number of carriers can only be set once per process, so every
+ * configuration runs in its own child process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "./threads.h"
+#include "utils/utils.h"
+
+/* Join in batches, so new threads reuse the stacks of the joined ones. */
+#define BATCH		256
+
+static long work = 20000000;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *empty(void *arg)
+{
+	return arg;
+}
+
+static void *spin(void *arg)
+{
+	unsigned long x = (unsigned long)arg;
+
+	for (long i = 0; i < work; i++)
+		x = x * 6364136223846793005UL + 1442695040888963407UL;
+
+	return (void *)x;
+}
+
+static unsigned long run_batch(void *(*routine)(void *), int count)
+{
+	int ids[BATCH];
+	unsigned long sum = 0;
+	void *res;
+	int rc;
+
+	for (int i = 0; i < count; i++) {
+		ids[i] = threads_create(routine, (void *)(long)i);
+		DIE(ids[i] < 0, "threads_create");
+	}
+
+	for (int i = 0; i < count; i++) {
+		while ((rc = threads_join(ids[i], &res)) == 0)
+			threads_yield();
+		DIE(rc < 0, "threads_join");
+		sum += (unsigned long)res;
+	}
+
+	return sum;
+}
+
+struct result {
+	double spawn_s;
+	unsigned long spawn_switches;
+	double cpu_s;
+};
+
+static void run(unsigned int carriers, int spawn, int fibers,
+		struct result *r)
+{
+	unsigned long switches;
+	double start;
+	int rc;
+
+	rc = threads_set_carriers(carriers);
+	DIE(rc < 0, "threads_set_carriers");
+
+	/* The first batch also starts the carriers. */
+	run_batch(empty, 1);
+
+	switches = threads_context_switches();
+	start = now();
+	for (int done = 0; done < spawn; done += BATCH)
+		run_batch(empty, spawn - done < BATCH ? spawn - done : BATCH);
+	r->spawn_s = now() - start;
+	r->spawn_switches = threads_context_switches() - switches;
+
+	start = now();
+	for (int done = 0; done < fibers; done += BATCH)
+		run_batch(spin, fibers - done < BATCH ? fibers - done : BATCH);
+	r->cpu_s = now() - start;
+}
+
+int main(int argc, char *argv[])
+{
+	int max_carriers = sysconf(_SC_NPROCESSORS_ONLN);
+	int spawn = 100000, fibers = 64;
+	struct result *results;
+	int opt, n;
+
+	while ((opt = getopt(argc, argv, "c:s:f:w:")) != -1) {
+		switch (opt) {
+		case 'c':
+			max_carriers = atoi(optarg);
+			break;
+		case 's':
+			spawn = atoi(optarg);
+			break;
+		case 'f':
+			fibers = atoi(optarg);
+			break;
+		case 'w':
+			work = atol(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-c max_carriers] [-s spawned_threads] [-f cpu_threads] [-w work]\n",
+				argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	DIE(max_carriers < 1 || spawn < 1 || fibers < 1 || work < 1,
+	    "invalid arguments");
+
+	/* Filled in by the children. */
+	results = mmap(NULL, (max_carriers + 1) * sizeof(*results),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	DIE(results == MAP_FAILED, "mmap");
+
+	printf("%d spawned threads, %d CPU-bound threads x %ld iterations\n",
+	       spawn, fibers, work);
+	printf("%8s %12s %14s %10s %8s\n", "carriers", "spawn_ns", "switches/s",
+	       "cpu_ms", "speedup");
+
+	for (n = 1; ; n = n * 2 < max_carriers ? n * 2 : max_carriers) {
+		struct result *r = &results[n];
+		int status;
+		pid_t pid;
+
+		fflush(stdout);
+		pid = fork();
+		DIE(pid < 0, "fork");
+		if (pid == 0) {
+			run(n, spawn, fibers, r);
+			exit(EXIT_SUCCESS);
+		}
+		DIE(waitpid(pid, &status, 0) < 0, "waitpid");
+		DIE(!WIFEXITED(status) || WEXITSTATUS(status) != 0,
+		    "benchmark process failed");
+
+		printf("%8d %12.0f %14.0f %10.1f %8.2f\n", n,
+		       r->spawn_s * 1e9 / spawn,
+		       r->spawn_switches / r->spawn_s,
+		       r->cpu_s * 1e3, results[1].cpu_s / r->cpu_s);
+
+		if (n == max_carriers)
+			break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,406 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+#include <linux/futex.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "carrier.h"
+#include "queue.h"
+#include "switch.h"
+
+/* Same time slice as the ITIMER_PROF timer of the single carrier mode. */
+#define CARRIER_TIME_SLICE_NS	10000000L
+
+/* Stack for the scheduler loop of the first carrier. */
+#define CARRIER_STACK_SIZE	(64 * 1024)
+
+/* How long an idle carrier sleeps before looking for work again. */
+#define CARRIER_IDLE_NS		1000000L
+
+/* Why the thread in carrier->prev stopped running. */
+enum stop_reason {
+	STOP_YIELDED,
+	STOP_PREEMPTED,
+	STOP_EXITED
+};
+
+struct carrier {
+	unsigned int index;
+	pthread_t thread;
+	timer_t timer;
+
+	/* Threads ready to run, taken from by this carrier and by thieves. */
+	pthread_spinlock_t lock;
+	QUEUE *ready;
+
+	/*
+	 * Threads interrupted by the timer. They may be in the middle of a
+	 * library call that uses thread-local state of this kernel thread
+	 * (errno, the per-thread cache of malloc()), so they are only resumed
+	 * by this carrier. Only the carrier itself uses this queue.
+	 */
+	QUEUE *preempted;
+	bool turn;
+
+	TCB *running;
+
+	/*
+	 * Set from the moment a thread starts switching to the scheduler loop
+	 * until the next thread runs: the SIGPROF handler leaves it alone.
+	 */
+	volatile sig_atomic_t switching;
+
+	/*
+	 * The thread that was running before the carrier switched to its
+	 * scheduler loop. It is queued (or handed to on_exit) by the loop,
+	 * once its stack is no longer in use.
+	 */
+	TCB *prev;
+	enum stop_reason prev_reason;
+
+	/* Stack pointer of the scheduler loop, saved by ult_switch(). */
+	void *sched_sp;
+
+	unsigned long switches;
+} __attribute__((aligned(64)));
+
+static struct carrier *carriers;
+static unsigned int num_carriers;
+static void (*exit_hook)(TCB *);
+static bool started;
+
+static __thread struct carrier *self;
+
+/* Incremented when work is queued, idle carriers wait for it to change. */
+static unsigned int work_seq;
+static unsigned int sleepers;
+
+/*
+ * A thread that yields may be resumed by another carrier, so the carrier is
+ * read again after every switch. Without the call, the compiler could reuse
+ * the address of the thread-local variable, computed before the switch.
+ */
+static __attribute__((noinline)) struct carrier *this_carrier(void)
+{
+	struct carrier *c = self;
+
+	__asm__ volatile("" ::: "memory");
+	return c;
+}
+
+static void wait_for_work(unsigned int seq)
+{
+	const struct timespec timeout = { 0, CARRIER_IDLE_NS };
+
+	__atomic_fetch_add(&sleepers, 1, __ATOMIC_SEQ_CST);
+	syscall(SYS_futex, &work_seq, FUTEX_WAIT_PRIVATE, seq, &timeout,
+		NULL, 0);
+	__atomic_fetch_sub(&sleepers, 1, __ATOMIC_SEQ_CST);
+}
+
+static void signal_work(void)
+{
+	__atomic_fetch_add(&work_seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&sleepers, __ATOMIC_SEQ_CST) > 0)
+		syscall(SYS_futex, &work_seq, FUTEX_WAKE_PRIVATE, 1, NULL,
+			NULL, 0);
+}
+
+static void runq_push(struct carrier *c, TCB *thread)
+{
+	pthread_spin_lock(&c->lock);
+	queue_enqueue(c->ready, thread);
+	pthread_spin_unlock(&c->lock);
+}
+
+static TCB *runq_pop(struct carrier *c)
+{
+	TCB *thread;
+
+	pthread_spin_lock(&c->lock);
+	thread = queue_dequeue(c->ready);
+	pthread_spin_unlock(&c->lock);
+
+	return thread;
+}
+
+/* Take the oldest thread that was not preempted from another carrier. */
+static TCB *steal(struct carrier *c)
+{
+	TCB *thread;
+
+	for (unsigned int i = 1; i < num_carriers; i++) {
+		thread = runq_pop(&carriers[(c->index + i) % num_carriers]);
+		if (thread != NULL)
+			return thread;
+	}
+
+	return NULL;
+}
+
+static TCB *find_work(struct carrier *c)
+{
+	unsigned int seq;
+	TCB *thread;
+
+	for (;;) {
+		seq = __atomic_load_n(&work_seq, __ATOMIC_SEQ_CST);
+
+		/* Alternate between the two local queues, for fairness. */
+		thread = NULL;
+		c->turn = !c->turn;
+		if (c->turn)
+			thread = queue_dequeue(c->preempted);
+		if (thread == NULL)
+			thread = runq_pop(c);
+		if (thread == NULL)
+			thread = queue_dequeue(c->preempted);
+		if (thread == NULL)
+			thread = steal(c);
+		if (thread != NULL)
+			return thread;
+
+		wait_for_work(seq);
+	}
+}
+
+/* Runs with switching set and SIGPROF unblocked, like the threads. */
+static void carrier_loop(struct carrier *c)
+{
+	TCB *next;
+
+	for (;;) {
+		if (c->prev != NULL) {
+			switch (c->prev_reason) {
+			case STOP_YIELDED:
+				runq_push(c, c->prev);
+				signal_work();
+				break;
+			case STOP_PREEMPTED:
+				queue_enqueue(c->preempted, c->prev);
+				break;
+			case STOP_EXITED:
+				exit_hook(c->prev);
+				break;
+			}
+			c->prev = NULL;
+		}
+
+		next = find_work(c);
+		c->running = next;
+		__atomic_store_n(&c->switches, c->switches + 1, __ATOMIC_RELAXED);
+
+		/* next clears switching once it runs. */
+		ult_switch(&c->sched_sp, next->sp);
+	}
+}
+
+static void carrier_loop_start(void)
+{
+	carrier_loop(this_carrier());
+}
+
+static bool arm_timer(struct carrier *c)
+{
+	struct sigevent event;
+	const struct itimerspec slice = {
+		{ 0, CARRIER_TIME_SLICE_NS },
+		{ 0, CARRIER_TIME_SLICE_NS }
+	};
+
+	/* Count the CPU time of this carrier and signal only this carrier. */
+	memset(&event, 0, sizeof(event));
+	event.sigev_notify = SIGEV_THREAD_ID;
+	event.sigev_signo = SIGPROF;
+	event._sigev_un._tid = gettid();	/* sigev_notify_thread_id */
+
+	if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &c->timer) == -1)
+		return false;
+
+	return timer_settime(c->timer, 0, &slice, NULL) == 0;
+}
+
+static void *carrier_main(void *arg)
+{
+	struct carrier *c = arg;
+	sigset_t sigprof;
+
+	self = c;
+
+	if (!arm_timer(c)) {
+		perror("timer_create");
+		abort();
+	}
+
+	/* The loop runs on the stack of this kernel thread. */
+	c->switching = 1;
+	sigemptyset(&sigprof);
+	sigaddset(&sigprof, SIGPROF);
+	pthread_sigmask(SIG_UNBLOCK, &sigprof, NULL);
+
+	carrier_loop(c);
+	return NULL;
+}
+
+bool carriers_start(unsigned int n, TCB *first, void (*on_exit)(TCB *))
+{
+	struct carrier *c;
+	void *stack;
+
+	carriers = aligned_alloc(__alignof__(struct carrier), n * sizeof(*carriers));
+	if (carriers == NULL)
+		return false;
+	memset(carriers, 0, n * sizeof(*carriers));
+
+	for (unsigned int i = 0; i < n; i++) {
+		carriers[i].index = i;
+		pthread_spin_init(&carriers[i].lock, PTHREAD_PROCESS_PRIVATE);
+		carriers[i].ready = queue_new();
+		carriers[i].preempted = queue_new();
+		if (carriers[i].ready == NULL || carriers[i].preempted == NULL)
+			return false;
+	}
+	num_carriers = n;
+	exit_hook = on_exit;
+
+	/*
+	 * The calling kernel thread keeps running first, so its scheduler
+	 * loop gets a stack of its own.
+	 */
+	c = &carriers[0];
+	self = c;
+	c->running = first;
+
+	stack = malloc(CARRIER_STACK_SIZE);
+	if (stack == NULL)
+		return false;
+	c->sched_sp = ult_switch_init(stack, CARRIER_STACK_SIZE,
+				      carrier_loop_start);
+
+	if (!arm_timer(c))
+		return false;
+
+	/* The new kernel threads inherit the blocked SIGPROF. */
+	for (unsigned int i = 1; i < n; i++) {
+		if (pthread_create(&carriers[i].thread, NULL, carrier_main,
+				   &carriers[i]) != 0)
+			return false;
+		pthread_detach(carriers[i].thread);
+	}
+
+	__atomic_store_n(&started, true, __ATOMIC_RELEASE);
+	return true;
+}
+
+bool carriers_enabled(void)
+{
+	return __atomic_load_n(&started, __ATOMIC_ACQUIRE);
+}
+
+TCB *carrier_running(void)
+{
+	return this_carrier()->running;
+}
+
+void carrier_submit(TCB *thread)
+{
+	runq_push(this_carrier(), thread);
+	signal_work();
+}
+
+/*
+ * Leave the running thread for the scheduler loop, which takes it from prev.
+ * Called with switching set. If mask is not NULL, the caller is the SIGPROF
+ * handler and mask is the signal mask of the interrupted thread.
+ */
+static void switch_to_loop(struct carrier *c, enum stop_reason reason,
+		const sigset_t *mask)
+{
+	TCB *thread = c->running;
+
+	c->prev = thread;
+	c->prev_reason = reason;
+	c->running = NULL;
+
+	/* The loop runs with the mask of the threads, not the handler's. */
+	if (mask != NULL)
+		pthread_sigmask(SIG_SETMASK, mask, NULL);
+	ult_switch(&thread->sp, c->sched_sp);
+}
+
+TCB *carrier_thread_start(void)
+{
+	struct carrier *c = this_carrier();
+	TCB *thread = c->running;
+
+	c->switching = 0;
+	return thread;
+}
+
+void carrier_yield(void)
+{
+	struct carrier *c = this_carrier();
+	bool idle;
+
+	/* Set before taking the lock: the loop takes it as well. */
+	c->switching = 1;
+
+	/* Nothing else to run on this carrier: don't go through the loop. */
+	pthread_spin_lock(&c->lock);
+	idle = queue_size(c->ready) == 0 && queue_size(c->preempted) == 0;
+	pthread_spin_unlock(&c->lock);
+	if (idle) {
+		c->switching = 0;
+		return;
+	}
+
+	switch_to_loop(c, STOP_YIELDED, NULL);
+
+	/* Possibly resumed by another carrier. */
+	this_carrier()->switching = 0;
+}
+
+void carrier_preempt(const sigset_t *mask)
+{
+	struct carrier *c = this_carrier();
+
+	if (c->switching)
+		return;
+
+	/*
+	 * The thread is suspended inside the signal handler, not at the
+	 * interrupted instruction: ult_switch() only saves the registers
+	 * preserved across function calls, while returning from the handler
+	 * restores all of them.
+	 */
+	c->switching = 1;
+	switch_to_loop(c, STOP_PREEMPTED, mask);
+	this_carrier()->switching = 0;
+}
+
+void carrier_exit(void)
+{
+	struct carrier *c = this_carrier();
+
+	c->switching = 1;
+	switch_to_loop(c, STOP_EXITED, NULL);
+	abort();
+}
+
+unsigned long carriers_switches(void)
+{
+	unsigned long total = 0;
+
+	for (unsigned int i = 0; i < num_carriers; i++)
+		total += __atomic_load_n(&carriers[i].switches, __ATOMIC_RELAXED);
+
+	return total;
+}
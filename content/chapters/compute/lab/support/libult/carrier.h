@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * M:N scheduling for libult.
+ *
+ * By default, all the user-level threads run on the kernel thread that
+ * created them. With several carriers, M user-level threads are multiplexed
+ * over N kernel threads (the carriers). Each carrier has its own run queue
+ * and an idle carrier steals work from the others. Each carrier is preempted
+ * by its own SIGPROF timer, measuring the CPU time of that carrier.
+ *
+ * Only threads that have not started yet or that yielded, which are in the
+ * run queue of their carrier, migrate. A preempted thread may be interrupted
+ * inside the C library, which keeps per kernel thread state, so it keeps
+ * running on the same carrier.
+ *
+ * Switching between a thread and the scheduler loop of its carrier uses
+ * ult_switch(), without system calls. Threads preempted by the timer switch
+ * from inside the SIGPROF handler: when resumed, they return from it, and the
+ * kernel restores the registers that ult_switch() doesn't save.
+ */
+
+#ifndef CARRIER_H
+#define CARRIER_H
+
+#include <signal.h>
+#include <stdbool.h>
+
+#include "tcb.h"
+
+/*
+ * Start num_carriers carriers. The calling kernel thread becomes the first
+ * carrier, with first as its running thread. The other carriers are new
+ * kernel threads. on_exit is called with every thread that exited, after
+ * the carrier has left its stack, so it can be handed to a joiner.
+ */
+bool carriers_start(unsigned int num_carriers, TCB *first,
+		void (*on_exit)(TCB *));
+
+/* Whether carriers_start() has been called. */
+bool carriers_enabled(void);
+
+/* The thread running on the calling carrier. */
+TCB *carrier_running(void);
+
+/*
+ * Make thread ready to run, on the calling carrier's queue. Must be called
+ * with SIGPROF blocked.
+ */
+void carrier_submit(TCB *thread);
+
+/* Called first by a new thread: returns its TCB. */
+TCB *carrier_thread_start(void);
+
+/* Let the other threads of this carrier run. */
+void carrier_yield(void);
+
+/*
+ * Called from the SIGPROF handler, with the signal mask of the interrupted
+ * thread: queue the running thread and run another one. Returns when the
+ * thread is resumed, on the same carrier, or right away if the carrier is in
+ * the middle of a switch.
+ */
+void carrier_preempt(const sigset_t *mask);
+
+/* The running thread has finished: hand it to on_exit and run another one. */
+void carrier_exit(void) __attribute__((noreturn));
+
+/* Context switches done by all the carriers so far. */
+unsigned long carriers_switches(void);
+
+#endif
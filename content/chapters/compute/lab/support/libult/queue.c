@@ -27,18 +27,15 @@
 #include "queue.h"
 
 
-#include <errno.h>
 #include <stdlib.h>
 
 
-struct node {
-	TCB *thread;
-	struct node *next;
-};
-
-
+/* The queue is intrusive: elements are linked through TCB->next, so
+   enqueueing and dequeueing never allocate and take constant time. A
+   TCB can only be in one queue at a time. */
 struct queue {
-	struct node *head;
+	TCB *head;
+	TCB *tail;
 	size_t size;
 };
 
@@ -59,15 +56,14 @@ QUEUE *queue_new(void)
 
 void queue_destroy(QUEUE *queue)
 {
-	struct node *prev = NULL;
-	struct node *cursor = queue->head;
+	TCB *prev = NULL;
+	TCB *cursor = queue->head;
 
 	while (cursor != NULL) {
 		prev = cursor;
 		cursor = cursor->next;
 
-		tcb_destroy(prev->thread);
-		free(prev);
+		tcb_destroy(prev);
 	}
 
 	free(queue);
@@ -82,28 +78,14 @@ size_t queue_size(const QUEUE *queue)
 
 int queue_enqueue(QUEUE *queue, TCB *elem)
 {
-	// Create the new node
+	elem->next = NULL;
 
-	struct node *new;
-
-	if ((new = malloc(sizeof(struct node))) == NULL) {
-	return errno;
-	}
-
-	new->thread = elem;
-	new->next = NULL;
-
-	// Enqueue the new node
-
-	if (queue->head == NULL) {
-		queue->head = new;
+	if (queue->tail == NULL) {
+		queue->head = elem;
 	} else {
-		struct node *parent = queue->head;
-		while (parent->next != NULL) {
-			parent = parent->next;
-		}
-		parent->next = new;
+		queue->tail->next = elem;
 	}
+	queue->tail = elem;
 
 	queue->size += 1;
 	return 0;
@@ -112,40 +94,40 @@ int queue_enqueue(QUEUE *queue, TCB *elem)
 
 TCB *queue_dequeue(QUEUE *queue)
 {
-	struct node *old_head = queue->head;
+	TCB *old_head = queue->head;
 	if (old_head == NULL || queue->size == 0) {
 		return NULL;
 	}
-	queue->head = queue->head->next;
+	queue->head = old_head->next;
+	if (queue->head == NULL) {
+		queue->tail = NULL;
+	}
 	queue->size -= 1;
 
-	TCB *retval = old_head->thread;
-	free(old_head);
-
-	return retval;
+	old_head->next = NULL;
+	return old_head;
 }
 
 
 TCB *queue_remove_id(QUEUE *queue, int id)
 {
-	if (queue->head == NULL) {
-		return NULL;
-	}
-
-	struct node *prev = NULL;
-	struct node *cur = queue->head;
+	TCB *prev = NULL;
+	TCB *cur = queue->head;
 
 	while (cur != NULL) {
-		if (cur->thread->id == id) {
+		if (cur->id == id) {
 			if (prev == NULL) {
 				queue->head = cur->next;
 			} else {
 				prev->next = cur->next;
 			}
+			if (queue->tail == cur) {
+				queue->tail = prev;
+			}
+			queue->size -= 1;
 
-			TCB *retval = cur->thread;
-			free(cur);
-			return retval;
+			cur->next = NULL;
+			return cur;
 		}
 
 		prev = cur;
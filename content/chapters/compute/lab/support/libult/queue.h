@@ -56,13 +56,14 @@ size_t queue_size(const QUEUE *queue);
 
 
 /* Add elem to the end of queue. Returns 0 on succes and non-zero on
-   failure.*/
+   failure. Takes constant time and does not allocate memory, so it
+   cannot fail. */
 int queue_enqueue(QUEUE *queue, TCB *elem);
 
 
-/* Remove the first item from the queue and return it. The caller will
-   have to free the reuturned element. Returns NULL if the queue is
-   empty. */
+/* Remove the first item from the queue and return it in constant
+   time. The caller will have to free the reuturned element. Returns
+   NULL if the queue is empty. */
 TCB *queue_dequeue(QUEUE *queue);
 
 
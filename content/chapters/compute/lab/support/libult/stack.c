@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "stack.h"
+
+/* Stacks kept for reuse. The pages they touched stay resident. */
+#define STACK_POOL_MAX	1024
+
+/*
+ * A free stack in the pool. The entry is stored at the top of the stack,
+ * in pages that the previous thread has already touched.
+ */
+struct free_stack {
+	struct free_stack *next;
+	size_t size;
+};
+
+/* Threads are created and joined on several carriers. */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct free_stack *pool;
+static unsigned int pool_size;
+
+static size_t page_size(void)
+{
+	static size_t size;
+
+	if (size == 0)
+		size = sysconf(_SC_PAGESIZE);
+
+	return size;
+}
+
+static struct free_stack *pool_entry(void *stack, size_t size)
+{
+	return (struct free_stack *)((char *)stack + size) - 1;
+}
+
+size_t stack_round_size(size_t size)
+{
+	size_t page = page_size();
+
+	return (size + page - 1) & ~(page - 1);
+}
+
+/* Take a stack of the given size from the pool. */
+static void *pool_get(size_t size)
+{
+	struct free_stack **link, *entry;
+
+	pthread_mutex_lock(&pool_lock);
+	for (link = &pool; *link != NULL; link = &(*link)->next) {
+		if ((*link)->size == size)
+			break;
+	}
+	entry = *link;
+	if (entry != NULL) {
+		*link = entry->next;
+		pool_size--;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	if (entry == NULL)
+		return NULL;
+
+	return (char *)(entry + 1) - size;
+}
+
+void *stack_alloc(size_t size)
+{
+	size_t guard = page_size();
+	char *map;
+	void *stack;
+
+	stack = pool_get(size);
+	if (stack != NULL)
+		return stack;
+
+	map = mmap(NULL, guard + size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+		   -1, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	/* Stacks grow down, so the guard page is the lowest one. */
+	if (mprotect(map, guard, PROT_NONE) == -1) {
+		munmap(map, guard + size);
+		return NULL;
+	}
+
+	return map + guard;
+}
+
+void stack_free(void *stack, size_t size)
+{
+	size_t guard = page_size();
+	struct free_stack *entry;
+
+	pthread_mutex_lock(&pool_lock);
+	if (pool_size < STACK_POOL_MAX) {
+		entry = pool_entry(stack, size);
+		entry->size = size;
+		entry->next = pool;
+		pool = entry;
+		pool_size++;
+		stack = NULL;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	if (stack != NULL)
+		munmap((char *)stack - guard, guard + size);
+}
@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Stacks for the libult threads.
+ *
+ * Every stack is mapped with mmap(), without reserving swap space, so only
+ * the pages a thread touches use memory. A page without any access rights
+ * lies below the stack: a thread that overflows its stack gets a SIGSEGV
+ * instead of silently overwriting other memory.
+ *
+ * The stacks of joined threads go to a pool and are given to new threads of
+ * the same stack size, which saves the mmap(), mprotect() and munmap() calls
+ * and the page faults of a fresh mapping.
+ */
+
+#ifndef STACK_H
+#define STACK_H
+
+#include <stddef.h>
+
+/* Smallest stack that stack_alloc() accepts. */
+#define STACK_MIN_SIZE	(16 * 1024)
+
+/* The size rounded up to a whole number of pages. */
+size_t stack_round_size(size_t size);
+
+/*
+ * Return the lowest address of a stack of size bytes, a multiple of the
+ * page size, or NULL on error, with errno set.
+ */
+void *stack_alloc(size_t size);
+
+/* Give back a stack returned by stack_alloc(). */
+void stack_free(void *stack, size_t size);
+
+#endif
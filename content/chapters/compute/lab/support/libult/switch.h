@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef SWITCH_H
+#define SWITCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Save the current thread's registers and resume the one saved at to_sp. */
+void ult_switch(void **from_sp, void *to_sp);
+
+/*
+ * Lay out a frame on a new stack so that ult_switch() to the returned stack
+ * pointer calls entry(), with the stack aligned as after a call instruction.
+ * entry() must not return.
+ */
+static inline void *ult_switch_init(void *stack, size_t size, void (*entry)(void))
+{
+	uint64_t *sp = (uint64_t *)(((uintptr_t)stack + size) & ~(uintptr_t)15);
+
+	*--sp = 0;				/* return address of entry() */
+	*--sp = (uintptr_t)entry;		/* popped by ret */
+	for (int i = 0; i < 6; i++)
+		*--sp = 0;			/* rbp, rbx, r12-r15 */
+	*--sp = 0x037fULL << 32 | 0x1f80;	/* x87 and SSE defaults */
+
+	return sp;
+}
+
+#endif
@@ -25,6 +25,7 @@
 /* Github link: https://github.com/kissen/threads */
 
 #include "tcb.h"
+#include "stack.h"
 
 #include <stdlib.h>
 
@@ -39,7 +40,8 @@ TCB *tcb_new(void)
 		return NULL;
 	}
 
-	new->id = next_id++;
+	// Threads may be created from several carriers (kernel threads)
+	new->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
 	return new;
 }
 
@@ -47,7 +49,8 @@ TCB *tcb_new(void)
 void tcb_destroy(TCB *block)
 {
 	if (block->has_dynamic_stack) {
-		free(block->context.uc_stack.ss_sp);
+		stack_free(block->context.uc_stack.ss_sp,
+				block->context.uc_stack.ss_size);
 	}
 
 	free(block);
@@ -39,13 +39,15 @@
 #include <ucontext.h>
 
 
-typedef struct {
+typedef struct tcb {
 	int id;
-	ucontext_t context;
+	ucontext_t context;	/* uc_stack is the stack of the thread */
+	void *sp;		/* saved by ult_switch() */
 	bool has_dynamic_stack;
 	void *(*start_routine) (void *);
 	void *argument;
 	void *return_value;
+	struct tcb *next;	/* link in the queue holding this TCB */
 } TCB;
 
 
@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Create, run and join many short-lived threads, a batch at a time, and
+ * report how fast they are created and how much memory stays resident.
+ * The stacks of each batch are reused by the next one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "./threads.h"
+#include "utils/utils.h"
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Resident memory of the process, in KiB. */
+static long rss_kb(void)
+{
+	long size, resident;
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	DIE(f == NULL, "fopen");
+	DIE(fscanf(f, "%ld %ld", &size, &resident) != 2, "fscanf");
+	fclose(f);
+
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void *short_lived(void *arg)
+{
+	/* Touch a bit of the stack, like a real thread would. */
+	volatile char buf[1024];
+
+	memset((char *)buf, 0, sizeof(buf));
+	buf[0] = 1;
+
+	return (void *)((long)arg + buf[0]);
+}
+
+int main(int argc, char *argv[])
+{
+	int num_threads = 100000, batch = 1000;
+	size_t stack_size = 0;
+	double create_s = 0, start, t;
+	long sum = 0, expected = 0;
+	struct rusage usage;
+	int *ids, opt, rc;
+	void *res;
+
+	while ((opt = getopt(argc, argv, "n:b:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			num_threads = atoi(optarg);
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		case 's':
+			stack_size = strtoul(optarg, NULL, 0) * 1024;
+			break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-n threads] [-b batch] [-s stack_kb]\n",
+				argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	DIE(num_threads < 1 || batch < 1, "invalid arguments");
+
+	ids = malloc(batch * sizeof(*ids));
+	DIE(ids == NULL, "malloc");
+
+	if (stack_size)
+		printf("%d threads, %d at a time, %zu KiB stacks\n",
+		       num_threads, batch, stack_size / 1024);
+	else
+		printf("%d threads, %d at a time, default stacks\n",
+		       num_threads, batch);
+
+	start = now();
+	for (int done = 0; done < num_threads; done += batch) {
+		int count = num_threads - done < batch ? num_threads - done : batch;
+
+		t = now();
+		for (int i = 0; i < count; i++) {
+			long arg = done + i;
+
+			if (stack_size)
+				ids[i] = threads_create_stack(short_lived,
+							      (void *)arg,
+							      stack_size);
+			else
+				ids[i] = threads_create(short_lived,
+							(void *)arg);
+			DIE(ids[i] < 0, "threads_create");
+			expected += arg + 1;
+		}
+		create_s += now() - t;
+
+		for (int i = 0; i < count; i++) {
+			while ((rc = threads_join(ids[i], &res)) == 0)
+				threads_yield();
+			DIE(rc < 0, "threads_join");
+			sum += (long)res;
+		}
+	}
+	t = now() - start;
+
+	DIE(sum != expected, "wrong results");
+
+	DIE(getrusage(RUSAGE_SELF, &usage) < 0, "getrusage");
+	printf("create: %.0f threads/s (%.0f ns each)\n",
+	       num_threads / create_s, create_s * 1e9 / num_threads);
+	printf("create+run+join: %.0f threads/s\n", num_threads / t);
+	printf("RSS: %ld KiB now, %ld KiB peak\n", rss_kb(), usage.ru_maxrss);
+
+	free(ids);
+
+	return 0;
+}
@@ -27,8 +27,12 @@
 #include "threads.h"
 #include "tcb.h"
 #include "queue.h"
+#include "carrier.h"
+#include "switch.h"
+#include "stack.h"
 
 #include <errno.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -39,18 +43,36 @@
 #include <ucontext.h>
 
 
+// Stack size used if RLIMIT_STACK is unlimited
+#define DEFAULT_STACK_SIZE (8 * 1024 * 1024)
+
+
 static QUEUE *ready, *completed;
 static TCB *running;
 
+// With several carriers, threads complete on all of them
+static pthread_spinlock_t completed_lock;
+
+static unsigned int num_carriers;
+static bool carriers_chosen;
+static unsigned long switches;
+
+// Set while switching threads: the SIGPROF handler must not interrupt it
+static volatile sig_atomic_t switching;
+
 
 static bool init_queues(void);
 static bool init_first_context(void);
 static bool init_profiling_timer(void);
+static bool init_carriers(void);
+static void complete_thread(TCB *);
 
 static void handle_sigprof(int, siginfo_t *, void *);
 static void handle_thread_start();
+static void switch_threads(TCB *, TCB *, const sigset_t *);
 
-static bool malloc_stack(TCB *);
+static size_t default_stack_size(void);
+static bool alloc_stack(TCB *, size_t);
 
 static void block_sigprof(void);
 static void unblock_sigprof(void);
@@ -58,6 +80,18 @@ static void unblock_sigprof(void);
 
 int threads_create(void *(*start_routine) (void *), void *arg)
 {
+	return threads_create_stack(start_routine, arg, default_stack_size());
+}
+
+
+int threads_create_stack(void *(*start_routine) (void *), void *arg,
+		size_t stack_size)
+{
+	if (stack_size < STACK_MIN_SIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+
 	block_sigprof();
 
 	// Init if necessary
@@ -76,6 +110,10 @@ int threads_create(void *(*start_routine) (void *), void *arg)
 		if (! init_profiling_timer()) {
 			abort();
 		}
+
+		if (! init_carriers()) {
+			abort();
+		}
 		
 		initialized = true;
 	}
@@ -85,38 +123,52 @@ int threads_create(void *(*start_routine) (void *), void *arg)
 	TCB *new;
 
 	if ((new = tcb_new()) == NULL) {
+		unblock_sigprof();
 		return -1;
 	}
 
-	if (getcontext(&new->context) == -1) {
-		tcb_destroy(new);
-		return -1;
-	}
+	// The stack pool is locked: don't get preempted while holding it
 
-	if (! malloc_stack(new)) {
+	if (! alloc_stack(new, stack_size)) {
 		tcb_destroy(new);
+		unblock_sigprof();
 		return -1;
 	}
 
-	makecontext(&new->context, handle_thread_start, 1, new->id);
+	// The first switch to the thread calls handle_thread_start()
+
+	new->sp = ult_switch_init(new->context.uc_stack.ss_sp,
+			new->context.uc_stack.ss_size, handle_thread_start);
 
 	new->start_routine = start_routine;
 	new->argument = arg;
 
 	// Enqueue the newly created stack
 
-	if (queue_enqueue(ready, new) != 0) {
+	// Another carrier may run, finish and free it right away
+
+	int id = new->id;
+
+	if (carriers_enabled()) {
+		carrier_submit(new);
+	} else if (queue_enqueue(ready, new) != 0) {
 		tcb_destroy(new);
+		unblock_sigprof();
 		return -1;
 	}
 
 	unblock_sigprof();
-	return new->id;
+	return id;
 }
 
 
 void threads_exit(void *result)
 {
+	if (carriers_enabled()) {
+		carrier_running()->return_value = result;
+		carrier_exit();  // the carrier queues it as completed
+	}
+
 	if (running == NULL) {
 		exit(EXIT_SUCCESS);
 	}
@@ -132,7 +184,43 @@ void threads_exit(void *result)
 		exit(EXIT_SUCCESS);
 	}
 
-	setcontext(&running->context);  // also unblocks SIGPROF
+	switches += 1;
+
+	void *unused;
+
+	switching = 1;
+	unblock_sigprof();
+	ult_switch(&unused, running->sp);
+	abort();
+}
+
+
+void threads_yield(void)
+{
+	if (carriers_enabled()) {
+		carrier_yield();
+		return;
+	}
+
+	if (running == NULL || queue_size(ready) == 0) {
+		return;
+	}
+
+	switching = 1;
+
+	TCB *prev = running;
+
+	if (queue_enqueue(ready, prev) != 0) {
+		abort();
+	}
+
+	if ((running = queue_dequeue(ready)) == NULL) {
+		abort();
+	}
+
+	switch_threads(prev, running, NULL);
+
+	switching = 0;
 }
 
 
@@ -144,14 +232,17 @@ int threads_join(int id, void **result)
 	}
 
 	block_sigprof();
+	pthread_spin_lock(&completed_lock);
 	TCB *block = queue_remove_id(completed, id);
-	unblock_sigprof();
+	pthread_spin_unlock(&completed_lock);
 
 	if (block == NULL) {
+		unblock_sigprof();
 		return 0;
 	} else {
 		*result = block->return_value;
-		tcb_destroy(block);
+		tcb_destroy(block);  // its stack goes back to the pool
+		unblock_sigprof();
 		return id;
 	}
 }
@@ -168,6 +259,8 @@ static bool init_queues(void)
 		return false;
 	}
 
+	pthread_spin_init(&completed_lock, PTHREAD_PROCESS_PRIVATE);
+
 	return true;
 }
 
@@ -209,6 +302,12 @@ static bool init_profiling_timer(void)
 		abort();
 	}
 
+	// Each carrier arms its own timer
+
+	if (threads_carriers() > 1) {
+		return true;
+	}
+
 	const struct itimerval timer = {
 		{ 0, 10000 },
 		{ 0, 1 }  // arms the timer as soon as possible
@@ -236,23 +335,31 @@ static void handle_sigprof(int signum, siginfo_t *nfo, void *context)
 	(void)signum;
 	(void)nfo;
 
+	const sigset_t *mask = &((ucontext_t *) context)->uc_sigmask;
+
+	if (carriers_enabled()) {
+		carrier_preempt(mask);
+		errno = old_errno;
+		return;
+	}
+
+	// Don't interrupt threads_yield() or threads_exit()
+
+	if (switching) {
+		return;
+	}
+
 	if (running == NULL && queue_size(ready) == 0) {
 		_exit(EXIT_SUCCESS);
 	}
 
-	// Backup the current context
-	
-	ucontext_t *stored = &running->context;
-	ucontext_t *updated = (ucontext_t *) context;
-
-	stored->uc_flags = updated->uc_flags;
-	stored->uc_link = updated->uc_link;
-	stored->uc_mcontext = updated->uc_mcontext;
-	stored->uc_sigmask = updated->uc_sigmask;
+	switching = 1;
 
 	// Round robin
 
-	if (queue_enqueue(ready, running) != 0) {
+	TCB *prev = running;
+
+	if (queue_enqueue(ready, prev) != 0) {
 		abort();
 	}
 
@@ -260,48 +367,157 @@ static void handle_sigprof(int signum, siginfo_t *nfo, void *context)
 		abort();
 	}
 
-	// Manually leave the signal handler
+	// The current thread stays suspended inside this handler. When it
+	// is resumed, the handler returns and the kernel restores all of its
+	// registers, which ult_switch() alone does not do.
+
+	switch_threads(prev, running, mask);
 
+	switching = 0;
 	errno = old_errno;
-	if (setcontext(&running->context) == -1) {
-		abort();
+}
+
+
+// Save prev on its stack and resume next, whether next stopped in
+// threads_yield() or inside the signal handler. If called from the signal
+// handler, mask is the signal mask of the interrupted thread: next runs
+// with it, not with the mask of the handler.
+
+static void switch_threads(TCB *prev, TCB *next, const sigset_t *mask)
+{
+	if (next == prev) {
+		return;
 	}
+
+	switches += 1;
+
+	if (mask != NULL) {
+		sigprocmask(SIG_SETMASK, mask, NULL);
+	}
+
+	ult_switch(&prev->sp, next->sp);
 }
 
 
 static void handle_thread_start(void)
 {
-	block_sigprof();
-	TCB *this = running;
-	unblock_sigprof();
+	TCB *this;
+
+	if (carriers_enabled()) {
+		this = carrier_thread_start();
+	} else {
+		this = running;
+		switching = 0;
+	}
 
 	void *result = this->start_routine(this->argument);
 	threads_exit(result);
 }
 
+
+int threads_set_carriers(unsigned int n)
+{
+	if (n == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (carriers_chosen) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	num_carriers = n;
+	return 0;
+}
+
+
+unsigned int threads_carriers(void)
+{
+	if (num_carriers == 0) {
+		const char *env = getenv("LIBULT_CARRIERS");
+		int n = env ? atoi(env) : 1;
+
+		num_carriers = n > 0 ? n : 1;
+	}
+
+	return num_carriers;
+}
+
+
+unsigned long threads_context_switches(void)
+{
+	if (carriers_enabled()) {
+		return carriers_switches();
+	}
+
+	return __atomic_load_n(&switches, __ATOMIC_RELAXED);
+}
+
+
+static bool init_carriers(void)
+{
+	carriers_chosen = true;
+
+	if (threads_carriers() == 1) {
+		return true;
+	}
+
+	// The main thread keeps running, on the first carrier
+
+	TCB *main_thread = running;
+	running = NULL;
+
+	return carriers_start(num_carriers, main_thread, complete_thread);
+}
+
+
+static void complete_thread(TCB *thread)
+{
+	pthread_spin_lock(&completed_lock);
+	queue_enqueue(completed, thread);
+	pthread_spin_unlock(&completed_lock);
+}
+
 	 
-static bool malloc_stack(TCB *thread)
+static size_t default_stack_size(void)
 {
-	// Get the stack size
+	static size_t size;
 
-	struct rlimit limit;
+	if (size == 0) {
+		struct rlimit limit;
 
-	if (getrlimit(RLIMIT_STACK, &limit) == -1) {
-		return false;
+		// As large as the stack of the main thread
+
+		if (getrlimit(RLIMIT_STACK, &limit) == -1
+				|| limit.rlim_cur == RLIM_INFINITY
+				|| limit.rlim_cur < STACK_MIN_SIZE) {
+			size = DEFAULT_STACK_SIZE;
+		} else {
+			size = limit.rlim_cur;
+		}
 	}
 
-	// Allocate memory
+	return size;
+}
+
+
+static bool alloc_stack(TCB *thread, size_t size)
+{
+	// Whole pages, with a guard page below
+
+	size = stack_round_size(size);
 
 	void *stack;
 
-	if ((stack = malloc(limit.rlim_cur)) == NULL) {
+	if ((stack = stack_alloc(size)) == NULL) {
 		return false;
 	}
 
 	// Update the thread control bock
 
 	thread->context.uc_stack.ss_flags = 0;
-	thread->context.uc_stack.ss_size = limit.rlim_cur;
+	thread->context.uc_stack.ss_size = size;
 	thread->context.uc_stack.ss_sp = stack;
 	thread->has_dynamic_stack = true;
 
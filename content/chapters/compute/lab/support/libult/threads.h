@@ -32,6 +32,12 @@
 #ifndef THREADS_H
 #define THREADS_H
 
+#include <stddef.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /* Create a new thread. func is the function that will be run once the
    thread starts execution and arg is the argument for that
@@ -40,6 +46,14 @@
 int threads_create(void *(*start_routine) (void *), void *arg);
 
 
+/* Like threads_create, with a stack of stack_size bytes instead of
+   one as large as RLIMIT_STACK. The size is rounded up to whole
+   pages and must be at least 16 KiB. Stacks of joined threads are
+   reused by new threads of the same stack size. */
+int threads_create_stack(void *(*start_routine) (void *), void *arg,
+		size_t stack_size);
+
+
 /* Stop execution of the thread calling this function. */
 void threads_exit(void *result);
 
@@ -52,4 +66,31 @@ void threads_exit(void *result);
 int threads_join(int id, void **result);
 
 
+/* Give the CPU to the next ready thread, if there is one. This is
+   much cheaper than waiting to be preempted: the switch is done in
+   user space, without system calls. */
+void threads_yield(void);
+
+
+/* Run the threads on n kernel threads (carriers) instead of only on
+   the one that created them. Must be called before the first
+   threads_create. Without it, the number of carriers is taken from
+   the LIBULT_CARRIERS environment variable, and defaults to 1. On
+   error, -1 is returned and errno is set. */
+int threads_set_carriers(unsigned int n);
+
+
+/* The number of carriers the threads run on. */
+unsigned int threads_carriers(void);
+
+
+/* The number of context switches done by the scheduler so far. */
+unsigned long threads_context_switches(void);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
 #endif
@@ -0,0 +1,175 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+"""
+Run the sum-array variants (C, D and Python) over several worker counts and
+compare them.
+
+Every variant runs a few times untimed (warm-up), then a number of timed
+repetitions, pinned to as many CPUs as it has workers. The C variants report
+their CLOCK_MONOTONIC time and perf_event_open counters when SUM_ARRAY_BENCH
+is set; the others only report their own "Time spent".
+
+All the runs go to a CSV file; speedup and efficiency tables, relative to the
+run of the same variant with one worker, go to the standard output.
+"""
+
+import argparse
+import csv
+import os
+import re
+import statistics
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+# name, command (without the worker count), takes a worker count, extra env
+VARIANTS = [
+    ("c/sequential", ["c/sum_array_sequential"], False, {}),
+    ("c/threads", ["c/sum_array_threads"], True, {}),
+    ("c/processes", ["c/sum_array_processes"], True, {}),
+    (
+        "c/openmp",
+        ["c/sum_array_threads_openmp"],
+        True,
+        {"OMP_PROC_BIND": "true", "OMP_PLACES": "cores"},
+    ),
+    ("d/threads_reduce", ["d/sum_array_threads_reduce"], True, {}),
+    ("python/sequential", [sys.executable, "python/sum_array_sequential.py"], False, {}),
+]
+
+COUNTERS = ["cycles", "llc_misses", "l1d_misses", "task_clock_ns"]
+
+BENCH_RE = re.compile(r"^bench: (.*)$", re.MULTILINE)
+TIME_RE = re.compile(r"time spent: ([0-9.]+) ?m", re.IGNORECASE)
+
+
+def worker_counts(max_workers):
+    n = 1
+    while n < max_workers:
+        yield n
+        n *= 2
+    yield max_workers
+
+
+def available(cmd):
+    if cmd[0] == sys.executable:
+        return os.path.exists(os.path.join(HERE, cmd[1]))
+    return os.access(os.path.join(HERE, cmd[0]), os.X_OK)
+
+
+def run_once(cmd, workers, env):
+    """Return the time in ms and the counters of one run."""
+    cpus = sorted(os.sched_getaffinity(0))[: max(workers, 1)]
+
+    proc = subprocess.run(
+        cmd,
+        cwd=HERE,
+        env=env,
+        capture_output=True,
+        text=True,
+        check=True,
+        preexec_fn=lambda: os.sched_setaffinity(0, cpus),
+    )
+
+    m = BENCH_RE.search(proc.stdout)
+    if m:
+        fields = dict(kv.split("=") for kv in m.group(1).split())
+        counters = {c: int(fields[c]) for c in COUNTERS if int(fields[c]) >= 0}
+        return int(fields["ns"]) / 1e6, counters
+
+    m = TIME_RE.search(proc.stdout)
+    if not m:
+        raise RuntimeError(f"{cmd[0]}: no time in output: {proc.stdout!r}")
+    return float(m.group(1)), {}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("-t", "--max-workers", type=int, default=os.cpu_count())
+    parser.add_argument("-w", "--warmup", type=int, default=1)
+    parser.add_argument("-n", "--repetitions", type=int, default=5)
+    parser.add_argument("-o", "--output", default="sum_array_bench.csv")
+    parser.add_argument(
+        "-v", "--variants", help="comma separated names, e.g. c/threads,c/openmp"
+    )
+    args = parser.parse_args()
+
+    env = dict(os.environ)
+    env["SUM_ARRAY_BENCH"] = "1"
+    # Generate the array once, for all the runs.
+    env.setdefault("SUM_ARRAY_CACHE", "/tmp/sum_array.cache")
+    env.setdefault("SUM_ARRAY_SEED", "1")
+
+    selected = args.variants.split(",") if args.variants else None
+    results = {}
+
+    with open(args.output, "w", newline="") as f:
+        out = csv.writer(f)
+        out.writerow(["variant", "workers", "repetition", "time_ms"] + COUNTERS)
+
+        for name, cmd, parallel, extra_env in VARIANTS:
+            if selected and name not in selected:
+                continue
+            if not available(cmd):
+                print(f"{name}: not built, skipped", file=sys.stderr)
+                continue
+
+            counts = worker_counts(args.max_workers) if parallel else [1]
+            for workers in counts:
+                full_cmd = cmd + [str(workers)] if parallel else cmd
+                run_env = dict(env, **extra_env)
+
+                for _ in range(args.warmup):
+                    run_once(full_cmd, workers, run_env)
+
+                for rep in range(args.repetitions):
+                    ms, counters = run_once(full_cmd, workers, run_env)
+                    out.writerow(
+                        [name, workers, rep, f"{ms:.3f}"]
+                        + [counters.get(c, "") for c in COUNTERS]
+                    )
+                    results.setdefault((name, workers), []).append((ms, counters))
+
+    print_tables(results)
+    print(f"\nAll runs: {args.output}")
+
+
+def median_counter(runs, counter):
+    values = [c[counter] for _, c in runs if counter in c]
+    return statistics.median(values) if values else None
+
+
+def print_tables(results):
+    print(
+        f"{'variant':<18} {'workers':>7} {'median_ms':>10} {'stdev_ms':>9} "
+        f"{'speedup':>8} {'effic.':>7} {'Mcycles':>9} {'LLC_miss':>10} {'cpu_ms':>8}"
+    )
+
+    for (name, workers), runs in results.items():
+        times = [ms for ms, _ in runs]
+        median = statistics.median(times)
+        stdev = statistics.stdev(times) if len(times) > 1 else 0.0
+
+        base = results.get((name, 1))
+        speedup = statistics.median(ms for ms, _ in base) / median if base else None
+
+        cycles = median_counter(runs, "cycles")
+        misses = median_counter(runs, "llc_misses")
+        cpu = median_counter(runs, "task_clock_ns")
+
+        def fmt(value, width, spec):
+            return f"{value:>{width}{spec}}" if value is not None else f"{'-':>{width}}"
+
+        print(
+            f"{name:<18} {workers:>7} {median:>10.1f} {stdev:>9.1f} "
+            f"{fmt(speedup, 8, '.2f')} "
+            f"{fmt(speedup / workers if speedup else None, 7, '.2f')} "
+            f"{fmt(cycles / 1e6 if cycles else None, 9, '.1f')} "
+            f"{fmt(misses, 10, '.0f')} "
+            f"{fmt(cpu / 1e6 if cpu else None, 8, '.1f')}"
+        )
+
+
+if __name__ == "__main__":
+    sys.exit(main())
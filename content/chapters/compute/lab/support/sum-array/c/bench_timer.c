@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "include/bench_timer.h"
+
+static const struct {
+	uint32_t type;
+	uint64_t config;
+	const char *name;
+} events[BENCH_NUM_COUNTERS] = {
+	[BENCH_CYCLES] = {
+		PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"
+	},
+	[BENCH_LLC_MISSES] = {
+		PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+			(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			(PERF_COUNT_HW_CACHE_RESULT_MISS << 16), "llc_misses"
+	},
+	[BENCH_L1D_MISSES] = {
+		PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+			(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			(PERF_COUNT_HW_CACHE_RESULT_MISS << 16), "l1d_misses"
+	},
+	[BENCH_TASK_CLOCK] = {
+		PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task_clock_ns"
+	},
+};
+
+static int open_counter(int i)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.inherit = 1;
+	/* Allowed with the default perf_event_paranoid setting. */
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void bench_timer_start(struct bench_timer *t)
+{
+	for (int i = 0; i < BENCH_NUM_COUNTERS; i++) {
+		t->fds[i] = open_counter(i);
+		t->counters[i] = -1;
+	}
+
+	for (int i = 0; i < BENCH_NUM_COUNTERS; i++)
+		if (t->fds[i] >= 0)
+			ioctl(t->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &t->start);
+}
+
+void bench_timer_stop(struct bench_timer *t)
+{
+	struct timespec stop;
+	uint64_t value;
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	t->ns = (stop.tv_sec - t->start.tv_sec) * 1000000000ULL +
+		stop.tv_nsec - t->start.tv_nsec;
+
+	for (int i = 0; i < BENCH_NUM_COUNTERS; i++) {
+		if (t->fds[i] < 0)
+			continue;
+		ioctl(t->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(t->fds[i], &value, sizeof(value)) == sizeof(value))
+			t->counters[i] = value;
+		close(t->fds[i]);
+		t->fds[i] = -1;
+	}
+}
+
+void bench_timer_report(const struct bench_timer *t)
+{
+	if (!getenv("SUM_ARRAY_BENCH"))
+		return;
+
+	printf("bench: ns=%lu", (unsigned long)t->ns);
+	for (int i = 0; i < BENCH_NUM_COUNTERS; i++)
+		printf(" %s=%ld", events[i].name, (long)t->counters[i]);
+	printf("\n");
+}
@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Measure false sharing: each thread increments its own slot many times,
+ * first with the slots packed next to each other (several of them in the
+ * same cache line), then with one slot per cache line.
+ *
+ * The threads never touch each other's slots, yet with the packed layout
+ * every increment takes the cache line away from the other CPUs.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "include/bench_timer.h"
+#include "utils/utils.h"
+#include "utils/thread_slots/thread_slots.h"
+
+struct thread_args {
+	pthread_t thread;
+	struct thread_slots *slots;
+	size_t tid;
+	int cpu;
+	long iterations;
+};
+
+static void *increment_slot(void *varg)
+{
+	struct thread_args *arg = varg;
+	volatile long *slot = thread_slot(arg->slots, arg->tid);
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(arg->cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	/* volatile: store to memory on every iteration */
+	for (long i = 0; i < arg->iterations; i++)
+		(*slot)++;
+
+	return NULL;
+}
+
+static double run(int num_threads, long iterations, int flags,
+		  struct bench_timer *timer)
+{
+	int num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	struct thread_slots slots;
+	struct thread_args *args;
+	int ret;
+
+	ret = thread_slots_init(&slots, num_threads, flags);
+	DIE(ret < 0, "thread_slots_init");
+	args = calloc(num_threads, sizeof(*args));
+	DIE(!args, "calloc");
+
+	bench_timer_start(timer);
+
+	for (int i = 0; i < num_threads; i++) {
+		args[i].slots = &slots;
+		args[i].tid = i;
+		args[i].cpu = i % num_cpus;
+		args[i].iterations = iterations;
+		ret = pthread_create(&args[i].thread, NULL, increment_slot, &args[i]);
+		DIE(ret != 0, "pthread_create");
+	}
+	for (int i = 0; i < num_threads; i++)
+		pthread_join(args[i].thread, NULL);
+
+	bench_timer_stop(timer);
+
+	DIE(thread_slots_sum(&slots) != (long)num_threads * iterations,
+	    "lost increments");
+
+	free(args);
+	thread_slots_destroy(&slots);
+
+	return timer->ns / 1e6;
+}
+
+static void print_counter(const struct bench_timer *timer, int counter)
+{
+	if (timer->counters[counter] < 0)
+		printf(" %12s", "-");
+	else
+		printf(" %12.1f", timer->counters[counter] / 1e6);
+}
+
+static void print_run(const char *layout, double ms,
+		      const struct bench_timer *timer)
+{
+	printf("%-8s %10.1f", layout, ms);
+	print_counter(timer, BENCH_CYCLES);
+	print_counter(timer, BENCH_L1D_MISSES);
+	print_counter(timer, BENCH_LLC_MISSES);
+	print_counter(timer, BENCH_TASK_CLOCK);
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	long iterations = 100000000;
+	struct bench_timer packed, padded;
+	double packed_ms, padded_ms;
+
+	if (argc > 1)
+		num_threads = atoi(argv[1]);
+	if (argc > 2)
+		iterations = atol(argv[2]);
+	if (argc > 3 || num_threads < 1 || iterations < 1) {
+		fprintf(stderr, "Usage: %s [num_threads] [iterations]\n", argv[0]);
+		exit(1);
+	}
+
+	printf("%d threads, %ld increments each\n", num_threads, iterations);
+	printf("%-8s %10s %12s %12s %12s %12s\n", "layout", "time_ms",
+	       "Mcycles", "M_l1d_miss", "M_llc_miss", "cpu_ms");
+
+	packed_ms = run(num_threads, iterations, THREAD_SLOTS_PACKED, &packed);
+	print_run("packed", packed_ms, &packed);
+	padded_ms = run(num_threads, iterations, 0, &padded);
+	print_run("padded", padded_ms, &padded);
+
+	printf("slowdown of packed over padded: %.2fx\n", packed_ms / padded_ms);
+
+	return 0;
+}
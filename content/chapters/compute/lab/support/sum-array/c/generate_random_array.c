@@ -3,13 +3,218 @@
 #include <time.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "include/generate_random_array.h"
+#include "utils/utils.h"
+
+#define CACHE_MAGIC		"SUMARRAY"
+#define CACHE_HEADER_SIZE	4096	/* keeps the array page aligned */
+
+struct cache_header {
+	char magic[8];
+	uint64_t seed;
+	uint64_t length;
+};
+
+/* The array mapped from the cache file, if any. */
+static void *cache_map;
+static size_t cache_map_size;
+
+/* SplitMix64: a counter-based generator, element i is mix(seed, i). */
+static inline uint64_t splitmix64(uint64_t seed, uint64_t i)
+{
+	uint64_t z = seed + (i + 1) * 0x9e3779b97f4a7c15ULL;
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+	return z ^ (z >> 31);
+}
+
+uint64_t random_array_seed(void)
+{
+	const char *seed = getenv("SUM_ARRAY_SEED");
+
+	if (seed != NULL)
+		return strtoull(seed, NULL, 0);
+
+	return time(0);
+}
+
+void generate_random_array_part(int array[], size_t start, size_t end,
+				uint64_t seed)
+{
+	for (size_t i = start; i < end; i++)
+		array[i] = splitmix64(seed, i) % MAX_ELEMENT;
+}
+
+struct generate_args {
+	pthread_t thread;
+	int *array;
+	size_t start;
+	size_t end;
+	uint64_t seed;
+};
+
+static void *generate_part(void *varg)
+{
+	struct generate_args *arg = varg;
+
+	generate_random_array_part(arg->array, arg->start, arg->end, arg->seed);
+
+	return NULL;
+}
+
+static void generate_random_array_seeded(size_t length, int array[],
+					 uint64_t seed)
+{
+	long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	struct generate_args *args;
+	int ret;
+
+	args = malloc(num_threads * sizeof(*args));
+	DIE(!args, "malloc");
+
+	for (long i = 0; i < num_threads; i++) {
+		args[i].array = array;
+		args[i].start = length / num_threads * i;
+		args[i].end = i == num_threads - 1 ? length :
+			length / num_threads * (i + 1);
+		args[i].seed = seed;
+		ret = pthread_create(&args[i].thread, NULL, generate_part, &args[i]);
+		DIE(ret != 0, "pthread_create");
+	}
+
+	for (long i = 0; i < num_threads; i++) {
+		ret = pthread_join(args[i].thread, NULL);
+		DIE(ret != 0, "pthread_join");
+	}
+
+	free(args);
+}
 
 void generate_random_array(size_t length, int array[])
 {
-	uint32_t seed = time(0);
+	generate_random_array_seeded(length, array, random_array_seed());
+}
+
+/*
+ * Map the cached array if it has the expected length and, unless seed is
+ * NULL, the expected seed. The pages are read in right away, so that the
+ * first pass over the array does not pay for it.
+ */
+static int *map_cache(const char *path, size_t length, const uint64_t *seed)
+{
+	struct cache_header header;
+	size_t size = CACHE_HEADER_SIZE + length * sizeof(int);
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size != size ||
+	    read(fd, &header, sizeof(header)) != sizeof(header) ||
+	    memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.length != length || (seed && header.seed != *seed)) {
+		close(fd);
+		return NULL;
+	}
+
+	cache_map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (cache_map == MAP_FAILED) {
+		cache_map = NULL;
+		return NULL;
+	}
+	cache_map_size = size;
+
+	return (int *)((char *)cache_map + CACHE_HEADER_SIZE);
+}
+
+static int write_all(int fd, const void *buf, size_t size)
+{
+	ssize_t n;
+
+	while (size > 0) {
+		n = write(fd, buf, size);
+		if (n < 0)
+			return -1;
+		buf = (const char *)buf + n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+/* Write to a temporary file first, so that readers never see half of it. */
+static void save_cache(const char *path, const int *array, size_t length,
+		       uint64_t seed)
+{
+	char header[CACHE_HEADER_SIZE] = { 0 };
+	struct cache_header *h = (struct cache_header *)header;
+	char tmp_path[4096];
+	int fd;
+
+	memcpy(h->magic, CACHE_MAGIC, sizeof(h->magic));
+	h->seed = seed;
+	h->length = length;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, getpid());
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		log_warn("Cannot cache the array in %s: %s", path, strerror(errno));
+		return;
+	}
+
+	if (write_all(fd, header, sizeof(header)) < 0 ||
+	    write_all(fd, array, length * sizeof(int)) < 0 ||
+	    close(fd) < 0 || rename(tmp_path, path) < 0) {
+		log_warn("Cannot cache the array in %s: %s", path, strerror(errno));
+		unlink(tmp_path);
+	}
+}
+
+int *get_random_array(size_t length)
+{
+	const char *cache = getenv("SUM_ARRAY_CACHE");
+	uint64_t seed = random_array_seed();
+	int *array;
+
+	if (cache) {
+		array = map_cache(cache, length,
+				  getenv("SUM_ARRAY_SEED") ? &seed : NULL);
+		if (array)
+			return array;
+	}
+
+	array = malloc(sizeof(*array) * length);
+	if (!array)
+		return NULL;
+	generate_random_array_seeded(length, array, seed);
+
+	if (cache)
+		save_cache(cache, array, length, seed);
+
+	return array;
+}
+
+void put_random_array(int *array)
+{
+	if (cache_map && array == (int *)((char *)cache_map + CACHE_HEADER_SIZE)) {
+		munmap(cache_map, cache_map_size);
+		cache_map = NULL;
+		return;
+	}
 
-	for (size_t i = 0; i < length; i++)
-		array[i] = rand_r(&seed) % MAX_ELEMENT;
+	free(array);
 }
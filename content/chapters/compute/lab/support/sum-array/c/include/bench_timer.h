@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef BENCH_TIMER_H
+#define BENCH_TIMER_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Time a region of code with CLOCK_MONOTONIC and, where the kernel allows it,
+ * count CPU cycles, last level and L1 data cache misses and CPU time (task
+ * clock) with perf_event_open(2). The counters follow the threads and
+ * processes created inside the region.
+ */
+enum bench_counter {
+	BENCH_CYCLES,
+	BENCH_LLC_MISSES,
+	BENCH_L1D_MISSES,
+	BENCH_TASK_CLOCK,	/* ns */
+	BENCH_NUM_COUNTERS
+};
+
+struct bench_timer {
+	struct timespec start;
+	int fds[BENCH_NUM_COUNTERS];
+	uint64_t ns;
+	int64_t counters[BENCH_NUM_COUNTERS];	/* -1 if not available */
+};
+
+void bench_timer_start(struct bench_timer *t);
+void bench_timer_stop(struct bench_timer *t);
+
+/*
+ * If SUM_ARRAY_BENCH is set, print a line the benchmark harness can parse:
+ * "bench: ns=... cycles=... llc_misses=... l1d_misses=... task_clock_ns=..."
+ */
+void bench_timer_report(const struct bench_timer *t);
+
+#endif /* BENCH_TIMER_H */
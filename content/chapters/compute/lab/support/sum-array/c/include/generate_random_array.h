@@ -3,8 +3,36 @@
 #ifndef GENERATE_RANDOM_ARRAY
 #define GENERATE_RANDOM_ARRAY
 
+#include <stddef.h>
+#include <stdint.h>
+
 #define MAX_ELEMENT 1000
 
+/*
+ * Element i only depends on the seed and on i, so any part of the array can
+ * be generated on its own, by any thread: the array is the same whatever the
+ * number of threads that generate it.
+ *
+ * The seed is taken from the SUM_ARRAY_SEED environment variable, or from the
+ * current time if it is not set.
+ */
+uint64_t random_array_seed(void);
+
+void generate_random_array_part(int array[], size_t start, size_t end,
+				uint64_t seed);
+
+/* Generate the whole array, with one thread per CPU. */
 void generate_random_array(size_t length, int array[]);
 
+/*
+ * Allocate and generate an array. If SUM_ARRAY_CACHE names a file, the array
+ * is saved there, and later runs map it instead of generating it again, as
+ * long as the length and seed (if SUM_ARRAY_SEED is set) match.
+ *
+ * Release the array with put_random_array().
+ */
+int *get_random_array(size_t length);
+
+void put_random_array(int *array);
+
 #endif /* GENERATE_RANDOM_ARRAY */
@@ -0,0 +1,404 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Sum the array as fast as the memory allows, and report the bandwidth
+ * reached for 1, 2, 4 ... threads.
+ *
+ * Compared to sum_array_threads.c:
+ * - the array is backed by huge pages (fewer TLB misses), either reserved
+ *   ones (MAP_HUGETLB) or transparent ones (MADV_HUGEPAGE);
+ * - each thread is pinned to a CPU and initializes the part of the array it
+ *   will sum: the kernel places a page on the NUMA node of the CPU that first
+ *   touches it, so every thread reads local memory;
+ * - the sum uses AVX-512 or AVX2 instructions when the CPU has them, with
+ *   several independent accumulators so that additions do not wait for one
+ *   another.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <immintrin.h>
+
+#include "include/generate_random_array.h"
+#include "include/array_utils.h"
+#include "utils/utils.h"
+
+#define HUGE_PAGE_SIZE		(2UL << 20)
+#define MAX_THREADS		256
+
+typedef long (*sum_kernel)(const int *array, size_t len);
+
+/* Four accumulators: four additions in flight. */
+static long sum_scalar(const int *array, size_t len)
+{
+	long s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	size_t i;
+
+	for (i = 0; i + 4 <= len; i += 4) {
+		s0 += array[i];
+		s1 += array[i + 1];
+		s2 += array[i + 2];
+		s3 += array[i + 3];
+	}
+	for (; i < len; i++)
+		s0 += array[i];
+
+	return s0 + s1 + s2 + s3;
+}
+
+/*
+ * Each 32-bit element is widened to 64 bits before being added, so the sum
+ * cannot overflow. Four vector accumulators of 4 (AVX2) or 8 (AVX-512)
+ * partial sums each.
+ */
+
+__attribute__((target("avx2")))
+static long sum_avx2(const int *array, size_t len)
+{
+	__m256i acc[4] = { _mm256_setzero_si256(), _mm256_setzero_si256(),
+		_mm256_setzero_si256(), _mm256_setzero_si256() };
+	__m256i v;
+	long sum;
+	size_t i;
+	int k;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = _mm256_loadu_si256((const __m256i *) (array + i));
+		acc[0] = _mm256_add_epi64(acc[0],
+			_mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+		acc[1] = _mm256_add_epi64(acc[1],
+			_mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+		v = _mm256_loadu_si256((const __m256i *) (array + i + 8));
+		acc[2] = _mm256_add_epi64(acc[2],
+			_mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+		acc[3] = _mm256_add_epi64(acc[3],
+			_mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+	}
+
+	acc[0] = _mm256_add_epi64(_mm256_add_epi64(acc[0], acc[1]),
+		_mm256_add_epi64(acc[2], acc[3]));
+	sum = 0;
+	for (k = 0; k < 4; k++)
+		sum += _mm256_extract_epi64(acc[0], k);
+
+	return sum + sum_scalar(array + i, len - i);
+}
+
+__attribute__((target("avx512f")))
+static long sum_avx512(const int *array, size_t len)
+{
+	__m512i acc[4] = { _mm512_setzero_si512(), _mm512_setzero_si512(),
+		_mm512_setzero_si512(), _mm512_setzero_si512() };
+	__m512i v;
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		v = _mm512_loadu_si512(array + i);
+		acc[0] = _mm512_add_epi64(acc[0],
+			_mm512_cvtepi32_epi64(_mm512_castsi512_si256(v)));
+		acc[1] = _mm512_add_epi64(acc[1],
+			_mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(v, 1)));
+		v = _mm512_loadu_si512(array + i + 16);
+		acc[2] = _mm512_add_epi64(acc[2],
+			_mm512_cvtepi32_epi64(_mm512_castsi512_si256(v)));
+		acc[3] = _mm512_add_epi64(acc[3],
+			_mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(v, 1)));
+	}
+
+	acc[0] = _mm512_add_epi64(_mm512_add_epi64(acc[0], acc[1]),
+		_mm512_add_epi64(acc[2], acc[3]));
+
+	return _mm512_reduce_add_epi64(acc[0]) +
+		sum_scalar(array + i, len - i);
+}
+
+static const struct {
+	const char *name;
+	const char *cpu_feature;
+	sum_kernel fn;
+} kernels[] = {
+	{ "scalar", NULL, sum_scalar },
+	{ "avx2", "avx2", sum_avx2 },
+	{ "avx512", "avx512f", sum_avx512 },
+};
+
+#define NUM_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static int kernel_supported(size_t k)
+{
+	if (kernels[k].cpu_feature == NULL)
+		return 1;
+	if (strcmp(kernels[k].cpu_feature, "avx2") == 0)
+		return __builtin_cpu_supports("avx2");
+	return __builtin_cpu_supports("avx512f");
+}
+
+/* By default, run only the fastest kernel the CPU supports. */
+static int kernel_selected(size_t k, const char *name)
+{
+	if (!kernel_supported(k))
+		return 0;
+
+	if (name == NULL) {
+		for (size_t j = k + 1; j < NUM_KERNELS; j++)
+			if (kernel_supported(j))
+				return 0;
+		return 1;
+	}
+
+	return strcmp(name, "all") == 0 || strcmp(name, kernels[k].name) == 0;
+}
+
+/* 1, 2, 4 ... and max_threads last. */
+static int next_thread_count(int num_threads, int max_threads)
+{
+	if (num_threads < max_threads && 2 * num_threads > max_threads)
+		return max_threads;
+
+	return 2 * num_threads;
+}
+
+struct thread_args {
+	pthread_t thread;
+	int cpu;
+	int *array;
+	size_t start;
+	size_t end;
+	sum_kernel kernel;
+	uint64_t seed;
+	long result;
+	int node;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void pin_to_cpu(int cpu)
+{
+	cpu_set_t set;
+	int ret;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	DIE(ret != 0, "pthread_setaffinity_np");
+}
+
+/*
+ * First touch: fill this thread's part of the array, from the CPU that will
+ * later sum it. The result is the sum of the values written.
+ */
+static void *init_part(void *varg)
+{
+	struct thread_args *arg = varg;
+	unsigned int cpu, node;
+
+	pin_to_cpu(arg->cpu);
+	generate_random_array_part(arg->array, arg->start, arg->end, arg->seed);
+	arg->result = sum_scalar(arg->array + arg->start, arg->end - arg->start);
+
+	getcpu(&cpu, &node);
+	arg->node = node;
+
+	return NULL;
+}
+
+static void *sum_part(void *varg)
+{
+	struct thread_args *arg = varg;
+
+	pin_to_cpu(arg->cpu);
+	arg->result = arg->kernel(arg->array + arg->start, arg->end - arg->start);
+
+	return NULL;
+}
+
+/* Run fn on num_threads pinned threads and return the sum of their results. */
+static long run_threads(struct thread_args *args, int num_threads,
+		void *(*fn)(void *))
+{
+	long result = 0;
+	int ret;
+
+	for (int i = 0; i < num_threads; i++) {
+		ret = pthread_create(&args[i].thread, NULL, fn, &args[i]);
+		DIE(ret != 0, "pthread_create");
+	}
+	for (int i = 0; i < num_threads; i++) {
+		ret = pthread_join(args[i].thread, NULL);
+		DIE(ret != 0, "pthread_join");
+		result += args[i].result;
+	}
+
+	return result;
+}
+
+/*
+ * Prefer reserved huge pages, then ask for transparent ones. Return the size
+ * of the mapping in *size.
+ */
+static int *alloc_array(size_t len, size_t *size, const char **backing)
+{
+	void *p;
+	int ret;
+
+	*size = (len * sizeof(int) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+	p = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED) {
+		*backing = "hugetlb";
+		return p;
+	}
+
+	p = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	DIE(p == MAP_FAILED, "mmap");
+	ret = madvise(p, *size, MADV_HUGEPAGE);
+	*backing = ret == 0 ? "thp" : "4k pages";
+
+	return p;
+}
+
+/*
+ * Fill cpus with the CPUs the process may run on (taskset, cgroup cpuset),
+ * at most MAX_THREADS of them. Return their number.
+ */
+static int allowed_cpus(int *cpus)
+{
+	cpu_set_t set;
+	int num_cpus = 0;
+	int ret;
+
+	ret = sched_getaffinity(0, sizeof(set), &set);
+	DIE(ret < 0, "sched_getaffinity");
+
+	for (int cpu = 0; cpu < CPU_SETSIZE && num_cpus < MAX_THREADS; cpu++)
+		if (CPU_ISSET(cpu, &set))
+			cpus[num_cpus++] = cpu;
+
+	return num_cpus;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-t max_threads] [-n elements] [-r runs] "
+		"[-k scalar|avx2|avx512|all] [-b peak_GBps]\n", argv0);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct thread_args args[MAX_THREADS];
+	int cpus[MAX_THREADS];
+	int num_cpus = allowed_cpus(cpus);
+	int max_threads = num_cpus;
+	const char *kernel_name = NULL;
+	size_t len = ARR_LEN;
+	double peak = 0;
+	int runs = 5;
+	const char *backing;
+	size_t size, part;
+	uint64_t seed = random_array_seed();
+	long expected, sum;
+	double t, best;
+	int *array;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:n:r:k:b:")) != -1) {
+		switch (opt) {
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'n':
+			len = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		case 'k':
+			kernel_name = optarg;
+			break;
+		case 'b':
+			peak = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (max_threads < 1 || max_threads > MAX_THREADS || runs < 1 || len == 0)
+		usage(argv[0]);
+
+	printf("%7s %8s %10s %10s %12s %8s %6s %s\n", "threads", "kernel",
+		"best_ms", "GB/s", "GB/s/thread", "peak%", "nodes", "backing");
+
+	for (int num_threads = 1; num_threads <= max_threads;
+			num_threads = next_thread_count(num_threads, max_threads)) {
+		unsigned long nodes = 0;
+
+		/* A fresh array for each thread count, first touched by its readers. */
+		array = alloc_array(len, &size, &backing);
+		part = len / num_threads;
+		for (int i = 0; i < num_threads; i++) {
+			args[i].cpu = cpus[i % num_cpus];
+			args[i].array = array;
+			args[i].start = i * part;
+			args[i].end = i == num_threads - 1 ? len : (i + 1) * part;
+			args[i].seed = seed;
+		}
+		expected = run_threads(args, num_threads, init_part);
+		for (int i = 0; i < num_threads; i++)
+			nodes |= 1UL << (args[i].node % 64);
+
+		for (size_t k = 0; k < NUM_KERNELS; k++) {
+			if (!kernel_selected(k, kernel_name))
+				continue;
+
+			for (int i = 0; i < num_threads; i++)
+				args[i].kernel = kernels[k].fn;
+
+			best = 0;
+			for (int r = 0; r < runs; r++) {
+				t = now();
+				sum = run_threads(args, num_threads, sum_part);
+				t = now() - t;
+				if (sum != expected) {
+					log_fatal("%s: sum is %ld, expected %ld",
+						kernels[k].name, sum, expected);
+					exit(EXIT_FAILURE);
+				}
+				if (best == 0 || t < best)
+					best = t;
+			}
+
+			printf("%7d %8s %10.2f %10.2f %12.2f ", num_threads,
+				kernels[k].name, best * 1000,
+				len * sizeof(int) / best / 1e9,
+				len * sizeof(int) / best / 1e9 / num_threads);
+			if (peak > 0)
+				printf("%8.1f ", 100 * len * sizeof(int) / best /
+					1e9 / peak);
+			else
+				printf("%8s ", "-");
+			printf("%6d %s\n", __builtin_popcountl(nodes), backing);
+		}
+
+		munmap(array, size);
+	}
+
+	return 0;
+}
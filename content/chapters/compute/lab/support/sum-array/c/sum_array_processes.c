@@ -4,7 +4,6 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
-#include <sys/time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/mman.h>
@@ -12,37 +11,29 @@
 
 #include "include/generate_random_array.h"
 #include "include/array_utils.h"
+#include "include/bench_timer.h"
 #include "utils/utils.h"
+#include "utils/thread_slots/thread_slots.h"
 
 static void calculate_array_part_sum(int *array, size_t start, size_t end,
-				     long *results, size_t tid)
+				     struct thread_slots *results, size_t tid)
 {
 	long sum_array = 0;
 
 	for (size_t i = start; i < end; ++i)
 		sum_array += array[i];
 
-	results[tid] = sum_array;
-}
-
-static inline void *create_shared_results_array(size_t num_processes)
-{
-	/*
-	 * This buffer will be shared by the process that creates it and all its
-	 * children due to the `MAP_SHARED` argument
-	 */
-	return mmap(NULL, num_processes * sizeof(long),
-		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+	*thread_slot(results, tid) = sum_array;
 }
 
 int main(int argc, char *argv[])
 {
 	int num_processes, ret = 0;
-	struct timeval start, stop;
+	struct bench_timer timer;
 	long time;
 	pid_t *children;
 	pid_t pidret;
-	long *results;
+	struct thread_slots results;
 	long final_result = 0;
 	int *array;
 
@@ -52,10 +43,14 @@ int main(int argc, char *argv[])
 	}
 
 	num_processes = atoi(argv[1]);
-	results = (long *)create_shared_results_array(num_processes);
-	DIE(!results, "Error when mapping results array");
+	/*
+	 * The slots will be shared by the process that creates them and all its
+	 * children, as they are mapped with `MAP_SHARED`.
+	 */
+	ret = thread_slots_init(&results, num_processes, THREAD_SLOTS_SHARED);
+	DIE(ret < 0, "Error when mapping results array");
 
-	array = malloc(sizeof(*array) * ARR_LEN);
+	array = get_random_array(ARR_LEN);
 	if (!array) {
 		fprintf(stderr, "Error when allocating array: %s\n", strerror(errno));
 		ret = errno;
@@ -69,9 +64,7 @@ int main(int argc, char *argv[])
 		goto error_malloc_children;
 	}
 
-	generate_random_array(ARR_LEN, array);
-
-	gettimeofday(&start, NULL);
+	bench_timer_start(&timer);
 
 	for (int i = 0; i < num_processes; ++i) {
 		size_t elems_per_process = ARR_LEN / num_processes;
@@ -85,7 +78,7 @@ int main(int argc, char *argv[])
 			ret = 1;
 			goto end;
 		case 0:
-			calculate_array_part_sum(array, start, end, results, i);
+			calculate_array_part_sum(array, start, end, &results, i);
 			goto end;
 		default:
 			continue;
@@ -98,23 +91,24 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "waitpid ended with error for process %d\n", i);
 			continue;
 		}
-		final_result += results[i];
+		final_result += *thread_slot(&results, i);
 	}
 
-	gettimeofday(&stop, NULL);
+	bench_timer_stop(&timer);
 
-	time = 1000 * (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1000;
+	time = timer.ns / 1000000;
 
 	printf("Array sum is %ld\nTime spent: %lu ms\n", final_result, time);
+	bench_timer_report(&timer);
 
 end:
 	free(children);
 
 error_malloc_children:
-	free(array);
+	put_random_array(array);
 
 error_malloc_array:
-	munmap(results, num_processes * sizeof(*results));
+	thread_slots_destroy(&results);
 
 	return ret;
 }
@@ -2,20 +2,21 @@
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <sys/time.h>
 #include <pthread.h>
 #include <errno.h>
 #include <string.h>
 
 #include "include/generate_random_array.h"
 #include "include/array_utils.h"
+#include "include/bench_timer.h"
 #include "utils/utils.h"
+#include "utils/thread_slots/thread_slots.h"
 
 struct thread_args {
 	int *array;
 	size_t start;
 	size_t end;
-	long *results;
+	struct thread_slots *results;
 	size_t tid;
 };
 
@@ -27,7 +28,7 @@ static void *calculate_array_part_sum(void *varg)
 	for (size_t i = arg->start; i < arg->end; i++)
 		sum_array += arg->array[i];
 
-	arg->results[arg->tid] = sum_array;
+	*thread_slot(arg->results, arg->tid) = sum_array;
 
 	return NULL;
 }
@@ -35,10 +36,10 @@ static void *calculate_array_part_sum(void *varg)
 int main(int argc, char *argv[])
 {
 	int num_threads;
-	struct timeval start, stop;
+	struct bench_timer timer;
 	long time;
 	pthread_t *threads;
-	long *results;
+	struct thread_slots results;
 	struct thread_args *args;
 	int ret;
 	long final_result = 0;
@@ -51,7 +52,7 @@ int main(int argc, char *argv[])
 
 	num_threads = atoi(argv[1]);
 
-	array = malloc(sizeof(*array) * ARR_LEN);
+	array = get_random_array(ARR_LEN);
 	DIE(!array, "Error when allocating array");
 
 	threads = malloc(sizeof(*threads) * num_threads);
@@ -61,8 +62,8 @@ int main(int argc, char *argv[])
 		goto error_malloc_threads;
 	}
 
-	results = malloc(sizeof(*results) * num_threads);
-	if (!results) {
+	ret = thread_slots_init(&results, num_threads, 0);
+	if (ret < 0) {
 		fprintf(stderr, "Error when allocating results: %s", strerror(errno));
 		ret = errno;
 		goto error_malloc_results;
@@ -75,9 +76,7 @@ int main(int argc, char *argv[])
 		goto error_malloc_args;
 	}
 
-	generate_random_array(ARR_LEN, array);
-
-	gettimeofday(&start, NULL);
+	bench_timer_start(&timer);
 
 	for (int i = 0; i < num_threads; i++) {
 		size_t elems_per_thread = ARR_LEN / num_threads;
@@ -87,7 +86,7 @@ int main(int argc, char *argv[])
 		args[i].array = array;
 		args[i].start = start;
 		args[i].end = end;
-		args[i].results = results;
+		args[i].results = &results;
 		args[i].tid = i;
 
 		ret = pthread_create(&threads[i], NULL, calculate_array_part_sum, (void *)&args[i]);
@@ -100,26 +99,26 @@ int main(int argc, char *argv[])
 	for (int i = 0; i < num_threads; i++)
 		pthread_join(threads[i], NULL);
 
-	for (int i = 0; i < num_threads; i++)
-		final_result += results[i];
+	final_result = thread_slots_sum(&results);
 
-	gettimeofday(&stop, NULL);
+	bench_timer_stop(&timer);
 
-	time = 1000 * (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1000;
+	time = timer.ns / 1000000;
 
 	printf("Array sum is %ld\nTime spent: %lu ms\n", final_result, time);
+	bench_timer_report(&timer);
 
 error_pthread_create:
 	free(args);
 
 error_malloc_args:
-	free(results);
+	thread_slots_destroy(&results);
 
 error_malloc_results:
 	free(threads);
 
 error_malloc_threads:
-	free(array);
+	put_random_array(array);
 
 	return ret;
 }
@@ -2,18 +2,18 @@
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <sys/time.h>
 #include <errno.h>
 #include <string.h>
 #include <omp.h>
 
 #include "include/generate_random_array.h"
 #include "include/array_utils.h"
+#include "include/bench_timer.h"
 #include "utils/utils.h"
 
 int main(int argc, char *argv[])
 {
-	struct timeval start, stop;
+	struct bench_timer timer;
 	long time, result = 0;
 	int num_threads;
 	int *array;
@@ -23,29 +23,28 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
-	array = malloc(sizeof(*array) * ARR_LEN);
+	array = get_random_array(ARR_LEN);
 	DIE(!array, "Error when allocating array");
 
-	generate_random_array(ARR_LEN, array);
-
 	num_threads = atoi(argv[1]);
 
 	omp_set_num_threads(num_threads);
 
-	gettimeofday(&start, NULL);
+	bench_timer_start(&timer);
 
 #pragma omp parallel for reduction(+ \
 				   : result)
 	for (int i = 0; i < ARR_LEN; i++)
 		result += array[i];
 
-	gettimeofday(&stop, NULL);
+	bench_timer_stop(&timer);
 
-	time = 1000 * (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1000;
+	time = timer.ns / 1000000;
 
 	printf("Array sum is %ld\nTime spent: %lu ms\n", result, time);
+	bench_timer_report(&timer);
 
-	free(array);
+	put_random_array(array);
 
 	return 0;
 }
@@ -0,0 +1,25 @@
+#!/bin/bash
+# SPDX-License-Identifier: BSD-3-Clause
+
+# Run every sum-array variant with 1, 2, 4 ... workers, up to the number of
+# CPUs, on the same array: it is generated once and cached in a file.
+
+export SUM_ARRAY_CACHE=${SUM_ARRAY_CACHE:-/tmp/sum_array.cache}
+export SUM_ARRAY_SEED=${SUM_ARRAY_SEED:-1}
+
+max=${1:-$(nproc)}
+
+cd "$(dirname "$0")" || exit 1
+
+printf "%-26s %8s %10s\n" "program" "workers" "time_ms"
+./sum_array_sequential | awk '/Time/ { printf "%-26s %8d %10d\n", "sum_array_sequential", 1, $3 }'
+for prog in sum_array_threads sum_array_processes sum_array_threads_openmp; do
+	n=1
+	while true; do
+		./"$prog" "$n" | awk -v p="$prog" -v n="$n" \
+			'/Time/ { printf "%-26s %8d %10d\n", p, n, $3 }'
+		[ "$n" -ge "$max" ] && break
+		n=$((2 * n > max ? max : 2 * n))
+	done
+done
+./sum_array_engine -t "$max"
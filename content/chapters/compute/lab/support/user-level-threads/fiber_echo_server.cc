@@ -0,0 +1,433 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Echo server where every connection is a Boost.Fiber that reads and writes
+ * as if its socket were blocking:
+ *
+ *	while ((n = conn_read(fd, buf, sizeof(buf))) > 0)
+ *		conn_write(fd, buf, n);
+ *
+ * The sockets are non-blocking. When a read or a write would block, the
+ * fiber suspends until epoll reports the socket ready. Each kernel thread has
+ * its own scheduler, epoll_reactor: when none of its fibers is ready, it
+ * waits in epoll_wait() and readies the fibers whose sockets became ready.
+ * The code of a connection stays sequential, like in a thread per connection
+ * server, while the system calls are those of an epoll server.
+ *
+ * Each thread accepts connections on its own listening socket, bound to the
+ * same port with SO_REUSEPORT: the kernel spreads the connections among the
+ * threads and their fibers stay on that thread.
+ *
+ * With -k, each connection gets a kernel thread and a blocking socket
+ * instead, running the same code.
+ *
+ * The server listens on port 42424, like epoll_echo_server, so that
+ * tcp_load -m echo loads both.
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <boost/fiber/all.hpp>
+
+#define ECHO_LISTEN_PORT	42424
+#define ECHO_BUF_SIZE		(16 * 1024)
+
+// Stack of a connection, fiber or kernel thread, the buffer lives there
+#define CONN_STACK_SIZE		(64 * 1024)
+
+#define MAX_EVENTS		256
+
+using boost::fibers::context;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(EXIT_FAILURE);
+}
+
+// The fibers waiting for a socket to become readable or writable
+struct io_waiters {
+	context *reader = nullptr;
+	context *writer = nullptr;
+};
+
+/*
+ * Round-robin scheduler that waits for I/O when it has nothing to run. A
+ * fiber that would block on a socket records itself in the io_waiters of
+ * that socket and suspends; epoll_wait() returns the io_waiters of the ready
+ * sockets, and their fibers go back to the ready queue.
+ */
+class epoll_reactor : public boost::fibers::algo::algorithm {
+private:
+	boost::fibers::scheduler::ready_queue_type rqueue_{};
+	int epollfd_;
+	// Written by notify() to end epoll_wait()
+	int eventfd_;
+
+public:
+	epoll_reactor();
+
+	~epoll_reactor()
+	{
+		close(eventfd_);
+		close(epollfd_);
+	}
+
+	// Sockets are watched until they are closed
+	void add(int fd, io_waiters *waiters);
+
+	// Ready the fibers whose sockets are ready, wait up to timeout ms
+	void poll(int timeout) noexcept;
+
+	void awakened(context *ctx) noexcept override
+	{
+		ctx->ready_link(rqueue_);
+	}
+
+	context *pick_next() noexcept override;
+
+	bool has_ready_fibers() const noexcept override
+	{
+		return !rqueue_.empty();
+	}
+
+	void suspend_until(std::chrono::steady_clock::time_point const &time_point) noexcept override;
+
+	void notify() noexcept override;
+};
+
+// The epoll_reactor of the calling thread
+static thread_local epoll_reactor *reactor;
+
+epoll_reactor::epoll_reactor()
+{
+	struct epoll_event ev = {};
+
+	epollfd_ = epoll_create1(0);
+	if (epollfd_ < 0)
+		die("epoll_create1");
+	eventfd_ = eventfd(0, EFD_NONBLOCK);
+	if (eventfd_ < 0)
+		die("eventfd");
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = nullptr;
+	if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, eventfd_, &ev) < 0)
+		die("epoll_ctl");
+
+	reactor = this;
+}
+
+void epoll_reactor::add(int fd, io_waiters *waiters)
+{
+	struct epoll_event ev = {};
+
+	// Edge-triggered: fibers only wait after a call failed with EAGAIN
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = waiters;
+	if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, fd, &ev) < 0)
+		die("epoll_ctl");
+}
+
+void epoll_reactor::poll(int timeout) noexcept
+{
+	struct epoll_event events[MAX_EVENTS];
+	context *self = context::active();
+	uint64_t count;
+	int n;
+
+	n = epoll_wait(epollfd_, events, MAX_EVENTS, timeout);
+	for (int i = 0; i < n; i++) {
+		io_waiters *waiters = (io_waiters *)events[i].data.ptr;
+		uint32_t ev = events[i].events;
+
+		if (waiters == nullptr) {
+			if (read(eventfd_, &count, sizeof(count)) < 0 && errno != EAGAIN)
+				perror("read");
+			continue;
+		}
+
+		// Errors and hang-ups wake both, their next call reports them
+		if ((ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) &&
+		    waiters->reader != nullptr) {
+			self->schedule(waiters->reader);
+			waiters->reader = nullptr;
+		}
+		if ((ev & (EPOLLOUT | EPOLLHUP | EPOLLERR)) && waiters->writer != nullptr) {
+			self->schedule(waiters->writer);
+			waiters->writer = nullptr;
+		}
+	}
+}
+
+context *epoll_reactor::pick_next() noexcept
+{
+	context *ctx;
+
+	if (rqueue_.empty())
+		return nullptr;
+
+	ctx = &rqueue_.front();
+	rqueue_.pop_front();
+
+	return ctx;
+}
+
+void epoll_reactor::suspend_until(std::chrono::steady_clock::time_point const &time_point) noexcept
+{
+	int timeout = -1;
+
+	// A sleeping fiber must wake up in time
+	if (time_point != std::chrono::steady_clock::time_point::max()) {
+		auto left = time_point - std::chrono::steady_clock::now();
+
+		timeout = std::chrono::ceil<std::chrono::milliseconds>(left).count();
+		if (timeout < 0)
+			timeout = 0;
+	}
+
+	poll(timeout);
+}
+
+void epoll_reactor::notify() noexcept
+{
+	uint64_t one = 1;
+
+	if (write(eventfd_, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		perror("write");
+}
+
+// One kernel thread per connection, blocking sockets
+static bool kernel_threads;
+
+static void wait_fd(io_waiters *waiters, bool write)
+{
+	context *self = context::active();
+
+	if (write)
+		waiters->writer = self;
+	else
+		waiters->reader = self;
+	self->suspend();
+}
+
+// Like read(), the calling fiber waits instead of the thread
+static ssize_t conn_read(int fd, io_waiters *waiters, char *buf, size_t size)
+{
+	ssize_t n;
+
+	for (;;) {
+		n = read(fd, buf, size);
+		if (n >= 0)
+			return n;
+		if (errno == EAGAIN)
+			wait_fd(waiters, false);
+		else if (errno != EINTR)
+			return -1;
+	}
+}
+
+// Write all of buf, returns -1 on error
+static int conn_write(int fd, io_waiters *waiters, const char *buf, size_t size)
+{
+	ssize_t n;
+
+	while (size > 0) {
+		n = send(fd, buf, size, MSG_NOSIGNAL);
+		if (n >= 0) {
+			buf += n;
+			size -= n;
+		} else if (errno == EAGAIN) {
+			wait_fd(waiters, true);
+		} else if (errno != EINTR) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void handle_connection(int fd)
+{
+	char buf[ECHO_BUF_SIZE];
+	io_waiters waiters;
+	ssize_t n;
+
+	if (!kernel_threads)
+		reactor->add(fd, &waiters);
+
+	while ((n = conn_read(fd, &waiters, buf, sizeof(buf))) > 0) {
+		if (conn_write(fd, &waiters, buf, n) < 0)
+			break;
+
+		/*
+		 * There may be more to read: a client that keeps sending must
+		 * not keep the other connections of the thread waiting.
+		 */
+		if (n == sizeof(buf) && !kernel_threads) {
+			reactor->poll(0);
+			boost::this_fiber::yield();
+		}
+	}
+
+	close(fd);
+}
+
+static void *connection_thread(void *arg)
+{
+	handle_connection((int)(long)arg);
+
+	return NULL;
+}
+
+static int listen_on(unsigned short port, int flags)
+{
+	struct sockaddr_in addr = {};
+	int fd, one = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM | flags, 0);
+	if (fd < 0)
+		die("socket");
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+	    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
+		die("setsockopt");
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		die("bind");
+	if (listen(fd, SOMAXCONN) < 0)
+		die("listen");
+
+	return fd;
+}
+
+// Accept connections and start a fiber for each one, never returns
+static void serve_fibers(unsigned short port)
+{
+	boost::fibers::use_scheduling_algorithm<epoll_reactor>();
+
+	int listenfd = listen_on(port, SOCK_NONBLOCK);
+	io_waiters waiters;
+	int fd;
+
+	reactor->add(listenfd, &waiters);
+
+	for (;;) {
+		fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK);
+		if (fd < 0) {
+			if (errno == EAGAIN) {
+				wait_fd(&waiters, false);
+			} else if (errno != EINTR) {
+				// Out of file descriptors, let some connections end
+				perror("accept4");
+				boost::this_fiber::sleep_for(std::chrono::milliseconds(10));
+			}
+			continue;
+		}
+
+		boost::fibers::fiber(std::allocator_arg,
+				     boost::fibers::protected_fixedsize_stack(CONN_STACK_SIZE),
+				     handle_connection, fd).detach();
+	}
+}
+
+// Accept connections and start a kernel thread for each one, never returns
+static void serve_threads(unsigned short port)
+{
+	int listenfd = listen_on(port, 0);
+	pthread_attr_t attr;
+	pthread_t tid;
+	int fd, rc;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_attr_setstacksize(&attr, CONN_STACK_SIZE);
+
+	for (;;) {
+		fd = accept(listenfd, NULL, NULL);
+		if (fd < 0) {
+			if (errno != EINTR) {
+				perror("accept");
+				usleep(10000);
+			}
+			continue;
+		}
+
+		rc = pthread_create(&tid, &attr, connection_thread, (void *)(long)fd);
+		if (rc != 0) {
+			errno = rc;
+			perror("pthread_create");
+			close(fd);
+		}
+	}
+}
+
+static void usage(const char *argv0)
+{
+	std::cerr << "Usage: " << argv0 << " [-p port] [-t threads | -k]" << std::endl;
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int num_threads = std::thread::hardware_concurrency();
+	unsigned short port = ECHO_LISTEN_PORT;
+	std::vector<std::thread> threads;
+	struct rlimit rlim;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:t:k")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 't':
+			num_threads = atoi(optarg);
+			break;
+		case 'k':
+			kernel_threads = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (num_threads < 1)
+		usage(argv[0]);
+
+	// Allow as many connections as the hard limit on open files
+	if (getrlimit(RLIMIT_NOFILE, &rlim) < 0)
+		die("getrlimit");
+	rlim.rlim_cur = rlim.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &rlim) < 0)
+		perror("setrlimit");
+
+	if (kernel_threads) {
+		std::cout << "Listening on port " << port
+			  << ", a kernel thread per connection" << std::endl;
+		serve_threads(port);
+	}
+
+	std::cout << "Listening on port " << port << ", " << num_threads
+		  << " thread(s) running a fiber per connection" << std::endl;
+	for (int i = 1; i < num_threads; i++)
+		threads.emplace_back(serve_fibers, port);
+	serve_fibers(port);
+
+	return 0;
+}
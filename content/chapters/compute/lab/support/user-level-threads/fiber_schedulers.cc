@@ -0,0 +1,523 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Run the same fiber workloads with each Boost.Fiber scheduler on 1, 2, 4...
+ * kernel threads and print how many operations per second they reach:
+ *  - yield: fibers that keep yielding, an operation is a context switch
+ *  - sum: a fan-out/fan-in sum, each fiber splits its range in two and joins
+ *    the fiber of the first half, an operation is a fiber
+ *  - barrier: fibers that keep waiting at a barrier, an operation is a wait
+ *
+ * The schedulers are round_robin (fibers stay on the thread that created
+ * them), shared_work (a single ready queue for all the threads),
+ * work_stealing (one queue per thread, idle threads steal from the others)
+ * and numa_work, defined below (one queue per NUMA node).
+ *
+ * work_stealing only accepts one number of threads per process, so each run
+ * takes place in a child process.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <boost/fiber/all.hpp>
+#include <boost/fiber/detail/thread_barrier.hpp>
+
+#define MAX_THREADS	64
+
+#define YIELD_FIBERS	64
+#define YIELDS		20000
+
+#define SUM_ELEMS	(1 << 22)
+#define SUM_CUTOFF	1024
+#define SUM_ROUNDS	10
+
+#define BARRIER_FIBERS	64
+#define BARRIER_ROUNDS	1000
+
+using boost::fibers::context;
+
+/*
+ * Threads of the same NUMA node share a ready queue and run on the CPUs of
+ * that node only. Threads fill the CPUs of a node before the next node gets
+ * any. Fibers stay on the node that readied them, close to the memory they
+ * use, unless a thread runs out of work on its node: then it takes fibers
+ * from the queues of the other nodes. Within a node, it works like
+ * shared_work.
+ */
+class numa_work : public boost::fibers::algo::algorithm {
+private:
+	struct node_queue {
+		std::mutex mtx;
+		std::deque<context *> rqueue;
+	};
+
+	static std::vector<std::unique_ptr<node_queue>> nodes_;
+
+	unsigned int node_id_;
+	node_queue &node_;
+	// Fibers that can't leave this thread, such as its main fiber
+	boost::fibers::scheduler::ready_queue_type lqueue_{};
+	std::mutex mtx_{};
+	std::condition_variable cnd_{};
+	bool flag_{ false };
+	bool suspend_;
+
+public:
+	// The CPUs of each node the process may run on, read from sysfs
+	static std::vector<std::vector<int>> topology;
+
+	static void init_topology(void);
+
+	// Thread id runs on the node of the id-th allowed CPU
+	static unsigned int node_of(unsigned int id);
+
+	numa_work(unsigned int id, bool suspend = false);
+
+	void awakened(context *ctx) noexcept override;
+
+	context *pick_next() noexcept override;
+
+	bool has_ready_fibers() const noexcept override
+	{
+		std::unique_lock<std::mutex> lock(node_.mtx);
+
+		return !node_.rqueue.empty() || !lqueue_.empty();
+	}
+
+	void suspend_until(std::chrono::steady_clock::time_point const &time_point) noexcept override;
+
+	void notify() noexcept override;
+};
+
+std::vector<std::unique_ptr<numa_work::node_queue>> numa_work::nodes_;
+std::vector<std::vector<int>> numa_work::topology;
+
+// "0-3,8-11" -> 0 1 2 3 8 9 10 11
+static std::vector<int> parse_cpulist(const std::string &list)
+{
+	std::vector<int> cpus;
+	std::istringstream in(list);
+	std::string range;
+
+	while (std::getline(in, range, ',')) {
+		int first, last;
+
+		if (std::sscanf(range.c_str(), "%d-%d", &first, &last) == 1)
+			last = first;
+		for (int cpu = first; cpu <= last; cpu++)
+			cpus.push_back(cpu);
+	}
+
+	return cpus;
+}
+
+void numa_work::init_topology(void)
+{
+	std::vector<int> allowed;
+	cpu_set_t set;
+
+	// Only the CPUs of taskset or of the cgroup cpuset, nodes may be left out
+	if (sched_getaffinity(0, sizeof(set), &set) < 0) {
+		perror("sched_getaffinity");
+		exit(EXIT_FAILURE);
+	}
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, &set))
+			allowed.push_back(cpu);
+
+	for (int node = 0; ; node++) {
+		std::ifstream in("/sys/devices/system/node/node" +
+				 std::to_string(node) + "/cpulist");
+		std::vector<int> cpus;
+		std::string list;
+
+		if (!in || !std::getline(in, list))
+			break;
+		for (int cpu : parse_cpulist(list))
+			if (CPU_ISSET(cpu, &set))
+				cpus.push_back(cpu);
+		if (!cpus.empty())
+			topology.push_back(cpus);
+	}
+
+	// No NUMA support: a single node with all the CPUs
+	if (topology.empty())
+		topology.push_back(allowed);
+
+	for (std::size_t i = 0; i < topology.size(); i++)
+		nodes_.emplace_back(new node_queue);
+}
+
+unsigned int numa_work::node_of(unsigned int id)
+{
+	std::size_t num_cpus = 0;
+
+	for (auto &cpus : topology)
+		num_cpus += cpus.size();
+
+	// More threads than CPUs: start over from the first node
+	id %= num_cpus;
+	for (unsigned int node = 0; ; node++) {
+		if (id < topology[node].size())
+			return node;
+		id -= topology[node].size();
+	}
+}
+
+numa_work::numa_work(unsigned int id, bool suspend) :
+	node_id_{ node_of(id) },
+	node_{ *nodes_[node_id_] },
+	suspend_{ suspend }
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	for (int cpu : topology[node_id_])
+		CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+void numa_work::awakened(context *ctx) noexcept
+{
+	if (ctx->is_context(boost::fibers::type::pinned_context)) {
+		lqueue_.push_back(*ctx);
+		return;
+	}
+
+	// Any thread of the node may resume it
+	ctx->detach();
+	std::unique_lock<std::mutex> lock(node_.mtx);
+	node_.rqueue.push_back(ctx);
+}
+
+context *numa_work::pick_next() noexcept
+{
+	context *ctx = nullptr;
+	std::unique_lock<std::mutex> lock(node_.mtx);
+
+	if (!node_.rqueue.empty()) {
+		ctx = node_.rqueue.front();
+		node_.rqueue.pop_front();
+		lock.unlock();
+		context::active()->attach(ctx);
+		return ctx;
+	}
+	lock.unlock();
+
+	if (!lqueue_.empty()) {
+		ctx = &lqueue_.front();
+		lqueue_.pop_front();
+		return ctx;
+	}
+
+	// Nothing to do on this node, take the oldest fiber of another one
+	for (std::size_t i = 1; i < nodes_.size(); i++) {
+		node_queue &remote = *nodes_[(node_id_ + i) % nodes_.size()];
+		std::unique_lock<std::mutex> remote_lock(remote.mtx, std::try_to_lock);
+
+		if (remote_lock.owns_lock() && !remote.rqueue.empty()) {
+			ctx = remote.rqueue.front();
+			remote.rqueue.pop_front();
+			remote_lock.unlock();
+			context::active()->attach(ctx);
+			return ctx;
+		}
+	}
+
+	return nullptr;
+}
+
+void numa_work::suspend_until(std::chrono::steady_clock::time_point const &time_point) noexcept
+{
+	if (!suspend_)
+		return;
+
+	// Until another thread readies a fiber of this one, like shared_work
+	std::unique_lock<std::mutex> lock(mtx_);
+	cnd_.wait_until(lock, time_point, [this]() { return flag_; });
+	flag_ = false;
+}
+
+void numa_work::notify() noexcept
+{
+	if (!suspend_)
+		return;
+
+	std::unique_lock<std::mutex> lock(mtx_);
+	flag_ = true;
+	lock.unlock();
+	cnd_.notify_all();
+}
+
+enum scheduler { ROUND_ROBIN, SHARED_WORK, WORK_STEALING, NUMA_WORK };
+
+static const char *scheduler_names[] = {
+	"round_robin", "shared_work", "work_stealing", "numa_work"
+};
+
+// Idle threads sleep instead of polling the ready queues
+static bool suspend;
+
+static void use_scheduler(enum scheduler sched, int id, int num_threads)
+{
+	switch (sched) {
+	case ROUND_ROBIN:
+		boost::fibers::use_scheduling_algorithm<boost::fibers::algo::round_robin>();
+		break;
+	case SHARED_WORK:
+		boost::fibers::use_scheduling_algorithm<boost::fibers::algo::shared_work>(suspend);
+		break;
+	case WORK_STEALING:
+		boost::fibers::use_scheduling_algorithm<boost::fibers::algo::work_stealing>(
+			num_threads, suspend);
+		break;
+	case NUMA_WORK:
+		boost::fibers::use_scheduling_algorithm<numa_work>(id, suspend);
+		break;
+	}
+}
+
+// Returns the number of operations
+static long yield_work(void)
+{
+	std::vector<boost::fibers::fiber> fibers;
+
+	for (int i = 0; i < YIELD_FIBERS; i++)
+		fibers.emplace_back([]() {
+			for (int j = 0; j < YIELDS; j++)
+				boost::this_fiber::yield();
+		});
+	for (auto &fiber : fibers)
+		fiber.join();
+
+	return (long)YIELD_FIBERS * YIELDS;
+}
+
+static long sum_range(const int *v, int n, long *num_fibers)
+{
+	long left, right, fibers_left, fibers_right = 0;
+	long sum = 0;
+
+	if (n <= SUM_CUTOFF) {
+		for (int i = 0; i < n; i++)
+			sum += v[i];
+		*num_fibers = 1;
+		return sum;
+	}
+
+	boost::fibers::fiber first([&]() {
+		left = sum_range(v, n / 2, &fibers_left);
+	});
+	right = sum_range(v + n / 2, n - n / 2, &fibers_right);
+	first.join();
+
+	*num_fibers = fibers_left + fibers_right;
+	return left + right;
+}
+
+static long sum_work(void)
+{
+	std::vector<int> v(SUM_ELEMS, 1);
+	long num_fibers = 0, n;
+
+	for (int i = 0; i < SUM_ROUNDS; i++) {
+		if (sum_range(v.data(), v.size(), &n) != SUM_ELEMS) {
+			std::cerr << "sum: wrong result" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		num_fibers += n;
+	}
+
+	return num_fibers;
+}
+
+static long barrier_work(void)
+{
+	boost::fibers::barrier barrier(BARRIER_FIBERS);
+	std::vector<boost::fibers::fiber> fibers;
+
+	for (int i = 0; i < BARRIER_FIBERS; i++)
+		fibers.emplace_back([&barrier]() {
+			for (int j = 0; j < BARRIER_ROUNDS; j++)
+				barrier.wait();
+		});
+	for (auto &fiber : fibers)
+		fiber.join();
+
+	return (long)BARRIER_FIBERS * BARRIER_ROUNDS;
+}
+
+static const struct {
+	const char *name;
+	long (*run)(void);
+} workloads[] = {
+	{ "yield",	yield_work },
+	{ "sum",	sum_work },
+	{ "barrier",	barrier_work },
+};
+
+/*
+ * The other threads run fibers until the main thread is done, they don't
+ * start any of their own.
+ */
+static bool done;
+static boost::fibers::mutex done_mutex;
+static boost::fibers::condition_variable_any done_cnd;
+
+static void thread_work(enum scheduler sched, int id, int num_threads,
+			boost::fibers::detail::thread_barrier *started)
+{
+	use_scheduler(sched, id, num_threads);
+	started->wait();
+
+	std::unique_lock<boost::fibers::mutex> lock(done_mutex);
+	done_cnd.wait(lock, []() { return done; });
+}
+
+// Operations per second
+static double run(enum scheduler sched, long (*work)(void), int num_threads)
+{
+	boost::fibers::detail::thread_barrier started(num_threads);
+	std::vector<std::thread> threads;
+
+	for (int i = 1; i < num_threads; i++)
+		threads.emplace_back(thread_work, sched, i, num_threads, &started);
+	use_scheduler(sched, 0, num_threads);
+	started.wait();
+
+	auto start = std::chrono::steady_clock::now();
+	long ops = work();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::unique_lock<boost::fibers::mutex> lock(done_mutex);
+	done = true;
+	lock.unlock();
+	done_cnd.notify_all();
+	for (auto &thread : threads)
+		thread.join();
+
+	return ops / elapsed.count();
+}
+
+static double run_in_child(enum scheduler sched, long (*work)(void), int num_threads)
+{
+	double ops_per_sec = 0;
+	int fds[2], status;
+	pid_t pid;
+
+	if (pipe(fds) < 0) {
+		perror("pipe");
+		exit(EXIT_FAILURE);
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		ops_per_sec = run(sched, work, num_threads);
+		if (write(fds[1], &ops_per_sec, sizeof(ops_per_sec)) != sizeof(ops_per_sec))
+			_exit(EXIT_FAILURE);
+		_exit(EXIT_SUCCESS);
+	}
+
+	close(fds[1]);
+	if (read(fds[0], &ops_per_sec, sizeof(ops_per_sec)) != sizeof(ops_per_sec))
+		ops_per_sec = 0;
+	close(fds[0]);
+	waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+		std::cerr << scheduler_names[sched] << " failed with "
+			  << num_threads << " threads" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	return ops_per_sec;
+}
+
+// 1, 2, 4 ... and max_threads last
+static int next_thread_count(int num_threads, int max_threads)
+{
+	if (num_threads < max_threads && 2 * num_threads > max_threads)
+		return max_threads;
+
+	return 2 * num_threads;
+}
+
+static void usage(const char *argv0)
+{
+	std::cerr << "Usage: " << argv0 << " [-t max_threads] [-s]" << std::endl;
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int max_threads = std::min<int>(std::thread::hardware_concurrency(), MAX_THREADS);
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:s")) != -1) {
+		switch (opt) {
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 's':
+			suspend = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (max_threads < 1 || max_threads > MAX_THREADS)
+		usage(argv[0]);
+
+	numa_work::init_topology();
+
+	std::cout << numa_work::topology.size() << " NUMA node(s), idle threads "
+		  << (suspend ? "sleep" : "poll")
+		  << "; thousands of operations per second" << std::endl;
+
+	for (auto &workload : workloads) {
+		std::cout << std::endl << std::left << std::setw(14) << workload.name
+			  << std::right;
+		for (int num_threads = 1; num_threads <= max_threads;
+		     num_threads = next_thread_count(num_threads, max_threads))
+			std::cout << std::setw(10) << num_threads;
+		std::cout << std::endl;
+
+		for (int sched = ROUND_ROBIN; sched <= NUMA_WORK; sched++) {
+			std::cout << std::left << std::setw(14) << scheduler_names[sched]
+				  << std::right << std::fixed << std::setprecision(0);
+			for (int num_threads = 1; num_threads <= max_threads;
+			     num_threads = next_thread_count(num_threads, max_threads)) {
+				std::cout.flush();
+				std::cout << std::setw(10)
+					  << run_in_child((enum scheduler)sched, workload.run,
+							  num_threads) / 1000;
+			}
+			std::cout << std::endl;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Two user-level threads pass control to each other back and forth.
+ * Compare the cost of a context switch with:
+ *  - swapcontext(), which also saves and restores the signal mask
+ *  - threads_yield() from libult, which switches in user space
+ *  - boost::this_fiber::yield() from Boost.Fiber
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#include <ucontext.h>
+
+#include <boost/fiber/all.hpp>
+
+#include "threads.h"
+
+#define STACK_SIZE (64 * 1024)
+
+static long num_iter = 1000000;
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::nano>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+static ucontext_t main_uc, pong_uc;
+
+static void pong_ucontext(void)
+{
+	for (;;)
+		swapcontext(&pong_uc, &main_uc);
+}
+
+static double ping_pong_ucontext(void)
+{
+	static char stack[STACK_SIZE];
+
+	getcontext(&pong_uc);
+	pong_uc.uc_stack.ss_sp = stack;
+	pong_uc.uc_stack.ss_size = sizeof(stack);
+	pong_uc.uc_link = NULL;
+	makecontext(&pong_uc, pong_ucontext, 0);
+
+	auto start = std::chrono::steady_clock::now();
+	for (long i = 0; i < num_iter; i++)
+		swapcontext(&main_uc, &pong_uc);
+
+	return elapsed_ns(start) / (2 * num_iter);
+}
+
+static void *pong_libult(void *arg)
+{
+	for (long i = 0; i < num_iter; i++)
+		threads_yield();
+
+	return arg;
+}
+
+static double ping_pong_libult(void)
+{
+	void *res;
+	int id = threads_create(pong_libult, NULL);
+
+	if (id < 0) {
+		perror("threads_create");
+		exit(EXIT_FAILURE);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (long i = 0; i < num_iter; i++)
+		threads_yield();
+	double ns = elapsed_ns(start);
+
+	while (threads_join(id, &res) == 0)
+		threads_yield();
+
+	return ns / (2 * num_iter);
+}
+
+static double ping_pong_fiber(void)
+{
+	boost::fibers::fiber pong([]() {
+		for (long i = 0; i < num_iter; i++)
+			boost::this_fiber::yield();
+	});
+
+	auto start = std::chrono::steady_clock::now();
+	for (long i = 0; i < num_iter; i++)
+		boost::this_fiber::yield();
+	double ns = elapsed_ns(start);
+
+	pong.join();
+
+	return ns / (2 * num_iter);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1)
+		num_iter = atol(argv[1]);
+	if (argc > 2 || num_iter < 1) {
+		std::cerr << "Usage: " << argv[0] << " [iterations]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::cout << num_iter << " round trips, ns per switch:" << std::endl;
+	std::cout << "ucontext:    " << ping_pong_ucontext() << std::endl;
+	std::cout << "libult:      " << ping_pong_libult() << std::endl;
+	std::cout << "Boost.Fiber: " << ping_pong_fiber() << std::endl;
+
+	return 0;
+}
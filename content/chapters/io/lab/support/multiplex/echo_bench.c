@@ -0,0 +1,166 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Benchmark for the echo server: send messages of 64 KB to 16 MB and
+ * receive them back, on one connection. Sending and receiving are
+ * interleaved with poll(2), since the server starts echoing before the
+ * whole message is sent.
+ *
+ * Report the echo throughput (MB/s, message bytes) and the average time
+ * per message, for each message size.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "utils/utils.h"
+#include "utils/log/log.h"
+#include "utils/sock/sock_util.h"
+
+#define ECHO_LISTEN_PORT		42424
+#define DEFAULT_ITERATIONS		20
+#define MIN_SIZE			(64 * 1024)
+#define MAX_SIZE			(16 * 1024 * 1024)
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Send msg and receive it back in echo. Return -1 on error or if the echo
+ * differs.
+ */
+
+static int echo_message(int sockfd, const char *msg, char *echo, size_t size)
+{
+	struct pollfd pfd;
+	size_t sent = 0, received = 0;
+	ssize_t n;
+
+	pfd.fd = sockfd;
+	while (received < size) {
+		pfd.events = POLLIN | (sent < size ? POLLOUT : 0);
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			ERR(1, "poll");
+			return -1;
+		}
+
+		if (pfd.revents & POLLOUT) {
+			n = send(sockfd, msg + sent, size - sent, MSG_NOSIGNAL);
+			if (n < 0 && errno != EAGAIN) {
+				ERR(1, "send");
+				return -1;
+			}
+			if (n > 0)
+				sent += n;
+		}
+
+		if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+			n = recv(sockfd, echo + received, size - received, 0);
+			if (n == 0) {
+				log_error("Connection closed by server");
+				return -1;
+			}
+			if (n < 0 && errno != EAGAIN) {
+				ERR(1, "recv");
+				return -1;
+			}
+			if (n > 0)
+				received += n;
+		}
+	}
+
+	if (memcmp(msg, echo, size) != 0) {
+		log_error("Echoed message differs");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-H host] [-p port] [-n iterations]\n", argv0);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *host = "localhost";
+	unsigned short port = ECHO_LISTEN_PORT;
+	int iterations = DEFAULT_ITERATIONS;
+	char *msg, *echo;
+	double start, elapsed;
+	int sockfd;
+	int opt;
+	int rc;
+
+	log_set_level(LOG_INFO);
+
+	while ((opt = getopt(argc, argv, "H:p:n:")) != -1) {
+		switch (opt) {
+		case 'H':
+			host = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations < 1)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	msg = malloc(MAX_SIZE);
+	DIE(msg == NULL, "malloc");
+	echo = malloc(MAX_SIZE);
+	DIE(echo == NULL, "malloc");
+	for (size_t i = 0; i < MAX_SIZE; i++)
+		msg[i] = 'a' + i % 26;
+
+	sockfd = tcp_connect_to_server(host, port);
+	DIE(sockfd < 0, "tcp_connect_to_server");
+	rc = fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+	DIE(rc < 0, "fcntl");
+
+	printf("%10s %10s %10s %12s\n", "size_kb", "messages", "MB/s",
+		"ms/message");
+
+	for (size_t size = MIN_SIZE; size <= MAX_SIZE; size *= 4) {
+		start = now();
+		for (int i = 0; i < iterations; i++) {
+			rc = echo_message(sockfd, msg, echo, size);
+			if (rc < 0)
+				exit(EXIT_FAILURE);
+		}
+		elapsed = now() - start;
+
+		printf("%10zu %10d %10.1f %12.3f\n", size / 1024, iterations,
+			size * iterations / elapsed / (1024 * 1024),
+			elapsed * 1000 / iterations);
+	}
+
+	tcp_close_connection(sockfd);
+	free(msg);
+	free(echo);
+
+	return 0;
+}
@@ -3,19 +3,41 @@
  *
  * epoll-based echo server. Uses epoll(7) to multiplex connections.
  *
- * TODO:
- *  - block data receiving when receive buffer is full (use circular buffers)
- *  - do not copy receive buffer into send buffer when send buffer data is
- *      still valid
+ * Connection handlers and message buffers are taken from pools (see
+ * utils/pool/pool.h), so accepting a connection doesn't allocate or clear
+ * memory.
+ *
+ * Received data is queued in a chain of reference counted buffers (see
+ * utils/buf/buf_chain.h), taken from the buffer pool as needed, and echoed
+ * from them with sendmsg(2), without being copied. Idle connections don't
+ * hold buffers. Receiving stops while the chain is full.
+ *
+ * With -z, large sends use MSG_ZEROCOPY; the kernel reports when it is done
+ * with the buffers on the socket error queue (EPOLLERR). A connection closed
+ * before that lingers, with its socket open, until the reports arrive.
+ *
+ * Connections are closed when idle (nothing received, nothing to echo) or
+ * when the client doesn't read the echoed data, for too long. Each connection
+ * has a timer in a timing wheel (see utils/timer/timer_wheel.h) that drives
+ * the epoll_wait() timeout. Activity only updates the connection deadline:
+ * the timer is moved when it fires early.
+ *
+ * With -m port, counters and latency histograms of accepting, reading and
+ * sending are served as text on port (see utils/metrics/metrics.h).
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <assert.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -24,138 +46,356 @@
 #include "utils/utils.h"
 #include "utils/log/log.h"
 #include "utils/sock/sock_util.h"
-#include "./w_epoll.h"
+#include "utils/sock/w_epoll.h"
+#include "utils/pool/pool.h"
+#include "utils/buf/buf_chain.h"
+#include "utils/timer/timer_wheel.h"
+#include "utils/metrics/metrics.h"
 
 #define ECHO_LISTEN_PORT		42424
 
+/* size of the buffers received data is stored in */
+#define ECHO_BUF_SIZE			(64 * 1024)
+
+/* default timeouts, in milliseconds */
+#define ECHO_IDLE_TIMEOUT		60000
+#define ECHO_SEND_TIMEOUT		10000
+
+/* resolution of connection timeouts, in milliseconds */
+#define ECHO_TIMER_TICK			10
+
+/* objects allocated at a time by the connection and buffer pools */
+#define CONN_POOL_SLAB			1024
+#define BUF_POOL_SLAB			16
+
 
 /* server socket file descriptor */
 static int listenfd;
 
+/* epoll data for the server socket, connections use their handler */
+#define LISTENER			((void *) &listenfd)
+
 /* epoll file descriptor */
 static int epollfd;
 
+static struct pool conn_pool;
+static struct pool buf_pool;
+
+/* send large messages with MSG_ZEROCOPY */
+static bool zerocopy;
+
+/* NULL unless metrics are served */
+static struct metrics *metrics;
+
+static unsigned int idle_timeout = ECHO_IDLE_TIMEOUT;
+static unsigned int send_timeout = ECHO_SEND_TIMEOUT;
+
+/* connection timers, and the time of the last epoll_wait() wakeup */
+static struct timer_wheel wheel;
+static uint64_t now_ms;
+
+#define container_of(ptr, type, member) \
+	((type *) ((char *) (ptr) - offsetof(type, member)))
+
 enum connection_state {
 	STATE_DATA_RECEIVED,
 	STATE_DATA_SENT,
+	STATE_CONNECTION_LINGERING,	/* waiting for zerocopy sends */
 	STATE_CONNECTION_CLOSED
 };
 
 /* structure acting as a connection handler */
 struct connection {
 	int sockfd;
-	/* buffers used for receiving messages and then echoing them back */
-	char recv_buffer[BUFSIZ];
-	size_t recv_len;
-	char send_buffer[BUFSIZ];
-	size_t send_len;
+	char peer[32];			/* address:port, for logging */
+	/* received data, until it is echoed back */
+	struct buf_chain chain;
+	/* buffers of zerocopy sends in progress; NULL without -z */
+	struct buf_zc *zc;
+	unsigned int events;		/* epoll events currently watched */
+	/* closed if there is no activity by the deadline */
+	struct timer timer;
+	uint64_t deadline;
+	uint64_t accepted_ns;		/* for metrics */
 	enum connection_state state;
 };
 
+static void connection_timeout(struct timer *timer);
+
 /*
  * Initialize connection structure on given socket.
  */
 
-static struct connection *connection_create(int sockfd)
+static struct connection *connection_create(int sockfd,
+		struct sockaddr_in *addr)
 {
-	struct connection *conn = malloc(sizeof(*conn));
+	struct connection *conn = pool_get(&conn_pool);
+	int one = 1;
+	int rc;
 
-	DIE(conn == NULL, "malloc");
+	if (conn == NULL)
+		return NULL;
 
 	conn->sockfd = sockfd;
-	memset(conn->recv_buffer, 0, BUFSIZ);
-	memset(conn->send_buffer, 0, BUFSIZ);
+	snprintf(conn->peer, sizeof(conn->peer), "%s:%d",
+		inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+	buf_chain_init(&conn->chain);
+	conn->zc = NULL;
+	conn->events = EPOLLIN;
+	timer_init(&conn->timer, connection_timeout);
+	conn->state = STATE_DATA_SENT;
+
+	if (zerocopy) {
+		rc = setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one));
+		ERR(rc < 0, "setsockopt SO_ZEROCOPY");
+		if (rc == 0) {
+			conn->zc = malloc(sizeof(*conn->zc));
+			DIE(conn->zc == NULL, "malloc");
+			buf_zc_init(conn->zc);
+		}
+	}
 
 	return conn;
 }
 
 /*
- * Copy receive buffer to send buffer (echo).
+ * Close the socket and free the connection handler. Zerocopy sends still in
+ * progress are aborted: the kernel drops their data instead of sending it
+ * from buffers that go back to the pool.
  */
 
-static void connection_copy_buffers(struct connection *conn)
+static void connection_close(struct connection *conn)
 {
-	conn->send_len = conn->recv_len;
-	memcpy(conn->send_buffer, conn->recv_buffer, conn->send_len);
+	struct linger abort = { .l_onoff = 1, .l_linger = 0 };
+	int rc;
+
+	rc = w_epoll_remove_ptr(epollfd, conn->sockfd, conn);
+	DIE(rc < 0, "w_epoll_remove_ptr");
+
+	timer_del(&wheel, &conn->timer);
+
+	if (conn->zc && conn->zc->count > 0) {
+		log_info("Aborting %u zerocopy send(s) to %s", conn->zc->count,
+			conn->peer);
+		rc = setsockopt(conn->sockfd, SOL_SOCKET, SO_LINGER, &abort,
+			sizeof(abort));
+		ERR(rc < 0, "setsockopt SO_LINGER");
+	}
+
+	close(conn->sockfd);
+	conn->state = STATE_CONNECTION_CLOSED;
+	buf_chain_clear(&conn->chain);
+	if (conn->zc) {
+		buf_zc_clear(conn->zc);
+		free(conn->zc);
+	}
+	pool_put(&conn_pool, conn);
 }
 
 /*
  * Remove connection handler.
+ *
+ * The kernel sends the data of zerocopy sends from the buffers themselves,
+ * so they can't go back to the pool before it reports it is done with them.
+ * Until then, the socket stays open, watched only for the reports (EPOLLERR
+ * is always watched), for at most send_timeout.
  */
 
 static void connection_remove(struct connection *conn)
 {
-	close(conn->sockfd);
-	conn->state = STATE_CONNECTION_CLOSED;
-	free(conn);
+	int rc;
+
+	metrics_count(metrics, METRICS_CLOSED, 1);
+	metrics_record_since(metrics, METRICS_CONNECTION, conn->accepted_ns);
+
+	if (conn->zc == NULL || conn->zc->count == 0) {
+		connection_close(conn);
+		return;
+	}
+
+	log_debug("Waiting for %u zerocopy send(s) to %s", conn->zc->count,
+		conn->peer);
+	buf_chain_clear(&conn->chain);
+	rc = w_epoll_update_ptr_none(epollfd, conn->sockfd, conn);
+	DIE(rc < 0, "w_epoll_update_ptr_none");
+	conn->events = 0;
+	conn->state = STATE_CONNECTION_LINGERING;
+
+	conn->deadline = now_ms + send_timeout;
+	timer_add(&wheel, &conn->timer, conn->deadline);
+}
+
+/*
+ * Push back the connection deadline after activity: wait for new data for
+ * idle_timeout, for the client to read echoed data for send_timeout. The
+ * timer is only moved if the deadline gets earlier.
+ */
+
+static void connection_touch(struct connection *conn)
+{
+	conn->deadline = now_ms + (conn->chain.len > 0 ? send_timeout :
+		idle_timeout);
+
+	if (!timer_pending(&conn->timer) ||
+			conn->deadline < timer_expires_ms(&wheel, &conn->timer))
+		timer_add(&wheel, &conn->timer, conn->deadline);
 }
 
 /*
- * Handle a new connection request on the server socket.
+ * Close the connection if it reached its deadline, or wait for it.
+ */
+
+static void connection_timeout(struct timer *timer)
+{
+	struct connection *conn = container_of(timer, struct connection, timer);
+
+	if (now_ms < conn->deadline) {
+		timer_add(&wheel, timer, conn->deadline);
+		return;
+	}
+
+	if (conn->state == STATE_CONNECTION_LINGERING) {
+		connection_close(conn);
+		return;
+	}
+
+	log_info("Connection timed out (%s): %s",
+		conn->chain.len > 0 ? "echo not read" : "idle", conn->peer);
+	connection_remove(conn);
+}
+
+/*
+ * Receive data while there is pending data to echo and watch for output
+ * while there is data to echo.
+ */
+
+static void connection_update_events(struct connection *conn)
+{
+	unsigned int events = 0;
+	int rc;
+
+	if (!buf_chain_full(&conn->chain))
+		events |= EPOLLIN;
+	if (conn->chain.len > 0)
+		events |= EPOLLOUT;
+
+	if (events == conn->events)
+		return;
+
+	if (events == (EPOLLIN | EPOLLOUT))
+		rc = w_epoll_update_ptr_inout(epollfd, conn->sockfd, conn);
+	else if (events == EPOLLIN)
+		rc = w_epoll_update_ptr_in(epollfd, conn->sockfd, conn);
+	else if (events == EPOLLOUT)
+		rc = w_epoll_update_ptr_out(epollfd, conn->sockfd, conn);
+	else
+		rc = w_epoll_update_ptr_none(epollfd, conn->sockfd, conn);
+	DIE(rc < 0, "w_epoll_update_ptr");
+
+	conn->events = events;
+}
+
+/*
+ * Handle new connection requests on the server socket: accept all of them,
+ * until accept4() would block.
  */
 
 static void handle_new_connection(void)
 {
-	static int sockfd;
-	socklen_t addrlen = sizeof(struct sockaddr_in);
+	socklen_t addrlen;
 	struct sockaddr_in addr;
 	struct connection *conn;
+	uint64_t start;
+	int sockfd;
 	int rc;
 
-	/* accept new connection */
-	sockfd = accept(listenfd, (SSA *) &addr, &addrlen);
-	DIE(sockfd < 0, "accept");
+	while (1) {
+		/* accept new connection */
+		addrlen = sizeof(addr);
+		sockfd = accept4(listenfd, (SSA *) &addr, &addrlen, SOCK_NONBLOCK);
+		if (sockfd < 0) {
+			/* The client gave up before being accepted. */
+			if (errno == ECONNABORTED || errno == EINTR)
+				continue;
+			/* Retry other errors (e.g. EMFILE) on the next wakeup. */
+			ERR(errno != EAGAIN && errno != EWOULDBLOCK, "accept4");
+			return;
+		}
+		start = metrics_start(metrics);
+
+		/* instantiate new connection handler */
+		conn = connection_create(sockfd, &addr);
+		if (conn == NULL) {
+			log_error("Out of memory for connection handlers");
+			close(sockfd);
+			continue;
+		}
+
+		log_info("Accepted connection from: %s", conn->peer);
 
-	log_error("Accepted connection from: %s:%d",
-			inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+		/* add socket to epoll */
+		rc = w_epoll_add_ptr_in(epollfd, sockfd, conn);
+		DIE(rc < 0, "w_epoll_add_in");
 
-	/* instantiate new connection handler */
-	conn = connection_create(sockfd);
+		connection_touch(conn);
 
-	/* add socket to epoll */
-	rc = w_epoll_add_ptr_in(epollfd, sockfd, conn);
-	DIE(rc < 0, "w_epoll_add_in");
+		conn->accepted_ns = start;
+		metrics_count(metrics, METRICS_ACCEPTED, 1);
+		metrics_record_since(metrics, METRICS_ACCEPT, start);
+	}
 }
 
 /*
- * Receive message on socket.
- * Store message in recv_buffer in struct connection.
+ * Receive messages on socket, until there is no more data or the buffer
+ * chain is full. Store them at the end of the chain.
  */
 
 static enum connection_state receive_message(struct connection *conn)
 {
 	ssize_t bytes_recv;
-	int rc;
-	char abuffer[64];
+	size_t len;
+	char *buffer;
 
-	rc = get_peer_address(conn->sockfd, abuffer, 64);
-	if (rc < 0) {
-		log_error("get_peer_address");
-		goto remove_connection;
-	}
+	while (1) {
+		buffer = buf_chain_tail(&conn->chain, &buf_pool, &len);
+		if (buffer == NULL) {
+			if (buf_chain_full(&conn->chain))
+				break;
+			log_error("Out of memory for buffers");
+			goto remove_connection;
+		}
 
-	bytes_recv = recv(conn->sockfd, conn->recv_buffer, BUFSIZ, 0);
-	if (bytes_recv < 0) {		/* error in communication */
-		log_error("Error in communication from: %s", abuffer);
-		goto remove_connection;
-	}
-	if (bytes_recv == 0) {		/* connection closed */
-		log_info("Connection closed from: %s", abuffer);
-		goto remove_connection;
-	}
+		bytes_recv = recv(conn->sockfd, buffer, len, 0);
+		if (bytes_recv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			buf_chain_commit(&conn->chain, 0);
+			break;
+		}
+		if (bytes_recv < 0) {		/* error in communication */
+			log_error("Error in communication from: %s", conn->peer);
+			metrics_count(metrics, METRICS_ERRORS, 1);
+			goto remove_connection;
+		}
+		if (bytes_recv == 0) {		/* connection closed */
+			log_info("Connection closed from: %s", conn->peer);
+			goto remove_connection;
+		}
+
+		log_debug("Received message from: %s", conn->peer);
+		log_debug("--%.*s--", (int) bytes_recv, buffer);
 
-	log_debug("Received message from: %s", abuffer);
-	log_debug("--%s--", conn->recv_buffer);
+		buf_chain_commit(&conn->chain, bytes_recv);
+		connection_touch(conn);
 
-	conn->recv_len = bytes_recv;
-	conn->state = STATE_DATA_RECEIVED;
+		metrics_count(metrics, METRICS_REQUESTS, 1);
+		metrics_count(metrics, METRICS_BYTES_IN, bytes_recv);
+	}
 
-	return STATE_DATA_RECEIVED;
+	if (conn->chain.len > 0)
+		conn->state = STATE_DATA_RECEIVED;
 
-remove_connection:
-	rc = w_epoll_remove_ptr(epollfd, conn->sockfd, conn);
-	DIE(rc < 0, "w_epoll_remove_ptr");
+	return conn->state;
 
+remove_connection:
 	/* remove current connection */
 	connection_remove(conn);
 
@@ -163,47 +403,38 @@ remove_connection:
 }
 
 /*
- * Send message on socket.
- * Store message in send_buffer in struct connection.
+ * Send (what is left of) the received data on socket.
  */
 
 static enum connection_state send_message(struct connection *conn)
 {
 	ssize_t bytes_sent;
-	int rc;
-	char abuffer[64];
-
-	rc = get_peer_address(conn->sockfd, abuffer, 64);
-	if (rc < 0) {
-		log_error("get_peer_address");
-		goto remove_connection;
-	}
 
-	bytes_sent = send(conn->sockfd, conn->send_buffer, conn->send_len, 0);
+	bytes_sent = buf_chain_send(&conn->chain, conn->sockfd, conn->zc);
+	if (bytes_sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return STATE_DATA_RECEIVED;
 	if (bytes_sent < 0) {		/* error in communication */
-		log_error("Error in communication to %s", abuffer);
+		log_error("Error in communication to %s", conn->peer);
+		metrics_count(metrics, METRICS_ERRORS, 1);
 		goto remove_connection;
 	}
 	if (bytes_sent == 0) {		/* connection closed */
-		log_info("Connection closed to %s", abuffer);
+		log_info("Connection closed to %s", conn->peer);
 		goto remove_connection;
 	}
 
-	log_debug("Sending message to %s", abuffer);
-	log_debug("--%s--", conn->send_buffer);
+	log_debug("Sent %zd bytes to %s", bytes_sent, conn->peer);
+	metrics_count(metrics, METRICS_BYTES_OUT, bytes_sent);
 
-	/* all done - remove out notification */
-	rc = w_epoll_update_ptr_in(epollfd, conn->sockfd, conn);
-	DIE(rc < 0, "w_epoll_update_ptr_in");
+	connection_touch(conn);
 
-	conn->state = STATE_DATA_SENT;
+	/* all done - receive next message */
+	if (conn->chain.len == 0)
+		conn->state = STATE_DATA_SENT;
 
-	return STATE_DATA_SENT;
+	return conn->state;
 
 remove_connection:
-	rc = w_epoll_remove_ptr(epollfd, conn->sockfd, conn);
-	DIE(rc < 0, "w_epoll_remove_ptr");
-
 	/* remove current connection */
 	connection_remove(conn);
 
@@ -211,51 +442,154 @@ remove_connection:
 }
 
 /*
- * Handle a client request on a client connection.
+ * Handle events on a client connection: zerocopy completions (reported as
+ * errors), incoming data to echo, room to send it.
  */
 
-static void handle_client_request(struct connection *conn)
+static void handle_client_request(struct connection *conn, unsigned int events)
 {
+	enum connection_state state;
+	uint64_t start;
 	int rc;
-	enum connection_state ret_state;
 
-	ret_state = receive_message(conn);
-	if (ret_state == STATE_CONNECTION_CLOSED)
+	if (conn->state == STATE_CONNECTION_LINGERING) {
+		/*
+		 * A hang-up with nothing to reap won't go away: the kernel
+		 * dropped the data of the connection, don't wait for it.
+		 */
+		rc = buf_zc_reap(conn->zc, conn->sockfd);
+		if (rc < 0 || conn->zc->count == 0 ||
+				(rc == 0 && (events & EPOLLHUP)))
+			connection_close(conn);
 		return;
+	}
+
+	if ((events & EPOLLERR) && conn->zc) {
+		if (buf_zc_reap(conn->zc, conn->sockfd) < 0) {
+			log_error("Error in communication with %s: %s", conn->peer,
+				strerror(errno));
+			connection_remove(conn);
+			return;
+		}
+		if (conn->zc->copied == 1)
+			log_debug("Zerocopy sends to %s are copied", conn->peer);
+	}
 
-	connection_copy_buffers(conn);
+	if ((events & (EPOLLIN | EPOLLHUP)) ||
+			((events & EPOLLERR) && conn->zc == NULL)) {
+		log_debug("New message");
+		start = metrics_start(metrics);
+		state = receive_message(conn);
+		metrics_record_since(metrics, METRICS_READ, start);
+		if (state == STATE_CONNECTION_CLOSED)
+			return;
+	}
+
+	if ((events & EPOLLOUT) || conn->chain.len > 0) {
+		log_debug("Ready to send message");
+		start = metrics_start(metrics);
+		state = send_message(conn);
+		metrics_record_since(metrics, METRICS_SEND, start);
+		if (state == STATE_CONNECTION_CLOSED)
+			return;
+	}
+
+	connection_update_events(conn);
+}
 
-	/* add socket to epoll for out events */
-	rc = w_epoll_update_ptr_inout(epollfd, conn->sockfd, conn);
-	DIE(rc < 0, "w_epoll_add_ptr_inout");
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-z] [-i idle_timeout_ms] [-w send_timeout_ms] "
+		"[-m metrics_port]\n", argv0);
+	exit(EXIT_FAILURE);
 }
 
-int main(void)
+int main(int argc, char *argv[])
 {
+	struct rlimit rlim;
+	int metrics_port = 0;
+	int opt;
 	int rc;
 
+	while ((opt = getopt(argc, argv, "zi:w:m:")) != -1) {
+		switch (opt) {
+		case 'z':
+			zerocopy = true;
+			break;
+		case 'i':
+			idle_timeout = strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			send_timeout = strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			metrics_port = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	/* Allow as many connections as the hard limit on open files. */
+	rc = getrlimit(RLIMIT_NOFILE, &rlim);
+	DIE(rc < 0, "getrlimit");
+	rlim.rlim_cur = rlim.rlim_max;
+	rc = setrlimit(RLIMIT_NOFILE, &rlim);
+	ERR(rc < 0, "setrlimit");
+
+	if (metrics_port > 0) {
+		/* one slot for the event loop */
+		metrics = metrics_create(1);
+		DIE(metrics == NULL, "metrics_create");
+		rc = metrics_serve(metrics, metrics_port);
+		DIE(rc < 0, "metrics_serve");
+		log_info("Serving metrics on port %d", metrics_port);
+	}
+
+	now_ms = timer_now_ms();
+	timer_wheel_init(&wheel, ECHO_TIMER_TICK, now_ms);
+
+	pool_init(&conn_pool, sizeof(struct connection), CONN_POOL_SLAB);
+	pool_init(&buf_pool, sizeof(struct buf) + ECHO_BUF_SIZE, BUF_POOL_SLAB);
+
 	/* init multiplexing */
 	epollfd = w_epoll_create();
 	DIE(epollfd < 0, "w_epoll_create");
 
-	/* create server socket */
-	listenfd = tcp_create_listener(ECHO_LISTEN_PORT,
-		DEFAULT_LISTEN_BACKLOG);
+	/*
+	 * create server socket; with a short backlog, bursts of connections
+	 * overflow the accept queue and wait for SYN retransmissions
+	 */
+	listenfd = tcp_create_listener(ECHO_LISTEN_PORT, SOMAXCONN);
 	DIE(listenfd < 0, "tcp_create_listener");
 
-	rc = w_epoll_add_fd_in(epollfd, listenfd);
-	DIE(rc < 0, "w_epoll_add_fd_in");
+	/* Accept connections until there are none left, without blocking. */
+	rc = fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+	DIE(rc < 0, "fcntl");
+
+	rc = w_epoll_add_ptr_in(epollfd, listenfd, LISTENER);
+	DIE(rc < 0, "w_epoll_add_ptr_in");
 
-	log_info("Server waiting for connections on port %d",
-			ECHO_LISTEN_PORT);
+	log_info("Server waiting for connections on port %d%s "
+			"(timeouts: idle %u ms, send %u ms)", ECHO_LISTEN_PORT,
+			zerocopy ? " (zerocopy)" : "", idle_timeout, send_timeout);
 
 	/* server main loop */
 	while (1) {
 		struct epoll_event rev;
 
-		/* wait for events */
-		rc = w_epoll_wait_infinite(epollfd, &rev);
-		DIE(rc < 0, "w_epoll_wait_infinite");
+		/* wait for events, or for the next connection timeout */
+		rc = w_epoll_wait(epollfd, &rev, 1,
+			timer_wheel_timeout(&wheel, now_ms));
+		if (rc < 0 && errno == EINTR)
+			continue;
+		DIE(rc < 0, "w_epoll_wait");
+
+		now_ms = timer_now_ms();
+		if (rc == 0) {
+			timer_wheel_advance(&wheel, now_ms);
+			continue;
+		}
 
 		/*
 		 * switch event types; consider
@@ -263,20 +597,16 @@ int main(void)
 		 *   - socket communication (on connection sockets)
 		 */
 
-		if (rev.data.fd == listenfd) {
+		if (rev.data.ptr == LISTENER) {
 			log_debug("New connection");
 			if (rev.events & EPOLLIN)
 				handle_new_connection();
 		} else {
-			if (rev.events & EPOLLIN) {
-				log_debug("New message");
-				handle_client_request(rev.data.ptr);
-			}
-			if (rev.events & EPOLLOUT) {
-				log_debug("Ready to send message");
-				send_message(rev.data.ptr);
-			}
+			handle_client_request(rev.data.ptr, rev.events);
 		}
+
+		/* after handling the event: its connection may time out */
+		timer_wheel_advance(&wheel, now_ms);
 	}
 
 	return 0;
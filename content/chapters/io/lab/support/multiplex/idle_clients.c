@@ -0,0 +1,220 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Idle connections test for the echo server
+ *
+ * Open many connections to the server and send nothing on them. Report the
+ * memory used by the server (if its PID is given) with all connections
+ * open, then wait for the server to close them on idle timeout.
+ *
+ * A client IP address has about 28000 ephemeral ports: on the loopback
+ * interface, connections are spread over several source addresses
+ * (127.0.0.1, 127.0.0.2, ...).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "utils/utils.h"
+#include "utils/log/log.h"
+
+#define ECHO_LISTEN_PORT		42424
+#define DEFAULT_CONNECTIONS		100000
+#define DEFAULT_WAIT			120	/* seconds */
+
+/* connections per loopback source address */
+#define CONNECTIONS_PER_ADDRESS		20000
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Return the resident memory of process pid in KB, -1 if unknown.
+ */
+
+static long rss_kb(pid_t pid)
+{
+	char path[64], line[256];
+	long kb = -1;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/%d/status", pid);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), f) != NULL)
+		if (sscanf(line, "VmRSS: %ld kB", &kb) == 1)
+			break;
+	fclose(f);
+
+	return kb;
+}
+
+static int connect_one(struct sockaddr_in *server, int index)
+{
+	struct sockaddr_in local;
+	int one = 1;
+	int sockfd;
+
+	sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (sockfd < 0)
+		return -1;
+
+	if ((ntohl(server->sin_addr.s_addr) >> 24) == 127) {
+		/* Let connect() pick the port, for the whole 4-tuple. */
+		setsockopt(sockfd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one,
+			sizeof(one));
+		memset(&local, 0, sizeof(local));
+		local.sin_family = AF_INET;
+		local.sin_addr.s_addr = htonl(INADDR_LOOPBACK +
+			index / CONNECTIONS_PER_ADDRESS);
+		if (bind(sockfd, (struct sockaddr *) &local, sizeof(local)) < 0)
+			goto close_socket;
+	}
+
+	if (connect(sockfd, (struct sockaddr *) server, sizeof(*server)) < 0)
+		goto close_socket;
+
+	return sockfd;
+
+close_socket:
+	close(sockfd);
+	return -1;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-H ip] [-p port] [-n connections] "
+		"[-s server_pid] [-t wait_seconds]\n", argv0);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in server;
+	struct epoll_event ev, rev[64];
+	struct rlimit rlim;
+	const char *host = "127.0.0.1";
+	unsigned short port = ECHO_LISTEN_PORT;
+	long connections = DEFAULT_CONNECTIONS;
+	int wait_seconds = DEFAULT_WAIT;
+	pid_t server_pid = -1;
+	long rss_before, rss_open, opened, closed;
+	double start;
+	int epollfd, sockfd;
+	int opt;
+	int rc;
+
+	while ((opt = getopt(argc, argv, "H:p:n:s:t:")) != -1) {
+		switch (opt) {
+		case 'H':
+			host = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'n':
+			connections = atol(optarg);
+			break;
+		case 's':
+			server_pid = atoi(optarg);
+			break;
+		case 't':
+			wait_seconds = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	memset(&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_port = htons(port);
+	if (inet_pton(AF_INET, host, &server.sin_addr) != 1)
+		usage(argv[0]);
+
+	/* One file descriptor per connection. */
+	rc = getrlimit(RLIMIT_NOFILE, &rlim);
+	DIE(rc < 0, "getrlimit");
+	rlim.rlim_cur = rlim.rlim_max;
+	rc = setrlimit(RLIMIT_NOFILE, &rlim);
+	DIE(rc < 0, "setrlimit");
+	if ((rlim_t) connections + 16 > rlim.rlim_cur) {
+		connections = rlim.rlim_cur - 16;
+		log_warn("Open files limit is %lu, opening %ld connections",
+			(unsigned long) rlim.rlim_cur, connections);
+	}
+
+	epollfd = epoll_create1(0);
+	DIE(epollfd < 0, "epoll_create1");
+
+	rss_before = server_pid > 0 ? rss_kb(server_pid) : -1;
+
+	start = now();
+	for (opened = 0; opened < connections; opened++) {
+		sockfd = connect_one(&server, opened);
+		if (sockfd < 0) {
+			log_error("Connection %ld: %s", opened, strerror(errno));
+			break;
+		}
+
+		/* The server closing the connection makes it readable. */
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.fd = sockfd;
+		rc = epoll_ctl(epollfd, EPOLL_CTL_ADD, sockfd, &ev);
+		DIE(rc < 0, "epoll_ctl");
+	}
+	printf("%ld connections opened in %.1f s\n", opened, now() - start);
+
+	if (server_pid > 0) {
+		/* Let the server accept the last connections. */
+		sleep(1);
+		rss_open = rss_kb(server_pid);
+		printf("server RSS: %.1f MB before, %.1f MB with the connections "
+			"open (%.2f KB per connection)\n", rss_before / 1024.0,
+			rss_open / 1024.0,
+			opened ? (double) (rss_open - rss_before) / opened : 0.0);
+	}
+
+	printf("waiting up to %d s for the server to close them...\n",
+		wait_seconds);
+	fflush(stdout);
+
+	start = now();
+	closed = 0;
+	while (closed < opened && now() - start < wait_seconds) {
+		rc = epoll_wait(epollfd, rev, 64, 1000);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		DIE(rc < 0, "epoll_wait");
+
+		for (int i = 0; i < rc; i++) {
+			close(rev[i].data.fd);
+			closed++;
+		}
+	}
+	printf("%ld connections closed by the server after %.1f s\n", closed,
+		now() - start);
+
+	if (server_pid > 0)
+		printf("server RSS: %.1f MB\n", rss_kb(server_pid) / 1024.0);
+
+	return closed == opened ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -9,5 +9,10 @@ LOGGER_DIR := $(UTILS_DIR)/log
 CPPFLAGS += -I$(INCLUDES_DIR)
 CFLAGS += -g -Wall -Wextra
 LDFLAGS += -z lazy
+
+# Remove log calls below this level at compile time (e.g. LOG_INFO).
+ifdef LOG_COMPILE_LEVEL
+CPPFLAGS += -DLOG_COMPILE_LEVEL=$(LOG_COMPILE_LEVEL)
+endif
 LOGGER_OBJ = log.o
 LOGGER = $(LOGGER_DIR)/$(LOGGER_OBJ)
@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Benchmark for the logger: synchronous vs. asynchronous mode.
+ *
+ * For 1 to 32 threads, every thread issues the same number of log_info()
+ * calls to a log file. Report the average cost of a call on the calling
+ * thread and the overall throughput (messages written per second,
+ * including the final flush in asynchronous mode).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "utils/log/log.h"
+#include "utils/utils.h"
+
+#define DEFAULT_MESSAGES	100000
+#define MAX_THREADS		32
+#define LOG_FILE		"log_bench.log"
+
+static unsigned long num_messages = DEFAULT_MESSAGES;
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t start_barrier;
+
+struct worker {
+	pthread_t tid;
+	long id;
+	double ns_per_call;
+};
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void lock_fn(bool lock, void *udata)
+{
+	if (lock)
+		pthread_mutex_lock(udata);
+	else
+		pthread_mutex_unlock(udata);
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	double start;
+
+	pthread_barrier_wait(&start_barrier);
+
+	start = now_ns();
+	for (unsigned long i = 0; i < num_messages; i++)
+		log_info("worker %ld: accepted connection %lu from %s:%d",
+			w->id, i, "127.0.0.1", 42424);
+	w->ns_per_call = (now_ns() - start) / num_messages;
+
+	return NULL;
+}
+
+static void run(const char *mode, int num_threads)
+{
+	struct worker workers[MAX_THREADS];
+	double start, elapsed, ns_per_call = 0;
+	int rc;
+
+	rc = pthread_barrier_init(&start_barrier, NULL, num_threads + 1);
+	DIE(rc != 0, "pthread_barrier_init");
+
+	for (int i = 0; i < num_threads; i++) {
+		workers[i].id = i;
+		rc = pthread_create(&workers[i].tid, NULL, worker_fn, &workers[i]);
+		DIE(rc != 0, "pthread_create");
+	}
+
+	start = now_ns();
+	pthread_barrier_wait(&start_barrier);
+
+	for (int i = 0; i < num_threads; i++) {
+		pthread_join(workers[i].tid, NULL);
+		ns_per_call += workers[i].ns_per_call;
+	}
+	log_async_flush();
+	elapsed = now_ns() - start;
+
+	pthread_barrier_destroy(&start_barrier);
+
+	printf("%-6s %7d %12.1f %14.0f\n", mode, num_threads,
+		ns_per_call / num_threads,
+		num_threads * num_messages / (elapsed / 1e9));
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *logf;
+	int rc;
+
+	if (argc > 1)
+		num_messages = strtoul(argv[1], NULL, 10);
+	if (num_messages == 0) {
+		fprintf(stderr, "Usage: %s [messages_per_thread]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	logf = fopen(LOG_FILE, "w");
+	DIE(logf == NULL, "fopen");
+
+	log_set_quiet(true);
+	log_set_lock(lock_fn, &log_mutex);
+	log_add_fp(logf, LOG_INFO);
+
+	printf("%-6s %7s %12s %14s\n", "mode", "threads", "ns/call", "msgs/s");
+
+	for (int t = 1; t <= MAX_THREADS; t *= 2)
+		run("sync", t);
+
+	rc = log_async_start(0);
+	DIE(rc < 0, "log_async_start");
+
+	for (int t = 1; t <= MAX_THREADS; t *= 2)
+		run("async", t);
+
+	log_async_stop();
+	fclose(logf);
+
+	return 0;
+}
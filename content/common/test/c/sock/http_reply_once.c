@@ -97,7 +97,8 @@ static void send_reply(int sockfd)
 	ssize_t bytes_sent;
 	char abuffer[64];
 	int rc;
-	char buffer[BUFSIZ] = "HTTP/1.1 200 OK\r\n"
+	/* constant reply: its length is known at compile time */
+	static const char buffer[] = "HTTP/1.1 200 OK\r\n"
 		"Date: Sun, 08 May 2011 09:26:16 GMT\r\n"
 		"Server: Apache/2.2.9\r\n"
 		"Last-Modified: Mon, 02 Aug 2010 17:55:28 GMT\r\n"
@@ -117,7 +118,7 @@ static void send_reply(int sockfd)
 		goto remove_connection;
 	}
 
-	bytes_sent = send(sockfd, buffer, strlen(buffer), 0);
+	bytes_sent = send(sockfd, buffer, sizeof(buffer) - 1, 0);
 	if (bytes_sent < 0) {		/* error in communication */
 		log_error("Error in communication to %s\n", abuffer);
 		goto remove_connection;
@@ -0,0 +1,540 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Load generator for the TCP servers in this repository
+ *
+ * Runs a number of concurrent clients, spread over threads; each thread
+ * multiplexes its clients with epoll(7). A client sends a request, waits for
+ * the whole response, then starts the next request, until the end of the
+ * run. Connections are opened without blocking and, for servers that keep
+ * them open, reused from a connection pool (see utils/sock/sock_util.h).
+ *
+ * Modes (protocols):
+ *   echo	send -s bytes, receive them back (epoll echo server)
+ *   http	GET -a path, read the response (web servers)
+ *   fib	send -a number, read the result until the server closes the
+ *		connection (fibonacci servers)
+ *   time	read the time until the server closes the connection (time
+ *		server)
+ *
+ * At the end, print requests per second, connections opened and reused,
+ * and the average and maximum request latency.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "utils/utils.h"
+#include "utils/log/log.h"
+#include "utils/sock/sock_util.h"
+#include "utils/sock/w_epoll.h"
+
+#define LOAD_MAX_THREADS	64
+#define LOAD_RECV_SIZE		(64 * 1024)
+#define LOAD_HEADER_SIZE	4096
+#define LOAD_MAX_EVENTS		64
+
+enum load_mode {
+	MODE_ECHO,
+	MODE_HTTP,
+	MODE_FIB,
+	MODE_TIME,
+};
+
+static const struct load_mode_info {
+	const char *name;
+	unsigned short port;		/* default */
+	const char *arg;		/* default */
+	bool keep_alive;		/* server keeps connections open */
+} modes[] = {
+	[MODE_ECHO] = { "echo", 42424, NULL, true },
+	[MODE_HTTP] = { "http", 8888, "/", true },
+	[MODE_FIB] = { "fib", 0, "20", false },
+	[MODE_TIME] = { "time", 2000, NULL, false },
+};
+
+struct load_thread;
+
+/* a client */
+struct load_conn {
+	struct load_thread *thread;
+	int sockfd;
+	bool connecting;
+	bool reused;			/* connection taken from the pool */
+	double start;
+
+	size_t sent;
+	size_t received;
+
+	/* HTTP response header, then body */
+	char hdr[LOAD_HEADER_SIZE];
+	size_t hdr_len;
+	bool in_body;
+	bool close_after;
+	size_t body_left;
+};
+
+struct load_thread {
+	pthread_t tid;
+	int epollfd;
+	struct tcp_pool pool;
+	unsigned int num_conns;
+	unsigned int active;
+	struct load_conn *conns;
+	char *recv_buf;
+
+	/* statistics */
+	unsigned long requests;
+	unsigned long errors;
+	double latency_sum;
+	double latency_max;
+};
+
+static enum load_mode mode = MODE_ECHO;
+static const char *server_host = "127.0.0.1";
+static unsigned short server_port;
+static const char *mode_arg;
+static size_t echo_size = 64;
+static int max_idle = -1;
+
+/* request sent by all clients */
+static char *request;
+static size_t request_len;
+
+static double deadline;
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void build_request(void)
+{
+	switch (mode) {
+	case MODE_ECHO:
+		request = malloc(echo_size);
+		DIE(request == NULL, "malloc");
+		for (size_t i = 0; i < echo_size; i++)
+			request[i] = 'a' + i % 26;
+		request_len = echo_size;
+		break;
+	case MODE_HTTP:
+		request_len = asprintf(&request,
+			"GET %s HTTP/1.1\r\nHost: %s\r\n\r\n", mode_arg,
+			server_host);
+		DIE(request == NULL, "asprintf");
+		break;
+	case MODE_FIB:
+		request = strdup(mode_arg);
+		DIE(request == NULL, "strdup");
+		request_len = strlen(request);
+		break;
+	case MODE_TIME:
+		request = NULL;
+		request_len = 0;
+		break;
+	}
+}
+
+/*
+ * Watch the connection for events: a file descriptor taken from the pool is
+ * already registered, disabled since its last event.
+ */
+
+static int conn_arm(struct load_conn *c, unsigned int events)
+{
+	int epollfd = c->thread->epollfd;
+	int rc;
+
+	rc = w_epoll_rearm_ptr(epollfd, c->sockfd, c, events);
+	if (rc < 0 && errno == ENOENT)
+		rc = w_epoll_add_ptr_oneshot(epollfd, c->sockfd, c, events);
+
+	return rc;
+}
+
+static void conn_start(struct load_conn *c);
+
+/*
+ * A connection from the pool may have been closed by the server in the
+ * meantime: retry those with a new connection. Stop the client on other
+ * failures, which would repeat.
+ */
+
+static void conn_fail(struct load_conn *c)
+{
+	struct load_thread *t = c->thread;
+
+	close(c->sockfd);
+	c->sockfd = -1;
+
+	if (c->reused && now_sec() < deadline) {
+		conn_start(c);
+		return;
+	}
+
+	t->errors++;
+	t->active--;
+}
+
+/*
+ * Account for the request and start the next one. The connection goes
+ * back to the pool if the server keeps it open.
+ */
+
+static void conn_done(struct load_conn *c, bool reusable)
+{
+	struct load_thread *t = c->thread;
+	double latency = now_sec() - c->start;
+
+	t->requests++;
+	t->latency_sum += latency;
+	if (latency > t->latency_max)
+		t->latency_max = latency;
+
+	if (reusable)
+		tcp_pool_put(&t->pool, c->sockfd);
+	else
+		close(c->sockfd);
+	c->sockfd = -1;
+
+	if (c->start + latency < deadline)
+		conn_start(c);
+	else
+		t->active--;
+}
+
+static void conn_send(struct load_conn *c)
+{
+	ssize_t n;
+
+	while (c->sent < request_len) {
+		n = send(c->sockfd, request + c->sent, request_len - c->sent,
+			MSG_NOSIGNAL);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (conn_arm(c, EPOLLOUT) < 0)
+				conn_fail(c);
+			return;
+		}
+		if (n < 0) {
+			conn_fail(c);
+			return;
+		}
+		c->sent += n;
+	}
+
+	if (conn_arm(c, EPOLLIN) < 0)
+		conn_fail(c);
+}
+
+static void conn_start(struct load_conn *c)
+{
+	struct load_thread *t = c->thread;
+	unsigned long reuses = t->pool.reuses;
+	bool in_progress;
+
+	c->sockfd = tcp_pool_get(&t->pool, &in_progress);
+	if (c->sockfd < 0) {
+		ERR(1, "tcp_pool_get");
+		t->errors++;
+		t->active--;
+		return;
+	}
+
+	c->reused = t->pool.reuses != reuses;
+	c->start = now_sec();
+	c->sent = 0;
+	c->received = 0;
+	c->hdr_len = 0;
+	c->in_body = false;
+	c->connecting = in_progress;
+
+	if (in_progress) {
+		if (conn_arm(c, EPOLLOUT) < 0)
+			conn_fail(c);
+		return;
+	}
+
+	conn_send(c);
+}
+
+/*
+ * Parse the HTTP response header once it is complete. Return the number of
+ * header bytes in data (the rest is body), 0 if the header is not complete.
+ */
+
+static size_t http_parse_header(struct load_conn *c, const char *data,
+		size_t len)
+{
+	size_t copy = len, used;
+	const char *end, *field;
+
+	if (copy > sizeof(c->hdr) - 1 - c->hdr_len)
+		copy = sizeof(c->hdr) - 1 - c->hdr_len;
+	memcpy(c->hdr + c->hdr_len, data, copy);
+	c->hdr[c->hdr_len + copy] = '\0';
+
+	end = strstr(c->hdr, "\r\n\r\n");
+	if (end == NULL) {
+		c->hdr_len += copy;
+		return 0;
+	}
+
+	used = end + 4 - c->hdr - c->hdr_len;
+	c->hdr_len = end + 4 - c->hdr;
+	c->in_body = true;
+
+	field = strcasestr(c->hdr, "\r\nContent-Length:");
+	c->body_left = field ? strtoul(field + 17, NULL, 10) : 0;
+	c->close_after = strcasestr(c->hdr, "\r\nConnection: close") != NULL ||
+		(strncmp(c->hdr, "HTTP/1.0", 8) == 0 &&
+		 strcasestr(c->hdr, "\r\nConnection: keep-alive") == NULL);
+
+	return used;
+}
+
+/*
+ * Consume received data. Return true when the response is complete.
+ */
+
+static bool conn_consume(struct load_conn *c, const char *data, size_t len)
+{
+	size_t used;
+
+	c->received += len;
+
+	switch (mode) {
+	case MODE_ECHO:
+		return c->received >= echo_size;
+	case MODE_HTTP:
+		if (!c->in_body) {
+			used = http_parse_header(c, data, len);
+			if (!c->in_body)
+				return false;
+			len -= used;
+		}
+		c->body_left -= len < c->body_left ? len : c->body_left;
+		return c->body_left == 0;
+	default:
+		/* complete when the server closes the connection */
+		return false;
+	}
+}
+
+static void conn_recv(struct load_conn *c)
+{
+	char *buf = c->thread->recv_buf;
+	ssize_t n;
+
+	while (1) {
+		n = recv(c->sockfd, buf, LOAD_RECV_SIZE, 0);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (conn_arm(c, EPOLLIN) < 0)
+				conn_fail(c);
+			return;
+		}
+		if (n == 0 && !modes[mode].keep_alive && c->received > 0) {
+			conn_done(c, false);
+			return;
+		}
+		if (n <= 0) {
+			conn_fail(c);
+			return;
+		}
+
+		if (conn_consume(c, buf, n)) {
+			conn_done(c, mode != MODE_HTTP || !c->close_after);
+			return;
+		}
+	}
+}
+
+static void conn_handle(struct load_conn *c)
+{
+	if (c->connecting) {
+		c->connecting = false;
+		if (tcp_connect_result(c->sockfd) < 0) {
+			ERR(1, "connect");
+			conn_fail(c);
+			return;
+		}
+	}
+
+	if (c->sent < request_len)
+		conn_send(c);
+	else
+		conn_recv(c);
+}
+
+static void *thread_run(void *arg)
+{
+	struct load_thread *t = arg;
+	struct epoll_event rev[LOAD_MAX_EVENTS];
+	int n;
+
+	for (unsigned int i = 0; i < t->num_conns; i++) {
+		t->conns[i].thread = t;
+		conn_start(&t->conns[i]);
+	}
+
+	while (t->active > 0) {
+		n = w_epoll_wait(t->epollfd, rev, LOAD_MAX_EVENTS, 100);
+		if (n < 0 && errno == EINTR)
+			continue;
+		DIE(n < 0, "epoll_wait");
+
+		for (int i = 0; i < n; i++)
+			conn_handle(rev[i].data.ptr);
+
+		/* Clients waiting for a response past the deadline give up. */
+		if (now_sec() > deadline + 1)
+			break;
+	}
+
+	return NULL;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-m echo|http|fib|time] [-H host] [-p port] "
+		"[-c clients] [-T threads] [-d seconds] [-s echo_size] "
+		"[-a path|number] [-k max_idle]\n", argv0);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct load_thread *threads;
+	unsigned int num_threads = 1, num_conns = 100;
+	unsigned int duration = 10;
+	unsigned long requests = 0, errors = 0, connects = 0, reuses = 0;
+	double latency_sum = 0, latency_max = 0, start, elapsed;
+	struct rlimit rlim;
+	int opt;
+	int rc;
+
+	while ((opt = getopt(argc, argv, "m:H:p:c:T:d:s:a:k:")) != -1) {
+		switch (opt) {
+		case 'm':
+			for (mode = 0; mode < sizeof(modes) / sizeof(modes[0]); mode++)
+				if (strcmp(optarg, modes[mode].name) == 0)
+					break;
+			if (mode == sizeof(modes) / sizeof(modes[0]))
+				usage(argv[0]);
+			break;
+		case 'H':
+			server_host = optarg;
+			break;
+		case 'p':
+			server_port = atoi(optarg);
+			break;
+		case 'c':
+			num_conns = atoi(optarg);
+			break;
+		case 'T':
+			num_threads = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 's':
+			echo_size = strtoul(optarg, NULL, 10);
+			break;
+		case 'a':
+			mode_arg = optarg;
+			break;
+		case 'k':
+			max_idle = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (server_port == 0)
+		server_port = modes[mode].port;
+	if (mode_arg == NULL)
+		mode_arg = modes[mode].arg;
+	if (server_port == 0 || num_threads == 0 ||
+			num_threads > LOAD_MAX_THREADS || num_conns < num_threads ||
+			echo_size == 0)
+		usage(argv[0]);
+
+	/* One file descriptor per client, and some in the pools. */
+	rc = getrlimit(RLIMIT_NOFILE, &rlim);
+	DIE(rc < 0, "getrlimit");
+	rlim.rlim_cur = rlim.rlim_max;
+	rc = setrlimit(RLIMIT_NOFILE, &rlim);
+	DIE(rc < 0, "setrlimit");
+
+	build_request();
+
+	threads = calloc(num_threads, sizeof(*threads));
+	DIE(threads == NULL, "calloc");
+
+	start = now_sec();
+	deadline = start + duration;
+
+	for (unsigned int i = 0; i < num_threads; i++) {
+		struct load_thread *t = &threads[i];
+
+		t->num_conns = num_conns / num_threads +
+			(i < num_conns % num_threads);
+		t->active = t->num_conns;
+		t->conns = calloc(t->num_conns, sizeof(*t->conns));
+		DIE(t->conns == NULL, "calloc");
+		t->recv_buf = malloc(LOAD_RECV_SIZE);
+		DIE(t->recv_buf == NULL, "malloc");
+		t->epollfd = w_epoll_create();
+		DIE(t->epollfd < 0, "w_epoll_create");
+
+		/* By default, keep a connection per client for reuse. */
+		rc = tcp_pool_init(&t->pool, server_host, server_port,
+			!modes[mode].keep_alive ? 0 :
+			max_idle >= 0 ? (unsigned int) max_idle : t->num_conns);
+		DIE(rc < 0, "tcp_pool_init");
+
+		rc = pthread_create(&t->tid, NULL, thread_run, t);
+		DIE(rc != 0, "pthread_create");
+	}
+
+	for (unsigned int i = 0; i < num_threads; i++) {
+		struct load_thread *t = &threads[i];
+
+		pthread_join(t->tid, NULL);
+		requests += t->requests;
+		errors += t->errors;
+		connects += t->pool.connects;
+		reuses += t->pool.reuses;
+		latency_sum += t->latency_sum;
+		if (t->latency_max > latency_max)
+			latency_max = t->latency_max;
+		tcp_pool_destroy(&t->pool);
+	}
+	elapsed = now_sec() - start;
+
+	printf("mode %s, %s:%hu, %u clients, %u threads, %.1f s\n",
+		modes[mode].name, server_host, server_port, num_conns,
+		num_threads, elapsed);
+	printf("requests     %lu (%.0f/s)\n", requests, requests / elapsed);
+	printf("errors       %lu\n", errors);
+	printf("connections  %lu opened, %lu reused\n", connects, reuses);
+	printf("latency      %.3f ms average, %.3f ms max\n",
+		requests ? latency_sum * 1000 / requests : 0.0,
+		latency_max * 1000);
+
+	return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,282 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#include "utils/buf/buf_chain.h"
+
+struct buf *buf_get(struct pool *pool)
+{
+	struct buf *buf = pool_get(pool);
+
+	if (buf == NULL)
+		return NULL;
+
+	buf->pool = pool;
+	buf->refs = 1;
+	buf->size = pool->obj_size - sizeof(*buf);
+
+	return buf;
+}
+
+void buf_put(struct buf *buf)
+{
+	if (--buf->refs == 0)
+		pool_put(buf->pool, buf);
+}
+
+void buf_chain_init(struct buf_chain *chain)
+{
+	chain->head = 0;
+	chain->count = 0;
+	chain->len = 0;
+}
+
+static struct buf_seg *chain_seg(struct buf_chain *chain, unsigned int i)
+{
+	return &chain->segs[(chain->head + i) % BUF_CHAIN_SEGS];
+}
+
+/*
+ * Return free space at the end of the chain, where new data (e.g. received
+ * from a socket) can be written; its size is stored in len. The last buffer
+ * is filled up first, unless others reference it. Otherwise a buffer is
+ * taken from pool. Return NULL if the chain is full or the pool is out of
+ * memory.
+ */
+
+char *buf_chain_tail(struct buf_chain *chain, struct pool *pool, size_t *len)
+{
+	struct buf_seg *seg;
+	struct buf *buf;
+
+	if (chain->count > 0) {
+		seg = chain_seg(chain, chain->count - 1);
+		if (seg->buf->refs == 1 && seg->off + seg->len < seg->buf->size) {
+			*len = seg->buf->size - seg->off - seg->len;
+			return seg->buf->data + seg->off + seg->len;
+		}
+	}
+
+	if (buf_chain_full(chain))
+		return NULL;
+	buf = buf_get(pool);
+	if (buf == NULL)
+		return NULL;
+
+	seg = chain_seg(chain, chain->count++);
+	seg->buf = buf;
+	seg->off = 0;
+	seg->len = 0;
+
+	*len = buf->size;
+	return buf->data;
+}
+
+/*
+ * Add len bytes written to the space returned by buf_chain_tail() to the
+ * chain. Committing 0 bytes gives back a buffer taken for nothing.
+ */
+
+void buf_chain_commit(struct buf_chain *chain, size_t len)
+{
+	struct buf_seg *seg = chain_seg(chain, chain->count - 1);
+
+	seg->len += len;
+	chain->len += len;
+
+	if (seg->len == 0) {
+		buf_put(seg->buf);
+		chain->count--;
+	}
+}
+
+/*
+ * Append len bytes at off in buf to the chain, taking a reference to buf.
+ * Return -1 if the chain is full.
+ */
+
+int buf_chain_append(struct buf_chain *chain, struct buf *buf, size_t off,
+		size_t len)
+{
+	struct buf_seg *seg;
+
+	if (buf_chain_full(chain))
+		return -1;
+
+	buf_ref(buf);
+	seg = chain_seg(chain, chain->count++);
+	seg->buf = buf;
+	seg->off = off;
+	seg->len = len;
+	chain->len += len;
+
+	return 0;
+}
+
+/*
+ * Remove len bytes from the start of the chain, dropping references to
+ * buffers that are done with.
+ */
+
+void buf_chain_consume(struct buf_chain *chain, size_t len)
+{
+	struct buf_seg *seg;
+
+	chain->len -= len;
+	while (len > 0) {
+		seg = chain_seg(chain, 0);
+		if (len < seg->len) {
+			seg->off += len;
+			seg->len -= len;
+			return;
+		}
+		len -= seg->len;
+		buf_put(seg->buf);
+		chain->head = (chain->head + 1) % BUF_CHAIN_SEGS;
+		chain->count--;
+	}
+}
+
+void buf_chain_clear(struct buf_chain *chain)
+{
+	while (chain->count > 0) {
+		buf_put(chain_seg(chain, 0)->buf);
+		chain->head = (chain->head + 1) % BUF_CHAIN_SEGS;
+		chain->count--;
+	}
+	chain->len = 0;
+}
+
+/*
+ * Send as much of the chain as possible with one sendmsg(2) call and
+ * remove what was sent. If zc is not NULL (the socket has SO_ZEROCOPY set),
+ * large sends use MSG_ZEROCOPY. Return the number of bytes sent, or -1 with
+ * errno set.
+ */
+
+ssize_t buf_chain_send(struct buf_chain *chain, int sockfd, struct buf_zc *zc)
+{
+	struct iovec iov[BUF_CHAIN_SEGS];
+	struct msghdr msg;
+	struct buf_seg *seg;
+	bool zerocopy;
+	size_t left;
+	ssize_t n;
+
+	for (unsigned int i = 0; i < chain->count; i++) {
+		seg = chain_seg(chain, i);
+		iov[i].iov_base = seg->buf->data + seg->off;
+		iov[i].iov_len = seg->len;
+	}
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = chain->count;
+
+	/* Copy when too many buffers are still waiting for the kernel. */
+	zerocopy = (zc != NULL && chain->len >= BUF_ZC_MIN_LEN &&
+		zc->count + chain->count <= BUF_ZC_PENDING);
+
+	n = sendmsg(sockfd, &msg, MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0));
+	if (n < 0 && zerocopy && errno == ENOBUFS) {
+		/* Too many pages pinned for the socket (optmem limit). */
+		zerocopy = false;
+		n = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+	}
+	if (n < 0)
+		return -1;
+
+	if (zerocopy) {
+		/* Keep the buffers sent from until the kernel is done. */
+		left = n;
+		for (unsigned int i = 0; i < chain->count && left > 0; i++) {
+			seg = chain_seg(chain, i);
+			buf_ref(seg->buf);
+			zc->pending[(zc->head + zc->count) % BUF_ZC_PENDING].buf =
+				seg->buf;
+			zc->pending[(zc->head + zc->count) % BUF_ZC_PENDING].id =
+				zc->next_id;
+			zc->count++;
+			left -= (left < seg->len) ? left : seg->len;
+		}
+		zc->next_id++;
+	}
+
+	buf_chain_consume(chain, n);
+
+	return n;
+}
+
+void buf_zc_init(struct buf_zc *zc)
+{
+	zc->head = 0;
+	zc->count = 0;
+	zc->next_id = 0;
+	zc->copied = 0;
+}
+
+/*
+ * Read MSG_ZEROCOPY completions from the socket error queue (reported as
+ * EPOLLERR) and release the buffers of completed sends. Return the number
+ * of notifications, or -1 for an actual socket error.
+ */
+
+int buf_zc_reap(struct buf_zc *zc, int sockfd)
+{
+	char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+	struct sock_extended_err *serr;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	int count = 0;
+
+	while (1) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(sockfd, &msg, MSG_ERRQUEUE) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return count;
+			return -1;
+		}
+
+		cmsg = CMSG_FIRSTHDR(&msg);
+		if (cmsg == NULL ||
+				!((cmsg->cmsg_level == SOL_IP &&
+					cmsg->cmsg_type == IP_RECVERR) ||
+				(cmsg->cmsg_level == SOL_IPV6 &&
+					cmsg->cmsg_type == IPV6_RECVERR)))
+			continue;
+
+		serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+		if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+			errno = serr->ee_errno;
+			return -1;
+		}
+		if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+			zc->copied++;
+
+		/* Sends ee_info to ee_data are done; they complete in order. */
+		while (zc->count > 0 &&
+				(int32_t) (zc->pending[zc->head].id - serr->ee_data) <= 0) {
+			buf_put(zc->pending[zc->head].buf);
+			zc->head = (zc->head + 1) % BUF_ZC_PENDING;
+			zc->count--;
+		}
+		count++;
+	}
+}
+
+void buf_zc_clear(struct buf_zc *zc)
+{
+	while (zc->count > 0) {
+		buf_put(zc->pending[zc->head].buf);
+		zc->head = (zc->head + 1) % BUF_ZC_PENDING;
+		zc->count--;
+	}
+}
@@ -0,0 +1,110 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Reference counted buffers and buffer chains
+ *
+ * A buffer chain is a queue of segments (parts of buffers) waiting to be
+ * sent. It is sent with a single sendmsg(2) call, without copying the
+ * segments into one contiguous buffer. The same buffer may be referenced by
+ * several chains (e.g. data forwarded to several peers); it goes back to its
+ * pool when the last reference is dropped.
+ *
+ * Large sends may use MSG_ZEROCOPY: the kernel then sends data straight
+ * from the buffers, which must not be reused until it reports completion on
+ * the socket error queue. The buffers are referenced until then.
+ *
+ * Nothing here is thread safe: buffers, chains and pools belong to one
+ * thread.
+ */
+
+#ifndef BUF_CHAIN_H_
+#define BUF_CHAIN_H_	1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "utils/pool/pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BUF_CHAIN_SEGS		16
+#define BUF_ZC_PENDING		64
+
+/* Smaller sends are copied: page pinning and notification cost more. */
+#define BUF_ZC_MIN_LEN		(16 * 1024)
+
+/* reference counted buffer, allocated from a pool */
+struct buf {
+	struct pool *pool;
+	unsigned int refs;
+	size_t size;
+	char data[];
+};
+
+/* the part of a buffer holding data */
+struct buf_seg {
+	struct buf *buf;
+	size_t off;
+	size_t len;
+};
+
+/* queue of segments to send */
+struct buf_chain {
+	struct buf_seg segs[BUF_CHAIN_SEGS];	/* circular */
+	unsigned int head;
+	unsigned int count;
+	size_t len;				/* bytes in all segments */
+};
+
+/* buffers referenced by MSG_ZEROCOPY sends the kernel is not done with */
+struct buf_zc {
+	struct {
+		struct buf *buf;
+		uint32_t id;			/* send call the buffer is used by */
+	} pending[BUF_ZC_PENDING];		/* circular */
+	unsigned int head;
+	unsigned int count;
+	uint32_t next_id;			/* id of the next zerocopy send */
+	unsigned long copied;			/* sends the kernel copied anyway */
+};
+
+/*
+ * The pool must hold objects of sizeof(struct buf) plus the data size.
+ */
+struct buf *buf_get(struct pool *pool);
+
+static inline void buf_ref(struct buf *buf)
+{
+	buf->refs++;
+}
+
+void buf_put(struct buf *buf);
+
+void buf_chain_init(struct buf_chain *chain);
+char *buf_chain_tail(struct buf_chain *chain, struct pool *pool, size_t *len);
+void buf_chain_commit(struct buf_chain *chain, size_t len);
+int buf_chain_append(struct buf_chain *chain, struct buf *buf, size_t off,
+		size_t len);
+void buf_chain_consume(struct buf_chain *chain, size_t len);
+void buf_chain_clear(struct buf_chain *chain);
+ssize_t buf_chain_send(struct buf_chain *chain, int sockfd, struct buf_zc *zc);
+
+static inline bool buf_chain_full(const struct buf_chain *chain)
+{
+	return chain->count == BUF_CHAIN_SEGS;
+}
+
+void buf_zc_init(struct buf_zc *zc);
+int buf_zc_reap(struct buf_zc *zc, int sockfd);
+void buf_zc_clear(struct buf_zc *zc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BUF_CHAIN_H_ */
@@ -22,6 +22,8 @@
 
 /* Github link: https://github.com/rxi/log.c */
 
+#include <unistd.h>
+
 #include "log.h"
 
 #define MAX_CALLBACKS 32
@@ -35,11 +37,22 @@ typedef struct {
 static struct {
   void *udata;
   log_LockFn lock;
+  log_LogFn backend;
   int level;
   bool quiet;
   Callback callbacks[MAX_CALLBACKS];
 } L;
 
+int log_min_level;
+
+/* Per-thread timestamp, formatted once per second. */
+static __thread struct {
+  time_t sec;
+  struct tm tm;
+  char short_time[16];
+  char full_time[32];
+} T = { .sec = -1 };
+
 
 static const char *level_strings[] = {
   "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"
@@ -53,8 +66,7 @@ static const char *level_colors[] = {
 
 
 static void stdout_callback(log_Event *ev) {
-  char buf[16];
-  buf[strftime(buf, sizeof(buf), "%H:%M:%S", ev->time)] = '\0';
+  const char *buf = T.short_time;
 #ifdef LOG_USE_COLOR
   fprintf(
     ev->udata, "%s %s%-5s\x1b[0m \x1b[90m%s:%d:\x1b[0m ",
@@ -72,8 +84,7 @@ static void stdout_callback(log_Event *ev) {
 
 
 static void file_callback(log_Event *ev) {
-  char buf[64];
-  buf[strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", ev->time)] = '\0';
+  const char *buf = T.full_time;
   fprintf(
     ev->udata, "%s %-5s %s:%d: ",
     buf, level_strings[ev->level], ev->file, ev->line);
@@ -83,6 +94,16 @@ static void file_callback(log_Event *ev) {
 }
 
 
+static void update_min_level(void) {
+  int min = L.quiet ? LOG_FATAL + 1 : L.level;
+
+  for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++) {
+    if (L.callbacks[i].level < min) { min = L.callbacks[i].level; }
+  }
+  log_min_level = min;
+}
+
+
 static void lock(void)   {
   if (L.lock) { L.lock(true, L.udata); }
 }
@@ -106,11 +127,13 @@ void log_set_lock(log_LockFn fn, void *udata) {
 
 void log_set_level(int level) {
   L.level = level;
+  update_min_level();
 }
 
 
 void log_set_quiet(bool enable) {
   L.quiet = enable;
+  update_min_level();
 }
 
 
@@ -118,6 +141,7 @@ int log_add_callback(log_LogFn fn, void *udata, int level) {
   for (int i = 0; i < MAX_CALLBACKS; i++) {
     if (!L.callbacks[i].fn) {
       L.callbacks[i] = (Callback) { fn, udata, level };
+      update_min_level();
       return 0;
     }
   }
@@ -130,10 +154,61 @@ int log_add_fp(FILE *fp, int level) {
 }
 
 
+/*
+ * Hand every message to fn instead of formatting it on the caller's thread.
+ * The lock is not taken; fn is responsible for level filtering (see
+ * log_get_sinks()). Pass NULL to return to synchronous logging.
+ */
+void log_set_backend(log_LogFn fn) {
+  L.backend = fn;
+}
+
+
+/*
+ * Fill sinks with the file descriptors a message of the given level should
+ * be written to: stderr (unless quiet) and every file added with
+ * log_add_fp(). Other callbacks are not reported. Return the number of
+ * sinks; sinks may be NULL to only count them.
+ */
+int log_get_sinks(int level, log_Sink *sinks, int max) {
+  int n = 0;
+
+  if (!L.quiet && level >= L.level) {
+    if (sinks && n < max) { sinks[n] = (log_Sink) { STDERR_FILENO, false }; }
+    n++;
+  }
+
+  for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++) {
+    Callback *cb = &L.callbacks[i];
+    if (cb->fn == file_callback && level >= cb->level) {
+      if (sinks && n < max) {
+        sinks[n] = (log_Sink) { fileno(cb->udata), true };
+      }
+      n++;
+    }
+  }
+
+  if (sinks && n > max) { n = max; }
+  return n;
+}
+
+
+static void update_time(void) {
+  time_t t = time(NULL);
+
+  if (t != T.sec) {
+    localtime_r(&t, &T.tm);
+    strftime(T.short_time, sizeof(T.short_time), "%H:%M:%S", &T.tm);
+    strftime(T.full_time, sizeof(T.full_time), "%Y-%m-%d %H:%M:%S", &T.tm);
+    T.sec = t;
+  }
+}
+
+
 static void init_event(log_Event *ev, void *udata) {
   if (!ev->time) {
-    time_t t = time(NULL);
-    ev->time = localtime(&t);
+    update_time();
+    ev->time = &T.tm;
   }
   ev->udata = udata;
 }
@@ -147,6 +222,15 @@ void log_log(int level, const char *file, int line, const char *fmt, ...) {
     .level = level,
   };
 
+  if (LOG_UNLIKELY(level < log_min_level)) { return; }
+
+  if (L.backend) {
+    va_start(ev.ap, fmt);
+    L.backend(&ev);
+    va_end(ev.ap);
+    return;
+  }
+
   lock();
 
   if (!L.quiet && level >= L.level) {
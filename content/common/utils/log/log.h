@@ -31,17 +31,47 @@ typedef struct {
   int level;
 } log_Event;
 
+typedef struct {
+  int fd;
+  bool full_date;
+} log_Sink;
+
 typedef void (*log_LogFn)(log_Event *ev);
 typedef void (*log_LockFn)(bool lock, void *udata);
 
 enum { LOG_TRACE, LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR, LOG_FATAL };
 
-#define log_trace(...) log_log(LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__)
-#define log_debug(...) log_log(LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
-#define log_info(...)  log_log(LOG_INFO,  __FILE__, __LINE__, __VA_ARGS__)
-#define log_warn(...)  log_log(LOG_WARN,  __FILE__, __LINE__, __VA_ARGS__)
-#define log_error(...) log_log(LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__)
-#define log_fatal(...) log_log(LOG_FATAL, __FILE__, __LINE__, __VA_ARGS__)
+/*
+ * Calls below LOG_COMPILE_LEVEL (e.g. -DLOG_COMPILE_LEVEL=LOG_INFO) are
+ * removed at compile time; their arguments are never evaluated.
+ */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_TRACE
+#endif
+
+#if defined(__GNUC__)
+#define LOG_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define LOG_UNLIKELY(x) (x)
+#endif
+
+/* Lowest level any output currently accepts, kept up to date by log.c. */
+extern int log_min_level;
+
+#define log_at(level, ...)                                             \
+  do {                                                                 \
+    if ((level) >= LOG_COMPILE_LEVEL &&                                \
+        !LOG_UNLIKELY((level) < log_min_level)) {                      \
+      log_log((level), __FILE__, __LINE__, __VA_ARGS__);               \
+    }                                                                  \
+  } while (0)
+
+#define log_trace(...) log_at(LOG_TRACE, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_DEBUG, __VA_ARGS__)
+#define log_info(...)  log_at(LOG_INFO,  __VA_ARGS__)
+#define log_warn(...)  log_at(LOG_WARN,  __VA_ARGS__)
+#define log_error(...) log_at(LOG_ERROR, __VA_ARGS__)
+#define log_fatal(...) log_at(LOG_FATAL, __VA_ARGS__)
 
 const char* log_level_string(int level);
 void log_set_lock(log_LockFn fn, void *udata);
@@ -49,6 +79,19 @@ void log_set_level(int level);
 void log_set_quiet(bool enable);
 int log_add_callback(log_LogFn fn, void *udata, int level);
 int log_add_fp(FILE *fp, int level);
+void log_set_backend(log_LogFn fn);
+int log_get_sinks(int level, log_Sink *sinks, int max);
+
+/*
+ * Asynchronous mode, implemented in log_async.c (link log_async.o and
+ * -lpthread to use it). Callers only copy a binary record (level, file,
+ * line, format pointer and raw arguments) into a per-thread ring buffer;
+ * a background thread formats records and writes them in batches. Only
+ * stderr and the files added with log_add_fp() are served in this mode.
+ */
+int log_async_start(size_t ring_size);
+void log_async_flush(void);
+void log_async_stop(void);
 
 void log_log(int level, const char *file, int line, const char *fmt, ...);
 
@@ -0,0 +1,963 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Asynchronous backend for the logger
+ *
+ * Every logging thread owns a single-producer / single-consumer ring
+ * buffer. log_log() only copies a binary record (timestamp, level, file,
+ * line, format pointer and the raw arguments, decoded according to the
+ * format) into the ring of the calling thread. A background writer thread
+ * drains all rings, formats the records and writes them to the sinks in
+ * batches, using writev(2).
+ *
+ * Producers never take a lock and never issue a system call, unless their
+ * ring is full or the writer thread is asleep and has to be woken up.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <limits.h>
+#include <wchar.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "log.h"
+
+#define LOG_ASYNC_DEFAULT_RING		(64 * 1024)
+#define LOG_ASYNC_MAX_RECORD		1024	/* record header + arguments */
+#define LOG_ASYNC_MAX_STR		256	/* longest copied %s, %ls argument */
+#define LOG_ASYNC_MAX_SPEC		64	/* longest conversion spec */
+#define LOG_ASYNC_MAX_LINE		2048	/* longest formatted message */
+#define LOG_ASYNC_MAX_SINKS		8
+#define LOG_ASYNC_BATCH_SIZE		(128 * 1024)
+#define LOG_ASYNC_BATCH_IOV		256	/* per sink, at most IOV_MAX */
+#define LOG_ASYNC_IDLE_WAIT_NS		(50 * 1000 * 1000)
+
+/* level of the filler record used when a record does not fit at the end */
+#define LOG_ASYNC_PAD			0xff
+
+#define ALIGN8(x)			(((x) + 7) & ~((size_t) 7))
+
+struct record {
+	uint32_t size;		/* whole record, arguments included, 8-aligned */
+	uint8_t level;
+	int line;
+	const char *file;
+	const char *fmt;
+	struct timespec ts;
+	/* followed by the arguments, each in a 8-aligned slot */
+};
+
+struct ring {
+	alignas(64) _Atomic size_t head;	/* advanced by the producer */
+	alignas(64) _Atomic size_t tail;	/* advanced by the writer */
+	alignas(64) size_t mask;
+	_Atomic bool orphan;		/* owning thread has exited */
+	struct ring *next;
+	char *data;
+};
+
+enum arg_type {
+	ARG_NONE,	/* %% */
+	ARG_INT,
+	ARG_LONG,
+	ARG_LLONG,
+	ARG_SIZE,
+	ARG_INTMAX,
+	ARG_PTRDIFF,
+	ARG_DOUBLE,
+	ARG_LDOUBLE,
+	ARG_STR,
+	ARG_WSTR,	/* %ls, or %s with another length modifier */
+	ARG_PTR,
+	ARG_COUNT,	/* %n, consumed but never written back */
+	ARG_ERRNO	/* %m, errno is captured by the caller */
+};
+
+/* conversion specification, as in "%-*.3lu" */
+struct spec {
+	const char *start;	/* the '%' character */
+	size_t len;
+	int nstars;		/* '*' width and precision, taking int arguments */
+	enum arg_type type;
+};
+
+/* one output file descriptor in the current batch */
+struct batch_sink {
+	int fd;
+	int niov;
+	struct iovec iov[LOG_ASYNC_BATCH_IOV];
+};
+
+static struct {
+	pthread_t writer;
+	bool running;
+	size_t ring_size;
+
+	/* list of all rings; the lock is only taken to add rings */
+	pthread_mutex_t rings_lock;
+	struct ring *rings;
+
+	/* writer wake up */
+	pthread_mutex_t wake_lock;
+	pthread_cond_t wake_cond;
+	_Atomic bool idle;
+	_Atomic bool stopping;
+
+	/* log_async_flush() requests and completions */
+	_Atomic unsigned long flush_req;
+	_Atomic unsigned long flush_done;
+
+	/* writer thread state */
+	char buf[LOG_ASYNC_BATCH_SIZE];
+	size_t buf_len;
+	struct batch_sink sinks[LOG_ASYNC_MAX_SINKS];
+	int nsinks;
+	time_t cached_sec;
+	char short_time[16];
+	char full_time[32];
+} A = {
+	.rings_lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake_lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake_cond = PTHREAD_COND_INITIALIZER,
+	.cached_sec = -1,
+};
+
+static const char *level_strings[] = {
+	"TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"
+};
+
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static __thread struct ring *my_ring;
+
+/*
+ * Parse the conversion specification following a '%' character. Return
+ * a pointer past its end.
+ */
+
+static const char *parse_spec(const char *p, struct spec *s)
+{
+	enum { LEN_NONE, LEN_L, LEN_LL, LEN_Z, LEN_J, LEN_T, LEN_BIG_L } len;
+
+	s->start = p - 1;
+	s->nstars = 0;
+	len = LEN_NONE;
+
+	while (*p && strchr("-+ #0'I", *p))
+		p++;
+	if (*p == '*') {
+		s->nstars++;
+		p++;
+	}
+	while (*p >= '0' && *p <= '9')
+		p++;
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			s->nstars++;
+			p++;
+		}
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+
+	for (;; p++) {
+		if (*p == 'h')
+			continue;
+		if (*p == 'l')
+			len = (len == LEN_L) ? LEN_LL : LEN_L;
+		else if (*p == 'q')
+			len = LEN_LL;
+		else if (*p == 'z')
+			len = LEN_Z;
+		else if (*p == 'j')
+			len = LEN_J;
+		else if (*p == 't')
+			len = LEN_T;
+		else if (*p == 'L')
+			len = LEN_BIG_L;
+		else
+			break;
+	}
+
+	switch (*p) {
+	case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+		s->type = (len == LEN_L) ? ARG_LONG :
+			(len == LEN_LL || len == LEN_BIG_L) ? ARG_LLONG :
+			(len == LEN_Z) ? ARG_SIZE :
+			(len == LEN_J) ? ARG_INTMAX :
+			(len == LEN_T) ? ARG_PTRDIFF : ARG_INT;
+		break;
+	case 'c':
+		s->type = ARG_INT;
+		break;
+	case 'e': case 'E': case 'f': case 'F':
+	case 'g': case 'G': case 'a': case 'A':
+		s->type = (len == LEN_BIG_L) ? ARG_LDOUBLE : ARG_DOUBLE;
+		break;
+	case 's':
+		s->type = (len == LEN_NONE) ? ARG_STR : ARG_WSTR;
+		break;
+	case 'p':
+		s->type = ARG_PTR;
+		break;
+	case 'n':
+		s->type = ARG_COUNT;
+		break;
+	case 'm':
+		s->type = ARG_ERRNO;
+		break;
+	case '%':
+		s->type = ARG_NONE;
+		break;
+	default:
+		/* Unknown or truncated conversion: print it as text. */
+		s->type = ARG_NONE;
+		s->len = p - s->start;
+		return p;
+	}
+
+	p++;
+	s->len = p - s->start;
+
+	return p;
+}
+
+/*
+ * Copy the arguments described by fmt from ap into buf. Return the number
+ * of bytes used; arguments that do not fit are dropped.
+ */
+
+static size_t encode_args(char *buf, size_t cap, const char *fmt, va_list ap)
+{
+	size_t off = 0;
+	const char *p = fmt;
+	struct spec s;
+	int saved_errno = errno;
+
+	while ((p = strchr(p, '%')) != NULL) {
+		p = parse_spec(p + 1, &s);
+
+		for (int i = 0; i < s.nstars; i++) {
+			int v = va_arg(ap, int);
+
+			if (off + 8 > cap)
+				return off;
+			memcpy(buf + off, &v, sizeof(v));
+			off += 8;
+		}
+
+		switch (s.type) {
+		case ARG_NONE:
+			continue;
+		case ARG_ERRNO:
+			if (off + 8 > cap)
+				return off;
+			memcpy(buf + off, &saved_errno, sizeof(saved_errno));
+			off += 8;
+			continue;
+		case ARG_LDOUBLE: {
+			long double v = va_arg(ap, long double);
+
+			if (off + sizeof(v) > cap)
+				return off;
+			memcpy(buf + off, &v, sizeof(v));
+			off += ALIGN8(sizeof(v));
+			continue;
+		}
+		case ARG_STR: {
+			const char *str = va_arg(ap, const char *);
+			uint32_t n;
+
+			if (str == NULL)
+				str = "(null)";
+			n = strnlen(str, LOG_ASYNC_MAX_STR);
+			if (off + 8 > cap)
+				return off;
+			if (off + 8 + n > cap)
+				n = cap - off - 8;
+			memcpy(buf + off, &n, sizeof(n));
+			memcpy(buf + off + 8, str, n);
+			off += 8 + ALIGN8(n);
+			if (off > cap)
+				off = cap;
+			continue;
+		}
+		case ARG_WSTR: {
+			const wchar_t *str = va_arg(ap, const wchar_t *);
+			uint32_t n;
+
+			if (str == NULL)
+				str = L"(null)";
+			n = wcsnlen(str, LOG_ASYNC_MAX_STR);
+			if (off + 8 > cap)
+				return off;
+			if (off + 8 + n * sizeof(wchar_t) > cap)
+				n = (cap - off - 8) / sizeof(wchar_t);
+			memcpy(buf + off, &n, sizeof(n));
+			memcpy(buf + off + 8, str, n * sizeof(wchar_t));
+			off += 8 + ALIGN8(n * sizeof(wchar_t));
+			if (off > cap)
+				off = cap;
+			continue;
+		}
+		default:
+			break;
+		}
+
+		if (off + 8 > cap)
+			return off;
+
+		switch (s.type) {
+		case ARG_INT: {
+			int v = va_arg(ap, int);
+
+			memcpy(buf + off, &v, sizeof(v));
+			break;
+		}
+		case ARG_LONG: {
+			long v = va_arg(ap, long);
+
+			memcpy(buf + off, &v, sizeof(v));
+			break;
+		}
+		case ARG_LLONG: {
+			long long v = va_arg(ap, long long);
+
+			memcpy(buf + off, &v, sizeof(v));
+			break;
+		}
+		case ARG_SIZE: {
+			size_t v = va_arg(ap, size_t);
+
+			memcpy(buf + off, &v, sizeof(v));
+			break;
+		}
+		case ARG_INTMAX: {
+			intmax_t v = va_arg(ap, intmax_t);
+
+			memcpy(buf + off, &v, sizeof(v));
+			break;
+		}
+		case ARG_PTRDIFF: {
+			ptrdiff_t v = va_arg(ap, ptrdiff_t);
+
+			memcpy(buf + off, &v, sizeof(v));
+			break;
+		}
+		case ARG_DOUBLE: {
+			double v = va_arg(ap, double);
+
+			memcpy(buf + off, &v, sizeof(v));
+			break;
+		}
+		default: {	/* ARG_PTR, ARG_COUNT */
+			void *v = va_arg(ap, void *);
+
+			memcpy(buf + off, &v, sizeof(v));
+			break;
+		}
+		}
+		off += 8;
+	}
+
+	return off;
+}
+
+/*
+ * Format a message from fmt and the arguments saved by encode_args().
+ * Every conversion is printed separately with snprintf(3), with '*'
+ * widths and precisions replaced by their saved values. Return the
+ * number of bytes written to out (at most cap - 1).
+ */
+
+static size_t decode_args(char *out, size_t cap, const char *fmt,
+		const char *args, size_t args_len)
+{
+	size_t n = 0, off = 0;
+	const char *p = fmt, *q;
+	struct spec s;
+	char spec[LOG_ASYNC_MAX_SPEC];
+	size_t sl;
+	int rc;
+
+#define ROOM()		(n < cap ? cap - n : 0)
+#define ARG(type)	(*(const type *) (args + off))
+
+	while (*p && n + 1 < cap) {
+		q = strchr(p, '%');
+		if (q == NULL)
+			q = p + strlen(p);
+		if (q > p) {
+			size_t len = q - p;
+
+			if (len > cap - n - 1)
+				len = cap - n - 1;
+			memcpy(out + n, p, len);
+			n += len;
+		}
+		if (*q == '\0')
+			break;
+
+		p = parse_spec(q + 1, &s);
+
+		if (s.type == ARG_NONE) {
+			if (s.len == 2 && s.start[1] == '%')
+				out[n++] = '%';
+			continue;
+		}
+
+		/* Rebuild the spec, replacing '*' with the saved values. */
+		sl = 0;
+		for (size_t i = 0; i < s.len && sl + 12 < sizeof(spec); i++) {
+			if (s.start[i] != '*') {
+				spec[sl++] = s.start[i];
+				continue;
+			}
+			if (off + 8 > args_len)
+				goto truncated;
+			sl += sprintf(spec + sl, "%d", ARG(int));
+			off += 8;
+		}
+		spec[sl] = '\0';
+
+		if (s.type == ARG_LDOUBLE) {
+			long double v;
+
+			if (off + sizeof(v) > args_len)
+				goto truncated;
+			memcpy(&v, args + off, sizeof(v));
+			rc = snprintf(out + n, ROOM(), spec, v);
+			off += ALIGN8(sizeof(long double));
+			n += rc > 0 ? rc : 0;
+			continue;
+		}
+
+		if (off + 8 > args_len)
+			goto truncated;
+
+		switch (s.type) {
+		case ARG_INT:
+			rc = snprintf(out + n, ROOM(), spec, ARG(int));
+			break;
+		case ARG_LONG:
+			rc = snprintf(out + n, ROOM(), spec, ARG(long));
+			break;
+		case ARG_LLONG:
+			rc = snprintf(out + n, ROOM(), spec, ARG(long long));
+			break;
+		case ARG_SIZE:
+			rc = snprintf(out + n, ROOM(), spec, ARG(size_t));
+			break;
+		case ARG_INTMAX:
+			rc = snprintf(out + n, ROOM(), spec, ARG(intmax_t));
+			break;
+		case ARG_PTRDIFF:
+			rc = snprintf(out + n, ROOM(), spec, ARG(ptrdiff_t));
+			break;
+		case ARG_DOUBLE:
+			rc = snprintf(out + n, ROOM(), spec, ARG(double));
+			break;
+		case ARG_PTR:
+			rc = snprintf(out + n, ROOM(), spec, ARG(void *));
+			break;
+		case ARG_ERRNO: {
+			char ebuf[128];
+
+			/* Replace the 'm' conversion with 's'. */
+			spec[sl - 1] = 's';
+			rc = snprintf(out + n, ROOM(), spec,
+				strerror_r(ARG(int), ebuf, sizeof(ebuf)));
+			break;
+		}
+		case ARG_STR: {
+			uint32_t len = ARG(uint32_t);
+			char str[LOG_ASYNC_MAX_STR + 1];
+
+			if (off + 8 + len > args_len)
+				len = args_len - off - 8;
+			memcpy(str, args + off + 8, len);
+			str[len] = '\0';
+			rc = snprintf(out + n, ROOM(), spec, str);
+			off += ALIGN8(len);
+			break;
+		}
+		case ARG_WSTR: {
+			uint32_t len = ARG(uint32_t);
+			wchar_t str[LOG_ASYNC_MAX_STR + 1];
+
+			if (off + 8 + len * sizeof(wchar_t) > args_len)
+				len = (args_len - off - 8) / sizeof(wchar_t);
+			memcpy(str, args + off + 8, len * sizeof(wchar_t));
+			str[len] = L'\0';
+			rc = snprintf(out + n, ROOM(), spec, str);
+			off += ALIGN8(len * sizeof(wchar_t));
+			break;
+		}
+		default:	/* ARG_COUNT */
+			rc = 0;
+			break;
+		}
+		off += 8;
+		n += rc > 0 ? rc : 0;
+	}
+
+	if (n >= cap)
+		n = cap - 1;
+	return n;
+
+truncated:
+	if (n >= cap)
+		n = cap - 1;
+	n += snprintf(out + n, cap - n, "...");
+	if (n >= cap)
+		n = cap - 1;
+	return n;
+
+#undef ROOM
+#undef ARG
+}
+
+/*
+ * Writer side: batching and output.
+ */
+
+static void write_all(int fd, struct iovec *iov, int niov)
+{
+	while (niov > 0) {
+		ssize_t rc = writev(fd, iov, niov);
+
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+
+		/* Skip over the fully written vectors after a partial write. */
+		while (niov > 0 && (size_t) rc >= iov->iov_len) {
+			rc -= iov->iov_len;
+			iov++;
+			niov--;
+		}
+		if (niov > 0) {
+			iov->iov_base = (char *) iov->iov_base + rc;
+			iov->iov_len -= rc;
+		}
+	}
+}
+
+static void batch_flush(void)
+{
+	for (int i = 0; i < A.nsinks; i++)
+		write_all(A.sinks[i].fd, A.sinks[i].iov, A.sinks[i].niov);
+
+	A.nsinks = 0;
+	A.buf_len = 0;
+}
+
+static struct batch_sink *batch_sink_get(int fd)
+{
+	for (int i = 0; i < A.nsinks; i++)
+		if (A.sinks[i].fd == fd)
+			return &A.sinks[i];
+
+	if (A.nsinks == LOG_ASYNC_MAX_SINKS)
+		return NULL;
+
+	A.sinks[A.nsinks].fd = fd;
+	A.sinks[A.nsinks].niov = 0;
+
+	return &A.sinks[A.nsinks++];
+}
+
+static void update_time_cache(time_t sec)
+{
+	struct tm tm;
+
+	if (sec == A.cached_sec)
+		return;
+
+	localtime_r(&sec, &tm);
+	strftime(A.short_time, sizeof(A.short_time), "%H:%M:%S", &tm);
+	strftime(A.full_time, sizeof(A.full_time), "%Y-%m-%d %H:%M:%S", &tm);
+	A.cached_sec = sec;
+}
+
+/*
+ * Worst case space taken in the batch by one record: two headers and
+ * the message.
+ */
+
+#define RECORD_BATCH_SPACE	(2 * 256 + LOG_ASYNC_MAX_LINE)
+
+static void batch_add(const struct record *rec)
+{
+	log_Sink sinks[LOG_ASYNC_MAX_SINKS];
+	struct batch_sink *bs;
+	char *hdr[2] = { NULL, NULL };
+	size_t hdr_len[2] = { 0, 0 };
+	char *body;
+	size_t body_len;
+	int nsinks;
+	int i;
+
+	nsinks = log_get_sinks(rec->level, sinks, LOG_ASYNC_MAX_SINKS);
+	if (nsinks == 0)
+		return;
+
+	/* Make room for the record, its iovecs and its sinks. */
+	if (A.buf_len + RECORD_BATCH_SPACE > sizeof(A.buf))
+		batch_flush();
+	for (i = 0; i < nsinks; i++) {
+		bs = batch_sink_get(sinks[i].fd);
+		if (bs == NULL || bs->niov + 2 > LOG_ASYNC_BATCH_IOV) {
+			batch_flush();
+			break;
+		}
+	}
+
+	update_time_cache(rec->ts.tv_sec);
+
+	body = A.buf + A.buf_len;
+	body_len = decode_args(body, LOG_ASYNC_MAX_LINE, rec->fmt,
+			(const char *) (rec + 1), rec->size - sizeof(*rec));
+	body[body_len++] = '\n';
+	A.buf_len += body_len;
+
+	for (i = 0; i < nsinks; i++) {
+		int h = sinks[i].full_date;
+
+		if (hdr[h] == NULL) {
+			int rc;
+
+			hdr[h] = A.buf + A.buf_len;
+			rc = snprintf(hdr[h], 256, "%s %-5s %s:%d: ",
+				h ? A.full_time : A.short_time,
+				level_strings[rec->level], rec->file, rec->line);
+			hdr_len[h] = (rc < 0) ? 0 : (rc >= 256) ? 255 : rc;
+			A.buf_len += hdr_len[h];
+		}
+
+		bs = batch_sink_get(sinks[i].fd);
+		bs->iov[bs->niov].iov_base = hdr[h];
+		bs->iov[bs->niov++].iov_len = hdr_len[h];
+		bs->iov[bs->niov].iov_base = body;
+		bs->iov[bs->niov++].iov_len = body_len;
+	}
+}
+
+/*
+ * Consume all records currently available in a ring. Return the number of
+ * records consumed.
+ */
+
+static size_t drain_ring(struct ring *r)
+{
+	size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+	size_t count = 0;
+
+	while (tail != head) {
+		const struct record *rec;
+
+		rec = (const struct record *) (r->data + (tail & r->mask));
+		if (rec->level != LOG_ASYNC_PAD) {
+			batch_add(rec);
+			count++;
+		}
+		tail += rec->size;
+
+		/* Records are copied in the batch, so the slot can be reused. */
+		atomic_store_explicit(&r->tail, tail, memory_order_release);
+	}
+
+	return count;
+}
+
+static bool rings_pending(void)
+{
+	for (struct ring *r = A.rings; r != NULL; r = r->next)
+		if (atomic_load(&r->head) != atomic_load(&r->tail))
+			return true;
+
+	return false;
+}
+
+/*
+ * Drain every ring once. Free rings of exited threads once empty.
+ */
+
+static size_t drain_rings(void)
+{
+	struct ring **pr, *r;
+	size_t count = 0;
+
+	pthread_mutex_lock(&A.rings_lock);
+	pr = &A.rings;
+	while ((r = *pr) != NULL) {
+		count += drain_ring(r);
+
+		if (atomic_load(&r->orphan) &&
+				atomic_load(&r->head) == atomic_load(&r->tail)) {
+			*pr = r->next;
+			free(r->data);
+			free(r);
+			continue;
+		}
+		pr = &r->next;
+	}
+	pthread_mutex_unlock(&A.rings_lock);
+
+	return count;
+}
+
+static void writer_sleep(void)
+{
+	struct timespec deadline;
+	bool pending;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += LOG_ASYNC_IDLE_WAIT_NS;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&A.wake_lock);
+	atomic_store(&A.idle, true);
+	pthread_mutex_lock(&A.rings_lock);
+	pending = rings_pending();
+	pthread_mutex_unlock(&A.rings_lock);
+	if (!pending && !atomic_load(&A.stopping) &&
+			atomic_load(&A.flush_req) == atomic_load(&A.flush_done))
+		pthread_cond_timedwait(&A.wake_cond, &A.wake_lock, &deadline);
+	atomic_store(&A.idle, false);
+	pthread_mutex_unlock(&A.wake_lock);
+}
+
+static void *writer_thread(void *arg)
+{
+	(void) arg;
+
+	while (1) {
+		unsigned long req = atomic_load(&A.flush_req);
+		size_t count;
+
+		count = drain_rings();
+		batch_flush();
+		atomic_store(&A.flush_done, req);
+
+		if (count > 0)
+			continue;
+		if (atomic_load(&A.stopping))
+			break;
+		writer_sleep();
+	}
+
+	return NULL;
+}
+
+static void wake_writer(void)
+{
+	if (!atomic_load(&A.idle))
+		return;
+
+	pthread_mutex_lock(&A.wake_lock);
+	pthread_cond_signal(&A.wake_cond);
+	pthread_mutex_unlock(&A.wake_lock);
+}
+
+/*
+ * Producer side.
+ */
+
+static void ring_destructor(void *arg)
+{
+	struct ring *r = arg;
+
+	atomic_store(&r->orphan, true);
+}
+
+static void ring_key_create(void)
+{
+	pthread_key_create(&ring_key, ring_destructor);
+}
+
+static struct ring *ring_get(void)
+{
+	struct ring *r;
+
+	if (my_ring != NULL)
+		return my_ring;
+
+	r = calloc(1, sizeof(*r));
+	if (r == NULL)
+		return NULL;
+	r->data = aligned_alloc(64, A.ring_size);
+	if (r->data == NULL) {
+		free(r);
+		return NULL;
+	}
+	r->mask = A.ring_size - 1;
+
+	pthread_mutex_lock(&A.rings_lock);
+	r->next = A.rings;
+	A.rings = r;
+	pthread_mutex_unlock(&A.rings_lock);
+
+	pthread_setspecific(ring_key, r);
+	my_ring = r;
+
+	return r;
+}
+
+static void ring_push(struct ring *r, const struct record *rec)
+{
+	size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	size_t size = r->mask + 1;
+	size_t pos = head & r->mask;
+	size_t pad = (size - pos < rec->size) ? size - pos : 0;
+
+	/* Wait for the writer if the ring is full. */
+	while (size - (head - atomic_load_explicit(&r->tail,
+				memory_order_acquire)) < pad + rec->size) {
+		wake_writer();
+		sched_yield();
+	}
+
+	if (pad > 0) {
+		struct record *filler = (struct record *) (r->data + pos);
+
+		filler->size = pad;
+		filler->level = LOG_ASYNC_PAD;
+		pos = 0;
+	}
+	memcpy(r->data + pos, rec, rec->size);
+
+	atomic_store_explicit(&r->head, head + pad + rec->size,
+			memory_order_release);
+
+	/* Pairs with the idle flag store in writer_sleep(). */
+	atomic_thread_fence(memory_order_seq_cst);
+	wake_writer();
+}
+
+static void async_backend(log_Event *ev)
+{
+	alignas(8) char buf[LOG_ASYNC_MAX_RECORD];
+	struct record *rec = (struct record *) buf;
+	struct ring *r;
+	size_t args_len;
+
+	if (log_get_sinks(ev->level, NULL, 0) == 0)
+		return;
+
+	r = ring_get();
+	if (r == NULL)
+		return;
+
+	clock_gettime(CLOCK_REALTIME_COARSE, &rec->ts);
+	rec->level = ev->level;
+	rec->line = ev->line;
+	rec->file = ev->file;
+	rec->fmt = ev->fmt;
+	args_len = encode_args(buf + sizeof(*rec), sizeof(buf) - sizeof(*rec),
+			ev->fmt, ev->ap);
+	rec->size = ALIGN8(sizeof(*rec) + args_len);
+
+	ring_push(r, rec);
+
+	/* Don't lose the last message before the process dies. */
+	if (ev->level == LOG_FATAL)
+		log_async_flush();
+}
+
+/*
+ * Start the writer thread and route all messages through it. ring_size is
+ * the size of the buffer allocated for every logging thread, rounded up to
+ * a power of two; 0 selects the default. Pending messages are flushed at
+ * exit(3).
+ */
+
+int log_async_start(size_t ring_size)
+{
+	static bool atexit_done;
+	size_t size = LOG_ASYNC_MAX_RECORD * 4;
+
+	if (A.running)
+		return 0;
+
+	if (ring_size == 0)
+		ring_size = LOG_ASYNC_DEFAULT_RING;
+	while (size < ring_size)
+		size <<= 1;
+	if (A.rings == NULL)
+		A.ring_size = size;
+
+	pthread_once(&ring_key_once, ring_key_create);
+
+	atomic_store(&A.stopping, false);
+	if (pthread_create(&A.writer, NULL, writer_thread, NULL) != 0)
+		return -1;
+	A.running = true;
+
+	if (!atexit_done) {
+		atexit(log_async_stop);
+		atexit_done = true;
+	}
+
+	log_set_backend(async_backend);
+
+	return 0;
+}
+
+/*
+ * Wait until all messages logged so far, by any thread, are written.
+ */
+
+void log_async_flush(void)
+{
+	unsigned long req;
+
+	if (!A.running)
+		return;
+
+	req = atomic_fetch_add(&A.flush_req, 1) + 1;
+	while (atomic_load(&A.flush_done) < req) {
+		wake_writer();
+		sched_yield();
+	}
+}
+
+/*
+ * Write pending messages, stop the writer thread and return to synchronous
+ * logging.
+ */
+
+void log_async_stop(void)
+{
+	if (!A.running)
+		return;
+
+	log_set_backend(NULL);
+	log_async_flush();
+
+	atomic_store(&A.stopping, true);
+	pthread_mutex_lock(&A.wake_lock);
+	pthread_cond_signal(&A.wake_cond);
+	pthread_mutex_unlock(&A.wake_lock);
+	pthread_join(A.writer, NULL);
+
+	A.running = false;
+}
@@ -0,0 +1,439 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "utils/metrics/metrics.h"
+
+#define HIST_SUB_BITS		4
+#define HIST_SUB_BUCKETS	(1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS		40	/* values up to 2^40 ns */
+#define HIST_BUCKETS		((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+#define CACHE_LINE		64
+
+/* wait after accept() fails, e.g. out of file descriptors */
+#define ACCEPT_BACKOFF_US	100000
+
+struct metrics_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[HIST_BUCKETS];
+};
+
+struct metrics_slot {
+	int owned;			/* by a live thread */
+	uint64_t counters[METRICS_COUNTERS];
+	struct metrics_hist hist[METRICS_PHASES];
+} __attribute__((aligned(CACHE_LINE)));
+
+struct metrics {
+	size_t map_size;
+	unsigned int nslots;
+	unsigned int used;		/* slots that were ever taken */
+	struct metrics_slot slots[];
+};
+
+static const char * const counter_names[METRICS_COUNTERS] = {
+	[METRICS_ACCEPTED] = "accepted",
+	[METRICS_CLOSED] = "closed",
+	[METRICS_REQUESTS] = "requests",
+	[METRICS_BYTES_IN] = "bytes_in",
+	[METRICS_BYTES_OUT] = "bytes_out",
+	[METRICS_ERRORS] = "errors",
+};
+
+static const char * const phase_names[METRICS_PHASES] = {
+	[METRICS_ACCEPT] = "accept",
+	[METRICS_QUEUE] = "queue",
+	[METRICS_READ] = "read",
+	[METRICS_COMPUTE] = "compute",
+	[METRICS_SEND] = "send",
+	[METRICS_CONNECTION] = "connection",
+};
+
+/* slot of the current thread, for the metrics it was taken from */
+static __thread struct metrics *thread_metrics;
+static __thread struct metrics_slot *thread_slot;
+
+/* gives back the slot when its thread exits */
+static pthread_key_t slot_key;
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+
+static void slot_release(void *arg)
+{
+	struct metrics_slot *slot = arg;
+
+	__atomic_store_n(&slot->owned, 0, __ATOMIC_RELEASE);
+}
+
+/* A forked child has its own threads: it must not share their slots. */
+static void slot_forget(void)
+{
+	thread_metrics = NULL;
+	thread_slot = NULL;
+}
+
+static void slot_key_create(void)
+{
+	pthread_key_create(&slot_key, slot_release);
+	pthread_atfork(NULL, NULL, slot_forget);
+}
+
+struct metrics *metrics_create(unsigned int max_slots)
+{
+	struct metrics *m;
+	size_t size;
+
+	if (max_slots == 0)
+		return NULL;
+
+	pthread_once(&slot_key_once, slot_key_create);
+
+	/* Slots are only touched (and get memory) when they are used. */
+	size = sizeof(*m) + max_slots * sizeof(struct metrics_slot);
+	m = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (m == MAP_FAILED)
+		return NULL;
+
+	m->map_size = size;
+	m->nslots = max_slots;
+
+	return m;
+}
+
+void metrics_destroy(struct metrics *m)
+{
+	if (m != NULL)
+		munmap(m, m->map_size);
+}
+
+/*
+ * Take a free slot for the current thread. Slots keep their values when
+ * given back: the next owner adds to them. If all slots are taken, the
+ * last one is shared, which atomic adds allow.
+ */
+
+static struct metrics_slot *slot_get(struct metrics *m)
+{
+	struct metrics_slot *slot;
+	unsigned int i, used;
+	int expected;
+
+	if (thread_metrics == m)
+		return thread_slot;
+
+	i = m->nslots - 1;
+	slot = &m->slots[i];
+	for (unsigned int j = 0; j < m->nslots - 1; j++) {
+		expected = 0;
+		if (__atomic_compare_exchange_n(&m->slots[j].owned, &expected,
+				1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			i = j;
+			slot = &m->slots[i];
+			pthread_setspecific(slot_key, slot);
+			break;
+		}
+	}
+
+	/* Readers only look at (and fault in) the slots in use. */
+	used = __atomic_load_n(&m->used, __ATOMIC_RELAXED);
+	while (used < i + 1 && !__atomic_compare_exchange_n(&m->used, &used,
+			i + 1, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+
+	thread_metrics = m;
+	thread_slot = slot;
+
+	return slot;
+}
+
+void metrics_count(struct metrics *m, enum metrics_counter counter,
+		uint64_t n)
+{
+	if (m == NULL)
+		return;
+
+	__atomic_fetch_add(&slot_get(m)->counters[counter], n,
+		__ATOMIC_RELAXED);
+}
+
+static unsigned int hist_index(uint64_t value)
+{
+	unsigned int msb;
+
+	if (value < HIST_SUB_BUCKETS)
+		return value;
+
+	if (value >= (1ULL << HIST_MAX_BITS))
+		value = (1ULL << HIST_MAX_BITS) - 1;
+
+	msb = 63 - __builtin_clzll(value);
+
+	return (msb - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS +
+		(value >> (msb - HIST_SUB_BITS)) - HIST_SUB_BUCKETS;
+}
+
+/* smallest value counted in bucket index */
+static uint64_t hist_value(unsigned int index)
+{
+	unsigned int group = index / HIST_SUB_BUCKETS;
+	unsigned int sub = index % HIST_SUB_BUCKETS;
+
+	if (group == 0)
+		return sub;
+
+	return (uint64_t) (HIST_SUB_BUCKETS + sub) << (group - 1);
+}
+
+void metrics_record(struct metrics *m, enum metrics_phase phase,
+		uint64_t ns)
+{
+	struct metrics_hist *hist;
+	uint64_t max;
+
+	if (m == NULL)
+		return;
+
+	hist = &slot_get(m)->hist[phase];
+	__atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&hist->sum, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&hist->buckets[hist_index(ns)], 1,
+		__ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+	while (ns > max && !__atomic_compare_exchange_n(&hist->max, &max, ns,
+			true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/*
+ * Merge the histograms of a phase from all slots. Slots are updated while
+ * they are read: the result is consistent within an update or so.
+ */
+
+static void hist_merge(struct metrics *m, enum metrics_phase phase,
+		struct metrics_hist *out)
+{
+	unsigned int used = __atomic_load_n(&m->used, __ATOMIC_ACQUIRE);
+	struct metrics_hist *hist;
+	uint64_t count, max;
+
+	memset(out, 0, sizeof(*out));
+	for (unsigned int i = 0; i < used; i++) {
+		hist = &m->slots[i].hist[phase];
+		count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+		if (count == 0)
+			continue;
+		out->count += count;
+		out->sum += __atomic_load_n(&hist->sum, __ATOMIC_RELAXED);
+		max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+		if (max > out->max)
+			out->max = max;
+		for (unsigned int b = 0; b < HIST_BUCKETS; b++)
+			out->buckets[b] += __atomic_load_n(&hist->buckets[b],
+				__ATOMIC_RELAXED);
+	}
+}
+
+/* Value at quantile q: the middle of its bucket, at most the maximum. */
+static uint64_t hist_quantile(const struct metrics_hist *hist, double q)
+{
+	uint64_t total = 0, rank, low, high;
+
+	for (unsigned int b = 0; b < HIST_BUCKETS; b++)
+		total += hist->buckets[b];
+	if (total == 0)
+		return 0;
+
+	rank = (uint64_t) (q * total);
+	if (rank >= total)
+		rank = total - 1;
+
+	for (unsigned int b = 0; b < HIST_BUCKETS; b++) {
+		if (rank < hist->buckets[b]) {
+			low = hist_value(b);
+			high = b + 1 < HIST_BUCKETS ? hist_value(b + 1) : low + 1;
+			low += (high - low - 1) / 2;
+			return low < hist->max ? low : hist->max;
+		}
+		rank -= hist->buckets[b];
+	}
+
+	return hist->max;
+}
+
+size_t metrics_format(struct metrics *m, char *buf, size_t size)
+{
+	static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	unsigned int used = __atomic_load_n(&m->used, __ATOMIC_ACQUIRE);
+	struct metrics_hist *hist;
+	uint64_t value;
+	size_t len = 0;
+
+#define APPEND(...) \
+	len += snprintf(buf + (len < size ? len : size), \
+		len < size ? size - len : 0, __VA_ARGS__)
+
+	for (int c = 0; c < METRICS_COUNTERS; c++) {
+		value = 0;
+		for (unsigned int i = 0; i < used; i++)
+			value += __atomic_load_n(&m->slots[i].counters[c],
+				__ATOMIC_RELAXED);
+		APPEND("%-12s %llu\n", counter_names[c],
+			(unsigned long long) value);
+	}
+
+	hist = malloc(sizeof(*hist));
+	if (hist == NULL)
+		return len;
+
+	APPEND("\n%-12s %10s %10s %10s %10s %10s %10s %10s\n", "phase",
+		"count", "mean_us", "p50_us", "p90_us", "p99_us", "p99.9_us",
+		"max_us");
+	for (int p = 0; p < METRICS_PHASES; p++) {
+		hist_merge(m, p, hist);
+		if (hist->count == 0)
+			continue;
+
+		APPEND("%-12s %10llu %10.1f", phase_names[p],
+			(unsigned long long) hist->count,
+			hist->sum / 1e3 / hist->count);
+		for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+			APPEND(" %10.1f", hist_quantile(hist, quantiles[q]) / 1e3);
+		APPEND(" %10.1f\n", hist->max / 1e3);
+	}
+
+#undef APPEND
+
+	free(hist);
+
+	return len;
+}
+
+struct metrics_server {
+	struct metrics *m;
+	int listenfd;
+};
+
+static void send_all(int sockfd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(sockfd, buf, len, MSG_NOSIGNAL);
+		if (n <= 0)
+			return;
+		buf += n;
+		len -= n;
+	}
+}
+
+/*
+ * Answer every connection with the metrics, as a minimal HTTP response, so
+ * both curl and nc can read them.
+ */
+
+static void *serve_thread(void *arg)
+{
+	struct metrics_server *server = arg;
+	struct timeval timeout = { .tv_sec = 0, .tv_usec = 100000 };
+	char request[1024], header[128];
+	size_t size = 16384, len;
+	char *text;
+	int sockfd;
+
+	text = malloc(size);
+	if (text == NULL)
+		return NULL;
+
+	while (1) {
+		sockfd = accept(server->listenfd, NULL, NULL);
+		if (sockfd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			/*
+			 * EMFILE, ENFILE, ENOBUFS: the server is overloaded,
+			 * retrying right away would only add to it.
+			 */
+			perror("metrics: accept");
+			usleep(ACCEPT_BACKOFF_US);
+			continue;
+		}
+
+		/* Read the request (if any), so closing doesn't reset it. */
+		setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+			sizeof(timeout));
+		recv(sockfd, request, sizeof(request), 0);
+
+		len = metrics_format(server->m, text, size);
+		if (len >= size)
+			len = size - 1;
+		snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain\r\n"
+			"Content-Length: %zu\r\n\r\n", len);
+		send_all(sockfd, header, strlen(header));
+		send_all(sockfd, text, len);
+		close(sockfd);
+	}
+
+	return NULL;
+}
+
+int metrics_serve(struct metrics *m, unsigned short port)
+{
+	struct metrics_server *server;
+	struct sockaddr_in addr;
+	pthread_attr_t attr;
+	pthread_t tid;
+	int one = 1;
+	int rc;
+
+	server = malloc(sizeof(*server));
+	if (server == NULL)
+		return -1;
+	server->m = m;
+
+	server->listenfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (server->listenfd < 0)
+		goto free_server;
+
+	setsockopt(server->listenfd, SOL_SOCKET, SO_REUSEADDR, &one,
+		sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(server->listenfd, (struct sockaddr *) &addr,
+			sizeof(addr)) < 0)
+		goto close_listener;
+	if (listen(server->listenfd, 16) < 0)
+		goto close_listener;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	rc = pthread_create(&tid, &attr, serve_thread, server);
+	pthread_attr_destroy(&attr);
+	if (rc != 0)
+		goto close_listener;
+
+	return 0;
+
+close_listener:
+	close(server->listenfd);
+free_server:
+	free(server);
+	return -1;
+}
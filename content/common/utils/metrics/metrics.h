@@ -0,0 +1,96 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Server metrics: counters and latency histograms
+ *
+ * Each thread (or process) updates its own slot, on its own cache lines,
+ * with relaxed atomic adds: there are no locks and no shared writes on the
+ * fast path. Readers merge all slots. Slots live in a shared anonymous
+ * mapping, so worker processes forked after metrics_create() report to the
+ * same metrics.
+ *
+ * Histograms are log-linear (HDR style): 16 buckets per power of two, i.e.
+ * values are known within 6.25%, from 1 ns to about 18 minutes.
+ *
+ * Metrics can be read as text on a TCP port, served by a thread started by
+ * metrics_serve():
+ *
+ *	curl -s localhost:9100
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_	1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum metrics_counter {
+	METRICS_ACCEPTED,		/* connections */
+	METRICS_CLOSED,
+	METRICS_REQUESTS,
+	METRICS_BYTES_IN,
+	METRICS_BYTES_OUT,
+	METRICS_ERRORS,
+	METRICS_COUNTERS
+};
+
+enum metrics_phase {
+	METRICS_ACCEPT,			/* from accept() to handing it over */
+	METRICS_QUEUE,			/* waiting for a worker */
+	METRICS_READ,
+	METRICS_COMPUTE,
+	METRICS_SEND,
+	METRICS_CONNECTION,		/* from accept() to close() */
+	METRICS_PHASES
+};
+
+struct metrics;
+
+struct metrics *metrics_create(unsigned int max_slots);
+void metrics_destroy(struct metrics *m);
+
+/* Updates do nothing if m is NULL: servers may run without metrics. */
+void metrics_count(struct metrics *m, enum metrics_counter counter,
+		uint64_t n);
+void metrics_record(struct metrics *m, enum metrics_phase phase,
+		uint64_t ns);
+
+/* Format all metrics as text; return the length, as snprintf(). */
+size_t metrics_format(struct metrics *m, char *buf, size_t size);
+
+/* Serve the metrics text to every connection on port, from a new thread. */
+int metrics_serve(struct metrics *m, unsigned short port);
+
+static inline uint64_t metrics_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Start time of a phase; the clock is not read without metrics. */
+static inline uint64_t metrics_start(struct metrics *m)
+{
+	return m != NULL ? metrics_now_ns() : 0;
+}
+
+/* Record the time elapsed since start, in ns. */
+static inline void metrics_record_since(struct metrics *m,
+		enum metrics_phase phase, uint64_t start)
+{
+	if (m != NULL)
+		metrics_record(m, phase, metrics_now_ns() - start);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* METRICS_H_ */
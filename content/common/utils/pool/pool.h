@@ -0,0 +1,92 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Pool of fixed size objects
+ *
+ * Objects are carved out of large anonymous mappings (slabs) and recycled
+ * through a free list; slabs are never returned to the system. An object's
+ * memory is only touched when it is first handed out, so untouched parts of
+ * a slab cost no physical memory.
+ *
+ * The pool is not thread safe: use one per thread.
+ */
+
+#ifndef POOL_H_
+#define POOL_H_	1
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct pool {
+	size_t obj_size;
+	size_t slab_size;	/* bytes mapped at a time */
+	void *free_list;	/* each free object points to the next one */
+	char *slab_next;	/* never used objects in the current slab */
+	char *slab_end;
+	size_t in_use;
+	size_t capacity;	/* objects carved out so far */
+};
+
+static inline void pool_init(struct pool *pool, size_t obj_size,
+		size_t objs_per_slab)
+{
+	/* Free objects hold the free list link; keep them aligned for it. */
+	if (obj_size < sizeof(void *))
+		obj_size = sizeof(void *);
+	obj_size = (obj_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+	pool->obj_size = obj_size;
+	pool->slab_size = obj_size * objs_per_slab;
+	pool->free_list = NULL;
+	pool->slab_next = NULL;
+	pool->slab_end = NULL;
+	pool->in_use = 0;
+	pool->capacity = 0;
+}
+
+/*
+ * Get an object from the pool. Its contents are undefined. Return NULL if
+ * memory is exhausted.
+ */
+
+static inline void *pool_get(struct pool *pool)
+{
+	void *obj = pool->free_list;
+
+	if (obj != NULL) {
+		pool->free_list = *(void **) obj;
+	} else {
+		if (pool->slab_next == pool->slab_end) {
+			obj = mmap(NULL, pool->slab_size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (obj == MAP_FAILED)
+				return NULL;
+			pool->slab_next = (char *) obj;
+			pool->slab_end = (char *) obj + pool->slab_size;
+		}
+		obj = pool->slab_next;
+		pool->slab_next += pool->obj_size;
+		pool->capacity++;
+	}
+
+	pool->in_use++;
+
+	return obj;
+}
+
+static inline void pool_put(struct pool *pool, void *obj)
+{
+	*(void **) obj = pool->free_list;
+	pool->free_list = obj;
+	pool->in_use--;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* POOL_H_ */
@@ -17,11 +17,80 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include "utils/utils.h"
 #include "utils/log/log.h"
 #include "utils/sock/sock_util.h"
 
+/*
+ * Names resolved recently, shared by all threads: resolving a name may take
+ * a round trip to a DNS server.
+ */
+
+static struct resolve_entry {
+	char name[256];
+	struct in_addr addr;
+	time_t expires;
+} resolve_cache[TCP_RESOLVE_CACHE_SIZE];
+static unsigned int resolve_next;
+static pthread_mutex_t resolve_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Fill addr with the IPv4 address of name (DNS name or dotted decimal
+ * string) and port. Thread safe.
+ */
+
+int tcp_resolve(const char *name, unsigned short port,
+		struct sockaddr_in *addr)
+{
+	struct addrinfo hints, *res;
+	struct resolve_entry *e;
+	time_t now = time(NULL);
+	int rc;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons(port);
+
+	if (inet_pton(AF_INET, name, &addr->sin_addr) == 1)
+		return 0;
+
+	pthread_mutex_lock(&resolve_lock);
+	for (unsigned int i = 0; i < TCP_RESOLVE_CACHE_SIZE; i++) {
+		e = &resolve_cache[i];
+		if (e->expires > now && strcmp(e->name, name) == 0) {
+			addr->sin_addr = e->addr;
+			pthread_mutex_unlock(&resolve_lock);
+			return 0;
+		}
+	}
+	pthread_mutex_unlock(&resolve_lock);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	rc = getaddrinfo(name, NULL, &hints, &res);
+	if (rc != 0) {
+		log_error("getaddrinfo %s: %s", name, gai_strerror(rc));
+		errno = EHOSTUNREACH;
+		return -1;
+	}
+	addr->sin_addr = ((struct sockaddr_in *) res->ai_addr)->sin_addr;
+	freeaddrinfo(res);
+
+	if (strlen(name) < sizeof(e->name)) {
+		pthread_mutex_lock(&resolve_lock);
+		e = &resolve_cache[resolve_next++ % TCP_RESOLVE_CACHE_SIZE];
+		strcpy(e->name, name);
+		e->addr = addr->sin_addr;
+		e->expires = now + TCP_RESOLVE_TTL;
+		pthread_mutex_unlock(&resolve_lock);
+	}
+
+	return 0;
+}
+
 /*
  * Connect to a TCP server identified by name (DNS name or dotted decimal
  * string) and port.
@@ -29,29 +98,158 @@
 
 int tcp_connect_to_server(const char *name, unsigned short port)
 {
-	struct hostent *hent;
 	struct sockaddr_in server_addr;
 	int s;
 	int rc;
 
-	hent = gethostbyname(name);
-	DIE(hent == NULL, "gethostbyname");
+	rc = tcp_resolve(name, port, &server_addr);
+	DIE(rc < 0, "tcp_resolve");
 
 	s = socket(PF_INET, SOCK_STREAM, 0);
 	DIE(s < 0, "socket");
 
-	memset(&server_addr, 0, sizeof(server_addr));
-	server_addr.sin_family = AF_INET;
-	server_addr.sin_port = htons(port);
-	memcpy(&server_addr.sin_addr.s_addr, hent->h_addr,
-			sizeof(server_addr.sin_addr.s_addr));
-
 	rc = connect(s, (struct sockaddr *) &server_addr, sizeof(server_addr));
 	DIE(rc < 0, "connect");
 
 	return s;
 }
 
+/*
+ * Start connecting a non-blocking socket to addr. If the connection is not
+ * established yet, in_progress is set: wait for the socket to be writable
+ * (e.g. EPOLLOUT), then get the result with tcp_connect_result().
+ */
+
+int tcp_connect_nonblock(const struct sockaddr_in *addr, bool *in_progress)
+{
+	int sockfd;
+
+	sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sockfd < 0)
+		return -1;
+
+	*in_progress = false;
+	if (connect(sockfd, (const SSA *) addr, sizeof(*addr)) < 0) {
+		if (errno != EINPROGRESS) {
+			close(sockfd);
+			return -1;
+		}
+		*in_progress = true;
+	}
+
+	return sockfd;
+}
+
+/*
+ * Return 0 if the connection started by tcp_connect_nonblock() succeeded,
+ * -1 with errno set to the reason if it failed.
+ */
+
+int tcp_connect_result(int sockfd)
+{
+	socklen_t len = sizeof(int);
+	int err;
+
+	if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+		return -1;
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+int tcp_pool_init(struct tcp_pool *pool, const char *name,
+		unsigned short port, unsigned int max_idle)
+{
+	if (tcp_resolve(name, port, &pool->addr) < 0)
+		return -1;
+
+	pool->idle = calloc(max_idle, sizeof(*pool->idle));
+	if (pool->idle == NULL && max_idle > 0)
+		return -1;
+
+	pool->num_idle = 0;
+	pool->max_idle = max_idle;
+	pool->connects = 0;
+	pool->reuses = 0;
+
+	return 0;
+}
+
+void tcp_pool_destroy(struct tcp_pool *pool)
+{
+	while (pool->num_idle > 0)
+		close(pool->idle[--pool->num_idle].sockfd);
+	free(pool->idle);
+	pool->idle = NULL;
+}
+
+static long elapsed_ms(const struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+	return (now.tv_sec - since->tv_sec) * 1000 +
+		(now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+/*
+ * Return a non-blocking connection to the pool server: the most recently
+ * used idle one, or a new one (see tcp_connect_nonblock() for in_progress).
+ * Connections idle for a while are checked first: the server may have
+ * closed them.
+ */
+
+int tcp_pool_get(struct tcp_pool *pool, bool *in_progress)
+{
+	struct tcp_pool_entry *e;
+	char c;
+	int sockfd;
+
+	while (pool->num_idle > 0) {
+		e = &pool->idle[--pool->num_idle];
+		if (elapsed_ms(&e->idle_since) >= TCP_POOL_CHECK_IDLE &&
+				(recv(e->sockfd, &c, 1, MSG_PEEK | MSG_DONTWAIT) >= 0 ||
+				(errno != EAGAIN && errno != EWOULDBLOCK))) {
+			/* closed, failed, or unexpected data */
+			close(e->sockfd);
+			continue;
+		}
+
+		pool->reuses++;
+		*in_progress = false;
+		return e->sockfd;
+	}
+
+	sockfd = tcp_connect_nonblock(&pool->addr, in_progress);
+	if (sockfd >= 0)
+		pool->connects++;
+
+	return sockfd;
+}
+
+/*
+ * Give back a connection after a complete exchange, to be reused. It is
+ * closed if the pool is full.
+ */
+
+void tcp_pool_put(struct tcp_pool *pool, int sockfd)
+{
+	struct tcp_pool_entry *e;
+
+	if (pool->num_idle == pool->max_idle) {
+		close(sockfd);
+		return;
+	}
+
+	e = &pool->idle[pool->num_idle++];
+	e->sockfd = sockfd;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &e->idle_since);
+}
+
 int tcp_close_connection(int sockfd)
 {
 	int rc;
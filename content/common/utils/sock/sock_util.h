@@ -11,7 +11,9 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
 #include <stdio.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 
@@ -22,11 +24,46 @@ extern "C" {
 #define SSA			struct sockaddr
 
 
+/* resolved names are kept for this long (seconds) */
+#define TCP_RESOLVE_TTL			60
+#define TCP_RESOLVE_CACHE_SIZE		16
+
+/* idle pooled connections are checked before reuse after this long (ms) */
+#define TCP_POOL_CHECK_IDLE		1000
+
+/*
+ * Client connections to a server, kept open for reuse (keep-alive). A pool
+ * belongs to one thread.
+ */
+struct tcp_pool {
+	struct sockaddr_in addr;
+	struct tcp_pool_entry {
+		int sockfd;
+		struct timespec idle_since;
+	} *idle;
+	unsigned int num_idle;
+	unsigned int max_idle;
+	unsigned long connects;		/* new connections */
+	unsigned long reuses;
+};
+
 int tcp_connect_to_server(const char *name, unsigned short port);
 int tcp_close_connection(int s);
 int tcp_create_listener(unsigned short port, int backlog);
 int get_peer_address(int sockfd, char *buf, size_t len);
 
+/* These don't exit on errors: they return -1 and set errno. */
+int tcp_resolve(const char *name, unsigned short port,
+		struct sockaddr_in *addr);
+int tcp_connect_nonblock(const struct sockaddr_in *addr, bool *in_progress);
+int tcp_connect_result(int sockfd);
+
+int tcp_pool_init(struct tcp_pool *pool, const char *name,
+		unsigned short port, unsigned int max_idle);
+void tcp_pool_destroy(struct tcp_pool *pool);
+int tcp_pool_get(struct tcp_pool *pool, bool *in_progress);
+void tcp_pool_put(struct tcp_pool *pool, int sockfd);
+
 #ifdef __cplusplus
 }
 #endif
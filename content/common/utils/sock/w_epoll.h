@@ -105,6 +105,21 @@ static inline int w_epoll_add_ptr_in(int epollfd, int fd, void *ptr)
 	return epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev);
 }
 
+/*
+ * Add fd for input events, waking up a single one of the epoll instances
+ * it is registered with (e.g. a listening socket shared by several
+ * event loops).
+ */
+static inline int w_epoll_add_ptr_in_exclusive(int epollfd, int fd, void *ptr)
+{
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+	ev.data.ptr = ptr;
+
+	return epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
 static inline int w_epoll_add_ptr_out(int epollfd, int fd, void *ptr)
 {
 	struct epoll_event ev;
@@ -155,6 +170,51 @@ static inline int w_epoll_update_ptr_inout(int epollfd, int fd, void *ptr)
 	return epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev);
 }
 
+/*
+ * Stop watching fd for input and output (errors and hang ups are still
+ * reported) without removing it from the epoll instance.
+ */
+static inline int w_epoll_update_ptr_none(int epollfd, int fd, void *ptr)
+{
+	struct epoll_event ev;
+
+	ev.events = 0;
+	ev.data.ptr = ptr;
+
+	return epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+/*
+ * Watch fd for a single event among events: fd is then disabled until it
+ * is rearmed, and may be handed over to another owner (ptr) meanwhile.
+ */
+static inline int w_epoll_add_ptr_oneshot(int epollfd, int fd, void *ptr,
+		unsigned int events)
+{
+	struct epoll_event ev;
+
+	ev.events = events | EPOLLONESHOT;
+	ev.data.ptr = ptr;
+
+	return epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/*
+ * Watch a oneshot fd again, on behalf of ptr. This is one epoll_ctl()
+ * (EPOLL_CTL_MOD) per rearm: it only saves the EPOLL_CTL_DEL and
+ * EPOLL_CTL_ADD of removing fd while it is idle and adding it back.
+ */
+static inline int w_epoll_rearm_ptr(int epollfd, int fd, void *ptr,
+		unsigned int events)
+{
+	struct epoll_event ev;
+
+	ev.events = events | EPOLLONESHOT;
+	ev.data.ptr = ptr;
+
+	return epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
 static inline int w_epoll_remove_ptr(int epollfd, int fd, void *ptr)
 {
 	struct epoll_event ev;
@@ -174,6 +234,13 @@ static inline int w_epoll_wait_infinite(int epollfd, struct epoll_event *rev)
 {
 	return epoll_wait(epollfd, rev, 1, EPOLL_TIMEOUT_INFINITE);
 }
+
+static inline int w_epoll_wait(int epollfd, struct epoll_event *rev,
+		int maxevents, int timeout)
+{
+	return epoll_wait(epollfd, rev, maxevents, timeout);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,88 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Per-thread result slots
+ *
+ * Workers that each write their own result into an array of longs still
+ * share cache lines: every write invalidates the line in the caches of the
+ * other CPUs (false sharing). Here every slot sits in its own cache line.
+ *
+ * The slots are mapped with mmap(), so they can also be shared with child
+ * processes (THREAD_SLOTS_SHARED). THREAD_SLOTS_PACKED lays them out next to
+ * each other instead, to measure the cost of false sharing.
+ */
+
+#ifndef THREAD_SLOTS_H_
+#define THREAD_SLOTS_H_	1
+
+#include <stdalign.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CACHE_LINE_SIZE		64
+
+#define THREAD_SLOTS_SHARED	(1 << 0)	/* visible to forked children */
+#define THREAD_SLOTS_PACKED	(1 << 1)	/* no padding, for comparison */
+
+struct thread_slot {
+	alignas(CACHE_LINE_SIZE) long value;
+};
+
+struct thread_slots {
+	char *base;
+	size_t count;
+	size_t stride;		/* bytes from one slot to the next */
+	size_t map_size;
+};
+
+/* Return 0 on success, -1 with errno set if the mapping fails. */
+static inline int thread_slots_init(struct thread_slots *slots, size_t count,
+		int flags)
+{
+	void *p;
+
+	slots->count = count;
+	slots->stride = (flags & THREAD_SLOTS_PACKED) ? sizeof(long) :
+		sizeof(struct thread_slot);
+	slots->map_size = count * slots->stride;
+
+	/* Zero filled, and page aligned hence cache line aligned. */
+	p = mmap(NULL, slots->map_size, PROT_READ | PROT_WRITE,
+		((flags & THREAD_SLOTS_SHARED) ? MAP_SHARED : MAP_PRIVATE) |
+		MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return -1;
+	slots->base = p;
+
+	return 0;
+}
+
+static inline void thread_slots_destroy(struct thread_slots *slots)
+{
+	munmap(slots->base, slots->map_size);
+}
+
+static inline long *thread_slot(const struct thread_slots *slots, size_t i)
+{
+	return (long *)(slots->base + i * slots->stride);
+}
+
+static inline long thread_slots_sum(const struct thread_slots *slots)
+{
+	long sum = 0;
+
+	for (size_t i = 0; i < slots->count; i++)
+		sum += *thread_slot(slots, i);
+
+	return sum;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,223 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <time.h>
+
+#include "utils/timer/timer_wheel.h"
+
+#define TIMER_WHEEL_MASK	(TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_MAX_TICKS	((1ULL << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) - 1)
+
+static void list_init(struct timer *head)
+{
+	head->next = head;
+	head->prev = head;
+}
+
+static bool list_empty(const struct timer *head)
+{
+	return head->next == head;
+}
+
+static void list_add(struct timer *head, struct timer *timer)
+{
+	timer->next = head->next;
+	timer->prev = head;
+	head->next->prev = timer;
+	head->next = timer;
+}
+
+static void list_unlink(struct timer *timer)
+{
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = NULL;
+	timer->prev = NULL;
+}
+
+/* Move all timers of a slot to the (empty) list head. */
+static void list_move_all(struct timer *from, struct timer *head)
+{
+	if (list_empty(from))
+		return;
+
+	head->next = from->next;
+	head->prev = from->prev;
+	head->next->prev = head;
+	head->prev->next = head;
+	list_init(from);
+}
+
+/*
+ * Put timer in the slot for its expiry tick: the lowest level whose turn
+ * covers it.
+ */
+
+static void wheel_place(struct timer_wheel *wheel, struct timer *timer)
+{
+	uint64_t delta = timer->expires - wheel->now;
+	unsigned int level, index;
+
+	if (delta > TIMER_WHEEL_MAX_TICKS) {
+		timer->expires = wheel->now + TIMER_WHEEL_MAX_TICKS;
+		delta = TIMER_WHEEL_MAX_TICKS;
+	}
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++)
+		if (delta < (1ULL << ((level + 1) * TIMER_WHEEL_BITS)))
+			break;
+
+	index = (timer->expires >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+	list_add(&wheel->slots[level][index], timer);
+}
+
+void timer_wheel_init(struct timer_wheel *wheel, unsigned int tick_ms,
+		uint64_t now_ms)
+{
+	wheel->tick_ms = tick_ms;
+	wheel->now = now_ms / tick_ms;
+	wheel->count = 0;
+
+	for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+		for (int i = 0; i < TIMER_WHEEL_SLOTS; i++)
+			list_init(&wheel->slots[level][i]);
+}
+
+void timer_init(struct timer *timer, timer_fn fn)
+{
+	timer->next = NULL;
+	timer->prev = NULL;
+	timer->expires = 0;
+	timer->fn = fn;
+}
+
+/*
+ * Start timer, or move it if it is pending, to expire at expires_ms (or
+ * up to a tick later).
+ */
+
+void timer_add(struct timer_wheel *wheel, struct timer *timer,
+		uint64_t expires_ms)
+{
+	if (timer_pending(timer))
+		list_unlink(timer);
+	else
+		wheel->count++;
+
+	timer->expires = (expires_ms + wheel->tick_ms - 1) / wheel->tick_ms;
+	if (timer->expires <= wheel->now)
+		timer->expires = wheel->now + 1;
+
+	wheel_place(wheel, timer);
+}
+
+void timer_del(struct timer_wheel *wheel, struct timer *timer)
+{
+	if (!timer_pending(timer))
+		return;
+
+	list_unlink(timer);
+	wheel->count--;
+}
+
+/*
+ * Move the timers of a slot of the given level to lower levels.
+ */
+
+static void cascade(struct timer_wheel *wheel, unsigned int level,
+		unsigned int index)
+{
+	struct timer head, *timer;
+
+	list_init(&head);
+	list_move_all(&wheel->slots[level][index], &head);
+
+	while (!list_empty(&head)) {
+		timer = head.next;
+		list_unlink(timer);
+		wheel_place(wheel, timer);
+	}
+}
+
+/*
+ * Run the timers that expired by now_ms.
+ */
+
+void timer_wheel_advance(struct timer_wheel *wheel, uint64_t now_ms)
+{
+	uint64_t target = now_ms / wheel->tick_ms;
+	struct timer head, *timer;
+	unsigned int index;
+
+	while (wheel->now < target) {
+		if (wheel->count == 0) {
+			wheel->now = target;
+			return;
+		}
+
+		wheel->now++;
+
+		/* At the start of a turn, get the timers of the next one. */
+		for (unsigned int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+			if ((wheel->now >> ((level - 1) * TIMER_WHEEL_BITS)) &
+					TIMER_WHEEL_MASK)
+				break;
+			index = (wheel->now >> (level * TIMER_WHEEL_BITS)) &
+				TIMER_WHEEL_MASK;
+			cascade(wheel, level, index);
+		}
+
+		/*
+		 * Callbacks may add and delete timers, including the ones
+		 * left to run: take them one at a time from a private list.
+		 */
+		list_init(&head);
+		list_move_all(&wheel->slots[0][wheel->now & TIMER_WHEEL_MASK],
+			&head);
+		while (!list_empty(&head)) {
+			timer = head.next;
+			list_unlink(timer);
+			wheel->count--;
+			timer->fn(timer);
+		}
+	}
+}
+
+/*
+ * Return the number of milliseconds until the next timer may expire, to be
+ * used as epoll_wait() timeout, or -1 if there are no timers. Timers in
+ * higher levels are only looked at when cascaded, so this may be earlier.
+ */
+
+int timer_wheel_timeout(const struct timer_wheel *wheel, uint64_t now_ms)
+{
+	uint64_t tick = wheel->now;
+	uint64_t expires_ms;
+
+	if (wheel->count == 0)
+		return -1;
+
+	do {
+		tick++;
+	} while ((tick & TIMER_WHEEL_MASK) != 0 &&
+		list_empty(&wheel->slots[0][tick & TIMER_WHEEL_MASK]));
+
+	expires_ms = tick * wheel->tick_ms;
+
+	return expires_ms > now_ms ? (int) (expires_ms - now_ms) : 0;
+}
+
+/*
+ * Current time for the wheel: a monotonic clock read without a system call,
+ * with a resolution of a few milliseconds.
+ */
+
+uint64_t timer_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
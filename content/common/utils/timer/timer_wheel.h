@@ -0,0 +1,77 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Hierarchical timing wheel
+ *
+ * Timers are kept in lists (slots) indexed by their expiry time: adding,
+ * moving and deleting a timer is O(1), with no system call. Level 0 has a
+ * slot per tick; each slot of level n covers a whole turn of level n - 1,
+ * and its timers are moved (cascaded) to lower levels when that turn
+ * starts.
+ *
+ * The wheel doesn't read the clock: the event loop passes the current time
+ * (in milliseconds) to timer_wheel_advance(), which runs expired timers,
+ * and uses timer_wheel_timeout() as the epoll_wait() timeout.
+ *
+ * Not thread safe: use one wheel per event loop.
+ */
+
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_	1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TIMER_WHEEL_BITS	6
+#define TIMER_WHEEL_SLOTS	(1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS	4	/* 2^24 ticks */
+
+struct timer;
+typedef void (*timer_fn)(struct timer *timer);
+
+struct timer {
+	struct timer *next;
+	struct timer *prev;
+	uint64_t expires;		/* tick */
+	timer_fn fn;
+};
+
+struct timer_wheel {
+	unsigned int tick_ms;
+	uint64_t now;			/* last tick processed */
+	unsigned long count;		/* pending timers */
+	struct timer slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+void timer_wheel_init(struct timer_wheel *wheel, unsigned int tick_ms,
+		uint64_t now_ms);
+void timer_init(struct timer *timer, timer_fn fn);
+void timer_add(struct timer_wheel *wheel, struct timer *timer,
+		uint64_t expires_ms);
+void timer_del(struct timer_wheel *wheel, struct timer *timer);
+void timer_wheel_advance(struct timer_wheel *wheel, uint64_t now_ms);
+int timer_wheel_timeout(const struct timer_wheel *wheel, uint64_t now_ms);
+
+static inline bool timer_pending(const struct timer *timer)
+{
+	return timer->next != NULL;
+}
+
+/* expiry time of a pending timer, rounded up to a tick */
+static inline uint64_t timer_expires_ms(const struct timer_wheel *wheel,
+		const struct timer *timer)
+{
+	return timer->expires * wheel->tick_ms;
+}
+
+uint64_t timer_now_ms(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TIMER_WHEEL_H_ */